@@ -0,0 +1,309 @@
+//
+//  GMBenchmark.m
+//  OSXFUSE
+//
+
+//  Microbenchmarks of the framework's per-operation overhead. The fusefm_*
+//  callbacks are called directly against GMSyntheticFileSystem, so no kernel,
+//  mount or backend is involved. Covered by the same license as the OSXFUSE
+//  framework.
+//
+//  Usage: GMBenchmark [-iterations N] [-entries N] [-filesize N] [-xattrsize N]
+//                     [-only name] [-json YES] [-baseline file.json]
+//
+//  -baseline reads the JSON output of an earlier run and reports the change
+//  in ns/op for each benchmark.
+
+#import "GMAvailability.h"						/* Always include this first */
+#import "GMHarness.h"
+#import "GMSyntheticFileSystem.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct
+	{
+  const struct fuse_operations *	m_pOps;
+  size_t													m_cbRead;
+  char *													m_pBuffer;
+  unsigned long										m_cEntries;				/* Filled in by the readdir filler */
+  } BENCHCONTEXT;
+
+typedef int (* BENCHFN) (BENCHCONTEXT * a_pContext);
+
+typedef struct
+	{
+  const char *	m_pszName;
+  BENCHFN				m_pfn;
+  unsigned int	m_uDivisor;						/* Iterations are divided by this for the slow benchmarks */
+  } BENCHMARK;
+
+#if GM_FUSE3
+static int	CountingFiller (void * a_pBuf, const char * a_pszName, const struct stat * a_pStat, fuse_off_t a_Offset,
+                            enum fuse_fill_dir_flags a_Flags)
+#else
+static int	CountingFiller (void * a_pBuf, const char * a_pszName, const struct stat * a_pStat, fuse_off_t a_Offset)
+#endif	/* GM_FUSE3 */
+	{
+  (void) a_pszName;											/* Avoid unused argument compiler warning */
+  (void) a_pStat;
+  (void) a_Offset;
+#if GM_FUSE3
+  (void) a_Flags;
+#endif	/* GM_FUSE3 */
+
+  ((BENCHCONTEXT *) a_pBuf)->m_cEntries++;
+  return 0;
+  }
+
+static int	BenchGetattr (BENCHCONTEXT * a_pContext)
+	{
+  struct stat	st;
+
+  return GMHarnessGetattr (a_pContext->m_pOps, "/file", &st, NULL);
+  }
+
+static int	BenchGetattrMissing (BENCHCONTEXT * a_pContext)
+	{
+  struct stat	st;
+  int					iRet;
+
+  iRet = GMHarnessGetattr (a_pContext->m_pOps, "/missing", &st, NULL);
+  return (iRet == -ENOENT) ? 0 : -EIO;
+  }
+
+static int	BenchOpenReadRelease (BENCHCONTEXT * a_pContext)
+	{
+  struct fuse_file_info	fi;
+  int										iRet;
+
+  memset (&fi, 0, sizeof (fi));
+  fi.flags = O_RDONLY;
+  iRet = a_pContext->m_pOps->open ("/file", &fi);
+  if (iRet != 0)
+    return iRet;
+  iRet = a_pContext->m_pOps->read ("/file", a_pContext->m_pBuffer, a_pContext->m_cbRead, 0, &fi);
+  a_pContext->m_pOps->release ("/file", &fi);
+  return (iRet < 0) ? iRet : 0;
+  }
+
+static int	BenchReaddir (BENCHCONTEXT * a_pContext)
+	{
+  struct fuse_file_info	fi;
+
+  memset (&fi, 0, sizeof (fi));
+  a_pContext->m_cEntries = 0;
+  return GMHarnessReaddir (a_pContext->m_pOps, "/dir", a_pContext, CountingFiller, 0, &fi);
+  }
+
+static int	BenchXattrProbeFetch (BENCHCONTEXT * a_pContext)
+	{
+  int	iRet;
+
+#if defined (__APPLE__)
+  iRet = a_pContext->m_pOps->getxattr ("/file", "user.bench", NULL, 0, 0);
+#else
+  iRet = a_pContext->m_pOps->getxattr ("/file", "user.bench", NULL, 0);
+#endif	/* defined (__APPLE__) */
+  if (iRet < 0)
+    return iRet;
+#if defined (__APPLE__)
+  iRet = a_pContext->m_pOps->getxattr ("/file", "user.bench", a_pContext->m_pBuffer, iRet, 0);
+#else
+  iRet = a_pContext->m_pOps->getxattr ("/file", "user.bench", a_pContext->m_pBuffer, iRet);
+#endif	/* defined (__APPLE__) */
+  return (iRet < 0) ? iRet : 0;
+  }
+
+static int	BenchCreateWriteRelease (BENCHCONTEXT * a_pContext)
+	{
+  struct fuse_file_info	fi;
+  int										iRet;
+
+  memset (&fi, 0, sizeof (fi));
+  fi.flags = O_CREAT | O_WRONLY;
+  iRet = a_pContext->m_pOps->create ("/new", 0644, &fi);
+  if (iRet != 0)
+    return iRet;
+  iRet = a_pContext->m_pOps->write ("/new", a_pContext->m_pBuffer, a_pContext->m_cbRead, 0, &fi);
+  a_pContext->m_pOps->release ("/new", &fi);
+  return (iRet < 0) ? iRet : 0;
+  }
+
+static const BENCHMARK	g_aBenchmarks [] =
+	{
+	{ "getattr",					BenchGetattr,							1 },
+	{ "getattr-enoent",		BenchGetattrMissing,			1 },
+	{ "open-read-release",	BenchOpenReadRelease,			1 },
+	{ "readdir",					BenchReaddir,							1000 },
+	{ "xattr-probe-fetch",	BenchXattrProbeFetch,			1 },
+	{ "create-write-release",	BenchCreateWriteRelease,	1 },
+	};
+
+/* Runs one benchmark. Returns nil if any iteration fails */
+static NSDictionary *	RunBenchmark (const BENCHMARK * a_pBenchmark, BENCHCONTEXT * a_pContext, unsigned long a_cIterations)
+	{
+  unsigned long	cIterations;
+  unsigned long	cWarmup;
+  unsigned long	i;
+  uint64_t			uStart;
+  uint64_t			uElapsed;
+  uint64_t			cAllocations;
+
+  cIterations = a_cIterations / a_pBenchmark->m_uDivisor;
+  if (cIterations == 0)
+    cIterations = 1;
+  cWarmup = (cIterations / 10) + 1;
+
+  for (i = 0; i < cWarmup; i++)
+    {
+    if (a_pBenchmark->m_pfn (a_pContext) != 0)
+      return nil;
+    }
+
+  cAllocations = GMHarnessAllocationCount ();
+  uStart = GMHarnessNow ();
+  for (i = 0; i < cIterations; i++)
+    {
+    if (a_pBenchmark->m_pfn (a_pContext) != 0)
+      return nil;
+    }
+  uElapsed = GMHarnessNow () - uStart;
+  cAllocations = GMHarnessAllocationCount () - cAllocations;
+
+  NSMutableDictionary* result = [NSMutableDictionary dictionary];
+  [result setObject:[NSString stringWithUTF8String:a_pBenchmark->m_pszName] forKey:@"name"];
+  [result setObject:[NSNumber numberWithUnsignedLong:cIterations] forKey:@"iterations"];
+  [result setObject:[NSNumber numberWithDouble:(double) uElapsed / cIterations] forKey:@"ns_per_op"];
+  if (GMHarnessCountsAllocations ())
+    [result setObject:[NSNumber numberWithDouble:(double) cAllocations / cIterations] forKey:@"allocs_per_op"];
+  return result;
+  }
+
+/* Returns a dictionary of benchmark name to ns/op from the JSON output of an earlier run */
+static NSDictionary *	LoadBaseline (NSString * a_poPath)
+	{
+  NSData* data = [NSData dataWithContentsOfFile:a_poPath];
+  if (data == nil)
+    return nil;
+  id root = [NSJSONSerialization JSONObjectWithData:data options:0 error:NULL];
+  if (![root isKindOfClass:[NSDictionary class]])
+    return nil;
+  NSMutableDictionary* baseline = [NSMutableDictionary dictionary];
+  for (NSDictionary* result in [root objectForKey:@"results"]) {
+    NSString* name = [result objectForKey:@"name"];
+    NSNumber* nsPerOp = [result objectForKey:@"ns_per_op"];
+    if (name != nil && nsPerOp != nil) {
+      [baseline setObject:nsPerOp forKey:name];
+    }
+  }
+  return baseline;
+  }
+
+int	main (int argc, const char * argv [])
+	{
+  (void) argc;													/* Avoid unused argument compiler warning */
+  (void) argv;
+
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  NSUserDefaults* args = [NSUserDefaults standardUserDefaults];
+  NSInteger iterations = [args integerForKey:@"iterations"];
+  NSInteger entries = [args integerForKey:@"entries"];
+  NSInteger fileSize = [args integerForKey:@"filesize"];
+  NSInteger xattrSize = [args integerForKey:@"xattrsize"];
+  NSString* only = [args stringForKey:@"only"];
+  BOOL json = [args boolForKey:@"json"];
+  NSString* baselinePath = [args stringForKey:@"baseline"];
+  int iRet = 0;
+
+  if (iterations <= 0) iterations = 100000;
+  if (entries <= 0) entries = 100000;
+  if (fileSize <= 0) fileSize = 4096;
+  if (xattrSize <= 0) xattrSize = 64;
+
+  NSDictionary* baseline = nil;
+  if (baselinePath != nil) {
+    baseline = LoadBaseline(baselinePath);
+    if (baseline == nil) {
+      fprintf(stderr, "GMBenchmark: Can't read baseline %s\n", [baselinePath UTF8String]);
+      [pool release];
+      return 1;
+    }
+  }
+
+  GMSyntheticFileSystem* synthetic =
+    [[GMSyntheticFileSystem alloc] initWithEntryCount:entries
+                                             fileSize:fileSize
+                                            xattrSize:xattrSize];
+  GMUserFileSystem* fs = [[GMUserFileSystem alloc] initWithDelegate:synthetic
+                                                       isThreadSafe:YES];
+  GMHarnessSetCurrentFS(fs, getuid(), getgid(), getpid());
+
+  BENCHCONTEXT context;
+  memset(&context, 0, sizeof(context));
+  context.m_pOps = GMHarnessOperations();
+  context.m_cbRead = (fileSize < xattrSize) ? xattrSize : fileSize;
+  context.m_pBuffer = calloc(1, context.m_cbRead);
+
+  NSMutableArray* results = [NSMutableArray array];
+  for (size_t i = 0; i < sizeof(g_aBenchmarks) / sizeof(g_aBenchmarks[0]); i++) {
+    const BENCHMARK* benchmark = &g_aBenchmarks[i];
+    if (only != nil && strcmp([only UTF8String], benchmark->m_pszName) != 0) {
+      continue;
+    }
+    NSAutoreleasePool* innerPool = [[NSAutoreleasePool alloc] init];
+    NSDictionary* result = RunBenchmark(benchmark, &context, iterations);
+    if (result == nil) {
+      fprintf(stderr, "GMBenchmark: %s failed\n", benchmark->m_pszName);
+      iRet = 1;
+    } else {
+      NSMutableDictionary* entry = [[result mutableCopy] autorelease];
+      NSNumber* before = [baseline objectForKey:[entry objectForKey:@"name"]];
+      if (before != nil && [before doubleValue] > 0) {
+        double delta = ([[entry objectForKey:@"ns_per_op"] doubleValue] - [before doubleValue]) /
+                       [before doubleValue] * 100.0;
+        [entry setObject:before forKey:@"baseline_ns_per_op"];
+        [entry setObject:[NSNumber numberWithDouble:delta] forKey:@"delta_percent"];
+      }
+      [results addObject:entry];
+    }
+    [innerPool release];
+  }
+
+  if (json) {
+    NSDictionary* root =
+      [NSDictionary dictionaryWithObjectsAndKeys:
+       results, @"results",
+       [NSNumber numberWithLong:entries], @"entries",
+       [NSNumber numberWithLong:fileSize], @"filesize",
+       [NSNumber numberWithLong:xattrSize], @"xattrsize",
+       [NSNumber numberWithBool:GMHarnessCountsAllocations()], @"counts_allocations",
+       nil];
+    NSData* data = [NSJSONSerialization dataWithJSONObject:root
+                                                   options:NSJSONWritingPrettyPrinted
+                                                     error:NULL];
+    fwrite([data bytes], 1, [data length], stdout);
+    fputc('\n', stdout);
+  } else {
+    printf("%-24s %12s %14s %12s %10s\n", "benchmark", "iterations", "ns/op", "allocs/op", "delta");
+    for (NSDictionary* result in results) {
+      NSNumber* allocs = [result objectForKey:@"allocs_per_op"];
+      NSNumber* delta = [result objectForKey:@"delta_percent"];
+      printf("%-24s %12lu %14.1f %12s %10s\n",
+             [[result objectForKey:@"name"] UTF8String],
+             [[result objectForKey:@"iterations"] unsignedLongValue],
+             [[result objectForKey:@"ns_per_op"] doubleValue],
+             allocs ? [[NSString stringWithFormat:@"%.2f", [allocs doubleValue]] UTF8String] : "n/a",
+             delta ? [[NSString stringWithFormat:@"%+.1f%%", [delta doubleValue]] UTF8String] : "");
+    }
+  }
+
+  free(context.m_pBuffer);
+  [fs release];
+  [synthetic release];
+  [pool release];
+  return iRet;
+  }
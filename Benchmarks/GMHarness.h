@@ -0,0 +1,112 @@
+//
+//  GMHarness.h
+//  OSXFUSE
+//
+
+//  In-process harness for driving the framework's fusefm_* callbacks without a
+//  kernel mount. Covered by the same license as the OSXFUSE framework.
+//
+//  The harness interposes libfuse's fuse_get_context() so that
+//  +[GMUserFileSystem currentFS] and +[GMUserFileSystem currentContext] return
+//  a per-thread context set up by GMHarnessSetCurrentFS(). On glibc it also
+//  interposes malloc(3), calloc(3) and realloc(3) to count allocations made by
+//  the calling thread.
+
+#import "GMAvailability.h"						/* Always include this first */
+
+#import "GMFuse.h"											/* The framework's libfuse API */
+
+#import "GMUserFileSystem.h"
+
+/* Makes a_poFS the file system of the calling thread, as if a FUSE worker thread were
+		processing a request from the given caller
+*/
+extern void	GMHarnessSetCurrentFS (GMUserFileSystem * a_poFS, uid_t a_UID, gid_t a_GID, pid_t a_PID);
+
+/* The framework's operations table. See GMFuseOperations.h */
+extern const struct fuse_operations *	GMHarnessOperations (void);
+
+/* Monotonic time in nanoseconds */
+extern uint64_t	GMHarnessNow (void);
+
+/* Number of allocations made by the calling thread since it started. Only meaningful
+		if GMHarnessCountsAllocations() returns YES
+*/
+extern uint64_t	GMHarnessAllocationCount (void);
+extern BOOL	GMHarnessCountsAllocations (void);
+
+/* The callbacks whose arguments differ between the libfuse 2 and libfuse 3 APIs. libfuse 3 folds fgetattr
+		and ftruncate into getattr and truncate, passing the open file to them and to chmod, chown and utimens,
+    and adds flags to rename and readdir. A NULL a_pFuseFileInfo calls the operation by path
+*/
+#if GM_FUSE3
+#define	GM_HARNESS_FGETATTR(a_pOps)				((a_pOps)->getattr)
+#define	GM_HARNESS_FTRUNCATE(a_pOps)			((a_pOps)->truncate)
+#else
+#define	GM_HARNESS_FGETATTR(a_pOps)				((a_pOps)->fgetattr)
+#define	GM_HARNESS_FTRUNCATE(a_pOps)			((a_pOps)->ftruncate)
+#endif	/* GM_FUSE3 */
+
+static inline int	GMHarnessGetattr (const struct fuse_operations * a_pOps, const char * a_pszPath, struct stat * a_pStat, struct fuse_file_info * a_pFuseFileInfo)
+	{
+#if GM_FUSE3
+  return a_pOps->getattr (a_pszPath, a_pStat, a_pFuseFileInfo);
+#else
+  return (a_pFuseFileInfo != NULL) ? a_pOps->fgetattr (a_pszPath, a_pStat, a_pFuseFileInfo) : a_pOps->getattr (a_pszPath, a_pStat);
+#endif	/* GM_FUSE3 */
+  }
+
+static inline int	GMHarnessTruncate (const struct fuse_operations * a_pOps, const char * a_pszPath, fuse_off_t a_cbSize, struct fuse_file_info * a_pFuseFileInfo)
+	{
+#if GM_FUSE3
+  return a_pOps->truncate (a_pszPath, a_cbSize, a_pFuseFileInfo);
+#else
+  return (a_pFuseFileInfo != NULL) ? a_pOps->ftruncate (a_pszPath, a_cbSize, a_pFuseFileInfo) : a_pOps->truncate (a_pszPath, a_cbSize);
+#endif	/* GM_FUSE3 */
+  }
+
+static inline int	GMHarnessChmod (const struct fuse_operations * a_pOps, const char * a_pszPath, mode_t a_Mode)
+	{
+#if GM_FUSE3
+  return a_pOps->chmod (a_pszPath, a_Mode, NULL);
+#else
+  return a_pOps->chmod (a_pszPath, a_Mode);
+#endif	/* GM_FUSE3 */
+  }
+
+static inline int	GMHarnessChown (const struct fuse_operations * a_pOps, const char * a_pszPath, uid_t a_UID, gid_t a_GID)
+	{
+#if GM_FUSE3
+  return a_pOps->chown (a_pszPath, a_UID, a_GID, NULL);
+#else
+  return a_pOps->chown (a_pszPath, a_UID, a_GID);
+#endif	/* GM_FUSE3 */
+  }
+
+static inline int	GMHarnessUtimens (const struct fuse_operations * a_pOps, const char * a_pszPath, const struct timespec a_TimeSpecs [2])
+	{
+#if GM_FUSE3
+  return a_pOps->utimens (a_pszPath, a_TimeSpecs, NULL);
+#else
+  return a_pOps->utimens (a_pszPath, a_TimeSpecs);
+#endif	/* GM_FUSE3 */
+  }
+
+static inline int	GMHarnessRename (const struct fuse_operations * a_pOps, const char * a_pszPath, const char * a_pszToPath)
+	{
+#if GM_FUSE3
+  return a_pOps->rename (a_pszPath, a_pszToPath, 0);
+#else
+  return a_pOps->rename (a_pszPath, a_pszToPath);
+#endif	/* GM_FUSE3 */
+  }
+
+static inline int	GMHarnessReaddir (const struct fuse_operations * a_pOps, const char * a_pszPath, void * a_pBuf, fuse_fill_dir_t a_pfnFiller,
+                                    fuse_off_t a_Offset, struct fuse_file_info * a_pFuseFileInfo)
+	{
+#if GM_FUSE3
+  return a_pOps->readdir (a_pszPath, a_pBuf, a_pfnFiller, a_Offset, a_pFuseFileInfo, 0);
+#else
+  return a_pOps->readdir (a_pszPath, a_pBuf, a_pfnFiller, a_Offset, a_pFuseFileInfo);
+#endif	/* GM_FUSE3 */
+  }
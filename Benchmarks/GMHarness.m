@@ -0,0 +1,92 @@
+//
+//  GMHarness.m
+//  OSXFUSE
+//
+
+//  In-process harness for driving the framework's fusefm_* callbacks without a
+//  kernel mount. Covered by the same license as the OSXFUSE framework.
+
+#import "GMAvailability.h"						/* Always include this first */
+#import "GMHarness.h"
+#import "GMFuseOperations.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static __thread struct fuse_context	gContext;
+static __thread uint64_t						gAllocations;
+
+/* Interposes the libfuse definition. The executable's definition takes precedence over the one
+		in libfuse, so the framework sees the harness context for the calling thread
+*/
+struct fuse_context *	fuse_get_context (void)
+	{
+  return &gContext;
+  }
+
+void	GMHarnessSetCurrentFS (GMUserFileSystem * a_poFS, uid_t a_UID, gid_t a_GID, pid_t a_PID)
+	{
+  memset (&gContext, 0, sizeof (gContext));
+  gContext.fuse = NULL;									/* There is no session. Don't call fusefm_init */
+  gContext.uid = a_UID;
+  gContext.gid = a_GID;
+  gContext.pid = a_PID;
+  gContext.private_data = a_poFS;
+  gContext.umask = 022;
+  }
+
+const struct fuse_operations *	GMHarnessOperations (void)
+	{
+  return GMUserFileSystemFuseOperations ();
+  }
+
+uint64_t	GMHarnessNow (void)
+	{
+  struct timespec	ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+  }
+
+#if defined (__GLIBC__)
+/* glibc exports its allocator under these names, so the interposed functions below can forward
+		to it. Only the calling thread's counter is updated, so there is no contention
+*/
+extern void *	__libc_malloc (size_t a_cb);
+extern void *	__libc_calloc (size_t a_cItems, size_t a_cb);
+extern void *	__libc_realloc (void * a_pv, size_t a_cb);
+
+void *	malloc (size_t a_cb)
+	{
+  ++gAllocations;
+  return __libc_malloc (a_cb);
+  }
+
+void *	calloc (size_t a_cItems, size_t a_cb)
+	{
+  ++gAllocations;
+  return __libc_calloc (a_cItems, a_cb);
+  }
+
+void *	realloc (void * a_pv, size_t a_cb)
+	{
+  ++gAllocations;
+  return __libc_realloc (a_pv, a_cb);
+  }
+
+BOOL	GMHarnessCountsAllocations (void)
+	{
+  return YES;
+  }
+#else
+BOOL	GMHarnessCountsAllocations (void)
+	{
+  return NO;
+  }
+#endif	/* defined (__GLIBC__) */
+
+uint64_t	GMHarnessAllocationCount (void)
+	{
+  return gAllocations;
+  }
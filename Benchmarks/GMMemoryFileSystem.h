@@ -0,0 +1,31 @@
+//
+//  GMMemoryFileSystem.h
+//  OSXFUSE
+//
+
+//  A reference in-memory file system delegate. Covered by the same license as
+//  the OSXFUSE framework.
+//
+//  Supports directories, regular files, symbolic links, hard links and
+//  extended attributes. Open files are served through
+//  GMMutableDataBackedFileDelegate, so reads, writes and truncation of an open
+//  file take the same path through the framework as a typical delegate.
+//
+//  The delegate is thread safe. A single lock protects the name space, the
+//  node attributes and the file contents, which keeps the delegate simple and
+//  makes its own cost predictable when comparing framework changes.
+
+#import "GMAvailability.h"						/* Always include this first */
+
+@class GMMemoryNode;
+
+@interface GMMemoryFileSystem : NSObject {
+ @private
+  NSLock* lock_;
+  GMMemoryNode* root_;
+  unsigned long long nextInode_;
+}
+
+- (id)init;
+
+@end
@@ -0,0 +1,749 @@
+//
+//  GMMemoryFileSystem.m
+//  OSXFUSE
+//
+
+//  A reference in-memory file system delegate. Covered by the same license as
+//  the OSXFUSE framework.
+
+#import "GMAvailability.h"						/* Always include this first */
+#import "GMMemoryFileSystem.h"
+#import "GMUserFileSystem.h"
+#import "GMDataBackedFileDelegate.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+static NSError *	PosixError (int a_iErrno)
+	{
+  return [NSError errorWithDomain:NSPOSIXErrorDomain code:a_iErrno userInfo:nil];
+  }
+
+// An inode. Plain data; every access is made with the file system lock held.
+@interface GMMemoryNode : NSObject {
+ @public
+  NSString* type_;                    // NSFileTypeDirectory, NSFileTypeRegular or NSFileTypeSymbolicLink
+  unsigned long long inode_;
+  unsigned long mode_;
+  unsigned long links_;
+  uid_t uid_;
+  gid_t gid_;
+  NSDate* accessDate_;
+  NSDate* modificationDate_;
+  NSDate* changeDate_;
+  NSDate* creationDate_;
+  NSMutableDictionary* children_;     // Directories: name -> GMMemoryNode
+  NSMutableData* data_;               // Regular files
+  NSString* destination_;             // Symbolic links
+  NSMutableDictionary* xattrs_;       // name -> NSData
+}
+- (id)initWithType:(NSString *)type inode:(unsigned long long)inode mode:(unsigned long)mode;
+- (void)touchModified;
+- (void)touchChanged;
+@end
+
+@implementation GMMemoryNode
+
+- (id)initWithType:(NSString *)type inode:(unsigned long long)inode mode:(unsigned long)mode {
+  self = [super init];
+  if (self) {
+    NSDate* now = [[NSDate alloc] init];
+    NSDictionary* context = [GMUserFileSystem currentContext];
+
+    type_ = [type retain];
+    inode_ = inode;
+    mode_ = mode & ALLPERMS;
+    links_ = 1;
+    if (context != nil) {
+      uid_ = [[context objectForKey:kGMUserFileSystemContextUserIDKey] unsignedIntValue];
+      gid_ = [[context objectForKey:kGMUserFileSystemContextGroupIDKey] unsignedIntValue];
+    } else {
+      uid_ = getuid();                // Not called from a FUSE request, e.g. the root directory
+      gid_ = getgid();
+    }
+    accessDate_ = [now retain];
+    modificationDate_ = [now retain];
+    changeDate_ = [now retain];
+    creationDate_ = now;
+    xattrs_ = [[NSMutableDictionary alloc] init];
+    if ([type isEqualToString:NSFileTypeDirectory]) {
+      children_ = [[NSMutableDictionary alloc] init];
+      links_ = 2;
+    } else if ([type isEqualToString:NSFileTypeRegular]) {
+      data_ = [[NSMutableData alloc] init];
+    }
+  }
+  return self;
+}
+
+- (void)dealloc {
+  [type_ release];
+  [accessDate_ release];
+  [modificationDate_ release];
+  [changeDate_ release];
+  [creationDate_ release];
+  [children_ release];
+  [data_ release];
+  [destination_ release];
+  [xattrs_ release];
+  [super dealloc];
+}
+
+- (void)touchModified {
+  NSDate* now = [[NSDate alloc] init];
+  [modificationDate_ release];
+  modificationDate_ = [now retain];
+  [changeDate_ release];
+  changeDate_ = now;
+}
+
+- (void)touchChanged {
+  [changeDate_ release];
+  changeDate_ = [[NSDate alloc] init];
+}
+
+@end
+
+// The userData of an open file. The node's NSMutableData is shared by every
+// open handle and every hard link, so each access takes the file system lock.
+@interface GMMemoryFileHandle : GMMutableDataBackedFileDelegate {
+ @private
+  GMMemoryNode* node_;
+  NSLock* lock_;
+}
+- (id)initWithNode:(GMMemoryNode *)node lock:(NSLock *)lock;
+@end
+
+@implementation GMMemoryFileHandle
+
+- (id)initWithNode:(GMMemoryNode *)node lock:(NSLock *)lock {
+  self = [super initWithMutableData:node->data_];
+  if (self) {
+    node_ = [node retain];
+    lock_ = [lock retain];
+  }
+  return self;
+}
+
+- (void)dealloc {
+  [node_ release];
+  [lock_ release];
+  [super dealloc];
+}
+
+- (int)readToBuffer:(char *)buffer
+               size:(size_t)size
+             offset:(fuse_off_t)offset
+              error:(NSError **)error {
+  [lock_ lock];
+  int ret = [super readToBuffer:buffer size:size offset:offset error:error];
+  [lock_ unlock];
+  return ret;
+}
+
+- (int)writeFromBuffer:(const char *)buffer
+                  size:(size_t)size
+                offset:(fuse_off_t)offset
+                 error:(NSError **)error {
+  [lock_ lock];
+  int ret = [super writeFromBuffer:buffer size:size offset:offset error:error];
+  [node_ touchModified];
+  [lock_ unlock];
+  return ret;
+}
+
+- (BOOL)truncateToOffset:(fuse_off_t)offset
+                   error:(NSError **)error {
+  [lock_ lock];
+  BOOL ret = [super truncateToOffset:offset error:error];
+  [node_ touchModified];
+  [lock_ unlock];
+  return ret;
+}
+
+@end
+
+@interface GMMemoryFileSystem (GMMemoryFileSystemPrivate)
+- (GMMemoryNode *)nodeAtPath:(NSString *)path error:(NSError **)error;
+- (GMMemoryNode *)parentOfPath:(NSString *)path name:(NSString **)name error:(NSError **)error;
+- (GMMemoryNode *)newNodeOfType:(NSString *)type mode:(unsigned long)mode;
+- (void)unlinkNode:(GMMemoryNode *)node;
+@end
+
+@implementation GMMemoryFileSystem
+
+- (id)init {
+  self = [super init];
+  if (self) {
+    lock_ = [[NSLock alloc] init];
+    nextInode_ = 1;
+    root_ = [self newNodeOfType:NSFileTypeDirectory mode:0755];
+  }
+  return self;
+}
+
+- (void)dealloc {
+  [root_ release];
+  [lock_ release];
+  [super dealloc];
+}
+
+#pragma mark Path Resolution
+
+// Symbolic links are resolved by the kernel, so they are never followed here.
+- (GMMemoryNode *)nodeAtPath:(NSString *)path error:(NSError **)error {
+  GMMemoryNode* node = root_;
+  for (NSString* component in [path componentsSeparatedByString:@"/"]) {
+    if ([component length] == 0) {
+      continue;
+    }
+    if (node->children_ == nil) {
+      *error = PosixError(ENOTDIR);
+      return nil;
+    }
+    node = [node->children_ objectForKey:component];
+    if (node == nil) {
+      *error = PosixError(ENOENT);
+      return nil;
+    }
+  }
+  return node;
+}
+
+- (GMMemoryNode *)parentOfPath:(NSString *)path name:(NSString **)name error:(NSError **)error {
+  *name = [path lastPathComponent];
+  if ([*name length] == 0 || [*name isEqualToString:@"/"]) {
+    *error = PosixError(EEXIST);
+    return nil;
+  }
+  GMMemoryNode* parent = [self nodeAtPath:[path stringByDeletingLastPathComponent] error:error];
+  if (parent != nil && parent->children_ == nil) {
+    *error = PosixError(ENOTDIR);
+    return nil;
+  }
+  return parent;
+}
+
+- (GMMemoryNode *)newNodeOfType:(NSString *)type mode:(unsigned long)mode {
+  return [[GMMemoryNode alloc] initWithType:type inode:nextInode_++ mode:mode];
+}
+
+// Drops one name of node. Directories lose their "." link at the same time.
+- (void)unlinkNode:(GMMemoryNode *)node {
+  if (node->children_ != nil) {
+    node->links_ = 0;
+  } else if (node->links_ > 0) {
+    --node->links_;
+  }
+  [node touchChanged];
+}
+
+#pragma mark Directory Contents
+
+- (NSArray *)contentsOfDirectoryAtPath:(NSString *)path error:(NSError **)error {
+  [lock_ lock];
+  NSArray* contents = nil;
+  GMMemoryNode* node = [self nodeAtPath:path error:error];
+  if (node != nil) {
+    if (node->children_ == nil) {
+      *error = PosixError(ENOTDIR);
+    } else {
+      contents = [node->children_ allKeys];
+    }
+  }
+  [lock_ unlock];
+  return contents;
+}
+
+#pragma mark Getting and Setting Attributes
+
+- (NSDictionary *)attributesOfItemAtPath:(NSString *)path
+                                userData:(id)userData
+                                   error:(NSError **)error {
+  (void) userData;																	/* Avoid unused parameter compiler warning */
+
+  [lock_ lock];
+  NSDictionary* attributes = nil;
+  GMMemoryNode* node = [self nodeAtPath:path error:error];
+  if (node != nil) {
+    unsigned long long size = 0;
+    if (node->data_ != nil) {
+      size = [node->data_ length];
+    } else if (node->destination_ != nil) {
+      size = strlen([node->destination_ UTF8String]);
+    } else {
+      size = [node->children_ count];
+    }
+    attributes =
+      [NSDictionary dictionaryWithObjectsAndKeys:
+       node->type_, NSFileType,
+       [NSNumber numberWithUnsignedLongLong:node->inode_], NSFileSystemFileNumber,
+       [NSNumber numberWithUnsignedLong:node->mode_], NSFilePosixPermissions,
+       [NSNumber numberWithUnsignedLong:node->links_], NSFileReferenceCount,
+       [NSNumber numberWithUnsignedInt:node->uid_], NSFileOwnerAccountID,
+       [NSNumber numberWithUnsignedInt:node->gid_], NSFileGroupOwnerAccountID,
+       [NSNumber numberWithUnsignedLongLong:size], NSFileSize,
+       node->modificationDate_, NSFileModificationDate,
+       node->accessDate_, kGMUserFileSystemFileAccessDateKey,
+       node->changeDate_, kGMUserFileSystemFileChangeDateKey,
+       node->creationDate_, NSFileCreationDate,
+       nil];
+  }
+  [lock_ unlock];
+  return attributes;
+}
+
+- (NSDictionary *)attributesOfFileSystemForPath:(NSString *)path
+                                          error:(NSError **)error {
+  (void) path;																			/* Avoid unused parameter compiler warning */
+  (void) error;
+
+  return [NSDictionary dictionaryWithObjectsAndKeys:
+          [NSNumber numberWithUnsignedLongLong:1ULL << 40], NSFileSystemSize,
+          [NSNumber numberWithUnsignedLongLong:1ULL << 40], NSFileSystemFreeSize,
+          [NSNumber numberWithUnsignedLongLong:1ULL << 32], NSFileSystemNodes,
+          [NSNumber numberWithUnsignedLongLong:1ULL << 32], NSFileSystemFreeNodes,
+          [NSNumber numberWithBool:YES], kGMUserFileSystemVolumeSupportsCaseSensitiveNamesKey,
+          nil];
+}
+
+- (BOOL)setAttributes:(NSDictionary *)attributes
+         ofItemAtPath:(NSString *)path
+             userData:(id)userData
+                error:(NSError **)error {
+  (void) userData;																	/* Avoid unused parameter compiler warning */
+
+  [lock_ lock];
+  GMMemoryNode* node = [self nodeAtPath:path error:error];
+  if (node == nil) {
+    [lock_ unlock];
+    return NO;
+  }
+  NSNumber* size = [attributes objectForKey:NSFileSize];
+  if (size != nil) {
+    if (node->data_ == nil) {
+      [lock_ unlock];
+      *error = PosixError((node->children_ != nil) ? EISDIR : EINVAL);
+      return NO;
+    }
+    [node->data_ setLength:[size unsignedLongLongValue]];
+    [node touchModified];
+  }
+  NSNumber* mode = [attributes objectForKey:NSFilePosixPermissions];
+  if (mode != nil) {
+    node->mode_ = [mode unsignedLongValue] & ALLPERMS;
+  }
+  NSNumber* uid = [attributes objectForKey:NSFileOwnerAccountID];
+  if (uid != nil && [uid longValue] != -1) {
+    node->uid_ = [uid unsignedIntValue];
+  }
+  NSNumber* gid = [attributes objectForKey:NSFileGroupOwnerAccountID];
+  if (gid != nil && [gid longValue] != -1) {
+    node->gid_ = [gid unsignedIntValue];
+  }
+  NSDate* date = [attributes objectForKey:NSFileModificationDate];
+  if (date != nil) {
+    [node->modificationDate_ release];
+    node->modificationDate_ = [date retain];
+  }
+  date = [attributes objectForKey:kGMUserFileSystemFileAccessDateKey];
+  if (date != nil) {
+    [node->accessDate_ release];
+    node->accessDate_ = [date retain];
+  }
+  [node touchChanged];
+  [lock_ unlock];
+  return YES;
+}
+
+#pragma mark File Contents
+
+- (BOOL)openFileAtPath:(NSString *)path
+                  mode:(int)mode
+              userData:(id *)userData
+                 error:(NSError **)error {
+  [lock_ lock];
+  GMMemoryNode* node = [self nodeAtPath:path error:error];
+  if (node == nil) {
+    [lock_ unlock];
+    return NO;
+  }
+  if (node->data_ == nil) {
+    [lock_ unlock];
+    *error = PosixError((node->children_ != nil) ? EISDIR : ELOOP);
+    return NO;
+  }
+  if ((mode & O_TRUNC) && (mode & O_ACCMODE) != O_RDONLY) {
+    [node->data_ setLength:0];
+    [node touchModified];
+  }
+  *userData = [[[GMMemoryFileHandle alloc] initWithNode:node lock:lock_] autorelease];
+  [lock_ unlock];
+  return YES;
+}
+
+- (void)releaseFileAtPath:(NSString *)path userData:(id)userData {
+  (void) path;																			/* Avoid unused parameter compiler warning */
+  (void) userData;
+}
+
+#pragma mark Creating an Item
+
+- (BOOL)createDirectoryAtPath:(NSString *)path
+                   attributes:(NSDictionary *)attributes
+                        error:(NSError **)error {
+  [lock_ lock];
+  NSString* name = nil;
+  GMMemoryNode* parent = [self parentOfPath:path name:&name error:error];
+  if (parent == nil) {
+    [lock_ unlock];
+    return NO;
+  }
+  if ([parent->children_ objectForKey:name] != nil) {
+    [lock_ unlock];
+    *error = PosixError(EEXIST);
+    return NO;
+  }
+  GMMemoryNode* node =
+    [self newNodeOfType:NSFileTypeDirectory
+                   mode:[[attributes objectForKey:NSFilePosixPermissions] unsignedLongValue]];
+  [parent->children_ setObject:node forKey:name];
+  [node release];
+  ++parent->links_;
+  [parent touchModified];
+  [lock_ unlock];
+  return YES;
+}
+
+- (BOOL)createFileAtPath:(NSString *)path
+              attributes:(NSDictionary *)attributes
+                   flags:(int)flags
+                userData:(id *)userData
+                   error:(NSError **)error {
+  [lock_ lock];
+  NSString* name = nil;
+  GMMemoryNode* parent = [self parentOfPath:path name:&name error:error];
+  if (parent == nil) {
+    [lock_ unlock];
+    return NO;
+  }
+  GMMemoryNode* node = [parent->children_ objectForKey:name];
+  if (node != nil) {
+    if ((flags & O_EXCL) || node->data_ == nil) {
+      [lock_ unlock];
+      *error = PosixError((node->children_ != nil) ? EISDIR : EEXIST);
+      return NO;
+    }
+    if (flags & O_TRUNC) {
+      [node->data_ setLength:0];
+      [node touchModified];
+    }
+  } else {
+    node = [self newNodeOfType:NSFileTypeRegular
+                          mode:[[attributes objectForKey:NSFilePosixPermissions] unsignedLongValue]];
+    [parent->children_ setObject:node forKey:name];
+    [node release];
+    [parent touchModified];
+  }
+  *userData = [[[GMMemoryFileHandle alloc] initWithNode:node lock:lock_] autorelease];
+  [lock_ unlock];
+  return YES;
+}
+
+#pragma mark Moving an Item
+
+- (BOOL)moveItemAtPath:(NSString *)source
+                toPath:(NSString *)destination
+                 error:(NSError **)error {
+  [lock_ lock];
+  NSString* sourceName = nil;
+  NSString* destinationName = nil;
+  GMMemoryNode* sourceParent = [self parentOfPath:source name:&sourceName error:error];
+  GMMemoryNode* destinationParent =
+    (sourceParent != nil) ? [self parentOfPath:destination name:&destinationName error:error] : nil;
+  GMMemoryNode* node = (destinationParent != nil) ? [sourceParent->children_ objectForKey:sourceName] : nil;
+  if (node == nil) {
+    [lock_ unlock];
+    if (*error == nil) {
+      *error = PosixError(ENOENT);
+    }
+    return NO;
+  }
+
+  // A directory can't be moved into its own subtree.
+  if (node->children_ != nil &&
+      [destination hasPrefix:[[source stringByStandardizingPath] stringByAppendingString:@"/"]]) {
+    [lock_ unlock];
+    *error = PosixError(EINVAL);
+    return NO;
+  }
+
+  GMMemoryNode* existing = [destinationParent->children_ objectForKey:destinationName];
+  if (existing == node) {
+    [lock_ unlock];
+    return YES;
+  }
+  if (existing != nil) {
+    if (existing->children_ != nil && node->children_ == nil) {
+      [lock_ unlock];
+      *error = PosixError(EISDIR);
+      return NO;
+    }
+    if (existing->children_ == nil && node->children_ != nil) {
+      [lock_ unlock];
+      *error = PosixError(ENOTDIR);
+      return NO;
+    }
+    if (existing->children_ != nil && [existing->children_ count] > 0) {
+      [lock_ unlock];
+      *error = PosixError(ENOTEMPTY);
+      return NO;
+    }
+    if (existing->children_ != nil) {
+      --destinationParent->links_;
+    }
+    [self unlinkNode:existing];
+  }
+
+  [node retain];
+  [sourceParent->children_ removeObjectForKey:sourceName];
+  [destinationParent->children_ setObject:node forKey:destinationName];
+  if (node->children_ != nil && sourceParent != destinationParent) {
+    --sourceParent->links_;
+    ++destinationParent->links_;
+  }
+  [node touchChanged];
+  [node release];
+  [sourceParent touchModified];
+  [destinationParent touchModified];
+  [lock_ unlock];
+  return YES;
+}
+
+#pragma mark Removing an Item
+
+- (BOOL)removeDirectoryAtPath:(NSString *)path error:(NSError **)error {
+  [lock_ lock];
+  NSString* name = nil;
+  GMMemoryNode* parent = [self parentOfPath:path name:&name error:error];
+  GMMemoryNode* node = (parent != nil) ? [parent->children_ objectForKey:name] : nil;
+  if (node == nil) {
+    [lock_ unlock];
+    if (*error == nil) {
+      *error = PosixError(ENOENT);
+    }
+    return NO;
+  }
+  if (node->children_ == nil) {
+    [lock_ unlock];
+    *error = PosixError(ENOTDIR);
+    return NO;
+  }
+  if ([node->children_ count] > 0) {
+    [lock_ unlock];
+    *error = PosixError(ENOTEMPTY);
+    return NO;
+  }
+  [self unlinkNode:node];
+  [parent->children_ removeObjectForKey:name];
+  --parent->links_;
+  [parent touchModified];
+  [lock_ unlock];
+  return YES;
+}
+
+- (BOOL)removeItemAtPath:(NSString *)path error:(NSError **)error {
+  [lock_ lock];
+  NSString* name = nil;
+  GMMemoryNode* parent = [self parentOfPath:path name:&name error:error];
+  GMMemoryNode* node = (parent != nil) ? [parent->children_ objectForKey:name] : nil;
+  if (node == nil) {
+    [lock_ unlock];
+    if (*error == nil) {
+      *error = PosixError(ENOENT);
+    }
+    return NO;
+  }
+  if (node->children_ != nil) {
+    [lock_ unlock];
+    *error = PosixError(EISDIR);
+    return NO;
+  }
+  [self unlinkNode:node];
+  [parent->children_ removeObjectForKey:name];
+  [parent touchModified];
+  [lock_ unlock];
+  return YES;
+}
+
+#pragma mark Linking an Item
+
+// Called by fusefm_link() with the existing item first and the new name second.
+- (BOOL)linkItemAtPath:(NSString *)path
+                toPath:(NSString *)otherPath
+                 error:(NSError **)error {
+  [lock_ lock];
+  GMMemoryNode* node = [self nodeAtPath:path error:error];
+  NSString* name = nil;
+  GMMemoryNode* parent = (node != nil) ? [self parentOfPath:otherPath name:&name error:error] : nil;
+  if (parent == nil) {
+    [lock_ unlock];
+    return NO;
+  }
+  if (node->children_ != nil) {
+    [lock_ unlock];
+    *error = PosixError(EPERM);
+    return NO;
+  }
+  if ([parent->children_ objectForKey:name] != nil) {
+    [lock_ unlock];
+    *error = PosixError(EEXIST);
+    return NO;
+  }
+  [parent->children_ setObject:node forKey:name];
+  ++node->links_;
+  [node touchChanged];
+  [parent touchModified];
+  [lock_ unlock];
+  return YES;
+}
+
+#pragma mark Symbolic Links
+
+- (BOOL)createSymbolicLinkAtPath:(NSString *)path
+             withDestinationPath:(NSString *)otherPath
+                           error:(NSError **)error {
+  [lock_ lock];
+  NSString* name = nil;
+  GMMemoryNode* parent = [self parentOfPath:path name:&name error:error];
+  if (parent == nil) {
+    [lock_ unlock];
+    return NO;
+  }
+  if ([parent->children_ objectForKey:name] != nil) {
+    [lock_ unlock];
+    *error = PosixError(EEXIST);
+    return NO;
+  }
+  GMMemoryNode* node = [self newNodeOfType:NSFileTypeSymbolicLink mode:0777];
+  node->destination_ = [otherPath copy];
+  [parent->children_ setObject:node forKey:name];
+  [node release];
+  [parent touchModified];
+  [lock_ unlock];
+  return YES;
+}
+
+- (NSString *)destinationOfSymbolicLinkAtPath:(NSString *)path
+                                        error:(NSError **)error {
+  [lock_ lock];
+  NSString* destination = nil;
+  GMMemoryNode* node = [self nodeAtPath:path error:error];
+  if (node != nil) {
+    if (node->destination_ == nil) {
+      *error = PosixError(EINVAL);
+    } else {
+      destination = [[node->destination_ retain] autorelease];
+    }
+  }
+  [lock_ unlock];
+  return destination;
+}
+
+#pragma mark Extended Attributes
+
+- (NSArray *)extendedAttributesOfItemAtPath:(NSString *)path
+                                      error:(NSError **)error {
+  [lock_ lock];
+  NSArray* names = nil;
+  GMMemoryNode* node = [self nodeAtPath:path error:error];
+  if (node != nil) {
+    names = [node->xattrs_ allKeys];
+  }
+  [lock_ unlock];
+  return names;
+}
+
+- (NSData *)valueOfExtendedAttribute:(NSString *)name
+                        ofItemAtPath:(NSString *)path
+                            position:(fuse_off_t)position
+                               error:(NSError **)error {
+  [lock_ lock];
+  NSData* value = nil;
+  GMMemoryNode* node = [self nodeAtPath:path error:error];
+  if (node != nil) {
+    value = [node->xattrs_ objectForKey:name];
+    if (value == nil) {
+      *error = PosixError(ENOATTR);
+    } else if (position > 0) {
+      if ((NSUInteger)position > [value length]) {
+        value = nil;
+        *error = PosixError(ERANGE);
+      } else {
+        value = [value subdataWithRange:NSMakeRange(position, [value length] - position)];
+      }
+    } else {
+      value = [[value retain] autorelease];
+    }
+  }
+  [lock_ unlock];
+  return value;
+}
+
+- (BOOL)setExtendedAttribute:(NSString *)name
+                ofItemAtPath:(NSString *)path
+                       value:(NSData *)value
+                    position:(fuse_off_t)position
+                     options:(int)options
+                       error:(NSError **)error {
+  (void) position;																	/* Avoid unused parameter compiler warning */
+
+  [lock_ lock];
+  GMMemoryNode* node = [self nodeAtPath:path error:error];
+  if (node == nil) {
+    [lock_ unlock];
+    return NO;
+  }
+  BOOL exists = ([node->xattrs_ objectForKey:name] != nil);
+  if ((options & XATTR_CREATE) && exists) {
+    [lock_ unlock];
+    *error = PosixError(EEXIST);
+    return NO;
+  }
+  if ((options & XATTR_REPLACE) && !exists) {
+    [lock_ unlock];
+    *error = PosixError(ENOATTR);
+    return NO;
+  }
+  NSData* copy = [value copy];
+  [node->xattrs_ setObject:copy forKey:name];
+  [copy release];
+  [node touchChanged];
+  [lock_ unlock];
+  return YES;
+}
+
+- (BOOL)removeExtendedAttribute:(NSString *)name
+                   ofItemAtPath:(NSString *)path
+                          error:(NSError **)error {
+  [lock_ lock];
+  GMMemoryNode* node = [self nodeAtPath:path error:error];
+  if (node == nil) {
+    [lock_ unlock];
+    return NO;
+  }
+  if ([node->xattrs_ objectForKey:name] == nil) {
+    [lock_ unlock];
+    *error = PosixError(ENOATTR);
+    return NO;
+  }
+  [node->xattrs_ removeObjectForKey:name];
+  [node touchChanged];
+  [lock_ unlock];
+  return YES;
+}
+
+@end
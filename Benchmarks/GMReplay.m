@@ -0,0 +1,1164 @@
+//
+//  GMReplay.m
+//  OSXFUSE
+//
+
+//  Replays an operation trace written by
+//  -[GMUserFileSystem startRecordingOperationsToPath:error:], so that a
+//  production op mix can be reproduced and bisected offline. Covered by the
+//  same license as the OSXFUSE framework.
+//
+//  Usage: GMReplay -trace file [-target dir | -delegate Class [-bundle path]]
+//                  [-speed original|max|N] [-prepare YES|NO] [-json YES]
+//
+//  Without -target the trace is replayed in-process: the fusefm_* callbacks are
+//  called directly, through the harness, against a new instance of -delegate
+//  (default GMMemoryFileSystem), optionally loaded from -bundle. With -target
+//  each operation is re-issued as the equivalent system call on the same path
+//  below dir, which is normally the mountpoint of a file system under test.
+//
+//  Each thread in the trace is replayed by its own thread, in its recorded
+//  order. -speed original keeps the recorded timing, N replays N times faster
+//  and max (the default) issues operations as fast as possible. Open handles
+//  are mapped from the recorded handle to the new one. -prepare (the default)
+//  first creates the directories and files that the trace uses but doesn't
+//  create itself.
+//
+//  Data and some attribute values aren't recorded. Writes and xattr values are
+//  zero filled, times are set to the current time and created files get mode
+//  0644. Open flags are replayed as recorded, so a trace should be replayed on
+//  the platform on which it was recorded.
+
+#import "GMAvailability.h"						/* Always include this first */
+#import "GMHarness.h"
+#import "GMMemoryFileSystem.h"
+#import "GMOperationTrace.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <time.h>
+#include <unistd.h>
+#if defined (__linux__) || defined (__APPLE__)
+#include <sys/xattr.h>
+#endif	/* defined (__linux__) || defined (__APPLE__) */
+#if defined (__APPLE__)
+#include <sys/mount.h>
+#endif	/* defined (__APPLE__) */
+
+#define	REPLAY_HANDLE_BUCKETS		4096
+#define	REPLAY_PREPARE_CHUNK		65536
+#define	REPLAY_OP_COUNT					(GMOperationTraceOpLseek + 1)
+
+/* setattr_x valid bits, from the OS X/Darwin fuse headers. Traces recorded on OS X/Darwin record
+		setattr operations rather than truncate and utimens, so they're also needed to replay elsewhere
+*/
+#define	REPLAY_SETATTR_SIZE			(1 << 3)
+#define	REPLAY_SETATTR_ACCTIME	(1 << 4)
+#define	REPLAY_SETATTR_MODTIME	(1 << 5)
+
+static const char *	g_apszOpNames [REPLAY_OP_COUNT] =
+	{
+  "none", "getattr", "fgetattr", "readlink", "mkdir", "unlink", "rmdir", "symlink", "rename", "link",
+  "chmod", "chown", "truncate", "ftruncate", "utimens", "open", "read", "write", "statfs", "release",
+  "fsync", "setxattr", "getxattr", "listxattr", "removexattr", "readdir", "create", "access",
+  "fallocate", "exchange", "setattr", "getxtimes", "setvolname", "flush", "copy_file_range",
+  "lseek"
+  };
+
+typedef struct
+	{
+  const GMOperationTraceRecord *	m_pRecord;
+  const char *										m_pszPath;
+  const char *										m_pszPath2;			/* NULL if there is no second path */
+  } REPLAYOP;
+
+typedef struct
+	{
+  uint64_t *		m_puLatencies;
+  size_t				m_cLatencies;
+  size_t				m_cMaxLatencies;
+  unsigned long	m_cMismatches;									/* Success or errno differs from the recording */
+  unsigned long	m_cSkipped;											/* Can't be replayed on this platform or target */
+  } OPSTATS;
+
+typedef struct HANDLEENTRY
+	{
+  uint64_t							m_uTraceHandle;
+  uint64_t							m_uHandle;							/* fuse_file_info fh, or a file descriptor + 1 */
+  struct HANDLEENTRY *	m_pNext;
+  } HANDLEENTRY;
+
+typedef struct REPLAYER
+	{
+  const struct fuse_operations *	m_pOps;						/* In-process, or NULL */
+  GMUserFileSystem *							m_poFS;
+  const char *										m_pszTarget;			/* Through a mount, or NULL */
+  double													m_dSpeed;					/* 0 for as fast as possible */
+  uint64_t												m_uFirstTimestamp;
+  uint64_t												m_uStart;
+  pthread_mutex_t									m_Mutex;					/* Protects m_apHandles */
+  HANDLEENTRY *										m_apHandles [REPLAY_HANDLE_BUCKETS];
+  } REPLAYER;
+
+typedef struct
+	{
+  REPLAYER *	m_pReplayer;
+  REPLAYOP *	m_pOps;
+  size_t			m_cOps;
+  size_t			m_cMaxOps;
+  size_t			m_cbBuffer;
+  char *			m_pBuffer;
+  OPSTATS			m_aStats [REPLAY_OP_COUNT];
+  pthread_t		m_Thread;
+  } REPLAYTHREAD;
+
+static void	StatsAdd (OPSTATS * a_pStats, uint64_t a_uLatency)
+	{
+  if (a_pStats->m_cLatencies == a_pStats->m_cMaxLatencies)
+    {
+    a_pStats->m_cMaxLatencies = (a_pStats->m_cMaxLatencies > 0) ? a_pStats->m_cMaxLatencies * 2 : 64;
+    a_pStats->m_puLatencies = realloc (a_pStats->m_puLatencies, a_pStats->m_cMaxLatencies * sizeof (uint64_t));
+    }
+  a_pStats->m_puLatencies [a_pStats->m_cLatencies++] = a_uLatency;
+  }
+
+static void	StatsMerge (OPSTATS * a_pTo, const OPSTATS * a_pFrom)
+	{
+  for (size_t i = 0; i < a_pFrom->m_cLatencies; i++)
+    StatsAdd (a_pTo, a_pFrom->m_puLatencies [i]);
+  a_pTo->m_cMismatches += a_pFrom->m_cMismatches;
+  a_pTo->m_cSkipped += a_pFrom->m_cSkipped;
+  }
+
+static int	CompareLatencies (const void * a_pv1, const void * a_pv2)
+	{
+  uint64_t	u1 = *(const uint64_t *) a_pv1;
+  uint64_t	u2 = *(const uint64_t *) a_pv2;
+
+  return (u1 < u2) ? -1 : ((u1 > u2) ? 1 : 0);
+  }
+
+/* Nearest-rank percentile in microseconds. Sorts the latencies */
+static double	Percentile (OPSTATS * a_pStats, double a_dPercentile)
+	{
+  size_t	i;
+
+  if (a_pStats->m_cLatencies == 0)
+    return 0;
+  qsort (a_pStats->m_puLatencies, a_pStats->m_cLatencies, sizeof (uint64_t), CompareLatencies);
+  i = (size_t) (a_dPercentile / 100.0 * a_pStats->m_cLatencies);
+  if (i >= a_pStats->m_cLatencies)
+    i = a_pStats->m_cLatencies - 1;
+  return (double) a_pStats->m_puLatencies [i] / 1000.0;
+  }
+
+static void	WaitUntil (uint64_t a_uDue)
+	{
+  uint64_t	uNow;
+
+  while ((uNow = GMHarnessNow ()) < a_uDue)
+    {
+    struct timespec	ts;
+    uint64_t				uDelta = a_uDue - uNow;
+
+    ts.tv_sec = (time_t) (uDelta / 1000000000ULL);
+    ts.tv_nsec = (long) (uDelta % 1000000000ULL);
+    nanosleep (&ts, NULL);
+    }
+  }
+
+#pragma mark Handles
+
+static uint64_t	HandleLookup (REPLAYER * a_pReplayer, uint64_t a_uTraceHandle)
+	{
+  HANDLEENTRY *	pEntry;
+  uint64_t			uHandle = 0;
+
+  if (a_uTraceHandle == 0)
+    return 0;
+  pthread_mutex_lock (&a_pReplayer->m_Mutex);
+  for (pEntry = a_pReplayer->m_apHandles [a_uTraceHandle % REPLAY_HANDLE_BUCKETS]; pEntry != NULL; pEntry = pEntry->m_pNext)
+    if (pEntry->m_uTraceHandle == a_uTraceHandle)
+      {
+      uHandle = pEntry->m_uHandle;
+      break;
+      }
+  pthread_mutex_unlock (&a_pReplayer->m_Mutex);
+  return uHandle;
+  }
+
+static void	HandleInsert (REPLAYER * a_pReplayer, uint64_t a_uTraceHandle, uint64_t a_uHandle)
+	{
+  HANDLEENTRY *	pEntry = malloc (sizeof (HANDLEENTRY));
+  HANDLEENTRY **	ppBucket = &a_pReplayer->m_apHandles [a_uTraceHandle % REPLAY_HANDLE_BUCKETS];
+
+  pEntry->m_uTraceHandle = a_uTraceHandle;
+  pEntry->m_uHandle = a_uHandle;
+  pthread_mutex_lock (&a_pReplayer->m_Mutex);
+  pEntry->m_pNext = *ppBucket;
+  *ppBucket = pEntry;
+  pthread_mutex_unlock (&a_pReplayer->m_Mutex);
+  }
+
+/* Returns the removed handle, or 0 */
+static uint64_t	HandleRemove (REPLAYER * a_pReplayer, uint64_t a_uTraceHandle)
+	{
+  HANDLEENTRY **	ppEntry;
+  HANDLEENTRY *		pEntry = NULL;
+  uint64_t				uHandle = 0;
+
+  if (a_uTraceHandle == 0)
+    return 0;
+  pthread_mutex_lock (&a_pReplayer->m_Mutex);
+  for (ppEntry = &a_pReplayer->m_apHandles [a_uTraceHandle % REPLAY_HANDLE_BUCKETS]; *ppEntry != NULL; ppEntry = &(*ppEntry)->m_pNext)
+    if ((*ppEntry)->m_uTraceHandle == a_uTraceHandle)
+      {
+      pEntry = *ppEntry;
+      *ppEntry = pEntry->m_pNext;
+      break;
+      }
+  pthread_mutex_unlock (&a_pReplayer->m_Mutex);
+  if (pEntry != NULL)
+    {
+    uHandle = pEntry->m_uHandle;
+    free (pEntry);
+    }
+  return uHandle;
+  }
+
+#pragma mark In-process
+
+#define	TIMED(a_iRet, a_Expr)																							\
+	do																																			\
+  	{																																			\
+    uint64_t	uTimedStart = GMHarnessNow ();															\
+    (a_iRet) = (a_Expr);																									\
+    *a_puLatency = GMHarnessNow () - uTimedStart;													\
+    }																																			\
+  while (0)
+
+#define	REQUIRE_OP(a_pfn)																									\
+	if ((a_pfn) == NULL)																										\
+  	return NO
+
+#if GM_FUSE3
+static int	CountingFiller (void * a_pBuf, const char * a_pszName, const struct stat * a_pStat, fuse_off_t a_Offset,
+                            enum fuse_fill_dir_flags a_Flags)
+#else
+static int	CountingFiller (void * a_pBuf, const char * a_pszName, const struct stat * a_pStat, fuse_off_t a_Offset)
+#endif	/* GM_FUSE3 */
+	{
+  (void) a_pszName;											/* Avoid unused argument compiler warning */
+  (void) a_pStat;
+  (void) a_Offset;
+#if GM_FUSE3
+  (void) a_Flags;
+#endif	/* GM_FUSE3 */
+
+  (*(unsigned long *) a_pBuf)++;
+  return 0;
+  }
+
+/* Returns NO if the operation can't be replayed in-process on this platform */
+static BOOL	ReplayInProcess (REPLAYTHREAD * a_pThread, const REPLAYOP * a_pOp, int * a_piResult, uint64_t * a_puLatency)
+	{
+  REPLAYER *											pReplayer = a_pThread->m_pReplayer;
+  const struct fuse_operations *	pOps = pReplayer->m_pOps;
+  const GMOperationTraceRecord *	pRecord = a_pOp->m_pRecord;
+  const char *										pszPath = a_pOp->m_pszPath;
+  const char *										pszPath2 = (a_pOp->m_pszPath2 != NULL) ? a_pOp->m_pszPath2 : "";
+  size_t													cb = (size_t) pRecord->size;
+  struct fuse_file_info						fi;
+  struct stat											st;
+  struct timespec									aTimes [2];
+  unsigned long										cEntries = 0;
+  int															iRet = 0;
+
+  if (cb > a_pThread->m_cbBuffer)
+    cb = a_pThread->m_cbBuffer;
+  memset (&fi, 0, sizeof (fi));
+  fi.flags = (int) pRecord->flags;
+  fi.fh = HandleLookup (pReplayer, pRecord->handle);
+  clock_gettime (CLOCK_REALTIME, &aTimes [0]);
+  aTimes [1] = aTimes [0];
+  GMHarnessSetCurrentFS (pReplayer->m_poFS, pRecord->uid, pRecord->gid, pRecord->pid);
+
+  switch (pRecord->op)
+  	{
+    case GMOperationTraceOpGetattr:
+      REQUIRE_OP (pOps->getattr);
+      TIMED (iRet, GMHarnessGetattr (pOps, pszPath, &st, NULL));
+      break;
+    case GMOperationTraceOpFgetattr:
+      REQUIRE_OP (GM_HARNESS_FGETATTR (pOps));
+      TIMED (iRet, GMHarnessGetattr (pOps, pszPath, &st, &fi));
+      break;
+    case GMOperationTraceOpReadlink:
+      REQUIRE_OP (pOps->readlink);
+      TIMED (iRet, pOps->readlink (pszPath, a_pThread->m_pBuffer, cb));
+      break;
+    case GMOperationTraceOpMkdir:
+      REQUIRE_OP (pOps->mkdir);
+      TIMED (iRet, pOps->mkdir (pszPath, (mode_t) pRecord->flags));
+      break;
+    case GMOperationTraceOpUnlink:
+      REQUIRE_OP (pOps->unlink);
+      TIMED (iRet, pOps->unlink (pszPath));
+      break;
+    case GMOperationTraceOpRmdir:
+      REQUIRE_OP (pOps->rmdir);
+      TIMED (iRet, pOps->rmdir (pszPath));
+      break;
+    case GMOperationTraceOpSymlink:					/* The recorded path is the link, the second path its destination */
+      REQUIRE_OP (pOps->symlink);
+      TIMED (iRet, pOps->symlink (pszPath2, pszPath));
+      break;
+    case GMOperationTraceOpRename:
+      REQUIRE_OP (pOps->rename);
+      TIMED (iRet, GMHarnessRename (pOps, pszPath, pszPath2));
+      break;
+    case GMOperationTraceOpLink:
+      REQUIRE_OP (pOps->link);
+      TIMED (iRet, pOps->link (pszPath, pszPath2));
+      break;
+    case GMOperationTraceOpChmod:
+      REQUIRE_OP (pOps->chmod);
+      TIMED (iRet, GMHarnessChmod (pOps, pszPath, (mode_t) pRecord->flags));
+      break;
+    case GMOperationTraceOpChown:
+      REQUIRE_OP (pOps->chown);
+      TIMED (iRet, GMHarnessChown (pOps, pszPath, (uid_t) pRecord->offset, (gid_t) pRecord->size));
+      break;
+    case GMOperationTraceOpTruncate:
+      REQUIRE_OP (pOps->truncate);
+      TIMED (iRet, GMHarnessTruncate (pOps, pszPath, pRecord->offset, NULL));
+      break;
+    case GMOperationTraceOpFtruncate:
+      REQUIRE_OP (GM_HARNESS_FTRUNCATE (pOps));
+      TIMED (iRet, GMHarnessTruncate (pOps, pszPath, pRecord->offset, &fi));
+      break;
+    case GMOperationTraceOpUtimens:
+      REQUIRE_OP (pOps->utimens);
+      TIMED (iRet, GMHarnessUtimens (pOps, pszPath, aTimes));
+      break;
+    case GMOperationTraceOpOpen:
+    case GMOperationTraceOpCreate:
+      if (pRecord->op == GMOperationTraceOpOpen)
+        {
+        REQUIRE_OP (pOps->open);
+        TIMED (iRet, pOps->open (pszPath, &fi));
+        }
+      else
+        {
+        REQUIRE_OP (pOps->create);
+        TIMED (iRet, pOps->create (pszPath, S_IFREG | 0644, &fi));
+        }
+      if (iRet == 0)
+        {
+        if (pRecord->handle != 0)
+          HandleInsert (pReplayer, pRecord->handle, fi.fh);
+        else
+          if (fi.fh != 0 && pOps->release != NULL)	/* Nothing in the trace will release it */
+            pOps->release (pszPath, &fi);
+        }
+      break;
+    case GMOperationTraceOpRead:
+      REQUIRE_OP (pOps->read);
+      TIMED (iRet, pOps->read (pszPath, a_pThread->m_pBuffer, cb, pRecord->offset, &fi));
+      break;
+    case GMOperationTraceOpWrite:
+      REQUIRE_OP (pOps->write);
+      TIMED (iRet, pOps->write (pszPath, a_pThread->m_pBuffer, cb, pRecord->offset, &fi));
+      break;
+    case GMOperationTraceOpStatfs:
+      {
+#if defined (__APPLE__)
+      struct statfs	stfs;
+
+      REQUIRE_OP (pOps->statfs_x);
+      TIMED (iRet, pOps->statfs_x (pszPath, &stfs));
+#else
+      struct statvfs	stvfs;
+
+      REQUIRE_OP (pOps->statfs);
+      TIMED (iRet, pOps->statfs (pszPath, &stvfs));
+#endif	/* defined (__APPLE__) */
+      break;
+      }
+    case GMOperationTraceOpRelease:
+      REQUIRE_OP (pOps->release);
+      fi.fh = HandleRemove (pReplayer, pRecord->handle);
+      TIMED (iRet, pOps->release (pszPath, &fi));
+      break;
+    case GMOperationTraceOpFlush:						/* Closing the handle through a mount flushes it */
+      REQUIRE_OP (pOps->flush);
+      TIMED (iRet, pOps->flush (pszPath, &fi));
+      break;
+    case GMOperationTraceOpFsync:
+      REQUIRE_OP (pOps->fsync);
+      TIMED (iRet, pOps->fsync (pszPath, (int) pRecord->flags, &fi));
+      break;
+    case GMOperationTraceOpSetxattr:
+      REQUIRE_OP (pOps->setxattr);
+#if defined (__APPLE__)
+      TIMED (iRet, pOps->setxattr (pszPath, pszPath2, a_pThread->m_pBuffer, cb, (int) pRecord->flags, (uint32_t) pRecord->offset));
+#else
+      TIMED (iRet, pOps->setxattr (pszPath, pszPath2, a_pThread->m_pBuffer, cb, (int) pRecord->flags));
+#endif	/* defined (__APPLE__) */
+      break;
+    case GMOperationTraceOpGetxattr:
+      REQUIRE_OP (pOps->getxattr);
+#if defined (__APPLE__)
+      TIMED (iRet, pOps->getxattr (pszPath, pszPath2, (cb > 0) ? a_pThread->m_pBuffer : NULL, cb, (uint32_t) pRecord->offset));
+#else
+      TIMED (iRet, pOps->getxattr (pszPath, pszPath2, (cb > 0) ? a_pThread->m_pBuffer : NULL, cb));
+#endif	/* defined (__APPLE__) */
+      break;
+    case GMOperationTraceOpListxattr:
+      REQUIRE_OP (pOps->listxattr);
+      TIMED (iRet, pOps->listxattr (pszPath, (cb > 0) ? a_pThread->m_pBuffer : NULL, cb));
+      break;
+    case GMOperationTraceOpRemovexattr:
+      REQUIRE_OP (pOps->removexattr);
+      TIMED (iRet, pOps->removexattr (pszPath, pszPath2));
+      break;
+    case GMOperationTraceOpReaddir:
+      REQUIRE_OP (pOps->readdir);
+      TIMED (iRet, GMHarnessReaddir (pOps, pszPath, &cEntries, CountingFiller, pRecord->offset, &fi));
+      break;
+    case GMOperationTraceOpAccess:
+      REQUIRE_OP (pOps->access);
+      TIMED (iRet, pOps->access (pszPath, (int) pRecord->flags));
+      break;
+    case GMOperationTraceOpFallocate:
+      REQUIRE_OP (pOps->fallocate);
+      TIMED (iRet, pOps->fallocate (pszPath, (int) pRecord->flags, pRecord->offset, (fuse_off_t) pRecord->size, &fi));
+      break;
+#if defined (__APPLE__)
+    case GMOperationTraceOpExchange:
+      REQUIRE_OP (pOps->exchange);
+      TIMED (iRet, pOps->exchange (pszPath, pszPath2, 0));
+      break;
+    case GMOperationTraceOpSetattr:
+      {
+      struct setattr_x	attrs;
+
+      REQUIRE_OP (pOps->fsetattr_x);
+      memset (&attrs, 0, sizeof (attrs));
+      attrs.valid = pRecord->flags & (REPLAY_SETATTR_SIZE | REPLAY_SETATTR_ACCTIME | REPLAY_SETATTR_MODTIME);
+      attrs.size = (off_t) pRecord->size;
+      attrs.acctime = aTimes [0];
+      attrs.modtime = aTimes [1];
+      TIMED (iRet, pOps->fsetattr_x (pszPath, &attrs, (pRecord->handle != 0) ? &fi : NULL));
+      break;
+      }
+    case GMOperationTraceOpGetxtimes:
+      {
+      struct timespec	tsBackup;
+      struct timespec	tsCreation;
+
+      REQUIRE_OP (pOps->getxtimes);
+      TIMED (iRet, pOps->getxtimes (pszPath, &tsBackup, &tsCreation));
+      break;
+      }
+    case GMOperationTraceOpSetvolname:
+      REQUIRE_OP (pOps->setvolname);
+      TIMED (iRet, pOps->setvolname (pszPath2));
+      break;
+#else
+    case GMOperationTraceOpSetattr:					/* Recorded on OS X/Darwin */
+      if (pRecord->flags & REPLAY_SETATTR_SIZE)
+        {
+        REQUIRE_OP (GM_HARNESS_FTRUNCATE (pOps));
+        TIMED (iRet, GMHarnessTruncate (pOps, pszPath, (fuse_off_t) pRecord->size, (pRecord->handle != 0) ? &fi : NULL));
+        }
+      else
+        if (pRecord->flags & (REPLAY_SETATTR_ACCTIME | REPLAY_SETATTR_MODTIME))
+          {
+          REQUIRE_OP (pOps->utimens);
+          TIMED (iRet, GMHarnessUtimens (pOps, pszPath, aTimes));
+          }
+        else
+          return NO;
+      break;
+#endif	/* defined (__APPLE__) */
+    default:
+      return NO;
+    }
+  *a_piResult = iRet;
+  return YES;
+  }
+
+#pragma mark Through a mount
+
+static void	TargetPath (const REPLAYER * a_pReplayer, const char * a_pszPath, char * a_pszBuffer, size_t a_cbBuffer)
+	{
+  snprintf (a_pszBuffer, a_cbBuffer, "%s%s", a_pReplayer->m_pszTarget, a_pszPath);
+  }
+
+/* System calls return -1 and set errno. Convert to the FUSE convention of 0 or -errno */
+static int	SyscallResult (long a_lRet)
+	{
+  return (a_lRet < 0) ? -errno : (int) a_lRet;
+  }
+
+/* File descriptor for a recorded handle. If the handle wasn't opened in the trace, e.g. because the delegate
+		returned no userData, the file is opened temporarily and *a_pbTemporary is set
+*/
+static int	TargetDescriptor (REPLAYER * a_pReplayer, const GMOperationTraceRecord * a_pRecord, const char * a_pszPath, int a_iFlags, BOOL * a_pbTemporary)
+	{
+  uint64_t	uHandle = HandleLookup (a_pReplayer, a_pRecord->handle);
+
+  *a_pbTemporary = (uHandle == 0);
+  if (uHandle != 0)
+    return (int) (uHandle - 1);
+  return open (a_pszPath, a_iFlags);
+  }
+
+/* Returns NO if the operation can't be replayed as a system call on this platform */
+static BOOL	ReplayThroughMount (REPLAYTHREAD * a_pThread, const REPLAYOP * a_pOp, int * a_piResult, uint64_t * a_puLatency)
+	{
+  REPLAYER *											pReplayer = a_pThread->m_pReplayer;
+  const GMOperationTraceRecord *	pRecord = a_pOp->m_pRecord;
+  const char *										pszName = (a_pOp->m_pszPath2 != NULL) ? a_pOp->m_pszPath2 : "";
+  size_t													cb = (size_t) pRecord->size;
+  char														szPath [PATH_MAX];
+  char														szPath2 [PATH_MAX];
+  struct stat											st;
+  BOOL														bTemporary = NO;
+  int															fd;
+  int															iRet = 0;
+
+  if (cb > a_pThread->m_cbBuffer)
+    cb = a_pThread->m_cbBuffer;
+  TargetPath (pReplayer, a_pOp->m_pszPath, szPath, sizeof (szPath));
+  TargetPath (pReplayer, pszName, szPath2, sizeof (szPath2));
+
+  switch (pRecord->op)
+  	{
+    case GMOperationTraceOpGetattr:
+      TIMED (iRet, SyscallResult (lstat (szPath, &st)));
+      break;
+    case GMOperationTraceOpReadlink:
+      TIMED (iRet, SyscallResult (readlink (szPath, a_pThread->m_pBuffer, cb)));
+      if (iRet > 0)
+        iRet = 0;
+      break;
+    case GMOperationTraceOpMkdir:
+      TIMED (iRet, SyscallResult (mkdir (szPath, (mode_t) pRecord->flags)));
+      break;
+    case GMOperationTraceOpUnlink:
+      TIMED (iRet, SyscallResult (unlink (szPath)));
+      break;
+    case GMOperationTraceOpRmdir:
+      TIMED (iRet, SyscallResult (rmdir (szPath)));
+      break;
+    case GMOperationTraceOpSymlink:					/* The destination is not relative to the mountpoint */
+      TIMED (iRet, SyscallResult (symlink (pszName, szPath)));
+      break;
+    case GMOperationTraceOpRename:
+      TIMED (iRet, SyscallResult (rename (szPath, szPath2)));
+      break;
+    case GMOperationTraceOpLink:
+      TIMED (iRet, SyscallResult (link (szPath, szPath2)));
+      break;
+    case GMOperationTraceOpChmod:
+      TIMED (iRet, SyscallResult (chmod (szPath, (mode_t) pRecord->flags)));
+      break;
+    case GMOperationTraceOpChown:
+      TIMED (iRet, SyscallResult (lchown (szPath, (uid_t) pRecord->offset, (gid_t) pRecord->size)));
+      break;
+    case GMOperationTraceOpTruncate:
+      TIMED (iRet, SyscallResult (truncate (szPath, pRecord->offset)));
+      break;
+    case GMOperationTraceOpUtimens:
+      TIMED (iRet, SyscallResult (utimensat (AT_FDCWD, szPath, NULL, AT_SYMLINK_NOFOLLOW)));
+      break;
+    case GMOperationTraceOpSetattr:
+      if (pRecord->flags & REPLAY_SETATTR_SIZE)
+        TIMED (iRet, SyscallResult (truncate (szPath, (off_t) pRecord->size)));
+      else
+        if (pRecord->flags & (REPLAY_SETATTR_ACCTIME | REPLAY_SETATTR_MODTIME))
+          TIMED (iRet, SyscallResult (utimensat (AT_FDCWD, szPath, NULL, AT_SYMLINK_NOFOLLOW)));
+        else
+          return NO;
+      break;
+    case GMOperationTraceOpOpen:
+    case GMOperationTraceOpCreate:
+      if (pRecord->op == GMOperationTraceOpOpen)
+        TIMED (fd, open (szPath, (int) pRecord->flags & ~(O_CREAT | O_EXCL)));
+      else
+        TIMED (fd, open (szPath, (int) pRecord->flags | O_CREAT, 0644));
+      iRet = SyscallResult (fd);
+      if (fd >= 0)
+        {
+        iRet = 0;
+        if (pRecord->handle != 0)
+          HandleInsert (pReplayer, pRecord->handle, (uint64_t) fd + 1);
+        else
+          close (fd);
+        }
+      break;
+    case GMOperationTraceOpRelease:
+      {
+      uint64_t	uHandle = HandleRemove (pReplayer, pRecord->handle);
+
+      if (uHandle == 0)
+        return NO;
+      TIMED (iRet, SyscallResult (close ((int) (uHandle - 1))));
+      break;
+      }
+    case GMOperationTraceOpFgetattr:
+    case GMOperationTraceOpRead:
+    case GMOperationTraceOpFsync:
+      fd = TargetDescriptor (pReplayer, pRecord, szPath, O_RDONLY, &bTemporary);
+      if (fd < 0)
+        {
+        iRet = -errno;
+        *a_puLatency = 0;
+        break;
+        }
+      if (pRecord->op == GMOperationTraceOpFgetattr)
+        TIMED (iRet, SyscallResult (fstat (fd, &st)));
+      else
+        if (pRecord->op == GMOperationTraceOpRead)
+          TIMED (iRet, SyscallResult (pread (fd, a_pThread->m_pBuffer, cb, pRecord->offset)));
+        else
+          TIMED (iRet, SyscallResult (fsync (fd)));
+      if (bTemporary)
+        close (fd);
+      break;
+    case GMOperationTraceOpWrite:
+    case GMOperationTraceOpFtruncate:
+    case GMOperationTraceOpFallocate:
+      fd = TargetDescriptor (pReplayer, pRecord, szPath, O_WRONLY, &bTemporary);
+      if (fd < 0)
+        {
+        iRet = -errno;
+        *a_puLatency = 0;
+        break;
+        }
+      if (pRecord->op == GMOperationTraceOpWrite)
+        TIMED (iRet, SyscallResult (pwrite (fd, a_pThread->m_pBuffer, cb, pRecord->offset)));
+      else
+        if (pRecord->op == GMOperationTraceOpFtruncate)
+          TIMED (iRet, SyscallResult (ftruncate (fd, pRecord->offset)));
+        else
+          {
+#if defined (__APPLE__)
+          if (bTemporary)
+            close (fd);
+          return NO;
+#else
+          TIMED (iRet, -posix_fallocate (fd, pRecord->offset, (off_t) pRecord->size));
+#endif	/* defined (__APPLE__) */
+          }
+      if (bTemporary)
+        close (fd);
+      break;
+    case GMOperationTraceOpStatfs:
+      {
+      struct statvfs	stvfs;
+
+      TIMED (iRet, SyscallResult (statvfs (szPath, &stvfs)));
+      break;
+      }
+    case GMOperationTraceOpReaddir:
+      {
+      uint64_t	uStart = GMHarnessNow ();
+      DIR *			pDir = opendir (szPath);
+
+      if (pDir == NULL)
+        iRet = -errno;
+      else
+        {
+        while (readdir (pDir) != NULL)
+          ;
+        closedir (pDir);
+        }
+      *a_puLatency = GMHarnessNow () - uStart;
+      break;
+      }
+    case GMOperationTraceOpAccess:
+      TIMED (iRet, SyscallResult (access (szPath, (int) pRecord->flags)));
+      break;
+#if defined (__APPLE__)
+    case GMOperationTraceOpSetxattr:
+      TIMED (iRet, SyscallResult (setxattr (szPath, pszName, a_pThread->m_pBuffer, cb, (uint32_t) pRecord->offset, (int) pRecord->flags | XATTR_NOFOLLOW)));
+      break;
+    case GMOperationTraceOpGetxattr:
+      TIMED (iRet, SyscallResult (getxattr (szPath, pszName, (cb > 0) ? a_pThread->m_pBuffer : NULL, cb, (uint32_t) pRecord->offset, XATTR_NOFOLLOW)));
+      break;
+    case GMOperationTraceOpListxattr:
+      TIMED (iRet, SyscallResult (listxattr (szPath, (cb > 0) ? a_pThread->m_pBuffer : NULL, cb, XATTR_NOFOLLOW)));
+      break;
+    case GMOperationTraceOpRemovexattr:
+      TIMED (iRet, SyscallResult (removexattr (szPath, pszName, XATTR_NOFOLLOW)));
+      break;
+    case GMOperationTraceOpExchange:
+      TIMED (iRet, SyscallResult (exchangedata (szPath, szPath2, 0)));
+      break;
+#elif defined (__linux__)
+    case GMOperationTraceOpSetxattr:
+      TIMED (iRet, SyscallResult (lsetxattr (szPath, pszName, a_pThread->m_pBuffer, cb, (int) pRecord->flags)));
+      break;
+    case GMOperationTraceOpGetxattr:
+      TIMED (iRet, SyscallResult (lgetxattr (szPath, pszName, (cb > 0) ? a_pThread->m_pBuffer : NULL, cb)));
+      break;
+    case GMOperationTraceOpListxattr:
+      TIMED (iRet, SyscallResult (llistxattr (szPath, (cb > 0) ? a_pThread->m_pBuffer : NULL, cb)));
+      break;
+    case GMOperationTraceOpRemovexattr:
+      TIMED (iRet, SyscallResult (lremovexattr (szPath, pszName)));
+      break;
+#endif	/* defined (__APPLE__) */
+    default:																/* Getxtimes, Setvolname and, on some platforms, xattrs */
+      return NO;
+    }
+  *a_piResult = iRet;
+  return YES;
+  }
+
+#pragma mark Replay
+
+static void *	ReplayThread (void * a_pvThread)
+	{
+  REPLAYTHREAD *	pThread = a_pvThread;
+  REPLAYER *			pReplayer = pThread->m_pReplayer;
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+
+  for (size_t i = 0; i < pThread->m_cOps; i++)
+    {
+    const REPLAYOP *								pOp = &pThread->m_pOps [i];
+    const GMOperationTraceRecord *	pRecord = pOp->m_pRecord;
+    OPSTATS *											pStats = &pThread->m_aStats [pRecord->op];
+    uint64_t											uLatency = 0;
+    int														iResult = 0;
+    BOOL													bReplayed;
+
+    if (pReplayer->m_dSpeed > 0)
+      WaitUntil (pReplayer->m_uStart + (uint64_t) ((pRecord->timestamp - pReplayer->m_uFirstTimestamp) / pReplayer->m_dSpeed));
+    if (pReplayer->m_pOps != NULL)
+      bReplayed = ReplayInProcess (pThread, pOp, &iResult, &uLatency);
+    else
+      bReplayed = ReplayThroughMount (pThread, pOp, &iResult, &uLatency);
+    if (!bReplayed)
+      {
+      pStats->m_cSkipped++;
+      continue;
+      }
+    StatsAdd (pStats, uLatency);
+    if ((iResult < 0 || pRecord->result < 0) && iResult != pRecord->result)
+      pStats->m_cMismatches++;
+    }
+  [pool release];
+  return NULL;
+  }
+
+static int	CompareTimestamps (const void * a_pv1, const void * a_pv2)
+	{
+  uint64_t	u1 = (*(const REPLAYOP * const *) a_pv1)->m_pRecord->timestamp;
+  uint64_t	u2 = (*(const REPLAYOP * const *) a_pv2)->m_pRecord->timestamp;
+
+  return (u1 < u2) ? -1 : ((u1 > u2) ? 1 : 0);
+  }
+
+/* Creates a directory, or a file of a_cbFile bytes, before the replay starts */
+static void	PrepareItem (REPLAYTHREAD * a_pThread, const char * a_pszPath, BOOL a_bDirectory, uint64_t a_cbFile)
+	{
+  REPLAYER *								pReplayer = a_pThread->m_pReplayer;
+  const struct fuse_operations *	pOps = pReplayer->m_pOps;
+
+  if (pOps != NULL)
+    {
+    struct fuse_file_info	fi;
+
+    GMHarnessSetCurrentFS (pReplayer->m_poFS, getuid (), getgid (), getpid ());
+    if (a_bDirectory)
+      {
+      pOps->mkdir (a_pszPath, 0755);
+      return;
+      }
+    memset (&fi, 0, sizeof (fi));
+    fi.flags = O_WRONLY;
+    if (pOps->create (a_pszPath, S_IFREG | 0644, &fi) != 0)
+      return;
+    for (uint64_t uOffset = 0; uOffset < a_cbFile; uOffset += REPLAY_PREPARE_CHUNK)
+      {
+      size_t	cb = (a_cbFile - uOffset < REPLAY_PREPARE_CHUNK) ? (size_t) (a_cbFile - uOffset) : REPLAY_PREPARE_CHUNK;
+
+      if (pOps->write (a_pszPath, a_pThread->m_pBuffer, cb, (fuse_off_t) uOffset, &fi) < 0)
+        break;
+      }
+    pOps->release (a_pszPath, &fi);
+    }
+  else
+    {
+    char	szPath [PATH_MAX];
+    int		fd;
+
+    TargetPath (pReplayer, a_pszPath, szPath, sizeof (szPath));
+    if (a_bDirectory)
+      {
+      mkdir (szPath, 0755);
+      return;
+      }
+    fd = open (szPath, O_WRONLY | O_CREAT, 0644);
+    if (fd < 0)
+      return;
+    if (ftruncate (fd, (off_t) a_cbFile) != 0)
+      fprintf (stderr, "GMReplay: Can't size %s: %s\n", szPath, strerror (errno));
+    close (fd);
+    }
+  }
+
+/* Creates the items which the trace uses successfully before, or without, creating them */
+static void	Prepare (REPLAYTHREAD * a_pThread, REPLAYOP * a_pOps, size_t a_cOps)
+	{
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  REPLAYOP **	ppOps = malloc (a_cOps * sizeof (REPLAYOP *));
+  NSMutableSet* created = [NSMutableSet set];
+  NSMutableSet* directories = [NSMutableSet set];
+  NSMutableDictionary* files = [NSMutableDictionary dictionary];
+
+  for (size_t i = 0; i < a_cOps; i++)
+    ppOps [i] = &a_pOps [i];
+  qsort (ppOps, a_cOps, sizeof (REPLAYOP *), CompareTimestamps);
+
+  for (size_t i = 0; i < a_cOps; i++)
+    {
+    const GMOperationTraceRecord *	pRecord = ppOps [i]->m_pRecord;
+    NSString* path = [NSString stringWithUTF8String:ppOps [i]->m_pszPath];
+    NSString* path2 = (ppOps [i]->m_pszPath2 != NULL) ? [NSString stringWithUTF8String:ppOps [i]->m_pszPath2] : nil;
+
+    for (NSString* parent = [path stringByDeletingLastPathComponent];
+         [parent length] > 1 && ![created containsObject:parent];
+         parent = [parent stringByDeletingLastPathComponent])
+      [directories addObject:parent];
+    if (pRecord->result < 0)
+      continue;
+    switch (pRecord->op)
+      {
+      case GMOperationTraceOpMkdir:
+      case GMOperationTraceOpCreate:
+      case GMOperationTraceOpSymlink:
+        [created addObject:path];
+        continue;
+      case GMOperationTraceOpLink:
+      case GMOperationTraceOpRename:
+        if (path2 != nil)
+          [created addObject:path2];
+        break;
+      default:
+        break;
+      }
+    if ([created containsObject:path] || [path isEqualToString:@"/"])
+      continue;
+    switch (pRecord->op)
+      {
+      case GMOperationTraceOpReaddir:
+      case GMOperationTraceOpRmdir:
+        [directories addObject:path];
+        break;
+      case GMOperationTraceOpGetattr:					/* Type unknown. A file unless it's used as a directory */
+      case GMOperationTraceOpAccess:
+      case GMOperationTraceOpStatfs:
+      case GMOperationTraceOpReadlink:
+        break;
+      default:
+        {
+        uint64_t	cbNeeded = 0;
+        NSNumber* size = [files objectForKey:path];
+
+        if (pRecord->op == GMOperationTraceOpRead && pRecord->result > 0)
+          cbNeeded = (uint64_t) pRecord->offset + (uint64_t) pRecord->result;
+        if (size == nil || [size unsignedLongLongValue] < cbNeeded)
+          [files setObject:[NSNumber numberWithUnsignedLongLong:cbNeeded] forKey:path];
+        break;
+        }
+      }
+    }
+
+  NSArray* sortedDirectories = [[directories allObjects] sortedArrayUsingSelector:@selector(compare:)];
+  for (NSString* directory in sortedDirectories)						/* Parents sort before their children */
+    PrepareItem (a_pThread, [directory fileSystemRepresentation], YES, 0);
+  for (NSString* file in files)
+    if (![directories containsObject:file])
+      PrepareItem (a_pThread, [file fileSystemRepresentation], NO, [[files objectForKey:file] unsignedLongLongValue]);
+  free (ppOps);
+  [pool release];
+  }
+
+static void	AddOperation (REPLAYTHREAD * a_pThread, const REPLAYOP * a_pOp)
+	{
+  const GMOperationTraceRecord *	pRecord = a_pOp->m_pRecord;
+
+  if (a_pThread->m_cOps == a_pThread->m_cMaxOps)
+    {
+    a_pThread->m_cMaxOps = (a_pThread->m_cMaxOps > 0) ? a_pThread->m_cMaxOps * 2 : 256;
+    a_pThread->m_pOps = realloc (a_pThread->m_pOps, a_pThread->m_cMaxOps * sizeof (REPLAYOP));
+    }
+  a_pThread->m_pOps [a_pThread->m_cOps++] = *a_pOp;
+  if (pRecord->size > a_pThread->m_cbBuffer && pRecord->op != GMOperationTraceOpFallocate &&
+      pRecord->op != GMOperationTraceOpChown && pRecord->op != GMOperationTraceOpSetattr)
+    a_pThread->m_cbBuffer = (size_t) pRecord->size;
+  }
+
+static NSDictionary *	Summarise (const char * a_pszName, OPSTATS * a_pRecorded, OPSTATS * a_pReplayed)
+	{
+  NSMutableDictionary* result = [NSMutableDictionary dictionary];
+
+  [result setObject:[NSString stringWithUTF8String:a_pszName] forKey:@"name"];
+  [result setObject:[NSNumber numberWithUnsignedLong:a_pRecorded->m_cLatencies] forKey:@"recorded_ops"];
+  [result setObject:[NSNumber numberWithUnsignedLong:a_pReplayed->m_cLatencies] forKey:@"replayed_ops"];
+  [result setObject:[NSNumber numberWithUnsignedLong:a_pReplayed->m_cSkipped] forKey:@"skipped"];
+  [result setObject:[NSNumber numberWithUnsignedLong:a_pReplayed->m_cMismatches] forKey:@"mismatches"];
+  [result setObject:[NSNumber numberWithDouble:Percentile (a_pRecorded, 50)] forKey:@"recorded_p50_us"];
+  [result setObject:[NSNumber numberWithDouble:Percentile (a_pRecorded, 99)] forKey:@"recorded_p99_us"];
+  [result setObject:[NSNumber numberWithDouble:Percentile (a_pReplayed, 50)] forKey:@"p50_us"];
+  [result setObject:[NSNumber numberWithDouble:Percentile (a_pReplayed, 99)] forKey:@"p99_us"];
+  [result setObject:[NSNumber numberWithDouble:Percentile (a_pReplayed, 99.9)] forKey:@"p999_us"];
+  return result;
+  }
+
+int	main (int argc, const char * argv [])
+	{
+  (void) argc;													/* Avoid unused argument compiler warning */
+  (void) argv;
+
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  NSUserDefaults* args = [NSUserDefaults standardUserDefaults];
+  NSString* tracePath = [args stringForKey:@"trace"];
+  NSString* target = [args stringForKey:@"target"];
+  NSString* delegateName = [args stringForKey:@"delegate"];
+  NSString* bundlePath = [args stringForKey:@"bundle"];
+  NSString* speed = [args stringForKey:@"speed"];
+  BOOL prepare = ([args objectForKey:@"prepare"] != nil) ? [args boolForKey:@"prepare"] : YES;
+  BOOL json = [args boolForKey:@"json"];
+  id delegate = nil;
+  REPLAYER replayer;
+  int iRet = 0;
+
+  if (tracePath == nil) {
+    fprintf(stderr, "GMReplay: Specify the trace with -trace file\n");
+    [pool release];
+    return 2;
+  }
+  NSData* trace = [NSData dataWithContentsOfFile:tracePath];
+  const GMOperationTraceHeader* header = [trace bytes];
+  if (trace == nil || [trace length] < sizeof(GMOperationTraceHeader) ||
+      memcmp(header->magic, kGMOperationTraceMagic, sizeof(header->magic)) != 0 ||
+      header->version != kGMOperationTraceVersion ||
+      header->headerSize < sizeof(GMOperationTraceHeader)) {
+    fprintf(stderr, "GMReplay: %s is not an operation trace\n", [tracePath UTF8String]);
+    [pool release];
+    return 1;
+  }
+
+  memset(&replayer, 0, sizeof(replayer));
+  pthread_mutex_init(&replayer.m_Mutex, NULL);
+  if (speed == nil || [speed isEqualToString:@"max"]) {
+    replayer.m_dSpeed = 0;
+  } else if ([speed isEqualToString:@"original"]) {
+    replayer.m_dSpeed = 1;
+  } else if ((replayer.m_dSpeed = [speed doubleValue]) <= 0) {
+    fprintf(stderr, "GMReplay: -speed must be original, max or a positive number\n");
+    [pool release];
+    return 2;
+  }
+
+  if (target != nil) {
+    replayer.m_pszTarget = [target fileSystemRepresentation];
+  } else {
+    if (bundlePath != nil && ![[NSBundle bundleWithPath:bundlePath] load]) {
+      fprintf(stderr, "GMReplay: Can't load %s\n", [bundlePath UTF8String]);
+      [pool release];
+      return 1;
+    }
+    if (delegateName == nil) {
+      delegateName = @"GMMemoryFileSystem";
+    }
+    Class delegateClass = NSClassFromString(delegateName);
+    if (delegateClass == Nil) {
+      fprintf(stderr, "GMReplay: No delegate class %s\n", [delegateName UTF8String]);
+      [pool release];
+      return 1;
+    }
+    delegate = [[delegateClass alloc] init];
+    replayer.m_poFS = [[GMUserFileSystem alloc] initWithDelegate:delegate isThreadSafe:YES];
+    replayer.m_pOps = GMHarnessOperations();
+  }
+
+  // Split the trace into one list of operations for each recorded thread.
+  const char* bytes = [trace bytes];
+  size_t length = [trace length];
+  size_t position = header->headerSize;
+  REPLAYTHREAD* threads = NULL;
+  uint32_t threadCount = 0;
+  REPLAYOP* allOps = NULL;
+  size_t opCount = 0;
+  size_t maxOps = 0;
+  OPSTATS recorded[REPLAY_OP_COUNT];
+  unsigned long long dropped = 0;
+  uint64_t traceEnd = 0;
+
+  memset(recorded, 0, sizeof(recorded));
+  replayer.m_uFirstTimestamp = UINT64_MAX;
+  while (position + sizeof(GMOperationTraceRecord) <= length) {
+    const GMOperationTraceRecord* record = (const GMOperationTraceRecord *)(bytes + position);
+    REPLAYOP op;
+
+    if (record->recordSize < sizeof(GMOperationTraceRecord) || position + record->recordSize > length ||
+        sizeof(GMOperationTraceRecord) + record->pathLength + record->path2Length + 2 > record->recordSize) {
+      fprintf(stderr, "GMReplay: Trace is truncated or corrupt at offset %zu\n", position);
+      iRet = 1;
+      break;
+    }
+    position += record->recordSize;
+    if (record->op == GMOperationTraceOpDropped) {
+      dropped += record->size;
+      continue;
+    }
+    if (record->op == GMOperationTraceOpNone || record->op >= REPLAY_OP_COUNT || record->tid == 0) {
+      continue;
+    }
+    op.m_pRecord = record;
+    op.m_pszPath = (const char *)(record + 1);
+    op.m_pszPath2 = (record->path2Length > 0) ? op.m_pszPath + record->pathLength + 1 : NULL;
+    if (opCount == maxOps) {
+      maxOps = (maxOps > 0) ? maxOps * 2 : 4096;
+      allOps = realloc(allOps, maxOps * sizeof(REPLAYOP));
+    }
+    allOps[opCount++] = op;
+    if (record->tid > threadCount) {
+      threads = realloc(threads, (record->tid + 1) * sizeof(REPLAYTHREAD));
+      memset(threads + threadCount + 1, 0, (record->tid - threadCount) * sizeof(REPLAYTHREAD));
+      threadCount = record->tid;
+    }
+    StatsAdd(&recorded[record->op], record->latency);
+    if (record->timestamp < replayer.m_uFirstTimestamp) {
+      replayer.m_uFirstTimestamp = record->timestamp;
+    }
+    if (record->timestamp + record->latency > traceEnd) {
+      traceEnd = record->timestamp + record->latency;
+    }
+  }
+  for (size_t i = 0; i < opCount; i++) {
+    AddOperation(&threads[allOps[i].m_pRecord->tid], &allOps[i]);
+  }
+  for (uint32_t tid = 1; tid <= threadCount; tid++) {
+    threads[tid].m_pReplayer = &replayer;
+    if (threads[tid].m_cbBuffer < REPLAY_PREPARE_CHUNK) {
+      threads[tid].m_cbBuffer = REPLAY_PREPARE_CHUNK;
+    }
+    threads[tid].m_pBuffer = calloc(1, threads[tid].m_cbBuffer);
+  }
+
+  if (prepare && threadCount > 0) {
+    Prepare(&threads[1], allOps, opCount);
+  }
+
+  replayer.m_uStart = GMHarnessNow();
+  for (uint32_t tid = 1; tid <= threadCount; tid++) {
+    if (threads[tid].m_cOps > 0 &&
+        pthread_create(&threads[tid].m_Thread, NULL, ReplayThread, &threads[tid]) != 0) {
+      threads[tid].m_cOps = 0;
+      fprintf(stderr, "GMReplay: Can't create a replay thread\n");
+      iRet = 1;
+    }
+  }
+  for (uint32_t tid = 1; tid <= threadCount; tid++) {
+    if (threads[tid].m_cOps > 0) {
+      pthread_join(threads[tid].m_Thread, NULL);
+    }
+  }
+  uint64_t elapsed = GMHarnessNow() - replayer.m_uStart;
+
+  OPSTATS replayed[REPLAY_OP_COUNT];
+  memset(replayed, 0, sizeof(replayed));
+  for (uint32_t tid = 1; tid <= threadCount; tid++) {
+    for (int i = 0; i < REPLAY_OP_COUNT; i++) {
+      StatsMerge(&replayed[i], &threads[tid].m_aStats[i]);
+      free(threads[tid].m_aStats[i].m_puLatencies);
+    }
+    free(threads[tid].m_pOps);
+    free(threads[tid].m_pBuffer);
+  }
+
+  NSMutableArray* results = [NSMutableArray array];
+  unsigned long mismatches = 0;
+  for (int i = 1; i < REPLAY_OP_COUNT; i++) {
+    if (recorded[i].m_cLatencies > 0) {
+      [results addObject:Summarise(g_apszOpNames[i], &recorded[i], &replayed[i])];
+      mismatches += replayed[i].m_cMismatches;
+    }
+    free(recorded[i].m_puLatencies);
+    free(replayed[i].m_puLatencies);
+  }
+  double recordedSeconds = (opCount > 0) ? (double)(traceEnd - replayer.m_uFirstTimestamp) / 1e9 : 0;
+  double replayedSeconds = (double)elapsed / 1e9;
+
+  if (json) {
+    NSDictionary* root =
+      [NSDictionary dictionaryWithObjectsAndKeys:
+       results, @"results",
+       tracePath, @"trace",
+       (target != nil) ? target : [NSString stringWithFormat:@"in-process %@", [delegate class]], @"target",
+       (speed != nil) ? speed : @"max", @"speed",
+       [NSNumber numberWithUnsignedLong:opCount], @"ops",
+       [NSNumber numberWithUnsignedInt:threadCount], @"threads",
+       [NSNumber numberWithUnsignedLongLong:dropped], @"dropped",
+       [NSNumber numberWithUnsignedLong:mismatches], @"mismatches",
+       [NSNumber numberWithDouble:recordedSeconds], @"recorded_seconds",
+       [NSNumber numberWithDouble:replayedSeconds], @"seconds",
+       nil];
+    NSData* data = [NSJSONSerialization dataWithJSONObject:root
+                                                   options:NSJSONWritingPrettyPrinted
+                                                     error:NULL];
+    fwrite([data bytes], 1, [data length], stdout);
+    fputc('\n', stdout);
+  } else {
+    printf("%zu operations from %u threads in %.3fs, replayed in %.3fs. %llu dropped while recording, %lu mismatched results\n",
+           opCount, threadCount, recordedSeconds, replayedSeconds, dropped, mismatches);
+    printf("%-12s %10s %10s %10s %12s %12s %10s %10s %10s\n",
+           "op", "recorded", "replayed", "skipped", "mismatches", "rec p50 us", "p50 us", "p99 us", "p999 us");
+    for (NSDictionary* result in results) {
+      printf("%-12s %10lu %10lu %10lu %12lu %12.1f %10.1f %10.1f %10.1f\n",
+             [[result objectForKey:@"name"] UTF8String],
+             [[result objectForKey:@"recorded_ops"] unsignedLongValue],
+             [[result objectForKey:@"replayed_ops"] unsignedLongValue],
+             [[result objectForKey:@"skipped"] unsignedLongValue],
+             [[result objectForKey:@"mismatches"] unsignedLongValue],
+             [[result objectForKey:@"recorded_p50_us"] doubleValue],
+             [[result objectForKey:@"p50_us"] doubleValue],
+             [[result objectForKey:@"p99_us"] doubleValue],
+             [[result objectForKey:@"p999_us"] doubleValue]);
+    }
+  }
+
+  for (size_t i = 0; i < REPLAY_HANDLE_BUCKETS; i++) {
+    while (replayer.m_apHandles[i] != NULL) {
+      HANDLEENTRY* entry = replayer.m_apHandles[i];
+      replayer.m_apHandles[i] = entry->m_pNext;
+      if (replayer.m_pOps == NULL) {
+        close((int)(entry->m_uHandle - 1));
+      }
+      free(entry);
+    }
+  }
+  pthread_mutex_destroy(&replayer.m_Mutex);
+  free(allOps);
+  free(threads);
+  [replayer.m_poFS release];
+  [delegate release];
+  [pool release];
+  return iRet;
+  }
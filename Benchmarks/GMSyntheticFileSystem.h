@@ -0,0 +1,37 @@
+//
+//  GMSyntheticFileSystem.h
+//  OSXFUSE
+//
+
+//  A synthetic file system delegate for measuring framework overhead.
+//  Covered by the same license as the OSXFUSE framework.
+//
+//  Every answer is precomputed and every open or create returns a shared
+//  handle, so the delegate itself makes no allocations on the measured paths.
+//  The file system contains:<ul>
+//    <li>/dir   A directory with a configurable number of entries
+//    <li>/file  A regular file of configurable size with one extended
+//               attribute, user.bench, of configurable size
+//    <li>/new   Accepts create and write, discarding the data</ul>
+
+#import "GMAvailability.h"						/* Always include this first */
+
+@class GMDataBackedFileDelegate;
+
+@interface GMSyntheticFileSystem : NSObject {
+ @private
+  NSArray* rootEntries_;
+  NSArray* entries_;
+  NSDictionary* directoryAttributes_;
+  NSDictionary* fileAttributes_;
+  GMDataBackedFileDelegate* fileHandle_;
+  id sinkHandle_;
+  NSArray* xattrNames_;
+  NSData* xattrValue_;
+}
+
+- (id)initWithEntryCount:(NSUInteger)entryCount
+                fileSize:(NSUInteger)fileSize
+               xattrSize:(NSUInteger)xattrSize;
+
+@end
@@ -0,0 +1,191 @@
+//
+//  GMSyntheticFileSystem.m
+//  OSXFUSE
+//
+
+//  A synthetic file system delegate for measuring framework overhead.
+//  Covered by the same license as the OSXFUSE framework.
+
+#import "GMAvailability.h"						/* Always include this first */
+#import "GMSyntheticFileSystem.h"
+#import "GMUserFileSystem.h"
+#import "GMDataBackedFileDelegate.h"
+
+#include <errno.h>
+
+static NSString* const kBenchDirectoryPath = @"/dir";
+static NSString* const kBenchFilePath = @"/file";
+static NSString* const kBenchNewFilePath = @"/new";
+static NSString* const kBenchXattrName = @"user.bench";
+
+// Accepts writes and discards them. Shared by every create of /new.
+@interface GMSyntheticSink : NSObject
+- (int)writeFromBuffer:(const char *)buffer
+                  size:(size_t)size
+                offset:(fuse_off_t)offset
+                 error:(NSError **)error;
+@end
+
+@implementation GMSyntheticSink
+
+- (int)writeFromBuffer:(const char *)buffer
+                  size:(size_t)size
+                offset:(fuse_off_t)offset
+                 error:(NSError **)error {
+  (void) buffer;																		/* Avoid unused parameter compiler warning */
+  (void) offset;
+  (void) error;
+  return (int)size;
+}
+
+@end
+
+@implementation GMSyntheticFileSystem
+
+- (id)init {
+  return [self initWithEntryCount:100000 fileSize:4096 xattrSize:64];
+}
+
+- (id)initWithEntryCount:(NSUInteger)entryCount
+                fileSize:(NSUInteger)fileSize
+               xattrSize:(NSUInteger)xattrSize {
+  self = [super init];
+  if (self) {
+    NSMutableArray* entries = [NSMutableArray arrayWithCapacity:entryCount];
+    for (NSUInteger i = 0; i < entryCount; ++i) {
+      [entries addObject:[NSString stringWithFormat:@"entry-%08lu", (unsigned long)i]];
+    }
+    entries_ = [entries copy];
+    rootEntries_ = [[NSArray alloc] initWithObjects:
+                    [kBenchDirectoryPath lastPathComponent],
+                    [kBenchFilePath lastPathComponent], nil];
+
+    NSDate* now = [NSDate date];
+    directoryAttributes_ =
+      [[NSDictionary alloc] initWithObjectsAndKeys:
+       NSFileTypeDirectory, NSFileType,
+       [NSNumber numberWithLong:0755], NSFilePosixPermissions,
+       [NSNumber numberWithLong:2], NSFileReferenceCount,
+       now, NSFileModificationDate,
+       nil];
+    fileAttributes_ =
+      [[NSDictionary alloc] initWithObjectsAndKeys:
+       NSFileTypeRegular, NSFileType,
+       [NSNumber numberWithLong:0644], NSFilePosixPermissions,
+       [NSNumber numberWithLong:1], NSFileReferenceCount,
+       [NSNumber numberWithUnsignedLongLong:fileSize], NSFileSize,
+       now, NSFileModificationDate,
+       nil];
+
+    NSMutableData* contents = [NSMutableData dataWithLength:fileSize];
+    memset([contents mutableBytes], 'x', fileSize);
+    fileHandle_ = [[GMDataBackedFileDelegate alloc] initWithData:contents];
+    sinkHandle_ = [[GMSyntheticSink alloc] init];
+
+    xattrNames_ = [[NSArray alloc] initWithObjects:kBenchXattrName, nil];
+    NSMutableData* value = [NSMutableData dataWithLength:xattrSize];
+    memset([value mutableBytes], 'v', xattrSize);
+    xattrValue_ = [value copy];
+  }
+  return self;
+}
+
+- (void)dealloc {
+  [rootEntries_ release];
+  [entries_ release];
+  [directoryAttributes_ release];
+  [fileAttributes_ release];
+  [fileHandle_ release];
+  [sinkHandle_ release];
+  [xattrNames_ release];
+  [xattrValue_ release];
+  [super dealloc];
+}
+
+#pragma mark GMUserFileSystemOperations
+
+- (NSArray *)contentsOfDirectoryAtPath:(NSString *)path error:(NSError **)error {
+  if ([path isEqualToString:kBenchDirectoryPath]) {
+    return entries_;
+  }
+  if ([path isEqualToString:@"/"]) {
+    return rootEntries_;
+  }
+  *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:ENOENT userInfo:nil];
+  return nil;
+}
+
+- (NSDictionary *)attributesOfItemAtPath:(NSString *)path
+                                userData:(id)userData
+                                   error:(NSError **)error {
+  (void) userData;																	/* Avoid unused parameter compiler warning */
+
+  if ([path isEqualToString:kBenchFilePath] ||
+      [path isEqualToString:kBenchNewFilePath]) {
+    return fileAttributes_;
+  }
+  if ([path isEqualToString:kBenchDirectoryPath] ||
+      [path isEqualToString:@"/"]) {
+    return directoryAttributes_;
+  }
+  *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:ENOENT userInfo:nil];
+  return nil;
+}
+
+- (BOOL)openFileAtPath:(NSString *)path
+                  mode:(int)mode
+              userData:(id *)userData
+                 error:(NSError **)error {
+  (void) mode;																			/* Avoid unused parameter compiler warning */
+
+  if ([path isEqualToString:kBenchFilePath]) {
+    *userData = fileHandle_;
+    return YES;
+  }
+  *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:ENOENT userInfo:nil];
+  return NO;
+}
+
+- (void)releaseFileAtPath:(NSString *)path userData:(id)userData {
+  (void) path;																			/* Avoid unused parameter compiler warning */
+  (void) userData;
+}
+
+- (BOOL)createFileAtPath:(NSString *)path
+              attributes:(NSDictionary *)attributes
+                   flags:(int)flags
+                userData:(id *)userData
+                   error:(NSError **)error {
+  (void) attributes;																/* Avoid unused parameter compiler warning */
+  (void) flags;
+
+  if ([path isEqualToString:kBenchNewFilePath]) {
+    *userData = sinkHandle_;
+    return YES;
+  }
+  *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:EACCES userInfo:nil];
+  return NO;
+}
+
+- (NSArray *)extendedAttributesOfItemAtPath:(NSString *)path
+                                      error:(NSError **)error {
+  (void) path;																			/* Avoid unused parameter compiler warning */
+  (void) error;
+  return xattrNames_;
+}
+
+- (NSData *)valueOfExtendedAttribute:(NSString *)name
+                        ofItemAtPath:(NSString *)path
+                            position:(fuse_off_t)position
+                               error:(NSError **)error {
+  (void) position;																	/* Avoid unused parameter compiler warning */
+
+  if ([path isEqualToString:kBenchFilePath] &&
+      [name isEqualToString:kBenchXattrName]) {
+    return xattrValue_;
+  }
+  *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:ENOATTR userInfo:nil];
+  return nil;
+}
+
+@end
@@ -0,0 +1,578 @@
+//
+//  GMWorkload.m
+//  OSXFUSE
+//
+
+//  End-to-end workload driver. Mounts GMMemoryFileSystem, or uses an existing
+//  directory, and runs standard I/O patterns against it through the kernel.
+//  Reports throughput and p50/p99/p999 latency for each pattern. Covered by the
+//  same license as the OSXFUSE framework.
+//
+//  Usage: GMWorkload -mountpoint dir [-options opt1,opt2] | -target dir
+//                    [-workloads name1,name2] [-files N] [-smallsize N]
+//                    [-largesize N] [-randomops N] [-depth N] [-fanout N]
+//                    [-threads N] [-json YES]
+//
+//  -target runs the same patterns against a directory which is not mounted by
+//  this tool, e.g. a tmpfs, to provide a reference for the framework's cost.
+//
+//  Workloads:<ul>
+//    <li>create-storm   create, write and close -files small files
+//    <li>seq-write      write a -largesize file in 1MB chunks
+//    <li>seq-read       read the same file back in 1MB chunks
+//    <li>random-4k      -randomops 4KB preads and pwrites at random offsets
+//    <li>tree-walk      build a tree of -depth levels of -fanout directories,
+//                       then readdir and lstat every entry
+//    <li>parallel-read  -threads readers each read the whole large file</ul>
+
+#import "GMAvailability.h"						/* Always include this first */
+#import "GMUserFileSystem.h"
+#import "GMMemoryFileSystem.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define	WORKLOAD_CHUNK_SIZE		(1024 * 1024)
+#define	WORKLOAD_RANDOM_SIZE	4096
+#define	WORKLOAD_MOUNT_TRIES	100							/* Wait up to 10s for the mount to appear */
+
+typedef struct
+	{
+  uint64_t *	m_puSamples;
+  size_t			m_cSamples;
+  size_t			m_cMaxSamples;
+  uint64_t		m_cBytes;
+  int					m_iErrno;										/* First failure, if any */
+  } SAMPLES;
+
+typedef struct
+	{
+  const char *	m_pszPath;
+  uint64_t			m_cbFile;
+  SAMPLES				m_Samples;
+  } READERARGS;
+
+static uint64_t	Now (void)
+	{
+  struct timespec	ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+  }
+
+static void	SamplesInit (SAMPLES * a_pSamples, size_t a_cMaxSamples)
+	{
+  memset (a_pSamples, 0, sizeof (*a_pSamples));
+  a_pSamples->m_cMaxSamples = (a_cMaxSamples > 0) ? a_cMaxSamples : 1;
+  a_pSamples->m_puSamples = malloc (a_pSamples->m_cMaxSamples * sizeof (uint64_t));
+  }
+
+static void	SamplesAdd (SAMPLES * a_pSamples, uint64_t a_uLatency)
+	{
+  if (a_pSamples->m_cSamples == a_pSamples->m_cMaxSamples)
+    {
+    a_pSamples->m_cMaxSamples *= 2;
+    a_pSamples->m_puSamples = realloc (a_pSamples->m_puSamples, a_pSamples->m_cMaxSamples * sizeof (uint64_t));
+    }
+  a_pSamples->m_puSamples [a_pSamples->m_cSamples++] = a_uLatency;
+  }
+
+static void	SamplesFail (SAMPLES * a_pSamples)
+	{
+  if (a_pSamples->m_iErrno == 0)
+    a_pSamples->m_iErrno = (errno != 0) ? errno : EIO;
+  }
+
+static void	SamplesMerge (SAMPLES * a_pTo, const SAMPLES * a_pFrom)
+	{
+  for (size_t i = 0; i < a_pFrom->m_cSamples; i++)
+    SamplesAdd (a_pTo, a_pFrom->m_puSamples [i]);
+  a_pTo->m_cBytes += a_pFrom->m_cBytes;
+  if (a_pTo->m_iErrno == 0)
+    a_pTo->m_iErrno = a_pFrom->m_iErrno;
+  }
+
+static void	SamplesFree (SAMPLES * a_pSamples)
+	{
+  free (a_pSamples->m_puSamples);
+  a_pSamples->m_puSamples = NULL;
+  }
+
+static int	CompareSamples (const void * a_pv1, const void * a_pv2)
+	{
+  uint64_t	u1 = *(const uint64_t *) a_pv1;
+  uint64_t	u2 = *(const uint64_t *) a_pv2;
+
+  return (u1 < u2) ? -1 : ((u1 > u2) ? 1 : 0);
+  }
+
+/* Nearest-rank percentile. a_pSamples must be sorted */
+static double	Percentile (const SAMPLES * a_pSamples, double a_dPercentile)
+	{
+  size_t	i;
+
+  if (a_pSamples->m_cSamples == 0)
+    return 0;
+  i = (size_t) (a_dPercentile / 100.0 * a_pSamples->m_cSamples);
+  if (i >= a_pSamples->m_cSamples)
+    i = a_pSamples->m_cSamples - 1;
+  return (double) a_pSamples->m_puSamples [i];
+  }
+
+static NSDictionary *	Summarise (const char * a_pszName, SAMPLES * a_pSamples, uint64_t a_uElapsed)
+	{
+  qsort (a_pSamples->m_puSamples, a_pSamples->m_cSamples, sizeof (uint64_t), CompareSamples);
+
+  double seconds = (double) a_uElapsed / 1e9;
+  NSMutableDictionary* result = [NSMutableDictionary dictionary];
+  [result setObject:[NSString stringWithUTF8String:a_pszName] forKey:@"name"];
+  [result setObject:[NSNumber numberWithUnsignedLong:a_pSamples->m_cSamples] forKey:@"ops"];
+  [result setObject:[NSNumber numberWithDouble:seconds] forKey:@"seconds"];
+  [result setObject:[NSNumber numberWithDouble:(seconds > 0) ? a_pSamples->m_cSamples / seconds : 0] forKey:@"ops_per_second"];
+  [result setObject:[NSNumber numberWithDouble:(seconds > 0) ? a_pSamples->m_cBytes / seconds / 1048576.0 : 0] forKey:@"mb_per_second"];
+  [result setObject:[NSNumber numberWithDouble:Percentile (a_pSamples, 50) / 1000.0] forKey:@"p50_us"];
+  [result setObject:[NSNumber numberWithDouble:Percentile (a_pSamples, 99) / 1000.0] forKey:@"p99_us"];
+  [result setObject:[NSNumber numberWithDouble:Percentile (a_pSamples, 99.9) / 1000.0] forKey:@"p999_us"];
+  if (a_pSamples->m_iErrno != 0)
+    [result setObject:[NSString stringWithUTF8String:strerror (a_pSamples->m_iErrno)] forKey:@"error"];
+  return result;
+  }
+
+#pragma mark Workloads
+
+static NSDictionary *	CreateStorm (NSString * a_poRoot, unsigned long a_cFiles, size_t a_cbFile)
+	{
+  SAMPLES		Samples;
+  char *		pBuffer = calloc (1, a_cbFile + 1);
+  NSString *	poDir = [a_poRoot stringByAppendingPathComponent:@"create-storm"];
+  uint64_t	uStart;
+
+  SamplesInit (&Samples, a_cFiles);
+  mkdir ([poDir UTF8String], 0755);
+  uStart = Now ();
+  for (unsigned long i = 0; i < a_cFiles; i++)
+    {
+    char	szPath [PATH_MAX];
+    snprintf (szPath, sizeof (szPath), "%s/f%08lu", [poDir UTF8String], i);
+    uint64_t	uOpStart = Now ();
+    int				fd = open (szPath, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fd < 0 || write (fd, pBuffer, a_cbFile) != (ssize_t) a_cbFile)
+      SamplesFail (&Samples);
+    if (fd >= 0)
+      close (fd);
+    SamplesAdd (&Samples, Now () - uOpStart);
+    Samples.m_cBytes += a_cbFile;
+    }
+  NSDictionary* result = Summarise ("create-storm", &Samples, Now () - uStart);
+  SamplesFree (&Samples);
+  free (pBuffer);
+  return result;
+  }
+
+static NSDictionary *	SequentialWrite (NSString * a_poPath, uint64_t a_cbFile)
+	{
+  SAMPLES		Samples;
+  char *		pBuffer = malloc (WORKLOAD_CHUNK_SIZE);
+  uint64_t	uStart;
+  int				fd;
+
+  memset (pBuffer, 's', WORKLOAD_CHUNK_SIZE);
+  SamplesInit (&Samples, a_cbFile / WORKLOAD_CHUNK_SIZE + 1);
+  uStart = Now ();
+  fd = open ([a_poPath UTF8String], O_CREAT | O_WRONLY | O_TRUNC, 0644);
+  if (fd < 0)
+    SamplesFail (&Samples);
+  else
+    {
+    for (uint64_t cbDone = 0; cbDone < a_cbFile; )
+      {
+      size_t		cb = (a_cbFile - cbDone < WORKLOAD_CHUNK_SIZE) ? (size_t) (a_cbFile - cbDone) : WORKLOAD_CHUNK_SIZE;
+      uint64_t	uOpStart = Now ();
+      ssize_t		cbWritten = write (fd, pBuffer, cb);
+      SamplesAdd (&Samples, Now () - uOpStart);
+      if (cbWritten <= 0)
+        {
+        SamplesFail (&Samples);
+        break;
+        }
+      cbDone += cbWritten;
+      Samples.m_cBytes += cbWritten;
+      }
+    close (fd);
+    }
+  NSDictionary* result = Summarise ("seq-write", &Samples, Now () - uStart);
+  SamplesFree (&Samples);
+  free (pBuffer);
+  return result;
+  }
+
+/* Reads the whole file in 1MB chunks, adding to a_pSamples */
+static void	ReadWholeFile (const char * a_pszPath, SAMPLES * a_pSamples)
+	{
+  char *	pBuffer = malloc (WORKLOAD_CHUNK_SIZE);
+  int			fd = open (a_pszPath, O_RDONLY);
+
+  if (fd < 0)
+    SamplesFail (a_pSamples);
+  else
+    {
+    for (;;)
+      {
+      uint64_t	uOpStart = Now ();
+      ssize_t		cbRead = read (fd, pBuffer, WORKLOAD_CHUNK_SIZE);
+      SamplesAdd (a_pSamples, Now () - uOpStart);
+      if (cbRead < 0)
+        SamplesFail (a_pSamples);
+      if (cbRead <= 0)
+        break;
+      a_pSamples->m_cBytes += cbRead;
+      }
+    close (fd);
+    }
+  free (pBuffer);
+  }
+
+static NSDictionary *	SequentialRead (NSString * a_poPath, uint64_t a_cbFile)
+	{
+  SAMPLES		Samples;
+  uint64_t	uStart;
+
+  SamplesInit (&Samples, a_cbFile / WORKLOAD_CHUNK_SIZE + 2);
+  uStart = Now ();
+  ReadWholeFile ([a_poPath UTF8String], &Samples);
+  NSDictionary* result = Summarise ("seq-read", &Samples, Now () - uStart);
+  SamplesFree (&Samples);
+  return result;
+  }
+
+static NSDictionary *	Random4K (NSString * a_poPath, uint64_t a_cbFile, unsigned long a_cOps)
+	{
+  SAMPLES		Samples;
+  char			aBuffer [WORKLOAD_RANDOM_SIZE];
+  uint64_t	cBlocks = a_cbFile / WORKLOAD_RANDOM_SIZE;
+  uint64_t	uStart;
+  int				fd;
+
+  memset (aBuffer, 'r', sizeof (aBuffer));
+  SamplesInit (&Samples, a_cOps);
+  srandom (1);															/* Same offsets on every run */
+  uStart = Now ();
+  fd = open ([a_poPath UTF8String], O_RDWR);
+  if (fd < 0 || cBlocks == 0)
+    SamplesFail (&Samples);
+  else
+    {
+    for (unsigned long i = 0; i < a_cOps; i++)
+      {
+      fuse_off_t	offset = (fuse_off_t) (random () % cBlocks) * WORKLOAD_RANDOM_SIZE;
+      uint64_t		uOpStart = Now ();
+      ssize_t			cb = (i & 1) ? pwrite (fd, aBuffer, sizeof (aBuffer), offset) : pread (fd, aBuffer, sizeof (aBuffer), offset);
+      SamplesAdd (&Samples, Now () - uOpStart);
+      if (cb < 0)
+        SamplesFail (&Samples);
+      else
+        Samples.m_cBytes += cb;
+      }
+    }
+  if (fd >= 0)
+    close (fd);
+  NSDictionary* result = Summarise ("random-4k", &Samples, Now () - uStart);
+  SamplesFree (&Samples);
+  return result;
+  }
+
+static void	BuildTree (const char * a_pszDir, unsigned int a_uDepth, unsigned int a_uFanout)
+	{
+  char	szPath [PATH_MAX];
+
+  for (unsigned int i = 0; i < a_uFanout; i++)
+    {
+    snprintf (szPath, sizeof (szPath), "%s/file%u", a_pszDir, i);
+    int fd = open (szPath, O_CREAT | O_WRONLY, 0644);
+    if (fd >= 0)
+      close (fd);
+    if (a_uDepth > 0)
+      {
+      snprintf (szPath, sizeof (szPath), "%s/dir%u", a_pszDir, i);
+      mkdir (szPath, 0755);
+      BuildTree (szPath, a_uDepth - 1, a_uFanout);
+      }
+    }
+  }
+
+/* Each sample is one readdir(3) or lstat(2) */
+static void	WalkTree (const char * a_pszDir, SAMPLES * a_pSamples)
+	{
+  DIR *	pDir = opendir (a_pszDir);
+
+  if (pDir == NULL)
+    {
+    SamplesFail (a_pSamples);
+    return;
+    }
+  for (;;)
+    {
+    uint64_t				uOpStart = Now ();
+    struct dirent *	pEntry = readdir (pDir);
+    SamplesAdd (a_pSamples, Now () - uOpStart);
+    if (pEntry == NULL)
+      break;
+    if (strcmp (pEntry->d_name, ".") == 0 || strcmp (pEntry->d_name, "..") == 0)
+      continue;
+
+    char				szPath [PATH_MAX];
+    struct stat	st;
+    snprintf (szPath, sizeof (szPath), "%s/%s", a_pszDir, pEntry->d_name);
+    uOpStart = Now ();
+    int iRet = lstat (szPath, &st);
+    SamplesAdd (a_pSamples, Now () - uOpStart);
+    if (iRet != 0)
+      SamplesFail (a_pSamples);
+    else if (S_ISDIR (st.st_mode))
+      WalkTree (szPath, a_pSamples);
+    }
+  closedir (pDir);
+  }
+
+static NSDictionary *	TreeWalk (NSString * a_poRoot, unsigned int a_uDepth, unsigned int a_uFanout)
+	{
+  SAMPLES			Samples;
+  NSString *	poDir = [a_poRoot stringByAppendingPathComponent:@"tree-walk"];
+  uint64_t		uStart;
+
+  mkdir ([poDir UTF8String], 0755);
+  BuildTree ([poDir UTF8String], a_uDepth, a_uFanout);
+  SamplesInit (&Samples, 1024);
+  uStart = Now ();
+  WalkTree ([poDir UTF8String], &Samples);
+  NSDictionary* result = Summarise ("tree-walk", &Samples, Now () - uStart);
+  SamplesFree (&Samples);
+  return result;
+  }
+
+static void *	ReaderThread (void * a_pvArgs)
+	{
+  READERARGS *	pArgs = a_pvArgs;
+
+  ReadWholeFile (pArgs->m_pszPath, &pArgs->m_Samples);
+  return NULL;
+  }
+
+static NSDictionary *	ParallelRead (NSString * a_poPath, uint64_t a_cbFile, unsigned int a_cThreads)
+	{
+  SAMPLES				Samples;
+  READERARGS *	paArgs = calloc (a_cThreads, sizeof (READERARGS));
+  pthread_t *		paThreads = calloc (a_cThreads, sizeof (pthread_t));
+  uint64_t			uStart;
+
+  SamplesInit (&Samples, a_cThreads * (a_cbFile / WORKLOAD_CHUNK_SIZE + 2));
+  uStart = Now ();
+  for (unsigned int i = 0; i < a_cThreads; i++)
+    {
+    paArgs [i].m_pszPath = [a_poPath UTF8String];
+    paArgs [i].m_cbFile = a_cbFile;
+    SamplesInit (&paArgs [i].m_Samples, a_cbFile / WORKLOAD_CHUNK_SIZE + 2);
+    if (pthread_create (&paThreads [i], NULL, ReaderThread, &paArgs [i]) != 0)
+      {
+      paArgs [i].m_Samples.m_iErrno = EAGAIN;
+      paThreads [i] = 0;
+      }
+    }
+  for (unsigned int i = 0; i < a_cThreads; i++)
+    {
+    if (paThreads [i] != 0)
+      pthread_join (paThreads [i], NULL);
+    SamplesMerge (&Samples, &paArgs [i].m_Samples);
+    SamplesFree (&paArgs [i].m_Samples);
+    }
+  NSDictionary* result = Summarise ("parallel-read", &Samples, Now () - uStart);
+  SamplesFree (&Samples);
+  free (paThreads);
+  free (paArgs);
+  return result;
+  }
+
+#pragma mark Mounting
+
+/* The mount has appeared once the mountpoint is on a different device from its parent */
+static BOOL	IsMounted (NSString * a_poPath)
+	{
+  struct stat	stMount;
+  struct stat	stParent;
+
+  if (stat ([a_poPath UTF8String], &stMount) != 0 ||
+      stat ([[a_poPath stringByDeletingLastPathComponent] UTF8String], &stParent) != 0)
+    return NO;
+  return stMount.st_dev != stParent.st_dev;
+  }
+
+static BOOL	WaitForMount (NSString * a_poPath, BOOL a_bMounted)
+	{
+  for (int i = 0; i < WORKLOAD_MOUNT_TRIES; i++)
+    {
+    if (IsMounted (a_poPath) == a_bMounted)
+      return YES;
+    usleep (100000);
+    }
+  return NO;
+  }
+
+static void	UnmountFileSystem (GMUserFileSystem * a_poFS, NSString * a_poPath)
+	{
+  [a_poFS unmount];
+  if (WaitForMount (a_poPath, NO))
+    return;
+#if defined (__linux__)
+  /* -[GMUserFileSystem unmount] only acts once the mount has been reported, which doesn't happen
+  		on every platform, so fall back to fusermount(1)
+  */
+  NSTask* task = [NSTask launchedTaskWithLaunchPath:@"/bin/fusermount"
+                                          arguments:[NSArray arrayWithObjects:@"-u", a_poPath, nil]];
+  [task waitUntilExit];
+  WaitForMount (a_poPath, NO);
+#endif	/* defined (__linux__) */
+  }
+
+int	main (int argc, const char * argv [])
+	{
+  (void) argc;													/* Avoid unused argument compiler warning */
+  (void) argv;
+
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  NSUserDefaults* args = [NSUserDefaults standardUserDefaults];
+  NSString* mountPoint = [args stringForKey:@"mountpoint"];
+  NSString* target = [args stringForKey:@"target"];
+  NSString* mountOptions = [args stringForKey:@"options"];
+  NSString* workloadList = [args stringForKey:@"workloads"];
+  NSInteger files = [args integerForKey:@"files"];
+  NSInteger smallSize = [args integerForKey:@"smallsize"];
+  NSInteger largeSize = [args integerForKey:@"largesize"];
+  NSInteger randomOps = [args integerForKey:@"randomops"];
+  NSInteger depth = [args integerForKey:@"depth"];
+  NSInteger fanout = [args integerForKey:@"fanout"];
+  NSInteger threads = [args integerForKey:@"threads"];
+  BOOL json = [args boolForKey:@"json"];
+  GMUserFileSystem* fs = nil;
+  GMMemoryFileSystem* memory = nil;
+  int iRet = 0;
+
+  if (files <= 0) files = 10000;
+  if (smallSize <= 0) smallSize = 4096;
+  if (largeSize <= 0) largeSize = 256 * 1024 * 1024;
+  if (randomOps <= 0) randomOps = 20000;
+  if (depth <= 0) depth = 3;
+  if (fanout <= 0) fanout = 8;
+  if (threads <= 0) threads = 4;
+  if (workloadList == nil) {
+    workloadList = @"create-storm,seq-write,seq-read,random-4k,tree-walk,parallel-read";
+  }
+
+  if ((mountPoint == nil) == (target == nil)) {
+    fprintf(stderr, "GMWorkload: Specify exactly one of -mountpoint or -target\n");
+    [pool release];
+    return 2;
+  }
+
+  if (mountPoint != nil) {
+    NSArray* options = (mountOptions != nil) ? [mountOptions componentsSeparatedByString:@","] : [NSArray array];
+    memory = [[GMMemoryFileSystem alloc] init];
+    fs = [[GMUserFileSystem alloc] initWithDelegate:memory isThreadSafe:YES];
+    [fs mountAtPath:mountPoint withOptions:options shouldForeground:YES detachNewThread:YES];
+    if (!WaitForMount(mountPoint, YES)) {
+      fprintf(stderr, "GMWorkload: %s did not mount\n", [mountPoint UTF8String]);
+      [fs release];
+      [memory release];
+      [pool release];
+      return 1;
+    }
+    target = mountPoint;
+  }
+
+  NSString* largeFile = [target stringByAppendingPathComponent:@"large"];
+  NSArray* workloads = [workloadList componentsSeparatedByString:@","];
+  NSMutableArray* results = [NSMutableArray array];
+  BOOL haveLargeFile = NO;
+  for (NSString* workload in workloads) {
+    NSAutoreleasePool* innerPool = [[NSAutoreleasePool alloc] init];
+    NSDictionary* result = nil;
+
+    // The read patterns need the large file, so write it first if seq-write wasn't asked for.
+    if (!haveLargeFile && ([workload isEqualToString:@"seq-read"] ||
+                           [workload isEqualToString:@"random-4k"] ||
+                           [workload isEqualToString:@"parallel-read"])) {
+      SequentialWrite(largeFile, largeSize);
+      haveLargeFile = YES;
+    }
+
+    if ([workload isEqualToString:@"create-storm"]) {
+      result = CreateStorm(target, files, smallSize);
+    } else if ([workload isEqualToString:@"seq-write"]) {
+      result = SequentialWrite(largeFile, largeSize);
+      haveLargeFile = YES;
+    } else if ([workload isEqualToString:@"seq-read"]) {
+      result = SequentialRead(largeFile, largeSize);
+    } else if ([workload isEqualToString:@"random-4k"]) {
+      result = Random4K(largeFile, largeSize, randomOps);
+    } else if ([workload isEqualToString:@"tree-walk"]) {
+      result = TreeWalk(target, depth, fanout);
+    } else if ([workload isEqualToString:@"parallel-read"]) {
+      result = ParallelRead(largeFile, largeSize, threads);
+    } else {
+      fprintf(stderr, "GMWorkload: Unknown workload %s\n", [workload UTF8String]);
+      iRet = 2;
+    }
+    if (result != nil) {
+      if ([result objectForKey:@"error"] != nil) {
+        iRet = 1;
+      }
+      [results addObject:result];
+    }
+    [innerPool release];
+  }
+
+  if (json) {
+    NSDictionary* root =
+      [NSDictionary dictionaryWithObjectsAndKeys:
+       results, @"results",
+       target, @"target",
+       (mountOptions != nil) ? mountOptions : @"", @"options",
+       nil];
+    NSData* data = [NSJSONSerialization dataWithJSONObject:root
+                                                   options:NSJSONWritingPrettyPrinted
+                                                     error:NULL];
+    fwrite([data bytes], 1, [data length], stdout);
+    fputc('\n', stdout);
+  } else {
+    printf("%-14s %10s %12s %10s %10s %10s %10s  %s\n",
+           "workload", "ops", "ops/s", "MB/s", "p50 us", "p99 us", "p999 us", "");
+    for (NSDictionary* result in results) {
+      NSString* error = [result objectForKey:@"error"];
+      printf("%-14s %10lu %12.0f %10.1f %10.1f %10.1f %10.1f  %s\n",
+             [[result objectForKey:@"name"] UTF8String],
+             [[result objectForKey:@"ops"] unsignedLongValue],
+             [[result objectForKey:@"ops_per_second"] doubleValue],
+             [[result objectForKey:@"mb_per_second"] doubleValue],
+             [[result objectForKey:@"p50_us"] doubleValue],
+             [[result objectForKey:@"p99_us"] doubleValue],
+             [[result objectForKey:@"p999_us"] doubleValue],
+             error ? [error UTF8String] : "");
+    }
+  }
+
+  if (fs != nil) {
+    UnmountFileSystem(fs, mountPoint);
+    [fs release];
+    [memory release];
+  }
+  [pool release];
+  return iRet;
+  }
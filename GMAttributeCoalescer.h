@@ -0,0 +1,57 @@
+//
+//  GMAttributeCoalescer.h
+//  OSXFUSE
+//
+
+//  Private interface to the coalescing of attribute changes. This header is
+//  not installed with the framework.
+//
+//  On Linux and FreeBSD chmod, chown, utimens and truncate each arrive as a
+//  separate FUSE operation. When coalescing, changes to an item made by path
+//  are held and merged, and passed to the delegate in one
+//  setAttributes:ofItemAtPath:userData:error: call when another operation
+//  reaches the item, or once the delay has passed. Until then getattr reports
+//  the held changes over the delegate's attributes.
+
+#import "GMAvailability.h"						/* Always include this first */
+
+#import <Foundation/Foundation.h>
+
+@class GMUserFileSystem;
+
+@interface GMAttributeCoalescer : NSObject {
+ @private
+  NSCondition* condition_;
+  NSMutableDictionary* pending_;    // Path to GMPendingAttributes.
+  NSMutableSet* flushing_;          // Paths being passed to the delegate.
+  volatile NSUInteger pendingCount_; // Read without the lock as a hint.
+  NSTimeInterval delay_;
+  BOOL isStopping_;
+  GMUserFileSystem* fs_;            // Not retained. Stopped before it goes.
+}
+
+- (id)initWithFileSystem:(GMUserFileSystem *)fs delay:(NSTimeInterval)delay;
+
+// Starts the thread that passes on changes that have waited for the delay.
+- (void)start;
+
+// Passes on all held changes and stops the thread.
+- (void)stop;
+
+// Holds attributes for the item at path, merged over any already held.
+- (void)addAttributes:(NSDictionary *)attributes forPath:(NSString *)path;
+
+// The changes held for path, or nil.
+- (NSDictionary *)attributesForPath:(NSString *)path;
+
+// Passes on the changes held for path and, with descendants, for the items
+// below it. A nil path passes on everything. Returns NO and sets error if the
+// delegate failed.
+- (BOOL)flushPath:(NSString *)path
+      descendants:(BOOL)descendants
+            error:(NSError **)error;
+
+// YES if no changes might be held. Cheap enough to call on every operation.
+- (BOOL)isEmpty;
+
+@end
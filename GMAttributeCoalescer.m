@@ -0,0 +1,232 @@
+//
+//  GMAttributeCoalescer.m
+//  OSXFUSE
+//
+
+//  Coalescing of attribute changes. See GMAttributeCoalescer.h
+
+#import "GMAvailability.h"						/* Always include this first */
+#import "GMAttributeCoalescer.h"
+#import "GMUserFileSystem.h"
+
+// Changes held for one item.
+@interface GMPendingAttributes : NSObject {
+ @public
+  NSMutableDictionary* attributes_;
+  NSTimeInterval deadline_;         // Since the reference date.
+}
+@end
+
+@implementation GMPendingAttributes
+
+- (id)init {
+  self = [super init];
+  if (self) {
+    attributes_ = [[NSMutableDictionary alloc] init];
+  }
+  return self;
+}
+
+- (void)dealloc {
+  [attributes_ release];
+  [super dealloc];
+}
+
+@end
+
+// YES if a_poszCandidate is a_poszPath or, with a_bDescendants, below it. A nil a_poszPath matches
+// everything
+static BOOL	PathMatches (NSString * a_poszCandidate, NSString * a_poszPath, BOOL a_bDescendants)
+	{
+  if ((a_poszPath == nil) || [a_poszCandidate isEqualToString: a_poszPath])
+    return YES;
+  if (!a_bDescendants)
+    return NO;
+  if ([a_poszPath isEqualToString: @"/"])
+    return YES;
+  return [a_poszCandidate hasPrefix: a_poszPath] && ([a_poszCandidate length] > [a_poszPath length]) &&
+         ([a_poszCandidate characterAtIndex: [a_poszPath length]] == '/');
+  }
+
+@implementation GMAttributeCoalescer
+
+- (id)init {
+  [self release];
+  return nil;
+}
+
+- (id)initWithFileSystem:(GMUserFileSystem *)fs delay:(NSTimeInterval)delay {
+  self = [super init];
+  if (self) {
+    condition_ = [[NSCondition alloc] init];
+    pending_ = [[NSMutableDictionary alloc] init];
+    flushing_ = [[NSMutableSet alloc] init];
+    delay_ = delay;
+    fs_ = fs;
+  }
+  return self;
+}
+
+- (void)dealloc {
+  [condition_ release];
+  [pending_ release];
+  [flushing_ release];
+  [super dealloc];
+}
+
+- (BOOL)isEmpty {
+  return pendingCount_ == 0;
+}
+
+- (void)addAttributes:(NSDictionary *)attributes forPath:(NSString *)path {
+  [condition_ lock];
+  GMPendingAttributes* pending = [pending_ objectForKey:path];
+  if (pending == nil) {
+    pending = [[GMPendingAttributes alloc] init];
+    pending->deadline_ = [NSDate timeIntervalSinceReferenceDate] + delay_;
+    [pending_ setObject:pending forKey:path];
+    [pending release];
+    pendingCount_ = [pending_ count];
+    [condition_ broadcast];  // The thread may be waiting with nothing to do.
+  }
+  [pending->attributes_ addEntriesFromDictionary:attributes];
+  [condition_ unlock];
+}
+
+- (NSDictionary *)attributesForPath:(NSString *)path {
+  if (pendingCount_ == 0 || path == nil) {
+    return nil;
+  }
+  [condition_ lock];
+  GMPendingAttributes* pending = [pending_ objectForKey:path];
+  NSDictionary* attributes = pending ? [[pending->attributes_ copy] autorelease] : nil;
+  [condition_ unlock];
+  return attributes;
+}
+
+- (BOOL)flushPath:(NSString *)path
+      descendants:(BOOL)descendants
+            error:(NSError **)error {
+  if (pendingCount_ == 0) {
+    return YES;
+  }
+
+  // Changes to an item reach the delegate in order, so wait for any earlier
+  // flush of the same items to finish.
+  [condition_ lock];
+  BOOL isBusy = YES;
+  while (isBusy) {
+    isBusy = NO;
+    NSArray* flushing = [flushing_ allObjects];
+    for (NSUInteger i = 0, count = [flushing count]; i < count && !isBusy; ++i) {
+      isBusy = PathMatches([flushing objectAtIndex:i], path, descendants);
+    }
+    if (isBusy) {
+      [condition_ wait];
+    }
+  }
+  NSMutableArray* paths = [NSMutableArray array];
+  NSMutableArray* batch = [NSMutableArray array];
+  NSArray* candidates = [pending_ allKeys];
+  for (NSUInteger i = 0, count = [candidates count]; i < count; ++i) {
+    NSString* candidate = [candidates objectAtIndex:i];
+    if (PathMatches(candidate, path, descendants)) {
+      [paths addObject:candidate];
+      [batch addObject:[pending_ objectForKey:candidate]];
+    }
+  }
+  [pending_ removeObjectsForKeys:paths];
+  [flushing_ addObjectsFromArray:paths];
+  pendingCount_ = [pending_ count];
+  [condition_ unlock];
+
+  BOOL ret = YES;
+  for (NSUInteger i = 0, count = [paths count]; i < count; ++i) {
+    NSString* candidate = [paths objectAtIndex:i];
+    GMPendingAttributes* pending = [batch objectAtIndex:i];
+    NSError* flushError = nil;
+    BOOL ok = NO;
+    @try {
+      ok = [fs_ setAttributes:pending->attributes_
+                 ofItemAtPath:candidate
+                     userData:nil
+                        error:&flushError];
+    }
+    @catch (id exception) {
+      ok = NO;
+    }
+    if (!ok) {
+      NSLog (@"fuse: ERROR: Failed to set coalesced attributes %@ of '%@'. %@ IN %@",
+             pending->attributes_, candidate, flushError, fs_);
+      if (ret && error) {
+        *error = flushError;
+      }
+      ret = NO;
+    }
+  }
+
+  [condition_ lock];
+  for (NSUInteger i = 0, count = [paths count]; i < count; ++i) {
+    [flushing_ removeObject:[paths objectAtIndex:i]];
+  }
+  [condition_ broadcast];
+  [condition_ unlock];
+  return ret;
+}
+
+// Passes on changes once they have waited for the delay.
+- (void)run:(id)unused {
+  (void) unused;											/* Avoid unused argument compiler warning */
+
+  [condition_ lock];
+  while (!isStopping_) {
+    // The thread lives as long as the mount, so each pass drains its own pool.
+    NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+    NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+    NSTimeInterval earliest = 0;
+    NSMutableArray* expired = [NSMutableArray array];
+    NSArray* paths = [pending_ allKeys];
+    for (NSUInteger i = 0, count = [paths count]; i < count; ++i) {
+      NSString* path = [paths objectAtIndex:i];
+      GMPendingAttributes* pending = [pending_ objectForKey:path];
+      if (pending->deadline_ <= now) {
+        [expired addObject:path];
+      } else if (earliest == 0 || pending->deadline_ < earliest) {
+        earliest = pending->deadline_;
+      }
+    }
+    if ([expired count] == 0) {
+      if (earliest == 0) {
+        [condition_ wait];
+      } else {
+        [condition_ waitUntilDate:[NSDate dateWithTimeIntervalSinceReferenceDate:earliest]];
+      }
+    } else {
+      [condition_ unlock];
+      for (NSUInteger i = 0, count = [expired count]; i < count; ++i) {
+        NSAutoreleasePool* innerPool = [[NSAutoreleasePool alloc] init];
+        [self flushPath:[expired objectAtIndex:i] descendants:NO error:NULL];
+        [innerPool release];
+      }
+      [condition_ lock];
+    }
+    [pool release];
+  }
+  [condition_ unlock];
+}
+
+- (void)start {
+  [NSThread detachNewThreadSelector:@selector(run:)
+                           toTarget:self
+                         withObject:nil];
+}
+
+- (void)stop {
+  [condition_ lock];
+  isStopping_ = YES;
+  [condition_ broadcast];
+  [condition_ unlock];
+  [self flushPath:nil descendants:YES error:NULL];
+}
+
+@end
@@ -0,0 +1,150 @@
+//
+//  GMDispatchSession.h
+//  OSXFUSE
+//
+
+//  Private interface to one file system's kernel connection when it is served
+//  by a GMSessionDispatcher. This header is not installed with the framework.
+//
+//  A session mounts the file system with fuse_mount() and fuse_new() instead
+//  of fuse_main(), with either libfuse 2 or libfuse 3. See GMFuse.h. The
+//  dispatcher's poll thread reads its requests and queues them on the
+//  session; worker threads hand them to libfuse, which calls the fusefm_*
+//  callbacks with the file system as the context's private_data. The fields
+//  marked below belong to the dispatcher and are only touched with its lock
+//  held.
+
+#import "GMAvailability.h"						/* Always include this first */
+
+#import <Foundation/Foundation.h>
+
+#include <stdint.h>
+
+#import "GMSessionDispatcher.h"
+#import "GMUserFileSystem.h"
+
+struct fuse;
+struct fuse_chan;
+struct fuse_operations;
+
+// The opcodes that choose a request's class or exempt it from admission
+// control, from the kernel's fuse_kernel.h, which libfuse 2 doesn't install.
+enum
+	{
+  GMDispatchOpcodeLookup					= 1,
+  GMDispatchOpcodeForget					= 2,
+  GMDispatchOpcodeGetattr					= 3,
+  GMDispatchOpcodeRead						= 15,
+  GMDispatchOpcodeWrite						= 16,
+  GMDispatchOpcodeOpendir					= 27,
+  GMDispatchOpcodeReaddir					= 28,
+  GMDispatchOpcodeInit						= 26,
+  GMDispatchOpcodeReleasedir			= 29,
+  GMDispatchOpcodeAccess					= 34,
+  GMDispatchOpcodeInterrupt				= 36,
+  GMDispatchOpcodeDestroy					= 38,
+  GMDispatchOpcodeBatchForget			= 42,
+  GMDispatchOpcodeFallocate				= 43,
+  GMDispatchOpcodeReaddirplus			= 44,
+  GMDispatchOpcodeCopyFileRange		= 47,
+	};
+
+// The header at the start of every request, as in fuse_kernel.h.
+typedef struct GMDispatchInHeader
+	{
+  uint32_t	m_cbLength;
+  uint32_t	m_uOpcode;
+  uint64_t	m_uUnique;
+  uint64_t	m_uNodeID;
+  uint32_t	m_uUID;
+  uint32_t	m_uGID;
+  uint32_t	m_uPID;
+  uint32_t	m_uPadding;
+	} GMDispatchInHeader;
+
+// One request read from the kernel, waiting for a worker.
+typedef struct GMDispatchRequest
+	{
+  struct GMDispatchRequest *	m_pNext;
+  GMDispatchClass							m_Class;
+  uid_t												m_UID;
+  pid_t												m_PID;
+  BOOL												m_bAlwaysAdmit;		/* Not subject to the caller's limits */
+  id													m_poUserAccount;		/* Set by the dispatcher. Not retained */
+  id													m_poProcessAccount;
+  uint64_t										m_uReceived;			/* Monotonic nanoseconds */
+  size_t											m_cbLength;
+  char												m_acBuffer [];
+	} GMDispatchRequest;
+
+@interface GMDispatchSession : NSObject {
+ @public
+  // Owned by the dispatcher.
+  GMDispatchRequest* head_[GMDispatchClassCount];  // Queued requests, oldest first.
+  GMDispatchRequest* tail_[GMDispatchClassCount];
+  NSUInteger queuedCount_;          // In all classes.
+  NSUInteger inFlightCount_;        // Requests being served by workers.
+  NSUInteger maxInFlightCount_;     // 1 unless the delegate is thread safe.
+  BOOL isReady_[GMDispatchClassCount];  // In the dispatcher's ready queue for the class.
+  BOOL isFinishing_;                // In the dispatcher's queue of sessions to unmount.
+  BOOL isPolled_;                   // The poll thread is using fd_.
+  BOOL isExited_;                   // The kernel connection has gone.
+ @private
+  GMUserFileSystem* fs_;            // Retained until the session ends.
+  struct fuse* fuse_;
+  struct fuse_chan* chan_;          // NULL with libfuse 3, which has no channels.
+  char* mountPoint_;
+  int fd_;
+  size_t bufferSize_;
+}
+
+// Mounts fs with the command line that fuse_main() would have been given.
+// Returns nil if the mount fails.
+- (id)initWithFileSystem:(GMUserFileSystem *)fs
+                    argc:(int)argc
+                    argv:(char **)argv
+              operations:(const struct fuse_operations *)operations
+            isThreadSafe:(BOOL)isThreadSafe;
+
+- (int)fileDescriptor;
+- (size_t)bufferSize;
+
+// Reads one request into buffer, which holds bufferSize bytes. Returns a
+// queueable copy, or NULL if there was nothing to read. Sets *isExited when
+// the kernel connection has gone.
+- (GMDispatchRequest *)receiveRequestWithBuffer:(char *)buffer
+                                       isExited:(BOOL *)isExited;
+
+// Queues request at the back of its class. Called with the dispatcher's lock
+// held.
+- (void)enqueueRequest:(GMDispatchRequest *)request;
+
+// Removes the oldest request of a class, or returns NULL if there is none.
+// Called with the dispatcher's lock held.
+- (GMDispatchRequest *)dequeueRequestOfClass:(GMDispatchClass)dispatchClass;
+
+// Removes a queued request. Called with the dispatcher's lock held.
+- (void)removeRequest:(GMDispatchRequest *)request;
+
+// Serves request and frees it. Returns YES if libfuse has been told to exit.
+- (BOOL)processRequest:(GMDispatchRequest *)request;
+
+// Frees request without serving it.
++ (void)discardRequest:(GMDispatchRequest *)request;
+
+// Unmounts and destroys the connection and tells the file system it has
+// ended. Called once, when no request is queued or in flight.
+- (void)finish;
+
+@end
+
+@interface GMSessionDispatcher (GMDispatchSession)
+// Starts serving a mounted session.
+- (void)addSession:(GMDispatchSession *)session;
+@end
+
+@interface GMUserFileSystem (GMDispatchSession)
+// Called when the file system's loop has ended, with the result fuse_main()
+// would have returned.
+- (void)sessionDidEndWithResult:(int)ret;
+@end
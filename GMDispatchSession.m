@@ -0,0 +1,324 @@
+//
+//  GMDispatchSession.m
+//  OSXFUSE
+//
+
+//  One file system's kernel connection when served by a GMSessionDispatcher.
+//  See GMDispatchSession.h
+
+#import "GMAvailability.h"						/* Always include this first */
+#import "GMDispatchSession.h"
+
+#import "GMFuse.h"											/* Selects the libfuse API */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if GM_FUSE3
+/* libfuse 3 has no channels and doesn't say how large a request can be, so the session reads the device
+		itself into a buffer of libfuse's own size: FUSE_MAX_MAX_PAGES pages and FUSE_BUFFER_HEADER_SIZE.
+    libfuse limits max_write to fit
+*/
+static size_t	RequestBufferSize (void)
+	{
+  return 256 * (size_t) getpagesize () + 0x1000;
+  }
+#endif	/* GM_FUSE3 */
+
+static GMDispatchClass	ClassOfOpcode (uint32_t a_uOpcode)
+	{
+  switch (a_uOpcode)
+  	{
+    case GMDispatchOpcodeLookup:
+    case GMDispatchOpcodeGetattr:
+    case GMDispatchOpcodeAccess:
+    case GMDispatchOpcodeOpendir:
+    case GMDispatchOpcodeReaddir:
+    case GMDispatchOpcodeReaddirplus:
+    case GMDispatchOpcodeReleasedir:
+    	return GMDispatchClassInteractive;
+    case GMDispatchOpcodeRead:
+    case GMDispatchOpcodeWrite:
+    case GMDispatchOpcodeFallocate:
+    case GMDispatchOpcodeCopyFileRange:
+    	return GMDispatchClassBulk;
+    default:
+    	return GMDispatchClassDefault;
+    }
+  }
+
+// Requests that no caller limit may hold back: those that release kernel
+// state, end the session or interrupt a request that is already running.
+static BOOL	IsAlwaysAdmitted (uint32_t a_uOpcode, uint32_t a_uPID)
+	{
+  switch (a_uOpcode)
+  	{
+    case GMDispatchOpcodeForget:
+    case GMDispatchOpcodeBatchForget:
+    case GMDispatchOpcodeInit:
+    case GMDispatchOpcodeInterrupt:
+    case GMDispatchOpcodeDestroy:
+    	return YES;
+    default:
+    	return a_uPID == 0;						/* Sent by the kernel itself */
+    }
+  }
+
+static uint64_t	Now (void)
+	{
+  struct timespec	ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+  }
+
+@implementation GMDispatchSession
+
+- (id)init {
+  [self release];
+  return nil;
+}
+
+- (id)initWithFileSystem:(GMUserFileSystem *)fs
+                    argc:(int)argc
+                    argv:(char **)argv
+              operations:(const struct fuse_operations *)operations
+            isThreadSafe:(BOOL)isThreadSafe {
+  self = [super init];
+  if (self) {
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    int multithreaded = 0;
+
+    fd_ = -1;
+#if GM_FUSE3
+    struct fuse_cmdline_opts opts;
+    memset(&opts, 0, sizeof(opts));
+    if (fuse_parse_cmdline(&args, &opts) != 0 || opts.mountpoint == NULL) {
+      NSLog (@"fuse: ERROR: Could not parse the mount arguments IN %@", fs);
+      free(opts.mountpoint);
+      fuse_opt_free_args(&args);
+      [self release];
+      return nil;
+    }
+    mountPoint_ = opts.mountpoint;
+    multithreaded = !opts.singlethread;
+    fuse_ = fuse_new(&args, operations, sizeof(*operations), fs);
+    fuse_opt_free_args(&args);
+    if (fuse_ == NULL) {
+      NSLog (@"fuse: ERROR: fuse_new() FAILED for mountpoint '%s' IN %@", mountPoint_, fs);
+      [self release];
+      return nil;
+    }
+    if (fuse_mount(fuse_, mountPoint_) != 0) {
+      NSLog (@"fuse: ERROR: fuse_mount() FAILED for mountpoint '%s' IN %@", mountPoint_, fs);
+      fuse_destroy(fuse_);
+      fuse_ = NULL;
+      [self release];
+      return nil;
+    }
+    fd_ = fuse_session_fd(fuse_get_session(fuse_));
+    bufferSize_ = RequestBufferSize();
+#else
+    int foreground = 0;
+    if (fuse_parse_cmdline(&args, &mountPoint_, &multithreaded, &foreground) != 0 ||
+        mountPoint_ == NULL) {
+      NSLog (@"fuse: ERROR: Could not parse the mount arguments IN %@", fs);
+      fuse_opt_free_args(&args);
+      [self release];
+      return nil;
+    }
+    chan_ = fuse_mount(mountPoint_, &args);
+    if (chan_ == NULL) {
+      NSLog (@"fuse: ERROR: fuse_mount() FAILED for mountpoint '%s' IN %@", mountPoint_, fs);
+      fuse_opt_free_args(&args);
+      [self release];
+      return nil;
+    }
+    fuse_ = fuse_new(chan_, &args, operations, sizeof(*operations), fs);
+    fuse_opt_free_args(&args);
+    if (fuse_ == NULL) {
+      NSLog (@"fuse: ERROR: fuse_new() FAILED for mountpoint '%s' IN %@", mountPoint_, fs);
+      fuse_unmount(mountPoint_, chan_);
+      chan_ = NULL;
+      [self release];
+      return nil;
+    }
+    fd_ = fuse_chan_fd(chan_);
+    bufferSize_ = fuse_chan_bufsize(chan_);
+#endif	/* GM_FUSE3 */
+    maxInFlightCount_ = (isThreadSafe && multithreaded) ? NSUIntegerMax : 1;
+    fs_ = [fs retain];
+  }
+  return self;
+}
+
+- (void)dealloc {
+  for (int i = 0; i < GMDispatchClassCount; ++i) {
+    while (head_[i] != NULL) {
+      GMDispatchRequest* request = head_[i];
+      head_[i] = request->m_pNext;
+      [GMDispatchSession discardRequest:request];
+    }
+  }
+  free(mountPoint_);
+  [fs_ release];
+  [super dealloc];
+}
+
+- (NSString *)description {
+  return [NSString stringWithFormat:@"%@ mountpoint='%s', fd=%d, queued=%lu, in_flight=%lu",
+          [super description], mountPoint_, fd_, (unsigned long)queuedCount_,
+          (unsigned long)inFlightCount_];
+}
+
+- (int)fileDescriptor { return fd_; }
+- (size_t)bufferSize { return bufferSize_; }
+
+- (GMDispatchRequest *)receiveRequestWithBuffer:(char *)buffer
+                                       isExited:(BOOL *)isExited {
+  struct fuse_session* se = fuse_get_session(fuse_);
+#if GM_FUSE3
+  // As fuse_chan_recv() does with libfuse 2.
+  int res = (int)read(fd_, buffer, bufferSize_);
+  if (res < 0) {
+    res = (errno == ENODEV) ? 0 : -errno;
+  }
+#else
+  struct fuse_chan* chan = chan_;
+  int res = fuse_chan_recv(&chan, buffer, bufferSize_);
+#endif	/* GM_FUSE3 */
+
+  // fuse_chan_recv() returns 0 once the file system has been unmounted.
+  if (res == -EINTR || res == -EAGAIN || res == -ENOENT) {
+    *isExited = fuse_session_exited(se);
+    return NULL;
+  }
+  if (res <= 0) {
+    if (res < 0) {
+      NSLog (@"fuse: ERROR: Reading a request FAILED. errno %i, %s IN %@", -res, strerror (-res), self);
+    }
+    *isExited = YES;
+    return NULL;
+  }
+  *isExited = NO;
+
+  GMDispatchRequest* request = malloc(sizeof(GMDispatchRequest) + res);
+  if (request == NULL) {
+    // The kernel will wait for a reply that never comes, so stop the session
+    // rather than hang the caller.
+    NSLog (@"fuse: ERROR: Out of memory queueing a request IN %@", self);
+    fuse_session_exit(se);
+    *isExited = YES;
+    return NULL;
+  }
+  request->m_pNext = NULL;
+  request->m_Class = GMDispatchClassDefault;
+  request->m_UID = 0;
+  request->m_PID = 0;
+  request->m_bAlwaysAdmit = YES;
+  request->m_poUserAccount = nil;
+  request->m_poProcessAccount = nil;
+  if ((size_t)res >= sizeof(GMDispatchInHeader)) {
+    const GMDispatchInHeader* header = (const GMDispatchInHeader *)buffer;
+    request->m_Class = ClassOfOpcode(header->m_uOpcode);
+    request->m_UID = header->m_uUID;
+    request->m_PID = header->m_uPID;
+    request->m_bAlwaysAdmit = IsAlwaysAdmitted(header->m_uOpcode, header->m_uPID);
+  }
+  request->m_uReceived = Now();
+  request->m_cbLength = res;
+  memcpy(request->m_acBuffer, buffer, res);
+  return request;
+}
+
+- (void)enqueueRequest:(GMDispatchRequest *)request {
+  GMDispatchClass dispatchClass = request->m_Class;
+
+  request->m_pNext = NULL;
+  if (tail_[dispatchClass] != NULL) {
+    tail_[dispatchClass]->m_pNext = request;
+  } else {
+    head_[dispatchClass] = request;
+  }
+  tail_[dispatchClass] = request;
+  ++queuedCount_;
+}
+
+- (GMDispatchRequest *)dequeueRequestOfClass:(GMDispatchClass)dispatchClass {
+  GMDispatchRequest* request = head_[dispatchClass];
+
+  if (request != NULL) {
+    head_[dispatchClass] = request->m_pNext;
+    if (head_[dispatchClass] == NULL) {
+      tail_[dispatchClass] = NULL;
+    }
+    request->m_pNext = NULL;
+    --queuedCount_;
+  }
+  return request;
+}
+
+- (void)removeRequest:(GMDispatchRequest *)request {
+  GMDispatchClass dispatchClass = request->m_Class;
+  GMDispatchRequest* previous = NULL;
+
+  for (GMDispatchRequest* candidate = head_[dispatchClass]; candidate != NULL;
+       candidate = candidate->m_pNext) {
+    if (candidate == request) {
+      if (previous != NULL) {
+        previous->m_pNext = request->m_pNext;
+      } else {
+        head_[dispatchClass] = request->m_pNext;
+      }
+      if (tail_[dispatchClass] == request) {
+        tail_[dispatchClass] = previous;
+      }
+      request->m_pNext = NULL;
+      --queuedCount_;
+      return;
+    }
+    previous = candidate;
+  }
+}
+
+- (BOOL)processRequest:(GMDispatchRequest *)request {
+  struct fuse_session* se = fuse_get_session(fuse_);
+
+#if GM_FUSE3
+  struct fuse_buf buf;
+  memset(&buf, 0, sizeof(buf));
+  buf.size = request->m_cbLength;
+  buf.mem = request->m_acBuffer;
+  buf.fd = -1;
+  fuse_session_process_buf(se, &buf);
+#else
+  fuse_session_process(se, request->m_acBuffer, request->m_cbLength, chan_);
+#endif	/* GM_FUSE3 */
+  [GMDispatchSession discardRequest:request];
+  return fuse_session_exited(se);
+}
+
++ (void)discardRequest:(GMDispatchRequest *)request {
+  free(request);
+}
+
+- (void)finish {
+  NSLog (@"fuse: INFORMATION: Ended session for mountpoint '%s'", mountPoint_);
+
+  // The same teardown as fuse_main(). fuse_destroy() calls fusefm_destroy.
+#if GM_FUSE3
+  fuse_unmount(fuse_);
+#else
+  fuse_unmount(mountPoint_, chan_);
+#endif	/* GM_FUSE3 */
+  chan_ = NULL;
+  fd_ = -1;
+  fuse_destroy(fuse_);
+  fuse_ = NULL;
+  [fs_ sessionDidEndWithResult:0];
+}
+
+@end
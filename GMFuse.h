@@ -0,0 +1,40 @@
+//
+//  GMFuse.h
+//  OSXFUSE
+//
+
+//  Selects the libfuse API that the framework is built against. This header is
+//  not installed with the framework.
+//
+//  The framework uses the libfuse 2.6 API unless GM_FUSE_USE_VERSION says
+//  otherwise. The GNUmakefile defines it when pkg-config finds libfuse 3, which
+//  the framework then uses instead. Where the two APIs differ, test GM_FUSE3;
+//  where a feature arrived in a later libfuse 3 release, test GM_FUSE_AT_LEAST.
+
+/* FUSE_USE_VERSION: Which version of the libFuse API for which platform?
+		https://stackoverflow.com/questions/49739325/what-exactly-is-the-difference-between-fuse2-and-fuse3
+		OSXFUSE 3.8.3 implements the Fuse 2.6 API
+    Ubuntu Linux 20.04 implements the Fuse 2.9 API (Reported by fusermount(1) -V)
+    GhostBSD (FreeBSD 12.2-STABLE) implements the Fuse 2.9 API (Estimated from fuse.h. Needs confirmation)
+    Linux distributions also ship libfuse 3, whose API is selected with a FUSE_USE_VERSION of 30 or more.
+    	It is only used on Linux
+*/
+#if !defined (GM_FUSE_USE_VERSION)
+#define	GM_FUSE_USE_VERSION			26
+#endif	/* !defined (GM_FUSE_USE_VERSION) */
+
+#define	FUSE_USE_VERSION				GM_FUSE_USE_VERSION
+
+#include <fuse.h>
+#if FUSE_USE_VERSION >= 30
+#include <fuse_lowlevel.h>
+#define	GM_FUSE3								1
+#else
+#include <fuse/fuse_lowlevel.h>
+#define	GM_FUSE3								0
+#endif	/* FUSE_USE_VERSION >= 30 */
+
+/* YES if the libfuse headers are at least the given release */
+#define	GM_FUSE_AT_LEAST(a_uMajor, a_uMinor)																				\
+	((FUSE_MAJOR_VERSION > (a_uMajor)) ||																							\
+   ((FUSE_MAJOR_VERSION == (a_uMajor)) && (FUSE_MINOR_VERSION >= (a_uMinor))))
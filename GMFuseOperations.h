@@ -0,0 +1,20 @@
+//
+//  GMFuseOperations.h
+//  OSXFUSE
+//
+
+//  Private interface to the framework's FUSE operations table. This header is
+//  not installed with the framework. It is used by the in-process tools in
+//  Benchmarks/ which call the fusefm_* callbacks directly, without a kernel
+//  mount, so that the cost of the framework itself can be measured in isolation.
+//
+//  The caller is responsible for providing a struct fuse_context for each
+//  calling thread, with private_data set to the GMUserFileSystem being driven.
+//  See Benchmarks/GMHarness.h.
+
+#import "GMAvailability.h"
+
+struct fuse_operations;
+
+/* Returns the operations table that the framework passes to fuse_main() */
+extern const struct fuse_operations *	GMUserFileSystemFuseOperations (void);
@@ -0,0 +1,73 @@
+//
+//  GMHandleCache.h
+//  OSXFUSE
+//
+
+//  Private interface to the recycling of the delegate's open files. This
+//  header is not installed with the framework.
+//
+//  When a file is released, its userData is kept for a short time instead of
+//  being passed to releaseFileAtPath:userData:. An open of the same path with
+//  the same flags in that time is given the kept userData instead of calling
+//  openFileAtPath:mode:userData:error:. A thread releases the files that
+//  aren't reused in time, and the oldest file when too many are kept.
+//
+//  When the delegate's open is the only permission check, a cache that
+//  requires owners only gives a kept file to the caller that opened it: the
+//  file system notes the opener of each file that may be kept, and a file
+//  without one isn't kept.
+
+#import "GMAvailability.h"						/* Always include this first */
+
+#import <Foundation/Foundation.h>
+
+@class GMUserFileSystem;
+
+@interface GMHandleCache : NSObject {
+ @private
+  NSCondition* condition_;
+  NSMutableArray* kept_;            // GMKeptHandles, oldest first.
+  NSMutableArray* closing_;         // GMKeptHandles to release now.
+  NSMutableDictionary* owners_;     // Opener of each open userData, by address.
+  BOOL requiresOwner_;
+  NSUInteger maxCount_;
+  NSTimeInterval timeout_;
+  BOOL isStopping_;
+  BOOL isReleasing_;                // The thread is releasing a batch.
+  GMUserFileSystem* fs_;            // Not retained. Stopped before it goes.
+}
+
+- (id)initWithFileSystem:(GMUserFileSystem *)fs
+                maxCount:(NSUInteger)maxCount
+                 timeout:(NSTimeInterval)timeout
+           requiresOwner:(BOOL)requiresOwner;
+
+// Starts the thread that releases files that weren't reused in time.
+- (void)start;
+
+// Releases every kept file and stops the thread. Returns once no release is
+// in progress on the thread.
+- (void)stop;
+
+// YES if kept files are only reused by the caller that opened them.
+- (BOOL)requiresOwner;
+
+// Notes that owner, a key identifying the caller, opened userData. Only
+// needed when the cache requires owners.
+- (void)noteOwner:(NSString *)owner ofUserData:(id)userData;
+
+// Keeps userData, released with the given open flags, for reuse. Returns NO
+// if it wasn't kept, when the caller must release it.
+- (BOOL)keepUserData:(id)userData forPath:(NSString *)path flags:(int)flags;
+
+// Returns a kept userData for path, flags and, when the cache requires
+// owners, owner, which the cache no longer holds, or nil.
+- (id)takeUserDataForPath:(NSString *)path
+                    flags:(int)flags
+                    owner:(NSString *)owner;
+
+// Releases the files kept for path and, with descendants, for the items
+// below it, from the thread. A nil path releases everything.
+- (void)discardPath:(NSString *)path descendants:(BOOL)descendants;
+
+@end
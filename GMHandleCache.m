@@ -0,0 +1,235 @@
+//
+//  GMHandleCache.m
+//  OSXFUSE
+//
+
+//  Recycling of the delegate's open files. See GMHandleCache.h
+
+#import "GMAvailability.h"						/* Always include this first */
+#import "GMHandleCache.h"
+#import "GMUserFileSystem.h"
+
+// One released file, waiting to be reused.
+@interface GMKeptHandle : NSObject {
+ @public
+  NSString* path_;
+  id userData_;
+  int flags_;
+  NSString* owner_;                 // The caller that opened it, or nil.
+  NSTimeInterval deadline_;         // Since the reference date.
+}
+@end
+
+@implementation GMKeptHandle
+
+- (void)dealloc {
+  [path_ release];
+  [userData_ release];
+  [owner_ release];
+  [super dealloc];
+}
+
+@end
+
+// YES if a_poszCandidate is a_poszPath or, with a_bDescendants, below it. A nil a_poszPath matches
+// everything
+static BOOL	PathMatches (NSString * a_poszCandidate, NSString * a_poszPath, BOOL a_bDescendants)
+	{
+  if ((a_poszPath == nil) || [a_poszCandidate isEqualToString: a_poszPath])
+    return YES;
+  if (!a_bDescendants)
+    return NO;
+  if ([a_poszPath isEqualToString: @"/"])
+    return YES;
+  return [a_poszCandidate hasPrefix: a_poszPath] && ([a_poszCandidate length] > [a_poszPath length]) &&
+         ([a_poszCandidate characterAtIndex: [a_poszPath length]] == '/');
+  }
+
+@implementation GMHandleCache
+
+- (id)init {
+  [self release];
+  return nil;
+}
+
+- (id)initWithFileSystem:(GMUserFileSystem *)fs
+                maxCount:(NSUInteger)maxCount
+                 timeout:(NSTimeInterval)timeout
+           requiresOwner:(BOOL)requiresOwner {
+  self = [super init];
+  if (self) {
+    condition_ = [[NSCondition alloc] init];
+    kept_ = [[NSMutableArray alloc] init];
+    closing_ = [[NSMutableArray alloc] init];
+    owners_ = [[NSMutableDictionary alloc] init];
+    requiresOwner_ = requiresOwner;
+    maxCount_ = maxCount;
+    timeout_ = timeout;
+    fs_ = fs;
+  }
+  return self;
+}
+
+- (void)dealloc {
+  [condition_ release];
+  [kept_ release];
+  [closing_ release];
+  [owners_ release];
+  [super dealloc];
+}
+
+- (BOOL)requiresOwner {
+  return requiresOwner_;
+}
+
+- (void)noteOwner:(NSString *)owner ofUserData:(id)userData {
+  if (!requiresOwner_ || owner == nil || userData == nil) {
+    return;
+  }
+  [condition_ lock];
+  [owners_ setObject:owner forKey:[NSValue valueWithPointer:userData]];
+  [condition_ unlock];
+}
+
+- (BOOL)keepUserData:(id)userData forPath:(NSString *)path flags:(int)flags {
+  if (userData == nil || path == nil || maxCount_ == 0) {
+    return NO;
+  }
+  GMKeptHandle* handle = [[GMKeptHandle alloc] init];
+  handle->path_ = [path copy];
+  handle->userData_ = [userData retain];
+  handle->flags_ = flags;
+  handle->deadline_ = [NSDate timeIntervalSinceReferenceDate] + timeout_;
+
+  [condition_ lock];
+  BOOL isKept = !isStopping_;
+  if (requiresOwner_) {
+    NSValue* key = [NSValue valueWithPointer:userData];
+    handle->owner_ = [[owners_ objectForKey:key] retain];
+    [owners_ removeObjectForKey:key];
+    isKept = isKept && handle->owner_ != nil;
+  }
+  if (isKept) {
+    [kept_ addObject:handle];
+    if ([kept_ count] > maxCount_) {
+      [closing_ addObject:[kept_ objectAtIndex:0]];
+      [kept_ removeObjectAtIndex:0];
+    }
+    [condition_ broadcast];  // The thread may be waiting with nothing to do.
+  }
+  [condition_ unlock];
+  [handle release];
+  return isKept;
+}
+
+- (id)takeUserDataForPath:(NSString *)path
+                    flags:(int)flags
+                    owner:(NSString *)owner {
+  if (path == nil || (requiresOwner_ && owner == nil)) {
+    return nil;
+  }
+  id userData = nil;
+  [condition_ lock];
+  // The newest match has had the least time to go stale.
+  for (NSUInteger i = [kept_ count]; i > 0 && userData == nil; --i) {
+    GMKeptHandle* handle = [kept_ objectAtIndex:i - 1];
+    if (handle->flags_ == flags && [handle->path_ isEqualToString:path] &&
+        (!requiresOwner_ || [handle->owner_ isEqualToString:owner])) {
+      userData = [[handle->userData_ retain] autorelease];
+      [kept_ removeObjectAtIndex:i - 1];
+    }
+  }
+  [condition_ unlock];
+  return userData;
+}
+
+- (void)discardPath:(NSString *)path descendants:(BOOL)descendants {
+  [condition_ lock];
+  if ([kept_ count] > 0) {
+    NSMutableIndexSet* discarded = [NSMutableIndexSet indexSet];
+    for (NSUInteger i = 0, count = [kept_ count]; i < count; ++i) {
+      GMKeptHandle* handle = [kept_ objectAtIndex:i];
+      if (PathMatches(handle->path_, path, descendants)) {
+        [closing_ addObject:handle];
+        [discarded addIndex:i];
+      }
+    }
+    if ([discarded count] > 0) {
+      [kept_ removeObjectsAtIndexes:discarded];
+      [condition_ broadcast];
+    }
+  }
+  [condition_ unlock];
+}
+
+- (void)releaseHandles:(NSArray *)handles {
+  for (NSUInteger i = 0, count = [handles count]; i < count; ++i) {
+    NSAutoreleasePool* innerPool = [[NSAutoreleasePool alloc] init];
+    GMKeptHandle* handle = [handles objectAtIndex:i];
+    @try {
+      [fs_ releaseFileAtPath:handle->path_ userData:handle->userData_];
+    }
+    @catch (id exception) { }
+    [innerPool release];
+  }
+}
+
+// Releases the files that have waited for the timeout or been discarded.
+- (void)run:(id)unused {
+  (void) unused;											/* Avoid unused argument compiler warning */
+
+  [condition_ lock];
+  while (!isStopping_) {
+    // The thread lives as long as the mount, so each pass drains its own pool.
+    NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+    // Files are kept for the same time, so the oldest expires first.
+    NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+    while ([kept_ count] > 0 &&
+           ((GMKeptHandle *)[kept_ objectAtIndex:0])->deadline_ <= now) {
+      [closing_ addObject:[kept_ objectAtIndex:0]];
+      [kept_ removeObjectAtIndex:0];
+    }
+    if ([closing_ count] == 0) {
+      if ([kept_ count] == 0) {
+        [condition_ wait];
+      } else {
+        NSTimeInterval earliest = ((GMKeptHandle *)[kept_ objectAtIndex:0])->deadline_;
+        [condition_ waitUntilDate:[NSDate dateWithTimeIntervalSinceReferenceDate:earliest]];
+      }
+    } else {
+      NSArray* closing = [[closing_ copy] autorelease];
+      [closing_ removeAllObjects];
+      isReleasing_ = YES;
+      [condition_ unlock];
+      [self releaseHandles:closing];
+      [condition_ lock];
+      isReleasing_ = NO;
+      [condition_ broadcast];  // stop may be waiting for the batch.
+    }
+    [pool release];
+  }
+  [condition_ unlock];
+}
+
+- (void)start {
+  [NSThread detachNewThreadSelector:@selector(run:)
+                           toTarget:self
+                         withObject:nil];
+}
+
+- (void)stop {
+  [condition_ lock];
+  isStopping_ = YES;
+  NSMutableArray* closing = [NSMutableArray arrayWithArray:closing_];
+  [closing addObjectsFromArray:kept_];
+  [closing_ removeAllObjects];
+  [kept_ removeAllObjects];
+  [condition_ broadcast];
+  while (isReleasing_) {
+    [condition_ wait];
+  }
+  [condition_ unlock];
+  [self releaseHandles:closing];
+}
+
+@end
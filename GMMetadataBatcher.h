@@ -0,0 +1,50 @@
+//
+//  GMMetadataBatcher.h
+//  OSXFUSE
+//
+
+//  Private interface to the group commit of metadata operations. This header
+//  is not installed with the framework.
+//
+//  Each FUSE thread that submits an operation waits until the batch holding it
+//  has been committed, so a caller never sees its own change unfinished. The
+//  first thread to submit to an empty batch leads it: if other operations are
+//  in flight it waits for the batch window to pass or the batch to fill, then
+//  it hands the batch to the delegate on its own thread. A thread alone commits
+//  at once. Batches are committed one at a time, in order, and hold at most
+//  maxCount operations; a thread that finds the next batch full waits for it to
+//  be taken.
+
+#import "GMAvailability.h"						/* Always include this first */
+
+#import <Foundation/Foundation.h>
+
+#import "GMMetadataOperation.h"
+
+@interface GMMetadataBatcher : NSObject {
+ @private
+  NSCondition* condition_;
+  NSMutableArray* pending_;         // Operations for the next batch.
+  BOOL hasLeader_;                  // A thread is waiting to commit pending_.
+  BOOL isCommitting_;               // A batch is with the delegate.
+  NSUInteger inFlight_;             // Operations submitted and not finished.
+  NSTimeInterval window_;
+  NSUInteger maxCount_;
+  id delegate_;                     // Not retained, like the file system's.
+}
+
+- (id)initWithDelegate:(id)delegate
+                window:(NSTimeInterval)window
+              maxCount:(NSUInteger)maxCount;
+
+// Adds operation to a batch and waits for the batch to be committed. Returns
+// NO and sets error if the operation failed.
+- (BOOL)performOperation:(GMMetadataOperation *)operation
+                   error:(NSError **)error;
+
+@end
+
+@interface GMMetadataOperation (GMMetadataBatcher)
+- (BOOL)isFinished;
+- (void)setIsFinished:(BOOL)isFinished;
+@end
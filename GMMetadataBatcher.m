@@ -0,0 +1,125 @@
+//
+//  GMMetadataBatcher.m
+//  OSXFUSE
+//
+
+//  Group commit of metadata operations. See GMMetadataBatcher.h
+
+#import "GMAvailability.h"						/* Always include this first */
+#import "GMMetadataBatcher.h"
+#import "GMUserFileSystem.h"
+
+#include <errno.h>
+
+@implementation GMMetadataBatcher
+
+- (id)init {
+  [self release];
+  return nil;
+}
+
+- (id)initWithDelegate:(id)delegate
+                window:(NSTimeInterval)window
+              maxCount:(NSUInteger)maxCount {
+  self = [super init];
+  if (self) {
+    condition_ = [[NSCondition alloc] init];
+    pending_ = [[NSMutableArray alloc] init];
+    window_ = window;
+    maxCount_ = (maxCount > 0) ? maxCount : 1;
+    delegate_ = delegate;
+  }
+  return self;
+}
+
+- (void)dealloc {
+  [condition_ release];
+  [pending_ release];
+  [super dealloc];
+}
+
+// Hands batch to the delegate. Called by the leader without the lock held.
+- (void)commitBatch:(NSArray *)batch {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  NSError* error = nil;
+  BOOL ok = NO;
+
+  @try {
+    ok = [delegate_ performMetadataOperations:batch error:&error];
+  }
+  @catch (id exception) {
+    ok = NO;
+    error = nil;
+  }
+  if (!ok) {
+    if (error == nil) {
+      error = [NSError errorWithDomain:NSPOSIXErrorDomain code:EIO userInfo:nil];
+    }
+    for (NSUInteger i = 0, count = [batch count]; i < count; ++i) {
+      GMMetadataOperation* operation = [batch objectAtIndex:i];
+      if ([operation error] == nil) {
+        [operation setError:error];
+      }
+    }
+  }
+  [pool release];
+}
+
+- (BOOL)performOperation:(GMMetadataOperation *)operation
+                   error:(NSError **)error {
+  [condition_ lock];
+  ++inFlight_;
+  while ([pending_ count] >= maxCount_) {
+    [condition_ wait];  // The next batch is full until its leader takes it.
+  }
+  [pending_ addObject:operation];
+  if ([pending_ count] >= maxCount_) {
+    [condition_ broadcast];  // Wake the leader early.
+  }
+
+  if (!hasLeader_) {
+    hasLeader_ = YES;
+    // Waiting only pays off if other operations may join the batch.
+    if (inFlight_ > 1) {
+      NSDate* deadline = [NSDate dateWithTimeIntervalSinceNow:window_];
+      while ([pending_ count] < maxCount_ && [deadline timeIntervalSinceNow] > 0) {
+        [condition_ waitUntilDate:deadline];
+      }
+    }
+    while (isCommitting_) {
+      [condition_ wait];
+    }
+    NSArray* batch = pending_;
+    pending_ = [[NSMutableArray alloc] init];
+    hasLeader_ = NO;
+    isCommitting_ = YES;
+    [condition_ broadcast];  // Let threads waiting for room add to pending_.
+    [condition_ unlock];
+
+    [self commitBatch:batch];
+
+    [condition_ lock];
+    for (NSUInteger i = 0, count = [batch count]; i < count; ++i) {
+      [[batch objectAtIndex:i] setIsFinished:YES];
+    }
+    isCommitting_ = NO;
+    [condition_ broadcast];
+    [batch release];
+  } else {
+    while (![operation isFinished]) {
+      [condition_ wait];
+    }
+  }
+  --inFlight_;
+  [condition_ unlock];
+
+  if ([operation error] != nil) {
+    if (error) {
+      *error = [[[operation error] retain] autorelease];
+    }
+    return NO;
+  }
+  return YES;
+}
+
+@end
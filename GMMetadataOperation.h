@@ -0,0 +1,99 @@
+//
+//  GMMetadataOperation.h
+//  OSXFUSE
+//
+
+//  One metadata mutation in a batch handed to the delegate. Covered by the same
+//  license as the OSXFUSE framework.
+
+#import "GMAvailability.h"
+
+// See "64-bit Class and Instance Variable Access Control"
+// Note: For reasons I don't understand, this definition cannot be placed in
+//			GMAvailability.h.
+//			If it is, the preprocessor on macOS thinks that while GM_EXPORT is
+//			defined in GMAvailability.h, it is not defined in this file, despite
+//			the #import.
+#define GM_EXPORT					__attribute__((visibility("default")))
+
+#if !defined (GM_EXPORT_INTERFACE)
+#if defined (__clang__) || defined (__APPLE__)
+#define	GM_EXPORT_INTERFACE			GM_EXPORT
+#else
+#define GM_EXPORT_INTERFACE
+#endif	/* defined (__clang__) || defined (__APPLE__) */
+#endif	/* !defined (GM_EXPORT_INTERFACE) */
+
+/*!
+ * @header GMMetadataOperation
+ *
+ * When the mount profile sets a metadata batch window and the delegate
+ * implements performMetadataOperations:error:, file creation, attribute
+ * changes and renames are collected into batches and handed to the delegate
+ * together, so that a transactional store can commit them at once. Each
+ * operation in a batch is described by a GMMetadataOperation.
+ */
+
+/*! @abstract The kind of mutation. */
+typedef enum {
+  GMMetadataOperationCreateFile = 1,    // createFileAtPath:attributes:flags:userData:error:
+  GMMetadataOperationSetAttributes,     // setAttributes:ofItemAtPath:userData:error:
+  GMMetadataOperationMoveItem,          // moveItemAtPath:toPath:error:
+} GMMetadataOperationType;
+
+/*!
+ * @class
+ * @discussion A metadata mutation waiting to be committed. The delegate reports
+ * a failure with setError: and, for GMMetadataOperationCreateFile, returns the
+ * new file's userData with setUserData:. An operation without an error is
+ * treated as successful.
+ */
+GM_EXPORT_INTERFACE	@interface GMMetadataOperation : NSObject {
+ @private
+  GMMetadataOperationType type_;
+  NSString* path_;
+  NSString* destinationPath_;
+  NSDictionary* attributes_;
+  int flags_;
+  id userData_;
+  NSError* error_;
+  BOOL isFinished_;
+}
+
+- (id)initWithType:(GMMetadataOperationType)type
+              path:(NSString *)path
+   destinationPath:(NSString *)destinationPath
+        attributes:(NSDictionary *)attributes
+             flags:(int)flags
+          userData:(id)userData GM_AVAILABLE(3_8);
+
+- (GMMetadataOperationType)type GM_AVAILABLE(3_8);
+
+/*! @abstract The item to create, change or move. */
+- (NSString *)path GM_AVAILABLE(3_8);
+
+/*! @abstract Where to move the item, for GMMetadataOperationMoveItem. */
+- (NSString *)destinationPath GM_AVAILABLE(3_8);
+
+/*! @abstract Attributes for GMMetadataOperationCreateFile and
+ * GMMetadataOperationSetAttributes. */
+- (NSDictionary *)attributes GM_AVAILABLE(3_8);
+
+/*! @abstract The open flags for GMMetadataOperationCreateFile. */
+- (int)flags GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract The userData of an open file.
+ * @discussion For GMMetadataOperationSetAttributes, the open file being
+ * changed, or nil. For GMMetadataOperationCreateFile, set by the delegate.
+ */
+- (id)userData GM_AVAILABLE(3_8);
+- (void)setUserData:(id)userData GM_AVAILABLE(3_8);
+
+/*! @abstract A POSIX error if the operation failed, otherwise nil. */
+- (NSError *)error GM_AVAILABLE(3_8);
+- (void)setError:(NSError *)error GM_AVAILABLE(3_8);
+
+@end
+
+#undef GM_EXPORT
@@ -0,0 +1,75 @@
+//
+//  GMMetadataOperation.m
+//  OSXFUSE
+//
+
+//  One metadata mutation in a batch handed to the delegate. Covered by the same
+//  license as the OSXFUSE framework.
+
+#import "GMAvailability.h"						/* Always include this first */
+#import "GMMetadataOperation.h"
+#import "GMMetadataBatcher.h"
+
+@implementation GMMetadataOperation
+
+- (id)init {
+  [self release];
+  return nil;
+}
+
+- (id)initWithType:(GMMetadataOperationType)type
+              path:(NSString *)path
+   destinationPath:(NSString *)destinationPath
+        attributes:(NSDictionary *)attributes
+             flags:(int)flags
+          userData:(id)userData {
+  self = [super init];
+  if (self) {
+    type_ = type;
+    path_ = [path copy];
+    destinationPath_ = [destinationPath copy];
+    attributes_ = [attributes copy];
+    flags_ = flags;
+    userData_ = [userData retain];
+  }
+  return self;
+}
+
+- (void)dealloc {
+  [path_ release];
+  [destinationPath_ release];
+  [attributes_ release];
+  [userData_ release];
+  [error_ release];
+  [super dealloc];
+}
+
+- (NSString *)description {
+  return [NSString stringWithFormat:@"%@ type=%d, path=%@, destination=%@, flags=0x%X, error=%@",
+          [super description], type_, path_, destinationPath_, flags_, error_];
+}
+
+- (GMMetadataOperationType)type { return type_; }
+- (NSString *)path { return path_; }
+- (NSString *)destinationPath { return destinationPath_; }
+- (NSDictionary *)attributes { return attributes_; }
+- (int)flags { return flags_; }
+- (id)userData { return userData_; }
+- (void)setUserData:(id)userData {
+  [userData_ autorelease];
+  userData_ = [userData retain];
+}
+- (NSError *)error { return error_; }
+- (void)setError:(NSError *)error {
+  [error_ autorelease];
+  error_ = [error retain];
+}
+
+@end
+
+@implementation GMMetadataOperation (GMMetadataBatcher)
+
+- (BOOL)isFinished { return isFinished_; }
+- (void)setIsFinished:(BOOL)isFinished { isFinished_ = isFinished; }
+
+@end
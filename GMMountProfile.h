@@ -0,0 +1,389 @@
+//
+//  GMMountProfile.h
+//  OSXFUSE
+//
+
+//  Typed performance settings for a mount. Covered by the same license as the
+//  OSXFUSE framework.
+
+#import "GMAvailability.h"
+
+// See "64-bit Class and Instance Variable Access Control"
+// Note: For reasons I don't understand, this definition cannot be placed in
+//			GMAvailability.h.
+//			If it is, the preprocessor on macOS thinks that while GM_EXPORT is
+//			defined in GMAvailability.h, it is not defined in this file, despite
+//			the #import.
+#define GM_EXPORT					__attribute__((visibility("default")))
+
+#if !defined (GM_EXPORT_INTERFACE)
+#if defined (__clang__) || defined (__APPLE__)
+#define	GM_EXPORT_INTERFACE			GM_EXPORT
+#else
+#define GM_EXPORT_INTERFACE
+#endif	/* defined (__clang__) || defined (__APPLE__) */
+#endif	/* !defined (GM_EXPORT_INTERFACE) */
+
+/*!
+ * @header GMMountProfile
+ *
+ * A typed set of performance-related mount settings. Pass a profile to
+ * -[GMUserFileSystem setMountProfile:] before mounting instead of spelling the
+ * settings as strings in mountAtPath:withOptions:. The same profile is used
+ * to build the mount arguments and to request capabilities when the kernel
+ * connection is initialized, and
+ * -[GMUserFileSystem negotiatedMountProfile] reports what the kernel accepted.
+ */
+
+/*!
+ * @abstract Value of the timeout settings that leaves them at the FUSE default.
+ */
+#define kGMMountProfileDefaultTimeout		(-1.0)
+
+/*!
+ * @class
+ * @discussion Performance-related mount settings. A newly created profile
+ * requests the same behaviour as mounting without a profile: sizes and
+ * timeouts are left at the FUSE defaults, big writes are enabled except on
+ * OS X/Darwin, where they are always on, and splice writes are enabled on
+ * Linux. Sizes of 0 and timeouts of kGMMountProfileDefaultTimeout leave the
+ * setting at the FUSE default.
+ */
+GM_EXPORT_INTERFACE	@interface GMMountProfile : NSObject <NSCopying> {
+ @private
+  unsigned int maxWrite_;
+  unsigned int maxRead_;
+  unsigned int maxReadahead_;
+  double entryTimeout_;
+  double attrTimeout_;
+  double negativeTimeout_;
+  unsigned int negativeCacheSize_;
+  double negativeCacheTimeout_;
+  BOOL bigWrites_;
+  BOOL spliceRead_;
+  BOOL spliceWrite_;
+  BOOL autoCache_;
+  BOOL noPath_;
+  double metadataBatchWindow_;
+  unsigned int metadataBatchSize_;
+  unsigned int smallFileSize_;
+  double attributeCoalescingDelay_;
+  BOOL internPaths_;
+  BOOL readdirPlus_;
+  BOOL writebackCache_;
+  unsigned int directoryCacheSize_;
+  double directoryCacheTimeout_;
+  unsigned int symlinkCacheSize_;
+  double symlinkCacheTimeout_;
+  unsigned int accessCacheSize_;
+  double accessCacheTimeout_;
+  BOOL kernelPermissions_;
+  unsigned int handleCacheSize_;
+  double handleCacheTimeout_;
+  BOOL interruptible_;
+}
+
+/*! @abstract Returns an autoreleased profile with the default settings. */
++ (GMMountProfile *)mountProfile GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract Maximum size of a write request, in bytes.
+ * @discussion Sizes above 4096 need big writes on Linux and FreeBSD.
+ */
+- (unsigned int)maxWrite GM_AVAILABLE(3_8);
+- (void)setMaxWrite:(unsigned int)maxWrite GM_AVAILABLE(3_8);
+
+/*! @abstract Maximum size of a read request, in bytes. */
+- (unsigned int)maxRead GM_AVAILABLE(3_8);
+- (void)setMaxRead:(unsigned int)maxRead GM_AVAILABLE(3_8);
+
+/*! @abstract Maximum kernel readahead, in bytes. */
+- (unsigned int)maxReadahead GM_AVAILABLE(3_8);
+- (void)setMaxReadahead:(unsigned int)maxReadahead GM_AVAILABLE(3_8);
+
+/*! @abstract How long the kernel caches names, in seconds. */
+- (double)entryTimeout GM_AVAILABLE(3_8);
+- (void)setEntryTimeout:(double)entryTimeout GM_AVAILABLE(3_8);
+
+/*! @abstract How long the kernel caches attributes, in seconds. */
+- (double)attrTimeout GM_AVAILABLE(3_8);
+- (void)setAttrTimeout:(double)attrTimeout GM_AVAILABLE(3_8);
+
+/*! @abstract How long the kernel caches nonexistent names, in seconds. */
+- (double)negativeTimeout GM_AVAILABLE(3_8);
+- (void)setNegativeTimeout:(double)negativeTimeout GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract Number of nonexistent paths the framework remembers.
+ * @discussion When getattr finds that a path doesn't exist, the answer is
+ * cached so that repeated probes of the same path don't reach the delegate.
+ * Creating, linking or renaming through the mount invalidates the entries it
+ * affects; use -[GMUserFileSystem invalidateCachesForPath:] for other changes.
+ * This works on every platform and can be combined with negativeTimeout, which
+ * asks the kernel to cache the same answers but can't be invalidated.
+ * 0, the default, disables the cache.
+ */
+- (unsigned int)negativeCacheSize GM_AVAILABLE(3_8);
+- (void)setNegativeCacheSize:(unsigned int)negativeCacheSize GM_AVAILABLE(3_8);
+
+/*! @abstract How long the framework remembers a nonexistent path, in seconds. */
+- (double)negativeCacheTimeout GM_AVAILABLE(3_8);
+- (void)setNegativeCacheTimeout:(double)negativeCacheTimeout GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract Allow writes larger than 4096 bytes.
+ * @discussion Ignored on OS X/Darwin and with libfuse 3, where large writes
+ * are always allowed.
+ */
+- (BOOL)bigWrites GM_AVAILABLE(3_8);
+- (void)setBigWrites:(BOOL)bigWrites GM_AVAILABLE(3_8);
+
+/*! @abstract Use splice(2) to move read replies to the kernel. Linux only. */
+- (BOOL)spliceRead GM_AVAILABLE(3_8);
+- (void)setSpliceRead:(BOOL)spliceRead GM_AVAILABLE(3_8);
+
+/*! @abstract Use splice(2) to move write requests from the kernel. Linux only. */
+- (BOOL)spliceWrite GM_AVAILABLE(3_8);
+- (void)setSpliceWrite:(BOOL)spliceWrite GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract Keep the kernel's page cache when a file is reopened.
+ * @discussion The cache is only kept if the file's size and modification time
+ * haven't changed.
+ */
+- (BOOL)autoCache GM_AVAILABLE(3_8);
+- (void)setAutoCache:(BOOL)autoCache GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract Don't look up paths for operations on open files.
+ * @discussion FUSE normally finds the current path of a file for every read,
+ * write, fgetattr, ftruncate, fallocate, fsync and release, and the framework
+ * turns it into an NSString. With noPath the kernel's handle is used alone:
+ * the delegate receives a nil path and must find the file from the userData
+ * it returned when the file was opened. userData that implements
+ * readToBuffer:size:offset:error:, writeFromBuffer:size:offset:error: or
+ * truncateToOffset:error: is called directly, as it is without noPath.
+ * Without noPath, a file that is unlinked while open is renamed to a
+ * .fuse_hidden file, whose path is passed until the file is released, or,
+ * with the hard_remove option, its operations fail with ENOENT. Directories
+ * are listed from the path they were opened with. Off by default.
+ */
+- (BOOL)noPath GM_AVAILABLE(3_8);
+- (void)setNoPath:(BOOL)noPath GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract How long to collect metadata operations for, in seconds.
+ * @discussion See the GMUserFileSystemMetadataBatching category. An
+ * operation that arrives while no other is in flight is sent at once. 0, the
+ * default, sends each operation to the delegate as it arrives.
+ */
+- (double)metadataBatchWindow GM_AVAILABLE(3_8);
+- (void)setMetadataBatchWindow:(double)metadataBatchWindow GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract Most metadata operations in a batch. A full batch is committed
+ * before the window has passed. The default is 64.
+ */
+- (unsigned int)metadataBatchSize GM_AVAILABLE(3_8);
+- (void)setMetadataBatchSize:(unsigned int)metadataBatchSize GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract Largest file, in bytes, that is delivered to the delegate whole.
+ * @discussion See the GMUserFileSystemSmallFiles category. Files created, or
+ * opened with O_TRUNC, are kept in memory until they are closed and passed to
+ * the delegate in one call, unless they grow larger than this. 0, the default,
+ * disables small file mode.
+ */
+- (unsigned int)smallFileSize GM_AVAILABLE(3_8);
+- (void)setSmallFileSize:(unsigned int)smallFileSize GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract How long to hold attribute changes made by path, in seconds.
+ * @discussion Linux and FreeBSD only. chmod, chown, utimens and truncate reach
+ * the file system as separate operations, so copying a file with its
+ * attributes costs several setAttributes:ofItemAtPath:userData:error: calls.
+ * With a delay, the changes to an item are merged and passed to the delegate
+ * in one call when the next other operation on the item arrives, or when the
+ * delay has passed. Attributes read in the meantime include the held changes.
+ * Because the change has already succeeded when the delegate sees it, a
+ * failure can only be logged. Delayed changes are passed on from a framework
+ * thread, where +[GMUserFileSystem currentContext] is nil. 0, the default,
+ * passes each change on as it arrives.
+ */
+- (double)attributeCoalescingDelay GM_AVAILABLE(3_8);
+- (void)setAttributeCoalescingDelay:(double)attributeCoalescingDelay GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract Whether to reuse the NSStrings of recently seen paths.
+ * @discussion Each FUSE thread keeps a small cache of GMPaths, so an operation
+ * on a path the thread has seen recently doesn't decode it again, and the
+ * delegate can get the precomputed hash and components of the path it was
+ * given with +[GMPath pathWithString:]. Worthwhile when the same files are
+ * used repeatedly. While any mount in the process asks for it, all of them
+ * intern their paths. Off by default.
+ */
+- (BOOL)internPaths GM_AVAILABLE(3_8);
+- (void)setInternPaths:(BOOL)internPaths GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract Return attributes with directory listings.
+ * @discussion Only with libfuse 3 on Linux. The attributes of each entry are
+ * read when its directory is listed, so that ls -l and similar callers don't
+ * need a separate lookup for every name. The kernel decides when a listing
+ * is worth the attributes. Off by default.
+ */
+- (BOOL)readdirPlus GM_AVAILABLE(3_8);
+- (void)setReaddirPlus:(BOOL)readdirPlus GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract Let the kernel cache writes.
+ * @discussion Only with libfuse 3 on Linux. The kernel keeps written data in
+ * its page cache and sends it to writeFileAtPath:... in large pieces when it
+ * writes back dirty pages, instead of one call for every write(2). The kernel
+ * then owns the size and modification date of a regular file while it is
+ * open: the framework reports the size and date that the kernel has seen
+ * written, set or truncated over the delegate's attributes until the last
+ * open for writing is released, and the kernel's modification date reaches
+ * the delegate through setAttributes:ofItemAtPath:userData:error:.<br>
+ *
+ * The delegate's file handles must then accept what the kernel sends: a file
+ * opened O_WRONLY is opened O_RDWR, because the kernel reads to fill partly
+ * written pages, and O_APPEND is removed from the open flags, because the
+ * kernel chooses the offset of every write itself. Writes may also arrive
+ * after the file has been closed, up to its release, and from a framework
+ * thread that isn't the writer's. Suits a delegate whose files are only
+ * changed through the mount. Can't be combined with noPath. Off by default.
+ */
+- (BOOL)writebackCache GM_AVAILABLE(3_8);
+- (void)setWritebackCache:(BOOL)writebackCache GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract Number of directory listings the framework remembers.
+ * @discussion Each listing from contentsOfDirectoryAtPath:error: is cached, so
+ * that listing an unchanged directory again doesn't reach the delegate.
+ * Creating, removing, linking or renaming an item through the mount discards
+ * the listing of its directory; use -[GMUserFileSystem invalidateCachesForPath:]
+ * for other changes. With libfuse 3.5 or later on Linux the kernel is also
+ * allowed to keep listings, until the directory changes through the mount or
+ * its modification date changes. 0, the default, disables the cache.
+ */
+- (unsigned int)directoryCacheSize GM_AVAILABLE(3_8);
+- (void)setDirectoryCacheSize:(unsigned int)directoryCacheSize GM_AVAILABLE(3_8);
+
+/*! @abstract How long the framework remembers a directory listing, in seconds. */
+- (double)directoryCacheTimeout GM_AVAILABLE(3_8);
+- (void)setDirectoryCacheTimeout:(double)directoryCacheTimeout GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract Number of symbolic link targets the framework remembers.
+ * @discussion Each target from destinationOfSymbolicLinkAtPath:error: is
+ * cached, so that resolving a path through the same link again doesn't reach
+ * the delegate. Creating, removing or renaming a link through the mount
+ * discards its target; use -[GMUserFileSystem invalidateCachesForPath:] for
+ * other changes. With libfuse 3.10 or later on Linux the kernel is also asked
+ * to keep the targets, for as long as it keeps the link. 0, the default,
+ * disables the cache.
+ */
+- (unsigned int)symlinkCacheSize GM_AVAILABLE(3_8);
+- (void)setSymlinkCacheSize:(unsigned int)symlinkCacheSize GM_AVAILABLE(3_8);
+
+/*! @abstract How long the framework remembers a symbolic link target, in seconds. */
+- (double)symlinkCacheTimeout GM_AVAILABLE(3_8);
+- (void)setSymlinkCacheTimeout:(double)symlinkCacheTimeout GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract Number of items whose access checks the framework remembers.
+ * @discussion The answers of accessCheckOfItemAtPath:mode:error: for each
+ * item are cached by the caller's user ID, group ID, supplementary groups and
+ * mode, so that shells searching PATH and other tools that probe the same
+ * items repeatedly don't reach the delegate. On Linux libfuse finds the
+ * supplementary groups by reading /proc, and callers in more than 64 groups
+ * aren't cached. Elsewhere they can't be found, so callers with the same user
+ * and primary group share answers; don't enable the cache there for a
+ * delegate that checks supplementary groups. Only grants and refusals are cached, not other errors.
+ * Changing an item's permissions or owner through the mount discards its
+ * answers and those of the items below it; use
+ * -[GMUserFileSystem invalidateCachesForPath:] for other changes. Don't enable
+ * it for a delegate whose answers depend on anything else, such as the
+ * calling process. 0, the default, disables the cache.
+ */
+- (unsigned int)accessCacheSize GM_AVAILABLE(3_8);
+- (void)setAccessCacheSize:(unsigned int)accessCacheSize GM_AVAILABLE(3_8);
+
+/*! @abstract How long the framework remembers an access check, in seconds. */
+- (double)accessCacheTimeout GM_AVAILABLE(3_8);
+- (void)setAccessCacheTimeout:(double)accessCacheTimeout GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract Let the kernel check permissions.
+ * @discussion Mounts with the default_permissions option. The kernel checks
+ * every access against the owner, group and mode in the attributes it has
+ * cached, as a local file system would, and accessCheckOfItemAtPath:mode:error:
+ * is never called for access(2). The delegate's attributes must then describe
+ * who may use each item. Off by default.
+ */
+- (BOOL)kernelPermissions GM_AVAILABLE(3_8);
+- (void)setKernelPermissions:(BOOL)kernelPermissions GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract Number of released files the framework keeps open for reuse.
+ * @discussion When a file is released, the delegate's userData is kept for
+ * handleCacheTimeout seconds instead of being passed to
+ * releaseFileAtPath:userData:. Opening the same path with the same flags in
+ * that time reuses it without calling openFileAtPath:mode:userData:error:, so
+ * tools that open and close the same files repeatedly don't pay for the
+ * delegate's open each time. Only files opened read-only are kept, since a
+ * delegate may commit writes when a file is released; opening a path for
+ * writing releases its kept files. The framework's own small and
+ * data-backed files are never kept. Without kernelPermissions, when the
+ * delegate's open is the only permission check, a kept file is only reused by
+ * a caller with the same user and groups as the one that opened it.
+ * Renaming, removing, recreating or truncating a path, or changing its
+ * permissions or owner, releases its kept files, as does
+ * -[GMUserFileSystem invalidateCachesForPath:]. See
+ * shouldReuseFileAtPath:userData:mode: to refuse a reuse. 0, the default,
+ * disables the cache.
+ */
+- (unsigned int)handleCacheSize GM_AVAILABLE(3_8);
+- (void)setHandleCacheSize:(unsigned int)handleCacheSize GM_AVAILABLE(3_8);
+
+/*! @abstract How long the framework keeps a released file for reuse, in seconds. */
+- (double)handleCacheTimeout GM_AVAILABLE(3_8);
+- (void)setHandleCacheTimeout:(double)handleCacheTimeout GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract Give up on operations whose callers have interrupted them.
+ * @discussion Mounts with the intr option. When a process waiting on the file
+ * system is killed or gets a signal, libfuse signals the thread serving its
+ * request with SIGUSR1, so that the delegate's blocking system calls fail
+ * with EINTR; the process must not use SIGUSR1 itself. Interrupted opens,
+ * reads, writes, directory listings, attribute lookups, range copies and
+ * seeks fail with EINTR instead of reaching the delegate. Releases, flushes
+ * and syncs always run. The delegate can check
+ * +[GMUserFileSystem isCurrentOperationCancelled] whether or not this is set.
+ * Off by default.
+ */
+- (BOOL)interruptible GM_AVAILABLE(3_8);
+- (void)setInterruptible:(BOOL)interruptible GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract Checks that the settings are consistent and supported.
+ * @param error Filled with an error in the NSPOSIXErrorDomain describing the
+ *        first invalid setting: EINVAL for an out of range or inconsistent
+ *        value, ENOTSUP for a setting that isn't supported on this platform.
+ * @result YES if the profile can be used.
+ */
+- (BOOL)validate:(NSError **)error GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract The mount options for the settings.
+ * @discussion Options are in the form accepted by mountAtPath:withOptions:,
+ * without the "-o". Settings that are applied as capabilities rather than
+ * options aren't included.
+ * @result An array of NSString.
+ */
+- (NSArray *)mountOptions GM_AVAILABLE(3_8);
+
+@end
+
+#undef GM_EXPORT
@@ -0,0 +1,290 @@
+//
+//  GMMountProfile.m
+//  OSXFUSE
+//
+
+//  Typed performance settings for a mount. Covered by the same license as the
+//  OSXFUSE framework.
+
+#import "GMAvailability.h"						/* Always include this first */
+#import "GMMountProfile.h"
+
+#import "GMFuse.h"											/* Selects the libfuse API */
+
+#include <errno.h>
+#include <math.h>
+
+static const unsigned int kMinRequestSize = 4096;					/* One page */
+static const unsigned int kMaxRequestSize = 16 * 1024 * 1024;
+static const unsigned int kMaxSmallWriteSize = 4096;			/* Without big writes, on Linux and FreeBSD */
+static const double kDefaultNegativeCacheTimeout = 1.0;
+static const double kDefaultDirectoryCacheTimeout = 1.0;
+static const double kDefaultSymlinkCacheTimeout = 60.0;  // Links only change by being replaced.
+static const double kDefaultAccessCacheTimeout = 1.0;
+static const double kDefaultHandleCacheTimeout = 1.0;
+static const unsigned int kDefaultMetadataBatchSize = 64;
+static const unsigned int kMaxSmallFileSize = 64 * 1024 * 1024;		/* Buffered in memory until close */
+
+static NSError *	ProfileError (int a_iErrno, NSString * a_poszDescription)
+	{
+  NSDictionary* userInfo = [NSDictionary dictionaryWithObject:a_poszDescription forKey:NSLocalizedDescriptionKey];
+
+  return [NSError errorWithDomain:NSPOSIXErrorDomain code:a_iErrno userInfo:userInfo];
+  }
+
+static BOOL	IsValidSize (unsigned int a_cb)
+	{
+  return (a_cb == 0) || ((a_cb >= kMinRequestSize) && (a_cb <= kMaxRequestSize));
+  }
+
+static BOOL	IsValidTimeout (double a_dTimeout)
+	{
+  return (a_dTimeout == kGMMountProfileDefaultTimeout) || (isfinite (a_dTimeout) && a_dTimeout >= 0);
+  }
+
+@implementation GMMountProfile
+
++ (GMMountProfile *)mountProfile {
+  return [[[self alloc] init] autorelease];
+}
+
+- (id)init {
+  self = [super init];
+  if (self) {
+    entryTimeout_ = kGMMountProfileDefaultTimeout;
+    attrTimeout_ = kGMMountProfileDefaultTimeout;
+    negativeTimeout_ = kGMMountProfileDefaultTimeout;
+    negativeCacheTimeout_ = kDefaultNegativeCacheTimeout;
+    directoryCacheTimeout_ = kDefaultDirectoryCacheTimeout;
+    symlinkCacheTimeout_ = kDefaultSymlinkCacheTimeout;
+    accessCacheTimeout_ = kDefaultAccessCacheTimeout;
+    handleCacheTimeout_ = kDefaultHandleCacheTimeout;
+    metadataBatchSize_ = kDefaultMetadataBatchSize;
+#if !defined (__APPLE__)
+    bigWrites_ = YES;
+#endif	/* !defined (__APPLE__) */
+#if defined (__linux__)
+    spliceWrite_ = YES;
+#endif	/* defined (__linux__) */
+  }
+  return self;
+}
+
+- (id)copyWithZone:(NSZone *)zone {
+  GMMountProfile* copy = [[GMMountProfile allocWithZone:zone] init];
+  copy->maxWrite_ = maxWrite_;
+  copy->maxRead_ = maxRead_;
+  copy->maxReadahead_ = maxReadahead_;
+  copy->entryTimeout_ = entryTimeout_;
+  copy->attrTimeout_ = attrTimeout_;
+  copy->negativeTimeout_ = negativeTimeout_;
+  copy->negativeCacheSize_ = negativeCacheSize_;
+  copy->negativeCacheTimeout_ = negativeCacheTimeout_;
+  copy->bigWrites_ = bigWrites_;
+  copy->spliceRead_ = spliceRead_;
+  copy->spliceWrite_ = spliceWrite_;
+  copy->autoCache_ = autoCache_;
+  copy->noPath_ = noPath_;
+  copy->metadataBatchWindow_ = metadataBatchWindow_;
+  copy->metadataBatchSize_ = metadataBatchSize_;
+  copy->smallFileSize_ = smallFileSize_;
+  copy->attributeCoalescingDelay_ = attributeCoalescingDelay_;
+  copy->internPaths_ = internPaths_;
+  copy->readdirPlus_ = readdirPlus_;
+  copy->writebackCache_ = writebackCache_;
+  copy->directoryCacheSize_ = directoryCacheSize_;
+  copy->directoryCacheTimeout_ = directoryCacheTimeout_;
+  copy->symlinkCacheSize_ = symlinkCacheSize_;
+  copy->symlinkCacheTimeout_ = symlinkCacheTimeout_;
+  copy->accessCacheSize_ = accessCacheSize_;
+  copy->accessCacheTimeout_ = accessCacheTimeout_;
+  copy->kernelPermissions_ = kernelPermissions_;
+  copy->handleCacheSize_ = handleCacheSize_;
+  copy->handleCacheTimeout_ = handleCacheTimeout_;
+  copy->interruptible_ = interruptible_;
+  return copy;
+}
+
+- (NSString *)description {
+  return [NSString stringWithFormat:@"%@ max_write=%u, max_read=%u, max_readahead=%u, "
+          @"entry_timeout=%g, attr_timeout=%g, negative_timeout=%g, "
+          @"negative_cache=%u/%gs, big_writes=%d, "
+          @"splice_read=%d, splice_write=%d, auto_cache=%d, nopath=%d, "
+          @"metadata_batch=%u/%gs, small_file_size=%u, attribute_coalescing=%gs, "
+          @"intern_paths=%d, readdirplus=%d, writeback_cache=%d, directory_cache=%u/%gs, "
+          @"symlink_cache=%u/%gs, access_cache=%u/%gs, default_permissions=%d, "
+          @"handle_cache=%u/%gs, intr=%d",
+          [super description], maxWrite_, maxRead_, maxReadahead_,
+          entryTimeout_, attrTimeout_, negativeTimeout_,
+          negativeCacheSize_, negativeCacheTimeout_, bigWrites_,
+          spliceRead_, spliceWrite_, autoCache_, noPath_,
+          metadataBatchSize_, metadataBatchWindow_, smallFileSize_,
+          attributeCoalescingDelay_, internPaths_, readdirPlus_, writebackCache_,
+          directoryCacheSize_, directoryCacheTimeout_, symlinkCacheSize_, symlinkCacheTimeout_,
+          accessCacheSize_, accessCacheTimeout_, kernelPermissions_,
+          handleCacheSize_, handleCacheTimeout_, interruptible_];
+}
+
+- (unsigned int)maxWrite { return maxWrite_; }
+- (void)setMaxWrite:(unsigned int)maxWrite { maxWrite_ = maxWrite; }
+- (unsigned int)maxRead { return maxRead_; }
+- (void)setMaxRead:(unsigned int)maxRead { maxRead_ = maxRead; }
+- (unsigned int)maxReadahead { return maxReadahead_; }
+- (void)setMaxReadahead:(unsigned int)maxReadahead { maxReadahead_ = maxReadahead; }
+- (double)entryTimeout { return entryTimeout_; }
+- (void)setEntryTimeout:(double)entryTimeout { entryTimeout_ = entryTimeout; }
+- (double)attrTimeout { return attrTimeout_; }
+- (void)setAttrTimeout:(double)attrTimeout { attrTimeout_ = attrTimeout; }
+- (double)negativeTimeout { return negativeTimeout_; }
+- (void)setNegativeTimeout:(double)negativeTimeout { negativeTimeout_ = negativeTimeout; }
+- (unsigned int)negativeCacheSize { return negativeCacheSize_; }
+- (void)setNegativeCacheSize:(unsigned int)negativeCacheSize { negativeCacheSize_ = negativeCacheSize; }
+- (double)negativeCacheTimeout { return negativeCacheTimeout_; }
+- (void)setNegativeCacheTimeout:(double)negativeCacheTimeout { negativeCacheTimeout_ = negativeCacheTimeout; }
+- (BOOL)bigWrites { return bigWrites_; }
+- (void)setBigWrites:(BOOL)bigWrites { bigWrites_ = bigWrites; }
+- (BOOL)spliceRead { return spliceRead_; }
+- (void)setSpliceRead:(BOOL)spliceRead { spliceRead_ = spliceRead; }
+- (BOOL)spliceWrite { return spliceWrite_; }
+- (void)setSpliceWrite:(BOOL)spliceWrite { spliceWrite_ = spliceWrite; }
+- (BOOL)autoCache { return autoCache_; }
+- (void)setAutoCache:(BOOL)autoCache { autoCache_ = autoCache; }
+- (BOOL)noPath { return noPath_; }
+- (void)setNoPath:(BOOL)noPath { noPath_ = noPath; }
+- (double)metadataBatchWindow { return metadataBatchWindow_; }
+- (void)setMetadataBatchWindow:(double)metadataBatchWindow { metadataBatchWindow_ = metadataBatchWindow; }
+- (unsigned int)metadataBatchSize { return metadataBatchSize_; }
+- (void)setMetadataBatchSize:(unsigned int)metadataBatchSize { metadataBatchSize_ = metadataBatchSize; }
+- (unsigned int)smallFileSize { return smallFileSize_; }
+- (void)setSmallFileSize:(unsigned int)smallFileSize { smallFileSize_ = smallFileSize; }
+- (double)attributeCoalescingDelay { return attributeCoalescingDelay_; }
+- (void)setAttributeCoalescingDelay:(double)attributeCoalescingDelay { attributeCoalescingDelay_ = attributeCoalescingDelay; }
+- (BOOL)internPaths { return internPaths_; }
+- (void)setInternPaths:(BOOL)internPaths { internPaths_ = internPaths; }
+- (BOOL)readdirPlus { return readdirPlus_; }
+- (void)setReaddirPlus:(BOOL)readdirPlus { readdirPlus_ = readdirPlus; }
+- (BOOL)writebackCache { return writebackCache_; }
+- (void)setWritebackCache:(BOOL)writebackCache { writebackCache_ = writebackCache; }
+- (unsigned int)directoryCacheSize { return directoryCacheSize_; }
+- (void)setDirectoryCacheSize:(unsigned int)directoryCacheSize { directoryCacheSize_ = directoryCacheSize; }
+- (double)directoryCacheTimeout { return directoryCacheTimeout_; }
+- (void)setDirectoryCacheTimeout:(double)directoryCacheTimeout { directoryCacheTimeout_ = directoryCacheTimeout; }
+- (unsigned int)symlinkCacheSize { return symlinkCacheSize_; }
+- (void)setSymlinkCacheSize:(unsigned int)symlinkCacheSize { symlinkCacheSize_ = symlinkCacheSize; }
+- (double)symlinkCacheTimeout { return symlinkCacheTimeout_; }
+- (void)setSymlinkCacheTimeout:(double)symlinkCacheTimeout { symlinkCacheTimeout_ = symlinkCacheTimeout; }
+- (unsigned int)accessCacheSize { return accessCacheSize_; }
+- (void)setAccessCacheSize:(unsigned int)accessCacheSize { accessCacheSize_ = accessCacheSize; }
+- (double)accessCacheTimeout { return accessCacheTimeout_; }
+- (void)setAccessCacheTimeout:(double)accessCacheTimeout { accessCacheTimeout_ = accessCacheTimeout; }
+- (BOOL)kernelPermissions { return kernelPermissions_; }
+- (void)setKernelPermissions:(BOOL)kernelPermissions { kernelPermissions_ = kernelPermissions; }
+- (unsigned int)handleCacheSize { return handleCacheSize_; }
+- (void)setHandleCacheSize:(unsigned int)handleCacheSize { handleCacheSize_ = handleCacheSize; }
+- (double)handleCacheTimeout { return handleCacheTimeout_; }
+- (void)setHandleCacheTimeout:(double)handleCacheTimeout { handleCacheTimeout_ = handleCacheTimeout; }
+- (BOOL)interruptible { return interruptible_; }
+- (void)setInterruptible:(BOOL)interruptible { interruptible_ = interruptible; }
+
+- (BOOL)validate:(NSError **)error {
+  NSError* invalid = nil;
+
+  if (!IsValidSize(maxWrite_) || !IsValidSize(maxRead_) || !IsValidSize(maxReadahead_)) {
+    invalid = ProfileError(EINVAL, [NSString stringWithFormat:
+      @"max_write, max_read and max_readahead must be 0 or between %u and %u bytes",
+      kMinRequestSize, kMaxRequestSize]);
+  } else if (!IsValidTimeout(entryTimeout_) || !IsValidTimeout(attrTimeout_) ||
+             !IsValidTimeout(negativeTimeout_)) {
+    invalid = ProfileError(EINVAL,
+      @"entry_timeout, attr_timeout and negative_timeout must be kGMMountProfileDefaultTimeout or a non-negative number of seconds");
+  } else if (negativeCacheSize_ != 0 &&
+             (!isfinite(negativeCacheTimeout_) || negativeCacheTimeout_ <= 0)) {
+    invalid = ProfileError(EINVAL, @"The negative cache timeout must be a positive number of seconds");
+  } else if (directoryCacheSize_ != 0 &&
+             (!isfinite(directoryCacheTimeout_) || directoryCacheTimeout_ <= 0)) {
+    invalid = ProfileError(EINVAL, @"The directory cache timeout must be a positive number of seconds");
+  } else if (symlinkCacheSize_ != 0 &&
+             (!isfinite(symlinkCacheTimeout_) || symlinkCacheTimeout_ <= 0)) {
+    invalid = ProfileError(EINVAL, @"The symlink cache timeout must be a positive number of seconds");
+  } else if (accessCacheSize_ != 0 &&
+             (!isfinite(accessCacheTimeout_) || accessCacheTimeout_ <= 0)) {
+    invalid = ProfileError(EINVAL, @"The access cache timeout must be a positive number of seconds");
+  } else if (handleCacheSize_ != 0 &&
+             (!isfinite(handleCacheTimeout_) || handleCacheTimeout_ <= 0)) {
+    invalid = ProfileError(EINVAL, @"The handle cache timeout must be a positive number of seconds");
+  } else if (!isfinite(metadataBatchWindow_) || metadataBatchWindow_ < 0 ||
+             (metadataBatchWindow_ > 0 && metadataBatchSize_ == 0)) {
+    invalid = ProfileError(EINVAL, @"The metadata batch window must be a non-negative number of seconds and the batch size at least 1");
+  } else if (smallFileSize_ > kMaxSmallFileSize) {
+    invalid = ProfileError(EINVAL, [NSString stringWithFormat:
+      @"small_file_size must be at most %u bytes", kMaxSmallFileSize]);
+  } else if (!isfinite(attributeCoalescingDelay_) || attributeCoalescingDelay_ < 0) {
+    invalid = ProfileError(EINVAL, @"The attribute coalescing delay must be a non-negative number of seconds");
+#if defined (__APPLE__)
+  } else if (attributeCoalescingDelay_ > 0) {
+    invalid = ProfileError(ENOTSUP, @"Attribute coalescing isn't needed on OS X/Darwin, which sets attributes together");
+#endif	/* defined (__APPLE__) */
+#if !defined (__APPLE__) && !GM_FUSE3
+  } else if (maxWrite_ > kMaxSmallWriteSize && !bigWrites_) {
+    invalid = ProfileError(EINVAL, [NSString stringWithFormat:
+      @"max_write=%u has no effect without big writes", maxWrite_]);
+#endif	/* !defined (__APPLE__) && !GM_FUSE3 */
+#if !defined (__linux__)
+  } else if (spliceRead_ || spliceWrite_) {
+    invalid = ProfileError(ENOTSUP, @"Splice reads and writes are only supported on Linux");
+#endif	/* !defined (__linux__) */
+#if !GM_FUSE3
+  } else if (writebackCache_) {
+    invalid = ProfileError(ENOTSUP, @"The writeback cache needs libfuse 3");
+#endif	/* !GM_FUSE3 */
+  } else if (writebackCache_ && noPath_) {
+    invalid = ProfileError(EINVAL, @"The writeback cache tracks files by path, so it can't be used with no_path");
+  }
+  if (invalid != nil) {
+    if (error) {
+      *error = invalid;
+    }
+    return NO;
+  }
+  return YES;
+}
+
+- (NSArray *)mountOptions {
+  NSMutableArray* options = [NSMutableArray array];
+  // libfuse 3 has no max_write or max_readahead options. fusefm_init sets
+  // both when the connection is initialized, as it does with libfuse 2.
+#if !GM_FUSE3
+  if (maxWrite_ != 0) {
+    [options addObject:[NSString stringWithFormat:@"max_write=%u", maxWrite_]];
+  }
+#endif	/* !GM_FUSE3 */
+  if (maxRead_ != 0) {
+    [options addObject:[NSString stringWithFormat:@"max_read=%u", maxRead_]];
+  }
+#if !GM_FUSE3
+  if (maxReadahead_ != 0) {
+    [options addObject:[NSString stringWithFormat:@"max_readahead=%u", maxReadahead_]];
+  }
+#endif	/* !GM_FUSE3 */
+  if (entryTimeout_ != kGMMountProfileDefaultTimeout) {
+    [options addObject:[NSString stringWithFormat:@"entry_timeout=%g", entryTimeout_]];
+  }
+  if (attrTimeout_ != kGMMountProfileDefaultTimeout) {
+    [options addObject:[NSString stringWithFormat:@"attr_timeout=%g", attrTimeout_]];
+  }
+  if (negativeTimeout_ != kGMMountProfileDefaultTimeout) {
+    [options addObject:[NSString stringWithFormat:@"negative_timeout=%g", negativeTimeout_]];
+  }
+  if (autoCache_) {
+    [options addObject:@"auto_cache"];
+  }
+  if (kernelPermissions_) {
+    [options addObject:@"default_permissions"];
+  }
+  if (interruptible_) {
+    [options addObject:@"intr"];
+  }
+  return options;
+}
+
+@end
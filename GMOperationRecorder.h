@@ -0,0 +1,70 @@
+//
+//  GMOperationRecorder.h
+//  OSXFUSE
+//
+
+//  Private interface to the operation recorder behind
+//  -[GMUserFileSystem startRecordingOperationsToPath:error:]. This header is
+//  not installed with the framework.
+//
+//  Each thread that records an operation gets its own single producer, single
+//  consumer ring buffer, so recording never takes a lock or blocks a FUSE
+//  worker thread. If a ring is full the record is dropped and counted. A
+//  flusher thread drains the rings to the trace file. See GMOperationTrace.h
+//  for the file format.
+//
+//  A recorder is published through a slot, normally an instance variable. All
+//  access goes through the functions below so that a recorder can be stopped
+//  while other threads are recording without a lock on the recording path.
+//  The slot counts the threads recording to it in two halves, by epoch, so
+//  that stopping only waits for the threads that were already recording and
+//  can't be held off by a steady stream of new ones.
+
+#import "GMAvailability.h"
+#import "GMOperationTrace.h"
+
+#include <time.h>
+
+typedef struct GMOperationRecorder	GMOperationRecorder;
+
+typedef struct GMOperationRecorderSlot
+	{
+  GMOperationRecorder *	m_pRecorder;
+  unsigned int					m_uEpoch;						/* Advanced by each stop */
+  int										m_acWriters [2];		/* Threads recording, by the parity of the epoch they saw */
+	} GMOperationRecorderSlot;
+
+/* Number of recorders that are currently running, in all file systems. Checked before each
+		operation so that the cost of the hooks is a single load when nothing is being recorded
+*/
+extern int	g_cGMOperationRecorders;
+
+static inline BOOL	GMOperationRecorderIsActive (void)
+	{
+  return __atomic_load_n (&g_cGMOperationRecorders, __ATOMIC_RELAXED) != 0;
+  }
+
+/* Monotonic time in nanoseconds, used for record timestamps and latencies */
+static inline uint64_t	GMOperationRecorderNow (void)
+	{
+  struct timespec	ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+  }
+
+/* Creates a trace file at a_pszPath and publishes a new recorder in a_pSlot. Returns 0 or an errno value.
+		Fails with EBUSY if the slot already holds a recorder
+*/
+extern int	GMOperationRecorderStart (GMOperationRecorderSlot * a_pSlot, const char * a_pszPath);
+
+/* Unpublishes the recorder in a_pSlot, waits for threads that are recording to it, flushes the remaining
+		records and closes the trace file. Does nothing if the slot is empty
+*/
+extern void	GMOperationRecorderStop (GMOperationRecorderSlot * a_pSlot);
+
+/* Records one operation if a_pSlot holds a recorder. a_pRecord supplies every field except recordSize,
+		pathLength, path2Length, timestamp and tid, which are filled in here. a_uStart is the operation's
+		GMOperationRecorderNow() at entry. Either path may be NULL
+*/
+extern void	GMOperationRecorderRecord (GMOperationRecorderSlot * a_pSlot, GMOperationTraceRecord * a_pRecord, uint64_t a_uStart, const char * a_pszPath, const char * a_pszPath2);
@@ -0,0 +1,320 @@
+//
+//  GMOperationRecorder.m
+//  OSXFUSE
+//
+
+//  Operation trace recorder. See GMOperationRecorder.h and GMOperationTrace.h
+
+#import "GMAvailability.h"						/* Always include this first */
+#import "GMOperationRecorder.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define RECORDER_RING_SIZE				(1024 * 1024)		/* Per thread. Must be a power of 2 */
+#define RECORDER_FLUSH_INTERVAL_NS		100000000				/* Drain the rings every 100ms */
+#define RECORDER_MAX_PATH					UINT16_MAX
+
+typedef struct GMOperationRing
+	{
+  struct GMOperationRing *	m_pNext;
+  pthread_t									m_Thread;				/* The recording thread */
+  uint32_t									m_uTID;
+  uint64_t									m_uHead;				/* Written by the recording thread only */
+  uint64_t									m_uTail;				/* Written by the flusher thread only */
+  unsigned char							m_abData [RECORDER_RING_SIZE];
+  } GMOperationRing;
+
+struct GMOperationRecorder
+	{
+  uint64_t					m_uGeneration;						/* Unique for each recorder. Identifies stale per-thread rings */
+  uint64_t					m_uStart;									/* GMOperationRecorderNow() when recording started */
+  FILE *						m_pFile;
+  pthread_mutex_t		m_Mutex;									/* Protects m_bStopping. Held by the flusher while it writes */
+  pthread_cond_t		m_Cond;
+  pthread_t					m_Flusher;
+  BOOL							m_bStopping;
+  GMOperationRing *	m_pRings;									/* Pushed atomically. Freed only once the flusher has stopped */
+  uint32_t					m_cThreads;								/* Updated atomically */
+  uint64_t					m_cDropped;								/* Updated atomically */
+  };
+
+int	g_cGMOperationRecorders;
+
+static uint64_t		g_uNextGeneration = 1;
+
+static __thread GMOperationRing *	t_pRing;
+static __thread uint64_t					t_uRingGeneration;
+
+static void	RingPut (GMOperationRing * a_pRing, uint64_t * a_puPos, const void * a_pv, size_t a_cb)
+	{
+  size_t	uIndex = (size_t) (*a_puPos & (RECORDER_RING_SIZE - 1));
+  size_t	cbFirst = RECORDER_RING_SIZE - uIndex;
+
+  if (cbFirst > a_cb)
+    cbFirst = a_cb;
+  memcpy (&a_pRing->m_abData [uIndex], a_pv, cbFirst);
+  if (a_cb > cbFirst)
+    memcpy (&a_pRing->m_abData [0], (const unsigned char *) a_pv + cbFirst, a_cb - cbFirst);
+  *a_puPos += a_cb;
+  }
+
+/* Writes everything the recording thread has published. Called by the flusher */
+static void	RingDrain (GMOperationRecorder * a_pRecorder, GMOperationRing * a_pRing)
+	{
+  uint64_t	uHead = __atomic_load_n (&a_pRing->m_uHead, __ATOMIC_ACQUIRE);
+  uint64_t	uTail = a_pRing->m_uTail;
+
+  while (uTail != uHead)
+    {
+    size_t	uIndex = (size_t) (uTail & (RECORDER_RING_SIZE - 1));
+    size_t	cb = RECORDER_RING_SIZE - uIndex;
+
+    if (cb > uHead - uTail)
+      cb = (size_t) (uHead - uTail);
+    fwrite (&a_pRing->m_abData [uIndex], 1, cb, a_pRecorder->m_pFile);
+    uTail += cb;
+    }
+  __atomic_store_n (&a_pRing->m_uTail, uTail, __ATOMIC_RELEASE);
+  }
+
+static void *	FlusherThread (void * a_pv)
+	{
+  GMOperationRecorder *	pRecorder = a_pv;
+  GMOperationRing *			pRing;
+  BOOL									bStopping;
+
+  pthread_mutex_lock (&pRecorder->m_Mutex);
+  do
+    {
+    struct timespec	tsWait;
+
+    clock_gettime (CLOCK_REALTIME, &tsWait);
+    tsWait.tv_nsec += RECORDER_FLUSH_INTERVAL_NS;
+    if (tsWait.tv_nsec >= 1000000000)
+      {
+      tsWait.tv_sec++;
+      tsWait.tv_nsec -= 1000000000;
+      }
+    if (!pRecorder->m_bStopping)
+      pthread_cond_timedwait (&pRecorder->m_Cond, &pRecorder->m_Mutex, &tsWait);
+    bStopping = pRecorder->m_bStopping;
+    for (pRing = __atomic_load_n (&pRecorder->m_pRings, __ATOMIC_ACQUIRE); pRing != NULL; pRing = pRing->m_pNext)
+      RingDrain (pRecorder, pRing);
+    fflush (pRecorder->m_pFile);
+    }
+  while (!bStopping);
+  pthread_mutex_unlock (&pRecorder->m_Mutex);
+  return NULL;
+  }
+
+/* Returns the calling thread's ring for a_pRecorder, creating it if necessary. Returns NULL if there is no memory.
+		Only the last ring used is remembered, so a thread that serves several recording mounts, such as a
+    GMSessionDispatcher worker, finds its ring in the recorder's list when it switches. The ring is pushed onto
+    the list without m_Mutex, which the flusher holds while it writes
+*/
+static GMOperationRing *	ThreadRing (GMOperationRecorder * a_pRecorder)
+	{
+  GMOperationRing *	pRing;
+  pthread_t					Self;
+
+  if (t_uRingGeneration == a_pRecorder->m_uGeneration)
+    return t_pRing;
+
+  Self = pthread_self ();
+  for (pRing = __atomic_load_n (&a_pRecorder->m_pRings, __ATOMIC_ACQUIRE); pRing != NULL; pRing = pRing->m_pNext)
+    if (pthread_equal (pRing->m_Thread, Self))
+      break;
+  if (pRing == NULL)
+    {
+    pRing = calloc (1, sizeof (GMOperationRing));
+    if (pRing == NULL)
+      return NULL;
+    pRing->m_Thread = Self;
+    pRing->m_uTID = __atomic_add_fetch (&a_pRecorder->m_cThreads, 1, __ATOMIC_RELAXED);
+    pRing->m_pNext = __atomic_load_n (&a_pRecorder->m_pRings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n (&a_pRecorder->m_pRings, &pRing->m_pNext, pRing, YES, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      ;
+    }
+
+  t_pRing = pRing;
+  t_uRingGeneration = a_pRecorder->m_uGeneration;
+  return pRing;
+  }
+
+int	GMOperationRecorderStart (GMOperationRecorderSlot * a_pSlot, const char * a_pszPath)
+	{
+  GMOperationRecorder *		pRecorder;
+  GMOperationTraceHeader	Header;
+  GMOperationRecorder *		pExpected;
+  struct timespec					tsNow;
+  int											iErrno;
+
+  if (__atomic_load_n (&a_pSlot->m_pRecorder, __ATOMIC_ACQUIRE) != NULL)
+    return EBUSY;
+
+  pRecorder = calloc (1, sizeof (GMOperationRecorder));
+  if (pRecorder == NULL)
+    return ENOMEM;
+  pRecorder->m_pFile = fopen (a_pszPath, "wb");
+  if (pRecorder->m_pFile == NULL)
+    {
+    iErrno = errno;
+    free (pRecorder);
+    return iErrno;
+    }
+
+  memset (&Header, 0, sizeof (Header));
+  memcpy (Header.magic, kGMOperationTraceMagic, sizeof (Header.magic));
+  Header.version = kGMOperationTraceVersion;
+  Header.headerSize = sizeof (Header);
+  clock_gettime (CLOCK_REALTIME, &tsNow);
+  Header.startTime = (uint64_t) tsNow.tv_sec * 1000000000ULL + (uint64_t) tsNow.tv_nsec;
+  if (fwrite (&Header, sizeof (Header), 1, pRecorder->m_pFile) != 1)
+    {
+    iErrno = errno;
+    fclose (pRecorder->m_pFile);
+    free (pRecorder);
+    return (iErrno != 0) ? iErrno : EIO;
+    }
+
+  pRecorder->m_uGeneration = __atomic_fetch_add (&g_uNextGeneration, 1, __ATOMIC_RELAXED);
+  pRecorder->m_uStart = GMOperationRecorderNow ();
+  pthread_mutex_init (&pRecorder->m_Mutex, NULL);
+  pthread_cond_init (&pRecorder->m_Cond, NULL);
+  iErrno = pthread_create (&pRecorder->m_Flusher, NULL, FlusherThread, pRecorder);
+  if (iErrno != 0)
+    {
+    pthread_cond_destroy (&pRecorder->m_Cond);
+    pthread_mutex_destroy (&pRecorder->m_Mutex);
+    fclose (pRecorder->m_pFile);
+    free (pRecorder);
+    return iErrno;
+    }
+
+  __atomic_add_fetch (&g_cGMOperationRecorders, 1, __ATOMIC_RELAXED);
+  pExpected = NULL;
+  if (!__atomic_compare_exchange_n (&a_pSlot->m_pRecorder, &pExpected, pRecorder, NO, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    {
+    GMOperationRecorderSlot	Private;									/* Lost a race with another start */
+
+    memset (&Private, 0, sizeof (Private));
+    Private.m_pRecorder = pRecorder;
+    GMOperationRecorderStop (&Private);
+    return EBUSY;
+    }
+  return 0;
+  }
+
+void	GMOperationRecorderStop (GMOperationRecorderSlot * a_pSlot)
+	{
+  GMOperationRecorder *	pRecorder;
+  GMOperationRing *			pRing;
+  uint64_t							cDropped;
+  unsigned int					uEpoch;
+
+  pRecorder = __atomic_exchange_n (&a_pSlot->m_pRecorder, NULL, __ATOMIC_SEQ_CST);
+  if (pRecorder == NULL)
+    return;
+  __atomic_sub_fetch (&g_cGMOperationRecorders, 1, __ATOMIC_RELAXED);
+
+  /* A thread which loaded the old pointer counted itself in the half for the epoch it saw, and checked
+  		that the epoch hadn't moved on, before loading it. Threads that arrive after the epoch advances
+  		count themselves in the other half and find the slot empty, so the old half only drains
+  */
+  uEpoch = __atomic_fetch_add (&a_pSlot->m_uEpoch, 1, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n (&a_pSlot->m_acWriters [uEpoch & 1], __ATOMIC_SEQ_CST) != 0)
+    usleep (100);
+
+  pthread_mutex_lock (&pRecorder->m_Mutex);
+  pRecorder->m_bStopping = YES;
+  pthread_cond_signal (&pRecorder->m_Cond);
+  pthread_mutex_unlock (&pRecorder->m_Mutex);
+  pthread_join (pRecorder->m_Flusher, NULL);
+
+  cDropped = __atomic_load_n (&pRecorder->m_cDropped, __ATOMIC_RELAXED);
+  if (cDropped != 0)
+    {
+    GMOperationTraceRecord	Record;
+
+    memset (&Record, 0, sizeof (Record));
+    Record.recordSize = sizeof (Record);
+    Record.op = GMOperationTraceOpDropped;
+    Record.timestamp = GMOperationRecorderNow () - pRecorder->m_uStart;
+    Record.size = cDropped;
+    fwrite (&Record, sizeof (Record), 1, pRecorder->m_pFile);
+    }
+  fclose (pRecorder->m_pFile);
+
+  while ((pRing = pRecorder->m_pRings) != NULL)
+    {
+    pRecorder->m_pRings = pRing->m_pNext;
+    free (pRing);
+    }
+  pthread_cond_destroy (&pRecorder->m_Cond);
+  pthread_mutex_destroy (&pRecorder->m_Mutex);
+  free (pRecorder);
+  }
+
+void	GMOperationRecorderRecord (GMOperationRecorderSlot * a_pSlot, GMOperationTraceRecord * a_pRecord, uint64_t a_uStart, const char * a_pszPath, const char * a_pszPath2)
+	{
+  static const unsigned char	abZeros [8] = { 0 };
+  GMOperationRecorder *	pRecorder;
+  GMOperationRing *			pRing;
+  size_t								cbPath;
+  size_t								cbPath2;
+  uint32_t							cbRecord;
+  uint64_t							uHead;
+  uint64_t							uTail;
+  unsigned int					uEpoch;
+
+  for (;;)
+    {
+    uEpoch = __atomic_load_n (&a_pSlot->m_uEpoch, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch (&a_pSlot->m_acWriters [uEpoch & 1], 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n (&a_pSlot->m_uEpoch, __ATOMIC_SEQ_CST) == uEpoch)
+      break;
+    __atomic_sub_fetch (&a_pSlot->m_acWriters [uEpoch & 1], 1, __ATOMIC_SEQ_CST);		/* A stop is under way */
+    }
+  pRecorder = __atomic_load_n (&a_pSlot->m_pRecorder, __ATOMIC_SEQ_CST);
+  if (pRecorder != NULL)
+    {
+    cbPath = (a_pszPath != NULL) ? strlen (a_pszPath) : 0;
+    cbPath2 = (a_pszPath2 != NULL) ? strlen (a_pszPath2) : 0;
+    if (cbPath > RECORDER_MAX_PATH)
+      cbPath = RECORDER_MAX_PATH;
+    if (cbPath2 > RECORDER_MAX_PATH)
+      cbPath2 = RECORDER_MAX_PATH;
+    cbRecord = (uint32_t) ((sizeof (GMOperationTraceRecord) + cbPath + 1 + cbPath2 + 1 + 7) & ~(size_t) 7);
+
+    pRing = ThreadRing (pRecorder);
+    if (pRing == NULL)
+      __atomic_add_fetch (&pRecorder->m_cDropped, 1, __ATOMIC_RELAXED);
+    else
+      {
+      uHead = pRing->m_uHead;
+      uTail = __atomic_load_n (&pRing->m_uTail, __ATOMIC_ACQUIRE);
+      if (uHead - uTail + cbRecord > RECORDER_RING_SIZE)
+        __atomic_add_fetch (&pRecorder->m_cDropped, 1, __ATOMIC_RELAXED);
+      else
+        {
+        a_pRecord->recordSize = cbRecord;
+        a_pRecord->pathLength = (uint16_t) cbPath;
+        a_pRecord->path2Length = (uint16_t) cbPath2;
+        a_pRecord->timestamp = (a_uStart > pRecorder->m_uStart) ? a_uStart - pRecorder->m_uStart : 0;
+        a_pRecord->tid = pRing->m_uTID;
+        RingPut (pRing, &uHead, a_pRecord, sizeof (GMOperationTraceRecord));
+        RingPut (pRing, &uHead, (a_pszPath != NULL) ? a_pszPath : "", cbPath);
+        RingPut (pRing, &uHead, abZeros, 1);
+        RingPut (pRing, &uHead, (a_pszPath2 != NULL) ? a_pszPath2 : "", cbPath2);
+        RingPut (pRing, &uHead, abZeros, cbRecord - sizeof (GMOperationTraceRecord) - cbPath - 1 - cbPath2);
+        __atomic_store_n (&pRing->m_uHead, uHead, __ATOMIC_RELEASE);
+        }
+      }
+    }
+  __atomic_sub_fetch (&a_pSlot->m_acWriters [uEpoch & 1], 1, __ATOMIC_SEQ_CST);
+  }
@@ -0,0 +1,94 @@
+//
+//  GMOperationTrace.h
+//  OSXFUSE
+//
+
+//  File format of the operation traces written by
+//  -[GMUserFileSystem startRecordingOperationsToPath:error:].
+//
+//  A trace file is a GMOperationTraceHeader followed by a sequence of
+//  GMOperationTraceRecord. Each record is followed by its path, a NUL, its
+//  second path (rename, link, symlink, exchange, the destination of
+//  copy_file_range and the extended attribute name for xattr operations), a
+//  NUL, then padding to a multiple of 8 bytes. recordSize covers the record,
+//  the paths and the padding, so a reader can skip records it doesn't
+//  understand. Records from different threads are
+//  interleaved in the order in which they were flushed, which is not
+//  necessarily timestamp order. All fields are in host byte order.
+
+#import "GMAvailability.h"
+
+#include <stdint.h>
+
+#define kGMOperationTraceMagic		"GMOPTRC1"
+#define kGMOperationTraceVersion	1
+
+typedef enum {
+  GMOperationTraceOpNone = 0,
+  GMOperationTraceOpGetattr,
+  GMOperationTraceOpFgetattr,
+  GMOperationTraceOpReadlink,
+  GMOperationTraceOpMkdir,
+  GMOperationTraceOpUnlink,
+  GMOperationTraceOpRmdir,
+  GMOperationTraceOpSymlink,
+  GMOperationTraceOpRename,
+  GMOperationTraceOpLink,
+  GMOperationTraceOpChmod,
+  GMOperationTraceOpChown,
+  GMOperationTraceOpTruncate,
+  GMOperationTraceOpFtruncate,
+  GMOperationTraceOpUtimens,
+  GMOperationTraceOpOpen,
+  GMOperationTraceOpRead,
+  GMOperationTraceOpWrite,
+  GMOperationTraceOpStatfs,
+  GMOperationTraceOpRelease,
+  GMOperationTraceOpFsync,
+  GMOperationTraceOpSetxattr,
+  GMOperationTraceOpGetxattr,
+  GMOperationTraceOpListxattr,
+  GMOperationTraceOpRemovexattr,
+  GMOperationTraceOpReaddir,
+  GMOperationTraceOpCreate,
+  GMOperationTraceOpAccess,
+  GMOperationTraceOpFallocate,
+  GMOperationTraceOpExchange,         // OS X/Darwin only
+  GMOperationTraceOpSetattr,          // OS X/Darwin setattr_x and fsetattr_x
+  GMOperationTraceOpGetxtimes,        // OS X/Darwin only
+  GMOperationTraceOpSetvolname,       // OS X/Darwin only
+  GMOperationTraceOpFlush,            // Only with a small file size
+  GMOperationTraceOpCopyFileRange,    // libfuse 3 only. The destination offset isn't recorded
+  GMOperationTraceOpLseek,            // libfuse 3 only. size is the offset found, flags the whence
+
+  // Written once when recording stops. size is the number of records that
+  // were dropped because a thread's buffer was full.
+  GMOperationTraceOpDropped = 0xFFFF
+} GMOperationTraceOp;
+
+typedef struct {
+  char magic[8];          // kGMOperationTraceMagic, not NUL terminated
+  uint32_t version;       // kGMOperationTraceVersion
+  uint32_t headerSize;    // sizeof(GMOperationTraceHeader)
+  uint64_t startTime;     // Wall clock time when recording started, in ns since 1970
+} GMOperationTraceHeader;
+
+typedef struct {
+  uint32_t recordSize;    // Including the paths and padding
+  uint16_t op;            // GMOperationTraceOp
+  uint16_t pathLength;    // Excluding the NUL
+  uint16_t path2Length;   // Excluding the NUL. 0 if there is no second path
+  uint16_t reserved;
+  int32_t result;         // 0 or a byte count on success, -errno on failure
+  uint64_t timestamp;     // Operation entry, in ns since recording started
+  uint64_t latency;       // ns
+  int64_t offset;         // read, write, truncate, fallocate, readdir, xattr position. New uid for chown
+  uint64_t size;          // Requested size for read, write, xattr and readlink. New size for setattr. New gid for chown
+  uint64_t handle;        // The open file's fuse_file_info fh, or 0
+  uint32_t flags;         // Open flags, mode, access mask, fsync datasync, xattr options or setattr valid mask
+  uint32_t tid;           // Small per-recording thread number, starting at 1
+  uint32_t pid;           // Calling process
+  uint32_t uid;
+  uint32_t gid;
+  uint32_t reserved2;
+} GMOperationTraceRecord;
@@ -0,0 +1,96 @@
+//
+//  GMPath.h
+//  OSXFUSE
+//
+
+//  A file system path with its hash and components precomputed. Covered by the
+//  same license as the OSXFUSE framework.
+
+#import "GMAvailability.h"
+
+// Exports the class from the framework, as in GMUserFileSystem.h.
+#define GM_EXPORT					__attribute__((visibility("default")))
+
+#if !defined (GM_EXPORT_INTERFACE)
+#if defined (__clang__) || defined (__APPLE__)
+#define	GM_EXPORT_INTERFACE			GM_EXPORT
+#else
+#define GM_EXPORT_INTERFACE
+#endif	/* defined (__clang__) || defined (__APPLE__) */
+#endif	/* !defined (GM_EXPORT_INTERFACE) */
+
+/*!
+ * @header GMPath
+ *
+ * Delegates that key their own tables on paths spend much of each operation
+ * decoding the path and hashing it again. A GMPath keeps the UTF-8 bytes the
+ * kernel passed, their hash and the offsets of the components, and creates an
+ * NSString only when asked.<br>
+ *
+ * When the mount profile sets internPaths, the file system keeps a per-thread
+ * cache of recently seen paths and passes the delegate their NSStrings. Calling
+ * +pathWithString: with such a string during the operation returns its GMPath
+ * without decoding or hashing anything.
+ */
+
+/*!
+ * @class
+ * @discussion An immutable path. Two GMPaths are equal when their bytes are;
+ * the hash is computed once, so a GMPath is a cheap dictionary key. A GMPath is
+ * never equal to an NSString.
+ */
+GM_EXPORT_INTERFACE	@interface GMPath : NSObject <NSCopying> {
+ @private
+  char* bytes_;                     // NUL terminated.
+  NSUInteger length_;
+  NSUInteger hash_;
+  NSUInteger* componentOffsets_;    // Where each component starts in bytes_.
+  NSUInteger componentCount_;
+  NSString* string_;                // Created on first use.
+}
+
+/*!
+ * @abstract A new path for the given UTF-8 bytes.
+ */
++ (GMPath *)pathWithUTF8String:(const char *)path GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract The path for a string.
+ * @discussion If string was passed to the delegate by the file system on this
+ * thread and is still in its cache, the cached path is returned. Otherwise a
+ * new path is made from string. Returns nil for a nil string, such as the
+ * path of an open file under the mount profile's noPath.
+ */
++ (GMPath *)pathWithString:(NSString *)string GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract A path from this thread's cache of recently seen paths.
+ * @discussion The path is added to the cache, replacing an older one, if it
+ * isn't already there. Its NSString is created at once, so that it can be
+ * found again with +pathWithString:.
+ */
++ (GMPath *)internedPathWithUTF8String:(const char *)path GM_AVAILABLE(3_8);
+
+/*! @abstract The UTF-8 bytes, NUL terminated. Valid as long as the path. */
+- (const char *)UTF8String GM_AVAILABLE(3_8);
+
+/*! @abstract The number of bytes, without the NUL. */
+- (NSUInteger)length GM_AVAILABLE(3_8);
+
+- (BOOL)isEqualToPath:(GMPath *)path GM_AVAILABLE(3_8);
+
+/*! @abstract The path as an NSString, created on first use. */
+- (NSString *)string GM_AVAILABLE(3_8);
+
+/*! @abstract The number of components. "/" has none. */
+- (NSUInteger)componentCount GM_AVAILABLE(3_8);
+
+/*! @abstract The bytes of a component within UTF8String. */
+- (NSRange)rangeOfComponentAtIndex:(NSUInteger)index GM_AVAILABLE(3_8);
+
+/*! @abstract A component as a new NSString. */
+- (NSString *)componentAtIndex:(NSUInteger)index GM_AVAILABLE(3_8);
+
+@end
+
+#undef GM_EXPORT
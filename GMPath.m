@@ -0,0 +1,246 @@
+//
+//  GMPath.m
+//  OSXFUSE
+//
+
+//  A file system path with its hash and components precomputed. Covered by the
+//  same license as the OSXFUSE framework.
+
+#import "GMAvailability.h"						/* Always include this first */
+#import "GMPath.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PATH_INTERN_SLOTS				256						/* Per thread. Must be a power of 2 */
+
+/* The per-thread cache of recently seen paths. Both tables are direct mapped: a path replaces whatever was
+		in its slot. m_apoByHash finds a path from its bytes, m_apoByString from the NSString passed to the
+    delegate. Each holds a retain
+*/
+typedef struct
+	{
+  GMPath *	m_apoByHash [PATH_INTERN_SLOTS];
+  GMPath *	m_apoByString [PATH_INTERN_SLOTS];
+  } GMPathInternTable;
+
+static pthread_key_t			g_InternKey;						/* Frees a thread's table when it exits */
+static pthread_once_t			g_InternKeyOnce = PTHREAD_ONCE_INIT;
+static __thread GMPathInternTable *	t_pInternTable;
+
+static NSUInteger	HashPath (const char * a_pszPath, size_t * a_pcchPath)
+	{
+  const unsigned char *	pch = (const unsigned char *) a_pszPath;
+  uint64_t							uHash = 14695981039346656037ULL;
+
+  while (*pch != '\0')
+  	{
+    uHash ^= *pch++;
+    uHash *= 1099511628211ULL;
+    }
+  *a_pcchPath = (size_t) (pch - (const unsigned char *) a_pszPath);
+  return (NSUInteger) uHash;
+  }
+
+static void	FreeInternTable (void * a_pv)
+	{
+  GMPathInternTable *	pTable = (GMPathInternTable *) a_pv;
+
+  for (int i = 0; i < PATH_INTERN_SLOTS; i++)
+  	{
+    [pTable->m_apoByHash [i] release];
+    [pTable->m_apoByString [i] release];
+    }
+  free (pTable);
+  }
+
+static void	CreateInternKey (void)
+	{
+  pthread_key_create (&g_InternKey, FreeInternTable);
+  }
+
+/* Returns the calling thread's table, creating it if a_bCreate. NULL if there isn't one */
+static GMPathInternTable *	InternTable (BOOL a_bCreate)
+	{
+  if ((t_pInternTable == NULL) && a_bCreate)
+  	{
+    pthread_once (&g_InternKeyOnce, CreateInternKey);
+    t_pInternTable = (GMPathInternTable *) calloc (1, sizeof (GMPathInternTable));
+    if (t_pInternTable != NULL)
+      pthread_setspecific (g_InternKey, t_pInternTable);
+    }
+  return t_pInternTable;
+  }
+
+static inline size_t	StringSlot (NSString * a_poszString)
+	{
+  return ((uintptr_t) a_poszString >> 4) & (PATH_INTERN_SLOTS - 1);
+  }
+
+@implementation GMPath
+
+- (id)init {
+  [self release];
+  return nil;
+}
+
+- (id)initWithUTF8String:(const char *)path
+                  length:(size_t)length
+                    hash:(NSUInteger)hash {
+  self = [super init];
+  if (self) {
+    bytes_ = (char *)malloc(length + 1);
+    if (bytes_ == NULL) {
+      [self release];
+      return nil;
+    }
+    memcpy(bytes_, path, length + 1);
+    length_ = length;
+    hash_ = hash;
+
+    for (size_t i = 0; i < length; ++i) {
+      if (bytes_[i] != '/' && (i == 0 || bytes_[i - 1] == '/')) {
+        ++componentCount_;
+      }
+    }
+    if (componentCount_ > 0) {
+      componentOffsets_ = (NSUInteger *)malloc(componentCount_ * sizeof(NSUInteger));
+      if (componentOffsets_ == NULL) {
+        [self release];
+        return nil;
+      }
+      NSUInteger component = 0;
+      for (size_t i = 0; i < length; ++i) {
+        if (bytes_[i] != '/' && (i == 0 || bytes_[i - 1] == '/')) {
+          componentOffsets_[component++] = i;
+        }
+      }
+    }
+  }
+  return self;
+}
+
+- (void)dealloc {
+  free(bytes_);
+  free(componentOffsets_);
+  [string_ release];
+  [super dealloc];
+}
+
++ (GMPath *)pathWithUTF8String:(const char *)path {
+  size_t length = 0;
+  NSUInteger hash = HashPath(path, &length);
+  return [[[self alloc] initWithUTF8String:path length:length hash:hash] autorelease];
+}
+
++ (GMPath *)pathWithString:(NSString *)string {
+  if (string == nil) {
+    return nil;
+  }
+  GMPathInternTable* table = InternTable(NO);
+  if (table != NULL) {
+    GMPath* path = table->m_apoByString[StringSlot(string)];
+    if (path != nil && path->string_ == string) {
+      return [[path retain] autorelease];
+    }
+  }
+  return [self pathWithUTF8String:[string UTF8String]];
+}
+
++ (GMPath *)internedPathWithUTF8String:(const char *)path {
+  GMPathInternTable* table = InternTable(YES);
+  if (table == NULL) {
+    return [self pathWithUTF8String:path];
+  }
+
+  size_t length = 0;
+  NSUInteger hash = HashPath(path, &length);
+  size_t slot = hash & (PATH_INTERN_SLOTS - 1);
+  GMPath* interned = table->m_apoByHash[slot];
+  if (interned == nil || interned->hash_ != hash || interned->length_ != length ||
+      memcmp(interned->bytes_, path, length) != 0) {
+    interned = [[self alloc] initWithUTF8String:path length:length hash:hash];
+    if (interned == nil) {
+      return nil;
+    }
+    [table->m_apoByHash[slot] release];
+    table->m_apoByHash[slot] = interned;
+  }
+
+  // The string may have lost its slot to another since it was last used.
+  NSString* string = [interned string];
+  if (string != nil) {
+    size_t stringSlot = StringSlot(string);
+    if (table->m_apoByString[stringSlot] != interned) {
+      [table->m_apoByString[stringSlot] release];
+      table->m_apoByString[stringSlot] = [interned retain];
+    }
+  }
+  return [[interned retain] autorelease];
+}
+
+- (id)copyWithZone:(NSZone *)zone {
+  (void) zone;											/* Immutable */
+  return [self retain];
+}
+
+- (NSString *)description {
+  return [NSString stringWithFormat:@"%@ %s", [super description], bytes_];
+}
+
+- (const char *)UTF8String { return bytes_; }
+- (NSUInteger)length { return length_; }
+- (NSUInteger)hash { return hash_; }
+
+- (BOOL)isEqualToPath:(GMPath *)path {
+  return path == self ||
+         (path != nil && path->hash_ == hash_ && path->length_ == length_ &&
+          memcmp(path->bytes_, bytes_, length_) == 0);
+}
+
+- (BOOL)isEqual:(id)object {
+  return [object isKindOfClass:[GMPath class]] && [self isEqualToPath:object];
+}
+
+// Created at most once, even when several threads ask at the same time.
+- (NSString *)string {
+  NSString* string = __atomic_load_n(&string_, __ATOMIC_ACQUIRE);
+  if (string == nil) {
+    NSString* created = [[NSString alloc] initWithBytes:bytes_
+                                                 length:length_
+                                               encoding:NSUTF8StringEncoding];
+    NSString* expected = nil;
+    if (created == nil ||
+        __atomic_compare_exchange_n(&string_, &expected, created, NO,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      string = created;
+    } else {
+      [created release];
+      string = expected;
+    }
+  }
+  return string;
+}
+
+- (NSUInteger)componentCount { return componentCount_; }
+
+- (NSRange)rangeOfComponentAtIndex:(NSUInteger)index {
+  if (index >= componentCount_) {
+    [NSException raise:NSRangeException
+                format:@"Component %lu of %lu", (unsigned long)index,
+                       (unsigned long)componentCount_];
+  }
+  NSUInteger start = componentOffsets_[index];
+  const char* end = memchr(bytes_ + start, '/', length_ - start);
+  return NSMakeRange(start, (end != NULL) ? (NSUInteger)(end - bytes_) - start : length_ - start);
+}
+
+- (NSString *)componentAtIndex:(NSUInteger)index {
+  NSRange range = [self rangeOfComponentAtIndex:index];
+  return [[[NSString alloc] initWithBytes:bytes_ + range.location
+                                   length:range.length
+                                 encoding:NSUTF8StringEncoding] autorelease];
+}
+
+@end
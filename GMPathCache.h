@@ -0,0 +1,49 @@
+//
+//  GMPathCache.h
+//  OSXFUSE
+//
+
+//  Private interface to a bounded, path keyed cache used by GMUserFileSystem to
+//  answer repeated lookups without calling the delegate. This header is not
+//  installed with the framework.
+//
+//  Entries expire after a fixed time and the least recently used entry is
+//  evicted when the cache is full. Each entry holds a retained object, which
+//  may be nil when only the presence of the path matters.
+//
+//  Every invalidation advances the cache's generation. A caller that misses,
+//  asks the delegate and then inserts the answer passes the generation returned
+//  by the lookup, so an answer that raced with a change to the file system is
+//  not cached.
+
+#import "GMAvailability.h"						/* Always include this first */
+
+#import <Foundation/Foundation.h>
+
+typedef struct GMPathCache	GMPathCache;
+
+/* Creates a disabled cache. Returns NULL if out of memory */
+extern GMPathCache *	GMPathCacheCreate (void);
+
+extern void	GMPathCacheDestroy (GMPathCache * a_pCache);
+
+/* Empties the cache and sets its size and expiry time. A size of 0 disables the cache. Returns 0 or an
+		errno value
+*/
+extern int	GMPathCacheConfigure (GMPathCache * a_pCache, unsigned int a_cEntriesMax, double a_dTimeout);
+
+extern BOOL	GMPathCacheIsEnabled (GMPathCache * a_pCache);
+
+/* Looks up a_pszPath. On a hit returns YES and, if a_ppoValue isn't NULL, the entry's object, retained and
+		autoreleased. On a miss returns NO. Either way, if a_puGeneration isn't NULL, returns the generation to
+    pass to GMPathCacheInsert(), so that an entry can also be replaced by one built from it
+*/
+extern BOOL	GMPathCacheLookup (GMPathCache * a_pCache, const char * a_pszPath, id * a_ppoValue, unsigned long * a_puGeneration);
+
+/* Caches a_poValue, which may be nil, for a_pszPath unless the cache has been invalidated since
+		a_uGeneration was returned
+*/
+extern void	GMPathCacheInsert (GMPathCache * a_pCache, const char * a_pszPath, id a_poValue, unsigned long a_uGeneration);
+
+/* Removes a_pszPath and, if a_bDescendants, every path below it. A NULL a_pszPath removes everything */
+extern void	GMPathCacheRemove (GMPathCache * a_pCache, const char * a_pszPath, BOOL a_bDescendants);
@@ -0,0 +1,351 @@
+//
+//  GMPathCache.m
+//  OSXFUSE
+//
+
+//  Bounded path keyed cache. See GMPathCache.h
+
+#import "GMAvailability.h"						/* Always include this first */
+#import "GMPathCache.h"
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PATH_CACHE_MIN_BUCKETS		16
+
+typedef struct GMPathCacheEntry
+	{
+  struct GMPathCacheEntry *	m_pNextInBucket;
+  struct GMPathCacheEntry *	m_pNewer;						/* LRU list, most recently used first */
+  struct GMPathCacheEntry *	m_pOlder;
+  uint64_t									m_uHash;
+  uint64_t									m_uExpires;
+  id												m_poValue;
+  size_t										m_cchPath;
+  char											m_szPath [];
+  } GMPathCacheEntry;
+
+struct GMPathCache
+	{
+  pthread_mutex_t			m_Mutex;
+  unsigned int				m_cEntriesMax;					/* Read without the mutex by GMPathCacheIsEnabled() */
+  unsigned int				m_cEntries;
+  uint64_t						m_uTimeout;							/* Nanoseconds */
+  unsigned long				m_uGeneration;
+  size_t							m_cBuckets;							/* Power of 2 */
+  GMPathCacheEntry **	m_ppBuckets;
+  GMPathCacheEntry *	m_pNewest;
+  GMPathCacheEntry *	m_pOldest;
+  };
+
+static uint64_t	Now (void)
+	{
+  struct timespec	ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+  }
+
+/* FNV-1a */
+static uint64_t	HashPath (const char * a_pszPath, size_t * a_pcchPath)
+	{
+  const unsigned char *	pch = (const unsigned char *) a_pszPath;
+  uint64_t							uHash = 14695981039346656037ULL;
+
+  while (*pch != '\0')
+    {
+    uHash ^= *pch++;
+    uHash *= 1099511628211ULL;
+    }
+  *a_pcchPath = (size_t) (pch - (const unsigned char *) a_pszPath);
+  return uHash;
+  }
+
+static void	Unlink (GMPathCache * a_pCache, GMPathCacheEntry * a_pEntry)
+	{
+  GMPathCacheEntry **	ppEntry = &a_pCache->m_ppBuckets [a_pEntry->m_uHash & (a_pCache->m_cBuckets - 1)];
+
+  while (*ppEntry != a_pEntry)
+    ppEntry = &(*ppEntry)->m_pNextInBucket;
+  *ppEntry = a_pEntry->m_pNextInBucket;
+
+  if (a_pEntry->m_pNewer != NULL)
+    a_pEntry->m_pNewer->m_pOlder = a_pEntry->m_pOlder;
+  else
+    a_pCache->m_pNewest = a_pEntry->m_pOlder;
+  if (a_pEntry->m_pOlder != NULL)
+    a_pEntry->m_pOlder->m_pNewer = a_pEntry->m_pNewer;
+  else
+    a_pCache->m_pOldest = a_pEntry->m_pNewer;
+
+  a_pCache->m_cEntries--;
+  }
+
+/* Called with the mutex held. The entry is added to *a_ppRemoved, to be freed by FreeEntries() once the
+		mutex has been released, because releasing its object may run arbitrary code
+*/
+static void	RemoveEntry (GMPathCache * a_pCache, GMPathCacheEntry * a_pEntry, GMPathCacheEntry ** a_ppRemoved)
+	{
+  Unlink (a_pCache, a_pEntry);
+  a_pEntry->m_pNextInBucket = *a_ppRemoved;
+  *a_ppRemoved = a_pEntry;
+  }
+
+static void	FreeEntries (GMPathCacheEntry * a_pEntry)
+	{
+  GMPathCacheEntry *	pNext;
+
+  for ( ; a_pEntry != NULL; a_pEntry = pNext)
+    {
+    pNext = a_pEntry->m_pNextInBucket;
+    [a_pEntry->m_poValue release];
+    free (a_pEntry);
+    }
+  }
+
+static void	MakeNewest (GMPathCache * a_pCache, GMPathCacheEntry * a_pEntry)
+	{
+  if (a_pCache->m_pNewest == a_pEntry)
+    return;
+
+  /* Not the newest, so it has a newer neighbour */
+  a_pEntry->m_pNewer->m_pOlder = a_pEntry->m_pOlder;
+  if (a_pEntry->m_pOlder != NULL)
+    a_pEntry->m_pOlder->m_pNewer = a_pEntry->m_pNewer;
+  else
+    a_pCache->m_pOldest = a_pEntry->m_pNewer;
+
+  a_pEntry->m_pNewer = NULL;
+  a_pEntry->m_pOlder = a_pCache->m_pNewest;
+  a_pCache->m_pNewest->m_pNewer = a_pEntry;
+  a_pCache->m_pNewest = a_pEntry;
+  }
+
+static GMPathCacheEntry *	Find (GMPathCache * a_pCache, const char * a_pszPath, size_t a_cchPath, uint64_t a_uHash)
+	{
+  GMPathCacheEntry *	pEntry = a_pCache->m_ppBuckets [a_uHash & (a_pCache->m_cBuckets - 1)];
+
+  while (pEntry != NULL)
+    {
+    if (pEntry->m_uHash == a_uHash && pEntry->m_cchPath == a_cchPath && memcmp (pEntry->m_szPath, a_pszPath, a_cchPath) == 0)
+      break;
+    pEntry = pEntry->m_pNextInBucket;
+    }
+  return pEntry;
+  }
+
+/* Called with the mutex held */
+static void	RemoveAll (GMPathCache * a_pCache, GMPathCacheEntry ** a_ppRemoved)
+	{
+  while (a_pCache->m_pOldest != NULL)
+    RemoveEntry (a_pCache, a_pCache->m_pOldest, a_ppRemoved);
+  }
+
+GMPathCache *	GMPathCacheCreate (void)
+	{
+  GMPathCache *	pCache = calloc (1, sizeof (GMPathCache));
+
+  if (pCache == NULL)
+    return NULL;
+
+  if (pthread_mutex_init (&pCache->m_Mutex, NULL) != 0)
+    {
+    free (pCache);
+    return NULL;
+    }
+  return pCache;
+  }
+
+void	GMPathCacheDestroy (GMPathCache * a_pCache)
+	{
+  if (a_pCache == NULL)
+    return;
+
+  GMPathCacheConfigure (a_pCache, 0, 0);
+  pthread_mutex_destroy (&a_pCache->m_Mutex);
+  free (a_pCache);
+  }
+
+int	GMPathCacheConfigure (GMPathCache * a_pCache, unsigned int a_cEntriesMax, double a_dTimeout)
+	{
+  GMPathCacheEntry **	ppBuckets = NULL;
+  GMPathCacheEntry **	ppOldBuckets;
+  GMPathCacheEntry *	pRemoved = NULL;
+  size_t							cBuckets = 0;
+
+  if (a_cEntriesMax != 0)
+    {
+    if (!isfinite (a_dTimeout) || a_dTimeout <= 0)
+      return EINVAL;
+
+    cBuckets = PATH_CACHE_MIN_BUCKETS;
+    while (cBuckets < a_cEntriesMax)
+      cBuckets *= 2;
+    ppBuckets = calloc (cBuckets, sizeof (GMPathCacheEntry *));
+    if (ppBuckets == NULL)
+      return ENOMEM;
+    }
+
+  pthread_mutex_lock (&a_pCache->m_Mutex);
+  RemoveAll (a_pCache, &pRemoved);
+  ppOldBuckets = a_pCache->m_ppBuckets;
+  a_pCache->m_ppBuckets = ppBuckets;
+  a_pCache->m_cBuckets = cBuckets;
+  a_pCache->m_uTimeout = (uint64_t) (a_dTimeout * 1e9);
+  a_pCache->m_uGeneration++;
+  __atomic_store_n (&a_pCache->m_cEntriesMax, a_cEntriesMax, __ATOMIC_RELAXED);
+  pthread_mutex_unlock (&a_pCache->m_Mutex);
+
+  FreeEntries (pRemoved);
+  free (ppOldBuckets);
+  return 0;
+  }
+
+BOOL	GMPathCacheIsEnabled (GMPathCache * a_pCache)
+	{
+  return __atomic_load_n (&a_pCache->m_cEntriesMax, __ATOMIC_RELAXED) != 0;
+  }
+
+BOOL	GMPathCacheLookup (GMPathCache * a_pCache, const char * a_pszPath, id * a_ppoValue, unsigned long * a_puGeneration)
+	{
+  GMPathCacheEntry *	pEntry;
+  size_t							cchPath;
+  uint64_t						uHash;
+  GMPathCacheEntry *	pRemoved = NULL;
+  id									poValue = nil;
+  BOOL								bFound = NO;
+
+  if (!GMPathCacheIsEnabled (a_pCache))
+    {
+    if (a_puGeneration != NULL)
+      *a_puGeneration = 0;
+    return NO;
+    }
+
+  uHash = HashPath (a_pszPath, &cchPath);
+  pthread_mutex_lock (&a_pCache->m_Mutex);
+  if (a_pCache->m_cEntriesMax != 0)
+    {
+    pEntry = Find (a_pCache, a_pszPath, cchPath, uHash);
+    if (pEntry != NULL)
+      {
+      if (pEntry->m_uExpires > Now ())
+        {
+        MakeNewest (a_pCache, pEntry);
+        poValue = [pEntry->m_poValue retain];
+        bFound = YES;
+        }
+      else
+        RemoveEntry (a_pCache, pEntry, &pRemoved);
+      }
+    }
+  if (a_puGeneration != NULL)
+    *a_puGeneration = a_pCache->m_uGeneration;
+  pthread_mutex_unlock (&a_pCache->m_Mutex);
+
+  FreeEntries (pRemoved);
+  if (a_ppoValue != NULL)
+    *a_ppoValue = [poValue autorelease];
+  else
+    [poValue release];
+  return bFound;
+  }
+
+void	GMPathCacheInsert (GMPathCache * a_pCache, const char * a_pszPath, id a_poValue, unsigned long a_uGeneration)
+	{
+  GMPathCacheEntry *	pEntry;
+  size_t							cchPath;
+  uint64_t						uHash;
+  GMPathCacheEntry *	pRemoved = NULL;
+
+  if (!GMPathCacheIsEnabled (a_pCache))
+    return;
+
+  uHash = HashPath (a_pszPath, &cchPath);
+  pEntry = malloc (sizeof (GMPathCacheEntry) + cchPath + 1);
+  if (pEntry == NULL)
+    return;
+  memcpy (pEntry->m_szPath, a_pszPath, cchPath + 1);
+  pEntry->m_cchPath = cchPath;
+  pEntry->m_uHash = uHash;
+  pEntry->m_poValue = [a_poValue retain];
+
+  pthread_mutex_lock (&a_pCache->m_Mutex);
+  if (a_pCache->m_cEntriesMax == 0 || a_pCache->m_uGeneration != a_uGeneration)
+    {
+    pthread_mutex_unlock (&a_pCache->m_Mutex);
+    pEntry->m_pNextInBucket = NULL;
+    FreeEntries (pEntry);
+    return;
+    }
+
+  GMPathCacheEntry *	pOld = Find (a_pCache, a_pszPath, cchPath, uHash);
+
+  if (pOld != NULL)
+    RemoveEntry (a_pCache, pOld, &pRemoved);
+  else if (a_pCache->m_cEntries >= a_pCache->m_cEntriesMax)
+    RemoveEntry (a_pCache, a_pCache->m_pOldest, &pRemoved);
+
+  GMPathCacheEntry **	ppBucket = &a_pCache->m_ppBuckets [uHash & (a_pCache->m_cBuckets - 1)];
+
+  pEntry->m_uExpires = Now () + a_pCache->m_uTimeout;
+  pEntry->m_pNextInBucket = *ppBucket;
+  *ppBucket = pEntry;
+  pEntry->m_pNewer = NULL;
+  pEntry->m_pOlder = a_pCache->m_pNewest;
+  if (a_pCache->m_pNewest != NULL)
+    a_pCache->m_pNewest->m_pNewer = pEntry;
+  else
+    a_pCache->m_pOldest = pEntry;
+  a_pCache->m_pNewest = pEntry;
+  a_pCache->m_cEntries++;
+  pthread_mutex_unlock (&a_pCache->m_Mutex);
+
+  FreeEntries (pRemoved);
+  }
+
+void	GMPathCacheRemove (GMPathCache * a_pCache, const char * a_pszPath, BOOL a_bDescendants)
+	{
+  GMPathCacheEntry *	pEntry;
+  GMPathCacheEntry *	pNext;
+  GMPathCacheEntry *	pRemoved = NULL;
+  size_t							cchPath = 0;
+  uint64_t						uHash = 0;
+
+  if (!GMPathCacheIsEnabled (a_pCache))
+    return;
+
+  if (a_pszPath != NULL)
+    uHash = HashPath (a_pszPath, &cchPath);
+  pthread_mutex_lock (&a_pCache->m_Mutex);
+  a_pCache->m_uGeneration++;
+  if (a_pszPath == NULL)
+    RemoveAll (a_pCache, &pRemoved);
+  else if (a_pCache->m_cEntriesMax != 0)									/* Disabled since the check above */
+    {
+    pEntry = Find (a_pCache, a_pszPath, cchPath, uHash);
+    if (pEntry != NULL)
+      RemoveEntry (a_pCache, pEntry, &pRemoved);
+
+    if (a_bDescendants)
+      {
+      /* "/" is the only path that ends in a separator */
+      size_t	cchPrefix = (cchPath == 1) ? 0 : cchPath;
+
+      for (pEntry = a_pCache->m_pOldest; pEntry != NULL; pEntry = pNext)
+        {
+        pNext = pEntry->m_pNewer;
+        if (pEntry->m_cchPath > cchPrefix && pEntry->m_szPath [cchPrefix] == '/' && memcmp (pEntry->m_szPath, a_pszPath, cchPrefix) == 0)
+          RemoveEntry (a_pCache, pEntry, &pRemoved);
+        }
+      }
+    }
+  pthread_mutex_unlock (&a_pCache->m_Mutex);
+
+  FreeEntries (pRemoved);
+  }
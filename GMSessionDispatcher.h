@@ -0,0 +1,220 @@
+//
+//  GMSessionDispatcher.h
+//  OSXFUSE
+//
+
+//  Serves many mounted file systems from one set of threads. Covered by the
+//  same license as the OSXFUSE framework.
+
+#import "GMAvailability.h"
+
+// See "64-bit Class and Instance Variable Access Control"
+// Note: For reasons I don't understand, this definition cannot be placed in
+//			GMAvailability.h.
+//			If it is, the preprocessor on macOS thinks that while GM_EXPORT is
+//			defined in GMAvailability.h, it is not defined in this file, despite
+//			the #import.
+#define GM_EXPORT					__attribute__((visibility("default")))
+
+#if !defined (GM_EXPORT_INTERFACE)
+#if defined (__clang__) || defined (__APPLE__)
+#define	GM_EXPORT_INTERFACE			GM_EXPORT
+#else
+#define GM_EXPORT_INTERFACE
+#endif	/* defined (__clang__) || defined (__APPLE__) */
+#endif	/* !defined (GM_EXPORT_INTERFACE) */
+
+/*!
+ * @header GMSessionDispatcher
+ *
+ * By default each mounted GMUserFileSystem runs its own fuse_main() loop, with
+ * its own threads. A process that hosts many mounts can instead give them a
+ * shared GMSessionDispatcher with setSessionDispatcher: before mounting. One
+ * thread then waits for requests on every kernel connection and a fixed pool
+ * of worker threads serves them, taking turns between the mounts so that a busy
+ * mount cannot hold up the others.<br>
+ *
+ * Each file system keeps its own delegate, and currentFS and currentContext
+ * work as usual during its operations. A delegate that isn't thread safe is
+ * given one request at a time, as with fuse_main()'s -s option.<br>
+ *
+ * Requests are put into classes so that a bulk copy doesn't hold up ls and
+ * tab completion on the same mount. When requests of several classes are
+ * waiting, workers choose between the classes in proportion to their weights,
+ * and reserved workers serve only interactive requests.<br>
+ *
+ * Within a class, a mount's waiting requests are served fairly between the
+ * calling processes: the next request is the oldest one from the process with
+ * the fewest requests being served. Optional per-user and per-process limits
+ * on requests being served keep a runaway process from taking every worker;
+ * its excess requests wait while other callers are served.
+ */
+
+/*! @abstract The scheduling class of a request. */
+typedef enum {
+  GMDispatchClassInteractive = 0,   // lookup, getattr, access, opendir, readdir, releasedir
+  GMDispatchClassDefault,           // Everything else
+  GMDispatchClassBulk,              // read, write, fallocate, copy_file_range
+  GMDispatchClassCount
+} GMDispatchClass;
+
+/*!
+ * @abstract Queueing statistics for one class of requests.
+ * @discussion Queue time runs from when the dispatcher reads a request from the
+ * kernel until a worker starts serving it.
+ */
+typedef struct {
+  unsigned long long servedCount;   // Requests that have reached a worker.
+  unsigned long queuedCount;        // Requests waiting now.
+  double totalQueueTime;            // Seconds waited by the served requests.
+  double maxQueueTime;              // Longest wait of a served request, in seconds.
+} GMDispatchClassStatistics;
+
+/*!
+ * @class
+ * @discussion A worker pool shared by the file systems mounted with it. Its
+ * threads start when the first file system is mounted and run for the life of
+ * the process. Unlike fuse_main(), the dispatcher never daemonizes the process
+ * (shouldForeground is ignored) and installs no signal handlers; unmount each
+ * file system to shut it down.
+ */
+GM_EXPORT_INTERFACE	@interface GMSessionDispatcher : NSObject {
+ @private
+  NSCondition* condition_;
+  NSMutableArray* sessions_;        // Every mounted GMDispatchSession.
+  NSMutableArray* readySessions_[GMDispatchClassCount];  // Sessions with work, in turn order.
+  NSMutableArray* finishedSessions_;  // Sessions to unmount.
+  NSUInteger workerCount_;
+  NSUInteger reservedWorkerCount_;
+  NSUInteger weights_[GMDispatchClassCount];
+  NSInteger credits_[GMDispatchClassCount];  // For smooth weighted round robin.
+  GMDispatchClassStatistics statistics_[GMDispatchClassCount];
+  NSUInteger maxInFlightPerUser_;   // 0 if unlimited.
+  NSUInteger maxInFlightPerProcess_;
+  NSMutableDictionary* userAccounts_;     // uid to GMCallerAccount.
+  NSMutableDictionary* processAccounts_;  // pid to GMCallerAccount.
+  int wakeFds_[2];                  // Interrupts the poll for new work.
+  BOOL isStarted_;
+}
+
+/*!
+ * @abstract Initialize a dispatcher.
+ * @param workerCount The number of threads that serve requests. 0 uses one
+ *        per active processor.
+ * @result A GMSessionDispatcher instance.
+ */
+- (id)initWithWorkerCount:(NSUInteger)workerCount GM_AVAILABLE(3_8);
+
+/*! @abstract The number of threads that serve requests. */
+- (NSUInteger)workerCount GM_AVAILABLE(3_8);
+
+/*! @abstract The number of file systems currently mounted with the dispatcher. */
+- (NSUInteger)sessionCount GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract Set the share of workers a class gets when classes compete.
+ * @discussion The defaults are 8 for interactive requests, 4 for the default
+ * class and 1 for bulk requests. A class with weight 0 is only served when no
+ * other class is waiting. Takes effect at once.
+ * @param weight The relative weight.
+ * @param dispatchClass The class to set.
+ */
+- (void)setWeight:(NSUInteger)weight
+         forClass:(GMDispatchClass)dispatchClass GM_AVAILABLE(3_8);
+
+/*! @abstract The relative weight of a class. */
+- (NSUInteger)weightForClass:(GMDispatchClass)dispatchClass GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract Set the number of workers kept for interactive requests.
+ * @discussion Reserved workers never serve other classes, so interactive
+ * requests are served promptly however many bulk requests are running. The
+ * count is limited to one less than the number of workers. The default is 0.
+ * @param count The number of reserved workers.
+ */
+- (void)setReservedWorkerCount:(NSUInteger)count GM_AVAILABLE(3_8);
+
+/*! @abstract The number of workers kept for interactive requests. */
+- (NSUInteger)reservedWorkerCount GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract Queueing statistics for a class, since the dispatcher was created
+ * or its statistics were last reset.
+ */
+- (GMDispatchClassStatistics)statisticsForClass:(GMDispatchClass)dispatchClass GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract Reset the served counts and queue times of every class and
+ * caller.
+ */
+- (void)resetStatistics GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract Limit the requests of each user being served at once.
+ * @discussion Requests beyond the limit wait until one of the user's requests
+ * finishes. Requests that release kernel state or interrupt another request,
+ * and those sent by the kernel itself, are never held back. Applies across
+ * every mount of the dispatcher. Takes effect at once.
+ * @param count The limit, or 0 for no limit. The default is 0.
+ */
+- (void)setMaxInFlightRequestsPerUser:(NSUInteger)count GM_AVAILABLE(3_8);
+
+/*! @abstract The limit on each user's requests being served, or 0. */
+- (NSUInteger)maxInFlightRequestsPerUser GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract Limit the requests of each process being served at once.
+ * @discussion As setMaxInFlightRequestsPerUser:, for each process.
+ * @param count The limit, or 0 for no limit. The default is 0.
+ */
+- (void)setMaxInFlightRequestsPerProcess:(NSUInteger)count GM_AVAILABLE(3_8);
+
+/*! @abstract The limit on each process's requests being served, or 0. */
+- (NSUInteger)maxInFlightRequestsPerProcess GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract Who is using the dispatcher's mounts.
+ * @discussion One dictionary for each process that has made requests since
+ * the statistics were last reset, with the keys:<ul>
+ *   <li>kGMUserFileSystemContextUserIDKey
+ *   <li>kGMUserFileSystemContextProcessIDKey
+ *   <li>kGMSessionDispatcherInFlightCountKey
+ *   <li>kGMSessionDispatcherQueuedCountKey
+ *   <li>kGMSessionDispatcherServedCountKey
+ *   <li>kGMSessionDispatcherQueueTimeKey</ul>
+ * Idle processes may be forgotten once many processes have been seen.
+ * @result An array of dictionaries.
+ */
+- (NSArray *)callerStatistics GM_AVAILABLE(3_8);
+
+@end
+
+#pragma mark Caller Statistics
+
+/*! @group Caller Statistics */
+
+/*!
+ * @abstract The number of the caller's requests being served.
+ * @discussion The value is an NSNumber with unsigned integer value.
+ */
+extern NSString* const kGMSessionDispatcherInFlightCountKey GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract The number of the caller's requests waiting for a worker.
+ * @discussion The value is an NSNumber with unsigned integer value.
+ */
+extern NSString* const kGMSessionDispatcherQueuedCountKey GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract The number of the caller's requests that have reached a worker.
+ * @discussion The value is an NSNumber with unsigned long long value.
+ */
+extern NSString* const kGMSessionDispatcherServedCountKey GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract The time the caller's served requests spent waiting.
+ * @discussion The value is an NSNumber with double value, in seconds.
+ */
+extern NSString* const kGMSessionDispatcherQueueTimeKey GM_AVAILABLE(3_8);
+
+#undef GM_EXPORT
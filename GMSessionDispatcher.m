@@ -0,0 +1,614 @@
+//
+//  GMSessionDispatcher.m
+//  OSXFUSE
+//
+
+//  Serves many mounted file systems from one set of threads. See
+//  GMSessionDispatcher.h
+
+#import "GMAvailability.h"						/* Always include this first */
+#import "GMSessionDispatcher.h"
+#import "GMDispatchSession.h"
+#import "GMUserFileSystem.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define GM_EXPORT					__attribute__((visibility("default")))
+
+// Caller Statistics
+GM_EXPORT NSString* const kGMSessionDispatcherInFlightCountKey = @"kGMSessionDispatcherInFlightCountKey";
+GM_EXPORT NSString* const kGMSessionDispatcherQueuedCountKey = @"kGMSessionDispatcherQueuedCountKey";
+GM_EXPORT NSString* const kGMSessionDispatcherServedCountKey = @"kGMSessionDispatcherServedCountKey";
+GM_EXPORT NSString* const kGMSessionDispatcherQueueTimeKey = @"kGMSessionDispatcherQueueTimeKey";
+
+// Requests read ahead for a session before its connection is left for the
+// kernel to hold. Bounds the memory a busy mount can take from the others.
+static const NSUInteger kMaxQueuedRequestsPerSession = 64;
+
+// Requests held back by caller limits don't count towards the read ahead, so
+// that a runaway process can't stop other callers' requests being read, up to
+// this many in all.
+static const NSUInteger kMaxHeldRequestsPerSession = 256;
+
+// Idle processes are forgotten once this many have been seen.
+static const NSUInteger kMaxProcessAccounts = 1024;
+
+static const NSUInteger kDefaultWeights[GMDispatchClassCount] = { 8, 4, 1 };
+
+static uint64_t	Now (void)
+	{
+  struct timespec	ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+  }
+
+// The requests of one user or process.
+@interface GMCallerAccount : NSObject {
+ @public
+  uid_t uid_;
+  pid_t pid_;
+  NSUInteger inFlightCount_;
+  NSUInteger queuedCount_;
+  unsigned long long servedCount_;
+  double totalQueueTime_;
+}
+@end
+
+@implementation GMCallerAccount
+@end
+
+@implementation GMSessionDispatcher
+
+- (id)init {
+  return [self initWithWorkerCount:0];
+}
+
+- (id)initWithWorkerCount:(NSUInteger)workerCount {
+  self = [super init];
+  if (self) {
+    if (pipe(wakeFds_) != 0) {
+      NSLog (@"fuse: ERROR: pipe() FAILED. errno %i, %s", errno, strerror (errno));
+      [self release];
+      return nil;
+    }
+    fcntl(wakeFds_[0], F_SETFL, O_NONBLOCK);
+    fcntl(wakeFds_[1], F_SETFL, O_NONBLOCK);
+    condition_ = [[NSCondition alloc] init];
+    sessions_ = [[NSMutableArray alloc] init];
+    finishedSessions_ = [[NSMutableArray alloc] init];
+    userAccounts_ = [[NSMutableDictionary alloc] init];
+    processAccounts_ = [[NSMutableDictionary alloc] init];
+    for (int i = 0; i < GMDispatchClassCount; ++i) {
+      readySessions_[i] = [[NSMutableArray alloc] init];
+      weights_[i] = kDefaultWeights[i];
+    }
+    workerCount_ = (workerCount > 0) ? workerCount
+                                     : [[NSProcessInfo processInfo] activeProcessorCount];
+  }
+  return self;
+}
+
+// Only reached if no session was ever added; the threads retain the dispatcher.
+- (void)dealloc {
+  if (condition_ != nil) {
+    close(wakeFds_[0]);
+    close(wakeFds_[1]);
+  }
+  [condition_ release];
+  [sessions_ release];
+  [finishedSessions_ release];
+  [userAccounts_ release];
+  [processAccounts_ release];
+  for (int i = 0; i < GMDispatchClassCount; ++i) {
+    [readySessions_[i] release];
+  }
+  [super dealloc];
+}
+
+- (NSString *)description {
+  [condition_ lock];
+  NSString* description =
+    [NSString stringWithFormat:@"%@ workers=%lu, reserved=%lu, sessions=%lu, queued=%lu/%lu/%lu",
+     [super description], (unsigned long)workerCount_,
+     (unsigned long)reservedWorkerCount_, (unsigned long)[sessions_ count],
+     statistics_[GMDispatchClassInteractive].queuedCount,
+     statistics_[GMDispatchClassDefault].queuedCount,
+     statistics_[GMDispatchClassBulk].queuedCount];
+  [condition_ unlock];
+  return description;
+}
+
+- (NSUInteger)workerCount {
+  return workerCount_;
+}
+
+- (NSUInteger)sessionCount {
+  [condition_ lock];
+  NSUInteger count = [sessions_ count];
+  [condition_ unlock];
+  return count;
+}
+
+- (void)setWeight:(NSUInteger)weight forClass:(GMDispatchClass)dispatchClass {
+  if (dispatchClass < 0 || dispatchClass >= GMDispatchClassCount) {
+    return;
+  }
+  [condition_ lock];
+  weights_[dispatchClass] = weight;
+  [condition_ unlock];
+}
+
+- (NSUInteger)weightForClass:(GMDispatchClass)dispatchClass {
+  if (dispatchClass < 0 || dispatchClass >= GMDispatchClassCount) {
+    return 0;
+  }
+  [condition_ lock];
+  NSUInteger weight = weights_[dispatchClass];
+  [condition_ unlock];
+  return weight;
+}
+
+- (void)setReservedWorkerCount:(NSUInteger)count {
+  [condition_ lock];
+  reservedWorkerCount_ = (count < workerCount_) ? count : workerCount_ - 1;
+  [condition_ broadcast];  // Workers that are no longer reserved may have work.
+  [condition_ unlock];
+}
+
+- (NSUInteger)reservedWorkerCount {
+  [condition_ lock];
+  NSUInteger count = reservedWorkerCount_;
+  [condition_ unlock];
+  return count;
+}
+
+- (GMDispatchClassStatistics)statisticsForClass:(GMDispatchClass)dispatchClass {
+  GMDispatchClassStatistics statistics;
+
+  memset(&statistics, 0, sizeof(statistics));
+  if (dispatchClass >= 0 && dispatchClass < GMDispatchClassCount) {
+    [condition_ lock];
+    statistics = statistics_[dispatchClass];
+    [condition_ unlock];
+  }
+  return statistics;
+}
+
+- (void)resetStatistics {
+  [condition_ lock];
+  for (int i = 0; i < GMDispatchClassCount; ++i) {
+    statistics_[i].servedCount = 0;
+    statistics_[i].totalQueueTime = 0;
+    statistics_[i].maxQueueTime = 0;
+  }
+  NSArray* accounts = [processAccounts_ allValues];
+  for (NSUInteger i = 0, count = [accounts count]; i < count; ++i) {
+    GMCallerAccount* account = [accounts objectAtIndex:i];
+    account->servedCount_ = 0;
+    account->totalQueueTime_ = 0;
+    if (account->inFlightCount_ == 0 && account->queuedCount_ == 0) {
+      [processAccounts_ removeObjectForKey:[NSNumber numberWithInt:account->pid_]];
+    }
+  }
+  [condition_ unlock];
+}
+
+// Makes every session that may have been waiting for a caller limit eligible
+// for a worker again. Called with the lock held.
+- (void)rescheduleSessions {
+  for (NSUInteger i = 0, count = [sessions_ count]; i < count; ++i) {
+    [self scheduleSession:[sessions_ objectAtIndex:i]];
+  }
+}
+
+- (void)setMaxInFlightRequestsPerUser:(NSUInteger)count {
+  [condition_ lock];
+  maxInFlightPerUser_ = count;
+  [self rescheduleSessions];
+  [condition_ unlock];
+}
+
+- (NSUInteger)maxInFlightRequestsPerUser {
+  [condition_ lock];
+  NSUInteger count = maxInFlightPerUser_;
+  [condition_ unlock];
+  return count;
+}
+
+- (void)setMaxInFlightRequestsPerProcess:(NSUInteger)count {
+  [condition_ lock];
+  maxInFlightPerProcess_ = count;
+  [self rescheduleSessions];
+  [condition_ unlock];
+}
+
+- (NSUInteger)maxInFlightRequestsPerProcess {
+  [condition_ lock];
+  NSUInteger count = maxInFlightPerProcess_;
+  [condition_ unlock];
+  return count;
+}
+
+- (NSArray *)callerStatistics {
+  NSMutableArray* statistics = [NSMutableArray array];
+
+  [condition_ lock];
+  NSArray* accounts = [processAccounts_ allValues];
+  for (NSUInteger i = 0, count = [accounts count]; i < count; ++i) {
+    GMCallerAccount* account = [accounts objectAtIndex:i];
+    [statistics addObject:
+     [NSDictionary dictionaryWithObjectsAndKeys:
+      [NSNumber numberWithUnsignedInt:account->uid_], kGMUserFileSystemContextUserIDKey,
+      [NSNumber numberWithInt:account->pid_], kGMUserFileSystemContextProcessIDKey,
+      [NSNumber numberWithUnsignedInteger:account->inFlightCount_], kGMSessionDispatcherInFlightCountKey,
+      [NSNumber numberWithUnsignedInteger:account->queuedCount_], kGMSessionDispatcherQueuedCountKey,
+      [NSNumber numberWithUnsignedLongLong:account->servedCount_], kGMSessionDispatcherServedCountKey,
+      [NSNumber numberWithDouble:account->totalQueueTime_], kGMSessionDispatcherQueueTimeKey,
+      nil]];
+  }
+  [condition_ unlock];
+  return statistics;
+}
+
+// Returns the account for a caller, creating it if need be. Called with the
+// lock held.
+static GMCallerAccount *	AccountForKey (NSMutableDictionary * a_poAccounts, NSNumber * a_poKey)
+	{
+  GMCallerAccount *	poAccount = [a_poAccounts objectForKey: a_poKey];
+
+  if (poAccount == nil)
+  	{
+    poAccount = [[GMCallerAccount alloc] init];
+    [a_poAccounts setObject: poAccount forKey: a_poKey];
+    [poAccount release];
+    }
+  return poAccount;
+  }
+
+// YES if a request may start without exceeding its caller's limits. Called with
+// the lock held.
+- (BOOL)canAdmitRequest:(GMDispatchRequest *)request {
+  if (request->m_bAlwaysAdmit) {
+    return YES;
+  }
+  GMCallerAccount* user = request->m_poUserAccount;
+  GMCallerAccount* process = request->m_poProcessAccount;
+  return (maxInFlightPerUser_ == 0 || user->inFlightCount_ < maxInFlightPerUser_) &&
+         (maxInFlightPerProcess_ == 0 || process->inFlightCount_ < maxInFlightPerProcess_);
+}
+
+// The request of a class that a worker should serve next: the oldest admissible
+// request of the process with the fewest requests in flight. NULL if none may
+// start. Called with the lock held.
+- (GMDispatchRequest *)nextRequestOfClass:(GMDispatchClass)dispatchClass
+                                inSession:(GMDispatchSession *)session {
+  GMDispatchRequest* next = NULL;
+  NSUInteger nextInFlightCount = NSUIntegerMax;
+
+  if (session->inFlightCount_ >= session->maxInFlightCount_) {
+    return NULL;
+  }
+  for (GMDispatchRequest* request = session->head_[dispatchClass];
+       request != NULL && nextInFlightCount > 0; request = request->m_pNext) {
+    GMCallerAccount* process = request->m_poProcessAccount;
+    if ([self canAdmitRequest:request] && process->inFlightCount_ < nextInFlightCount) {
+      next = request;
+      nextInFlightCount = process->inFlightCount_;
+    }
+  }
+  return next;
+}
+
+// YES if the poll thread should read more requests for session. Called with the
+// lock held.
+- (BOOL)shouldReadAheadForSession:(GMDispatchSession *)session {
+  if (session->isExited_ || session->queuedCount_ >= kMaxHeldRequestsPerSession) {
+    return NO;
+  }
+  if (session->queuedCount_ < kMaxQueuedRequestsPerSession) {
+    return YES;
+  }
+  NSUInteger admissibleCount = 0;
+  for (int i = 0; i < GMDispatchClassCount; ++i) {
+    for (GMDispatchRequest* request = session->head_[i]; request != NULL;
+         request = request->m_pNext) {
+      if ([self canAdmitRequest:request]) {
+        ++admissibleCount;
+      }
+    }
+  }
+  return admissibleCount < kMaxQueuedRequestsPerSession;
+}
+
+// Makes the poll thread rebuild its set of connections.
+- (void)wakePoller {
+  char c = 0;
+  (void) write(wakeFds_[1], &c, 1);		/* A full pipe already means a wake up is pending */
+}
+
+static inline BOOL	SessionCanFinish (GMDispatchSession * a_poSession)
+	{
+  return a_poSession->isExited_ && !a_poSession->isPolled_ &&
+         (a_poSession->queuedCount_ == 0) && (a_poSession->inFlightCount_ == 0);
+  }
+
+// Puts session at the back of the ready queue of each class in which a worker
+// has something to do for it. Called with the lock held.
+- (void)scheduleSession:(GMDispatchSession *)session {
+  if (!session->isFinishing_ && SessionCanFinish(session)) {
+    session->isFinishing_ = YES;
+    [finishedSessions_ addObject:session];
+    [condition_ signal];
+  }
+  for (int i = 0; i < GMDispatchClassCount; ++i) {
+    if (!session->isReady_[i] && [self nextRequestOfClass:i inSession:session] != NULL) {
+      session->isReady_[i] = YES;
+      [readySessions_[i] addObject:session];
+      // A reserved worker woken for other work would leave it waiting.
+      if (i == GMDispatchClassInteractive || reservedWorkerCount_ == 0) {
+        [condition_ signal];
+      } else {
+        [condition_ broadcast];
+      }
+    }
+  }
+}
+
+// Chooses the class to serve next by smooth weighted round robin among the
+// classes with ready sessions. Returns GMDispatchClassCount if the worker has
+// nothing to do. Called with the lock held.
+- (GMDispatchClass)nextClassForReservedWorker:(BOOL)isReserved {
+  GMDispatchClass next = GMDispatchClassCount;
+  NSInteger totalWeight = 0;
+
+  for (int i = 0; i < GMDispatchClassCount; ++i) {
+    if ([readySessions_[i] count] == 0 ||
+        (isReserved && i != GMDispatchClassInteractive)) {
+      continue;
+    }
+    credits_[i] += weights_[i];
+    totalWeight += weights_[i];
+    if (next == GMDispatchClassCount || credits_[i] > credits_[next]) {
+      next = i;
+    }
+  }
+  if (next != GMDispatchClassCount) {
+    credits_[next] -= totalWeight;
+  }
+  return next;
+}
+
+- (void)addSession:(GMDispatchSession *)session {
+  [condition_ lock];
+  [sessions_ addObject:session];
+  if (!isStarted_) {
+    isStarted_ = YES;
+    [NSThread detachNewThreadSelector:@selector(pollSessions:) toTarget:self withObject:nil];
+    for (NSUInteger i = 0; i < workerCount_; ++i) {
+      [NSThread detachNewThreadSelector:@selector(serveSessions:)
+                               toTarget:self
+                             withObject:[NSNumber numberWithUnsignedInteger:i]];
+    }
+  }
+  [condition_ unlock];
+  [self wakePoller];
+}
+
+// Reads requests from every connection that has room in its queue.
+- (void)pollSessions:(id)unused {
+  (void) unused;											/* Avoid unused argument compiler warning */
+
+  struct pollfd* pollFds = NULL;
+  NSUInteger pollFdsCapacity = 0;
+  char* buffer = NULL;
+  size_t bufferSize = 0;
+
+  for (;;) {
+    NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+    NSMutableArray* polled = [NSMutableArray array];
+
+    [condition_ lock];
+    NSUInteger sessionCount = [sessions_ count];
+    size_t maxBufferSize = 0;
+    for (NSUInteger i = 0; i < sessionCount; ++i) {
+      GMDispatchSession* session = [sessions_ objectAtIndex:i];
+      if ([session bufferSize] > maxBufferSize) {
+        maxBufferSize = [session bufferSize];
+      }
+    }
+    if (sessionCount + 1 > pollFdsCapacity) {
+      struct pollfd* grown = realloc(pollFds, 2 * (sessionCount + 1) * sizeof(struct pollfd));
+      if (grown != NULL) {
+        pollFds = grown;
+        pollFdsCapacity = 2 * (sessionCount + 1);
+      }
+    }
+    if (maxBufferSize > bufferSize) {
+      char* grown = realloc(buffer, maxBufferSize);
+      if (grown != NULL) {
+        buffer = grown;
+        bufferSize = maxBufferSize;
+      }
+    }
+    if (sessionCount + 1 > pollFdsCapacity || maxBufferSize > bufferSize) {
+      [condition_ unlock];
+      NSLog (@"fuse: ERROR: Out of memory polling %lu sessions. Retrying IN %@", (unsigned long)sessionCount, self);
+      [pool release];
+      sleep(1);
+      continue;
+    }
+    for (NSUInteger i = 0; i < sessionCount; ++i) {
+      GMDispatchSession* session = [sessions_ objectAtIndex:i];
+      if ([self shouldReadAheadForSession:session]) {
+        session->isPolled_ = YES;
+        [polled addObject:session];
+      }
+    }
+    [condition_ unlock];
+
+    NSUInteger count = [polled count];
+    pollFds[0].fd = wakeFds_[0];
+    pollFds[0].events = POLLIN;
+    pollFds[0].revents = 0;
+    for (NSUInteger i = 0; i < count; ++i) {
+      pollFds[i + 1].fd = [[polled objectAtIndex:i] fileDescriptor];
+      pollFds[i + 1].events = POLLIN;
+      pollFds[i + 1].revents = 0;
+    }
+
+    int ret = poll(pollFds, count + 1, -1);
+    if (ret < 0 && errno != EINTR) {
+      NSLog (@"fuse: ERROR: poll() FAILED. errno %i, %s IN %@", errno, strerror (errno), self);
+    }
+    if (ret > 0 && (pollFds[0].revents & POLLIN)) {
+      char drain[64];
+      while (read(wakeFds_[0], drain, sizeof(drain)) > 0) {
+      }
+    }
+
+    for (NSUInteger i = 0; i < count; ++i) {
+      GMDispatchSession* session = [polled objectAtIndex:i];
+      GMDispatchRequest* request = NULL;
+      BOOL isExited = NO;
+
+      if (ret > 0 && pollFds[i + 1].revents != 0) {
+        request = [session receiveRequestWithBuffer:buffer isExited:&isExited];
+      }
+
+      [condition_ lock];
+      session->isPolled_ = NO;
+      if (isExited) {
+        session->isExited_ = YES;
+      }
+      if (request != NULL) {
+        GMCallerAccount* user = AccountForKey(userAccounts_, [NSNumber numberWithUnsignedInt:request->m_UID]);
+        GMCallerAccount* process = AccountForKey(processAccounts_, [NSNumber numberWithInt:request->m_PID]);
+        user->uid_ = request->m_UID;
+        process->uid_ = request->m_UID;
+        process->pid_ = request->m_PID;
+        ++user->queuedCount_;
+        ++process->queuedCount_;
+        request->m_poUserAccount = user;
+        request->m_poProcessAccount = process;
+        [session enqueueRequest:request];
+        ++statistics_[request->m_Class].queuedCount;
+      }
+      [self scheduleSession:session];
+      [condition_ unlock];
+    }
+
+    [pool release];
+  }
+}
+
+// Serves one request at a time from the session at the front of a class's
+// ready queue, which then goes to the back if it has more to do. The first
+// reservedWorkerCount workers serve only interactive requests.
+- (void)serveSessions:(NSNumber *)workerIndex {
+  NSUInteger index = [workerIndex unsignedIntegerValue];
+
+  [condition_ lock];
+  for (;;) {
+    GMDispatchClass dispatchClass = GMDispatchClassCount;
+    while ([finishedSessions_ count] == 0 &&
+           (dispatchClass = [self nextClassForReservedWorker:(index < reservedWorkerCount_)]) == GMDispatchClassCount) {
+      [condition_ wait];
+    }
+
+    if ([finishedSessions_ count] > 0) {
+      GMDispatchSession* session = [[finishedSessions_ objectAtIndex:0] retain];
+      [finishedSessions_ removeObjectAtIndex:0];
+      [sessions_ removeObject:session];
+      [condition_ unlock];
+
+      NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+      [session finish];
+      [session release];
+      [pool release];
+
+      [condition_ lock];
+      continue;
+    }
+
+    GMDispatchSession* session = [[readySessions_[dispatchClass] objectAtIndex:0] retain];
+    [readySessions_[dispatchClass] removeObjectAtIndex:0];
+    session->isReady_[dispatchClass] = NO;
+    GMDispatchRequest* request = [self nextRequestOfClass:dispatchClass inSession:session];
+    if (request == NULL) {
+      [session release];
+      continue;
+    }
+
+    BOOL wasFull = (session->queuedCount_ >= kMaxQueuedRequestsPerSession);
+    [session removeRequest:request];
+    GMDispatchClassStatistics* statistics = &statistics_[dispatchClass];
+    GMCallerAccount* user = request->m_poUserAccount;
+    GMCallerAccount* process = request->m_poProcessAccount;
+    double queueTime = (Now() - request->m_uReceived) / 1000000000.0;
+    --statistics->queuedCount;
+    ++statistics->servedCount;
+    statistics->totalQueueTime += queueTime;
+    if (queueTime > statistics->maxQueueTime) {
+      statistics->maxQueueTime = queueTime;
+    }
+    --user->queuedCount_;
+    --process->queuedCount_;
+    ++user->inFlightCount_;
+    ++process->inFlightCount_;
+    ++process->servedCount_;
+    process->totalQueueTime_ += queueTime;
+    ++session->inFlightCount_;
+    [self scheduleSession:session];
+    [condition_ unlock];
+
+    if (wasFull) {
+      [self wakePoller];
+    }
+    NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+    BOOL isExited = [session processRequest:request];
+    [pool release];
+
+    [condition_ lock];
+    --session->inFlightCount_;
+    BOOL wasLimited =
+      (maxInFlightPerUser_ > 0 && user->inFlightCount_ >= maxInFlightPerUser_) ||
+      (maxInFlightPerProcess_ > 0 && process->inFlightCount_ >= maxInFlightPerProcess_);
+    --user->inFlightCount_;
+    --process->inFlightCount_;
+    if (process->inFlightCount_ == 0 && process->queuedCount_ == 0 &&
+        [processAccounts_ count] > kMaxProcessAccounts) {
+      NSNumber* key = [[NSNumber alloc] initWithInt:process->pid_];  // No pool here.
+      [processAccounts_ removeObjectForKey:key];
+      [key release];
+    }
+    if (isExited && !session->isExited_) {
+      // Requests already read will get no reply from an exited session.
+      session->isExited_ = YES;
+      for (int i = 0; i < GMDispatchClassCount; ++i) {
+        GMDispatchRequest* discarded;
+        while ((discarded = [session dequeueRequestOfClass:i]) != NULL) {
+          --statistics_[i].queuedCount;
+          --((GMCallerAccount *)discarded->m_poUserAccount)->queuedCount_;
+          --((GMCallerAccount *)discarded->m_poProcessAccount)->queuedCount_;
+          [GMDispatchSession discardRequest:discarded];
+        }
+      }
+      [self wakePoller];
+    }
+    if (wasLimited) {
+      [self rescheduleSessions];
+    } else {
+      [self scheduleSession:session];
+    }
+    [session release];
+  }
+}
+
+@end
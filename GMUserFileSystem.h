@@ -66,6 +66,8 @@
  */
 
 @class GMUserFileSystemInternal;
+@class GMMountProfile;
+@class GMSessionDispatcher;
 
 /*!
  * @class
@@ -118,6 +120,18 @@ GM_EXPORT_INTERFACE	@interface GMUserFileSystem : NSObject {
  */
 + (NSDictionary *)currentContext GM_AVAILABLE(3_5);
 
+/*!
+ * @abstract Returns whether the caller has given up on the current operation.
+ * @discussion YES once the process that made the request has been killed or
+ * has been interrupted by a signal while waiting, so that nobody will see the
+ * result. A long-running delegate callback can check it now and then and
+ * fail with EINTR. Like currentContext, it is only valid during a file system
+ * delegate callback, on the thread that the callback was made on; it is NO
+ * on any other thread. See the mount profile's interruptible setting.
+ * @result YES if the current operation has been interrupted.
+ */
++ (BOOL)isCurrentOperationCancelled GM_AVAILABLE(3_8);
+
 /*!
  * @abstract Initialize the user space file system.
  * @discussion The file system delegate should implement some or all of the
@@ -179,6 +193,68 @@ GM_EXPORT_INTERFACE	@interface GMUserFileSystem : NSObject {
    shouldForeground:(BOOL)shouldForeground
     detachNewThread:(BOOL)detachNewThread GM_AVAILABLE(2_0);
 
+/*!
+ * @abstract Set the performance settings for the next mount.
+ * @discussion The profile is copied. It is validated when the file system is
+ * mounted; if it is invalid the mount fails with the validation error. Its
+ * mount options are added to those given to mountAtPath:withOptions: and its
+ * capabilities are requested when the kernel connection is initialized.
+ * @param profile The settings to use. nil restores the default settings.
+ */
+- (void)setMountProfile:(GMMountProfile *)profile GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract The performance settings for the next mount.
+ * @result A copy of the mount profile.
+ */
+- (GMMountProfile *)mountProfile GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract The performance settings in effect for the current mount.
+ * @discussion Available once the kernel connection has been initialized, i.e.
+ * by the time kGMUserFileSystemDidMount is posted. Sizes are those agreed with
+ * the kernel and capabilities that the kernel doesn't support are turned off.
+ * Note that libfuse may further limit max_write to the size of its buffers.
+ * @result The negotiated settings, or nil if the file system isn't mounted.
+ */
+- (GMMountProfile *)negotiatedMountProfile GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract Share a worker pool with other file systems.
+ * @discussion Takes effect at the next mount. The file system is then served
+ * by the dispatcher's threads instead of its own fuse_main() loop, and the
+ * thread that mounts it returns once it is mounted. See GMSessionDispatcher.h.
+ * @param dispatcher The dispatcher to use, which is retained. nil restores a
+ *        dedicated fuse_main() loop.
+ */
+- (void)setSessionDispatcher:(GMSessionDispatcher *)dispatcher GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract The dispatcher for the next mount.
+ * @result The dispatcher, or nil if the file system runs its own loop.
+ */
+- (GMSessionDispatcher *)sessionDispatcher GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract Discard cached lookups for a path.
+ * @discussion The framework caches some answers from the delegate, such as
+ * paths that don't exist, directory listings, symbolic link targets and
+ * access checks when the mount profile enables those caches. Changes made
+ * through the mounted file system update these caches; call this after
+ * changing the file system any other way. The listing of the directory that
+ * contains path is discarded too, so that a new or removed item shows up in
+ * it. Files kept open for reuse by the profile's handleCacheSize are
+ * released. With libfuse 3 and the directory cache on, the kernel keeps
+ * listings as well, and this also invalidates the kernel's attributes, data
+ * and listing for path and its directory, or for the root directory if path
+ * is nil. The kernel's other caches, set by the profile's timeouts, are not
+ * affected. Safe to call from any thread, but not from a delegate callback
+ * when the kernel would be invalidated.
+ * @param path The path to discard, along with everything below it. nil
+ *        discards everything.
+ */
+- (void)invalidateCachesForPath:(NSString *)path GM_AVAILABLE(3_8);
+
 /*!
  * @abstract Unmount the file system.
  * @discussion Unmounts the file system. The kGMUserFileSystemDidUnmount
@@ -197,6 +273,30 @@ GM_EXPORT_INTERFACE	@interface GMUserFileSystem : NSObject {
 - (BOOL)invalidateItemAtPath:(NSString *)path
                        error:(NSError **)error GM_AVAILABLE(3_8);
 
+/*!
+ * @abstract Start recording file system operations.
+ * @discussion Writes a record of every subsequent file system operation to a
+ * trace file, including its arguments, result, latency and calling process.
+ * The format is described in GMOperationTrace.h. Recording does not block the
+ * file system threads; if they produce records faster than they can be
+ * written, some records are dropped and the number dropped is recorded when
+ * recording stops. Use the GMReplay tool in Benchmarks/ to replay a trace.
+ * @param path The path of the trace file to create. An existing file is
+ *        replaced.
+ * @param error Should be filled with a POSIX error in case of failure. EBUSY
+ *        means that operations are already being recorded.
+ * @result YES if recording started.
+ */
+- (BOOL)startRecordingOperationsToPath:(NSString *)path
+                                 error:(NSError **)error GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract Stop recording file system operations.
+ * @discussion Writes any outstanding records and closes the trace file. Does
+ * nothing if operations are not being recorded.
+ */
+- (void)stopRecordingOperations GM_AVAILABLE(3_8);
+
 @end
 
 #pragma mark Operation Context
@@ -317,6 +417,8 @@ extern NSString* const kGMUserFileSystemDidUnmount GM_AVAILABLE(2_0);
  * @discussion
  * Returns true if all requested permissions are granted
  * or if the item exists and the mode is F_OK, at the specified path.
+ * The answers may be cached, and the kernel makes the checks itself instead
+ * if asked to; see the mount profile's accessCacheSize and kernelPermissions.
  * @seealso man access(2)
  * @param path The path to the item.
  * @param mode The requested permission (a mask consisting of the bitwise OR
@@ -437,6 +539,10 @@ extern NSString* const kGMUserFileSystemDidUnmount GM_AVAILABLE(2_0);
  * @abstract Opens the file at the given path for read/write.
  * @discussion This will only be called for existing files. If the file needs
  * to be created then createFileAtPath: will be called instead.
+ *
+ * When the mount profile's writebackCache is in effect, mode is O_RDWR for a
+ * file opened O_WRONLY and never includes O_APPEND: the kernel may read
+ * through any handle open for writing, and gives the offset of every write.
  * @seealso man open(2)
  * @param path The path to the file.
  * @param mode The open mode for the file (e.g. O_RDWR, etc.)
@@ -455,12 +561,35 @@ extern NSString* const kGMUserFileSystemDidUnmount GM_AVAILABLE(2_0);
  * @abstract Called when an opened file is closed.
  * @discussion If userData was provided in the corresponding openFileAtPath: call
  * then it will be passed in userData and released after this call completes.
+ *
+ * When the mount profile's handleCacheSize is non-zero, the call for a file
+ * opened read-only may come up to handleCacheTimeout seconds after the close,
+ * and userData may have served several opens of the same path and mode in the
+ * meantime. It is always the final close of userData. Files opened for
+ * writing are always released at once.
  * @seealso man close(2)
  * @param path The path to the file.
  * @param userData The userData corresponding to this open file or nil.
  */
 - (void)releaseFileAtPath:(NSString *)path userData:(id)userData GM_AVAILABLE(2_0);
 
+/*!
+ * @abstract Decides whether a file kept open after its release may be reused.
+ * @discussion When the mount profile's handleCacheSize is non-zero, an open of
+ * a path with the same mode as a recently released file is given that file's
+ * userData instead of calling openFileAtPath:mode:userData:error:. Return NO
+ * to open the file afresh, for example because userData has gone stale;
+ * releaseFileAtPath:userData: is then called for it. Without this method
+ * every match is reused.
+ * @param path The path to the file.
+ * @param userData The userData of the released file.
+ * @param mode The open mode, as openFileAtPath:mode:userData:error: would get.
+ * @result YES to reuse userData for the open.
+ */
+- (BOOL)shouldReuseFileAtPath:(NSString *)path
+                     userData:(id)userData
+                         mode:(int)mode GM_AVAILABLE(3_8);
+
 /*!
  * @abstract Reads data from the open file at the specified path.
  * @discussion Reads data from the file starting at offset into the provided
@@ -531,6 +660,69 @@ extern NSString* const kGMUserFileSystemDidUnmount GM_AVAILABLE(2_0);
                        length:(fuse_off_t)length
                         error:(NSError **)error GM_AVAILABLE(3_0);
 
+/*!
+ * @abstract Copies a range of bytes from one open file to another.
+ * @discussion Called for copy_file_range(2), which cp(1) uses on Linux, so
+ * that the data doesn't have to pass through the kernel and this process on
+ * its way from one file to the other. The file system can clone the range or
+ * have its storage copy it instead. Linux with libfuse 3.4 or later only.
+ *
+ * If userData was provided in the corresponding openFileAtPath: or
+ * createFileAtPath: calls then it will be passed in. Both files may be the
+ * same file. Fail with ENOTSUP to have the kernel copy the range by reading
+ * and writing it instead.
+ *
+ * @seealso man copy_file_range(2)
+ * @param path The path to the file to copy from.
+ * @param userData The userData corresponding to the file to copy from or nil.
+ * @param offset The offset in the file to copy from.
+ * @param toPath The path to the file to copy to.
+ * @param toUserData The userData corresponding to the file to copy to or nil.
+ * @param toOffset The offset in the file to copy to.
+ * @param length The number of bytes to copy.
+ * @param error Should be filled with a POSIX error in case of failure.
+ * @result The number of bytes copied, which may be fewer than length, or -1 on
+ * error.
+ */
+- (ssize_t)copyFileRangeAtPath:(NSString *)path
+                      userData:(id)userData
+                        offset:(fuse_off_t)offset
+                        toPath:(NSString *)toPath
+                    toUserData:(id)toUserData
+                      toOffset:(fuse_off_t)toOffset
+                        length:(size_t)length
+                         error:(NSError **)error GM_AVAILABLE(3_8);
+
+/*!
+ * @abstract Describes the data or hole that contains an offset in an open file.
+ * @discussion Called for lseek(2) with SEEK_DATA or SEEK_HOLE, which cp(1),
+ * qemu-img and backup tools use to skip the holes in sparse files instead of
+ * reading their zeros. The framework calls this as many times as it takes to
+ * find the next data or hole, so neighbouring extents may be of the same kind
+ * and a file may be described as data where the file system can't tell.
+ * Linux with libfuse 3.8 or later only.
+ *
+ * If userData was provided in the corresponding openFileAtPath: or
+ * createFileAtPath: call then it will be passed in.
+ *
+ * @seealso man lseek(2)
+ * @param path The path to the file.
+ * @param userData The userData corresponding to this open file or nil.
+ * @param offset The offset in the file.
+ * @param isData Should be set to YES if offset is in data, NO if in a hole.
+ * @param length Should be set to the number of bytes, at least 1, from offset
+ *        to the end of the data or hole.
+ * @param error Should be filled with a POSIX error in case of failure, ENXIO
+ *        if offset is at or past the end of the file.
+ * @result YES if the extent was described.
+ */
+- (BOOL)extentOfFileAtPath:(NSString *)path
+                  userData:(id)userData
+                    offset:(fuse_off_t)offset
+                    isData:(BOOL *)isData
+                    length:(fuse_off_t *)length
+                     error:(NSError **)error GM_AVAILABLE(3_8);
+
 /*!
  * @abstract Atomically exchanges data between files.
  * @discussion  Called to atomically exchange file data between path1 and path2.
@@ -562,7 +754,8 @@ extern NSString* const kGMUserFileSystemDidUnmount GM_AVAILABLE(2_0);
 /*!
  * @abstract Creates and opens a file at the specified path.
  * @discussion  This should create and open the file at the same time. The 
- * attributes may contain keys similar to setAttributes:.
+ * attributes may contain keys similar to setAttributes:. The flags are
+ * changed for the writeback cache as for openFileAtPath:mode:userData:error:.
  * @seealso man open(2)
  * @param path The path of the file to create.
  * @param attributes Set of attributes to apply to the newly created file.
@@ -720,6 +913,75 @@ extern NSString* const kGMUserFileSystemDidUnmount GM_AVAILABLE(2_0);
 
 @end
 
+/*!
+ * @category
+ * @discussion Optional group commit of metadata operations. When the mount
+ * profile sets a metadata batch window, the file system was created with
+ * isThreadSafe:YES and the delegate implements this method, file creation,
+ * attribute changes and renames are no longer sent to the delegate one at a
+ * time. They are collected for up to the window, or until the batch is full,
+ * and passed here together. Each caller waits until its batch has been
+ * performed, so a change is never reported as done before it is committed.<br>
+ *
+ * Truncation through an open file's userData that implements
+ * truncateToOffset:error: is still done immediately.
+ */
+@interface NSObject (GMUserFileSystemMetadataBatching)
+
+/*!
+ * @abstract Perform a batch of metadata operations.
+ * @discussion Apply the operations in order, as if each one's usual delegate
+ * method had been called, and commit them. Report the failure of an
+ * individual operation with -[GMMetadataOperation setError:]. Return the
+ * userData of each created file with -[GMMetadataOperation setUserData:].
+ * @param operations An array of GMMetadataOperation, in the order they
+ *        reached the file system.
+ * @param error Should be filled with a POSIX error if the whole batch failed.
+ * @result NO if the whole batch failed. Every operation without its own error
+ *         then fails with this error.
+ */
+- (BOOL)performMetadataOperations:(NSArray *)operations
+                            error:(NSError **)error GM_AVAILABLE(3_8);
+
+@end
+
+/*!
+ * @category
+ * @discussion Optional whole-file delivery of small files. When the mount
+ * profile sets a small file size and the delegate implements this method, a
+ * file that is created, or opened for writing with O_TRUNC, is kept in memory
+ * by the file system instead of being passed to the delegate. Its contents are
+ * delivered here when it is first flushed or closed, so the delegate sees one
+ * call rather than create, write, write ... release, and never stores an empty
+ * intermediate version of a truncated file.<br>
+ *
+ * A file that grows larger than the small file size is created or opened
+ * through the usual delegate methods, its contents written with
+ * writeFileAtPath:userData:buffer:size:offset:error:, and from then on handled
+ * as any other open file.<br>
+ *
+ * Until it is first delivered, a new file isn't known to the delegate: it can
+ * be stat'ed through the file system but isn't listed in its directory. A
+ * failure to deliver it is reported to the close(2) that flushed it.
+ */
+@interface NSObject (GMUserFileSystemSmallFiles)
+
+/*!
+ * @abstract Create or replace a file with the given contents.
+ * @param path The path to the file.
+ * @param contents The complete contents of the file.
+ * @param attributes For a new file, the attributes it was created with,
+ *        typically NSFilePosixPermissions, and any changed since. nil when an
+ *        existing file is replaced.
+ * @param error Should be filled with a POSIX error in case of failure.
+ * @result YES if the file was stored.
+ */
+- (BOOL)createFileAtPath:(NSString *)path
+            withContents:(NSData *)contents
+              attributes:(NSDictionary *)attributes
+                   error:(NSError **)error GM_AVAILABLE(3_8);
+
+@end
 
 /*! 
  * @category
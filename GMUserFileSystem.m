@@ -45,19 +45,15 @@
                 On the other hand, the "low level Fuse API" is asynchronous, allowing
                 parallel I/O operations. Rewriting the OSXFUSE framework to use it
                 would speed things up.
+                The high level API also needs each reply when the callback returns,
+                so a delegate operation can't complete later from a completion
+                handler without parking the Fuse thread until it does. Deferred
+                replies (fuse_reply_*()) need the low level API too.
 */
 #import "GMAvailability.h"						/* Always include this first */
 #import "GMUserFileSystem.h"
 
-/* FUSE_USE_VERSION: Which version of the libFuse API for which platform?
-		https://stackoverflow.com/questions/49739325/what-exactly-is-the-difference-between-fuse2-and-fuse3
-		OSXFUSE 3.8.3 implements the Fuse 2.6 API
-    Ubuntu Linux 20.04 implements the Fuse 2.9 API (Reported by fusermount(1) -V)
-    GhostBSD (FreeBSD 12.2-STABLE) implements the Fuse 2.9 API (Estimated from fuse.h. Needs confirmation)
-*/
-#define FUSE_USE_VERSION 26
-#include <fuse.h>
-#include <fuse/fuse_lowlevel.h>
+#import "GMFuse.h"								/* Selects the libfuse API */
 
 #include <string.h>
 #include <errno.h>
@@ -81,6 +77,14 @@
 
 #include <sys/utsname.h>
 
+#if defined (__linux__)
+#include <limits.h>
+#include <poll.h>
+#include <spawn.h>
+#include <time.h>
+#include <sys/wait.h>
+#endif	/* defined (__linux__) */
+
 #if defined (__APPLE__) || defined (__FreeBSD__)
 #include <sys/vnode.h>
 #endif	/* defined (__APPLE__) || defined (__FreeBSD__) */
@@ -88,6 +92,17 @@
 #import "GMFinderInfo.h"
 #import "GMResourceFork.h"
 #import "GMDataBackedFileDelegate.h"
+#import "GMFuseOperations.h"
+#import "GMOperationRecorder.h"
+#import "GMMountProfile.h"
+#import "GMPathCache.h"
+#import "GMMetadataOperation.h"
+#import "GMMetadataBatcher.h"
+#import "GMAttributeCoalescer.h"
+#import "GMHandleCache.h"
+#import "GMPath.h"
+#import "GMSessionDispatcher.h"
+#import "GMDispatchSession.h"
 
 #if defined (__APPLE__)
 #import "GMDTrace.h"
@@ -158,6 +173,9 @@ GM_EXPORT NSString* const kGMUserFileSystemWeblocURLKey = @"kGMUserFileSystemWeb
 // Used for time conversions to/from tv_nsec.
 static const double kNanoSecondsPerSecond = 1000000000.0;
 
+// Number of mounted file systems whose mount profile asks to intern paths.
+static int g_cInterningFileSystems;
+
 typedef enum {
   // Unable to unmount a dead FUSE files system located at mountpoint.
   GMUserFileSystem_ERROR_UNMOUNT_DEADFS = 1000,
@@ -182,9 +200,76 @@ typedef enum {
   GMUserFileSystem_FAILURE,         // Failed state; probably a mount failure.
 } GMUserFileSystemStatus;
 
+// Buffers a small file between create or open(O_TRUNC) and close, so that the
+// delegate receives its contents in one createFileAtPath:withContents:... call.
+// Used as the userData of every open of the file. If the file grows past the
+// mount profile's smallFileSize it is written to the delegate as a normal file
+// ("spilled") and later operations are passed through to the delegate's
+// userData.
+@interface GMSmallFile : NSObject {
+  GMUserFileSystem* fs_;            // Not retained. Outlives its open files.
+  NSLock* lock_;
+  NSString* path_;
+  NSMutableDictionary* attributes_; // For a new file: creation attributes.
+  int flags_;
+  NSUInteger maxSize_;
+  NSMutableData* data_;             // nil once spilled.
+  NSDate* modificationDate_;
+  id userData_;                     // The delegate's userData, once spilled.
+  BOOL existsInDelegate_;           // NO for a new file until first committed.
+  BOOL needsCommit_;
+  NSUInteger openCount_;            // Protected by the small file registry.
+}
+- (id)initWithFileSystem:(GMUserFileSystem *)fs
+                    path:(NSString *)path
+              attributes:(NSDictionary *)attributes
+                   flags:(int)flags
+                 maxSize:(NSUInteger)maxSize
+        existsInDelegate:(BOOL)existsInDelegate;
+- (NSString *)path;
+- (NSUInteger)openCount;
+- (void)setOpenCount:(NSUInteger)openCount;
+- (BOOL)isSpilled;
+- (BOOL)existsInDelegate;
+- (id)delegateUserData;
+- (NSDictionary *)attributesOverDelegateAttributes:(NSDictionary *)attributes;
+- (BOOL)mergeAttributes:(NSDictionary *)attributes;
+- (BOOL)spill:(NSError **)error;
+- (BOOL)commit:(NSError **)error;
+- (int)readToBuffer:(char *)buffer
+               size:(size_t)size
+             offset:(fuse_off_t)offset
+              error:(NSError **)error;
+- (int)writeFromBuffer:(const char *)buffer
+                  size:(size_t)size
+                offset:(fuse_off_t)offset
+                 error:(NSError **)error;
+- (BOOL)truncateToOffset:(fuse_off_t)offset error:(NSError **)error;
+- (BOOL)getLength:(fuse_off_t *)length;
+@end
+
+// The kernel's view of a file that is open for writing when the kernel
+// caches writes. Dirty pages reach the delegate late, so until the last
+// writable open is released the size and modification date that the kernel
+// has seen replace the delegate's. Protected by the writeback file registry.
+@interface GMWritebackFile : NSObject {
+  NSUInteger openCount_;
+  long long size_;                  // At least this, or exactly this if isSizeExact_.
+  BOOL isSizeExact_;                // Set once truncated, when writes can't tell.
+  NSDate* modificationDate_;        // nil until written or set.
+}
+- (NSUInteger)openCount;
+- (void)setOpenCount:(NSUInteger)openCount;
+- (void)didWriteToOffset:(long long)offset;
+- (void)didTruncateToSize:(long long)size;
+- (void)setModificationDate:(NSDate *)date;
+- (NSDictionary *)attributesOverDelegateAttributes:(NSDictionary *)attributes;
+@end
+
 @interface GMUserFileSystemInternal : NSObject {
   struct fuse* handle_;
   NSString* mountPath_;
+  NSString* mountInfoPath_;         // mountPath_ as the mount table lists it.
   GMUserFileSystemStatus status_;
   BOOL shouldCheckForResource_;     // Try to handle FinderInfo/Resource Forks?
   BOOL isThreadSafe_;               // Is the delegate thread-safe?
@@ -194,16 +279,73 @@ typedef enum {
   BOOL supportsExtendedTimes_;      // Delegate supports create and backup times?
   BOOL supportsSetVolumeName_;      // Delegate supports setvolname?
   BOOL isReadOnly_;                 // Is this mounted read-only?
+  GMOperationRecorderSlot recorder_;  // Holds a recorder while recording operations.
+  GMMountProfile* mountProfile_;    // Requested performance settings.
+  GMMountProfile* negotiatedMountProfile_;  // Settings in effect, once mounted.
+  GMPathCache* negativeCache_;      // Paths that getattr found not to exist.
+  GMPathCache* directoryCache_;     // Directory paths to their listings.
+  GMPathCache* symlinkCache_;       // Link paths to their targets' file system representations.
+  GMPathCache* accessCache_;        // Paths to their access decisions by caller and mode.
+  GMMetadataBatcher* metadataBatcher_;  // Non-nil while batching metadata operations.
+  GMAttributeCoalescer* attributeCoalescer_;  // Non-nil while coalescing attribute changes.
+  GMHandleCache* handleCache_;      // Non-nil while keeping released files for reuse.
+  BOOL interruptible_;              // Interrupted operations fail with EINTR.
+  NSUInteger smallFileSize_;        // Files up to this size are buffered. 0 if off.
+  NSMutableDictionary* smallFiles_; // Path to GMSmallFile for buffered files.
+  NSLock* smallFilesLock_;
+  BOOL writebackCache_;             // The kernel caches writes.
+  NSMutableDictionary* writebackFiles_;  // Path to GMWritebackFile for files open for writing.
+  NSLock* writebackFilesLock_;
+  GMSessionDispatcher* sessionDispatcher_;  // Serves the next mount, or nil for fuse_main().
   id delegate_;
 }
 - (id)initWithDelegate:(id)delegate isThreadSafe:(BOOL)isThreadSafe;
 - (void)setDelegate:(id)delegate;
+- (GMOperationRecorderSlot *)recorderSlot;
+- (GMMountProfile *)mountProfile;
+- (void)setMountProfile:(GMMountProfile *)profile;
+- (GMMountProfile *)negotiatedMountProfile;
+- (void)setNegotiatedMountProfile:(GMMountProfile *)profile;
+- (GMPathCache *)negativeCache;
+- (GMPathCache *)directoryCache;
+- (GMPathCache *)symlinkCache;
+- (GMPathCache *)accessCache;
+- (GMMetadataBatcher *)metadataBatcher;
+- (void)setMetadataBatcher:(GMMetadataBatcher *)batcher;
+- (GMAttributeCoalescer *)attributeCoalescer;
+- (void)setAttributeCoalescer:(GMAttributeCoalescer *)coalescer;
+- (GMHandleCache *)handleCache;
+- (void)setHandleCache:(GMHandleCache *)handleCache;
+- (BOOL)interruptible;
+- (void)setInterruptible:(BOOL)interruptible;
+- (NSUInteger)smallFileSize;
+- (void)setSmallFileSize:(NSUInteger)size;
+- (GMSmallFile *)smallFileForPath:(NSString *)path;
+- (GMSmallFile *)openSmallFile:(GMSmallFile *)smallFile;
+- (GMSmallFile *)openSmallFileForPath:(NSString *)path;
+- (BOOL)closeSmallFile:(GMSmallFile *)smallFile;
+- (void)removeSmallFile:(GMSmallFile *)smallFile;
+- (BOOL)writebackCache;
+- (void)setWritebackCache:(BOOL)writebackCache;
+- (void)openWritebackFileForPath:(NSString *)path truncated:(BOOL)truncated;
+- (void)closeWritebackFileForPath:(NSString *)path;
+- (void)moveWritebackFileAtPath:(NSString *)path toPath:(NSString *)toPath;
+- (void)didWriteWritebackFileAtPath:(NSString *)path toOffset:(long long)offset;
+- (void)didTruncateWritebackFileAtPath:(NSString *)path toSize:(long long)size;
+- (void)setWritebackModificationDate:(NSDate *)date forPath:(NSString *)path;
+- (NSDictionary *)writebackAttributesOverAttributes:(NSDictionary *)attributes
+                                            forPath:(NSString *)path;
+- (GMSessionDispatcher *)sessionDispatcher;
+- (void)setSessionDispatcher:(GMSessionDispatcher *)dispatcher;
 @end
 
 /* /sbin/umount is a setuid command on Linux and FreeBSD because umount2(2) and umount(2) respectively
 	require root priviledges. Executing the command avoids the need for setuid permission for this program.
   Interestingly, /sbin/umount is not a setuid command on OS X/Darwin.
+  On Linux, UnmountFuseMountPoint() does the same in process, using the setuid fusermount(1) only when
+  not running as root.
 */
+#if !defined (__linux__)
 static int	Unmount (NSArray * a_poaoArgs)
 	{
   NSString *	poszUnmount;
@@ -211,11 +353,7 @@ static int	Unmount (NSArray * a_poaoArgs)
   int					iExitCode;
   int					iErrno;
 
-#if defined (__linux__)
-	poszUnmount = @"/bin/umount";
-#else
   poszUnmount = @"/sbin/umount";		/* OS X/Darwin, FreeBSD, ... */
-#endif
 	poTaskUnmount = [NSTask launchedTaskWithLaunchPath: poszUnmount arguments: a_poaoArgs];
 	[poTaskUnmount waitUntilExit];
   iExitCode = [poTaskUnmount terminationStatus];
@@ -245,6 +383,151 @@ static int	Unmount (NSArray * a_poaoArgs)
     }
   return iErrno;
   }
+#endif	/* !defined (__linux__) */
+
+#if defined (__linux__)
+/* YES if /proc/self/mountinfo, already open as a_pFileMountInfo, lists a FUSE file system mounted at
+		a_pszMountPoint. The mount point is the fifth field, with space, tab, newline and backslash escaped as
+    octal, and the file system type follows the " - " separator. See proc(5)
+*/
+static BOOL	MountInfoContains (FILE * a_pFileMountInfo, const char * a_pszMountPoint)
+	{
+  char				szEscaped [PATH_MAX * 4 + 1];
+  size_t			cchEscaped = 0;
+  char *			pszLine = NULL;
+  size_t			cbLine = 0;
+  BOOL				fFound = NO;
+
+  for (const char * pch = a_pszMountPoint; *pch != '\0' && cchEscaped + 4 < sizeof (szEscaped); pch++)
+  	{
+    if ((*pch == ' ') || (*pch == '\t') || (*pch == '\n') || (*pch == '\\'))
+      cchEscaped += snprintf (szEscaped + cchEscaped, 5, "\\%03o", (unsigned char) *pch);
+    else
+      szEscaped [cchEscaped++] = *pch;
+    }
+  szEscaped [cchEscaped] = '\0';
+
+  rewind (a_pFileMountInfo);
+  while (!fFound && (getline (&pszLine, &cbLine, a_pFileMountInfo) > 0))
+  	{
+    char *	pszField = pszLine;
+
+    for (int i = 0; (i < 4) && (pszField != NULL); i++)
+    	{
+      pszField = strchr (pszField, ' ');
+      if (pszField != NULL)
+      	pszField++;
+      }
+    if ((pszField != NULL) && (strcspn (pszField, " ") == cchEscaped) &&
+    		(memcmp (pszField, szEscaped, cchEscaped) == 0))
+    	{
+      const char *	pszType = strstr (pszField, " - ");
+
+      fFound = (pszType != NULL) && (strncmp (pszType + 3, "fuse", 4) == 0);
+      }
+    }
+  free (pszLine);
+  return fFound;
+  }
+
+/* The mount point as /proc/self/mountinfo lists it: absolute, with symbolic links resolved. A dead FUSE
+		file system on the mount point can't be looked up, so then only its parent directory is resolved
+*/
+static NSString *	MountInfoPath (NSString * a_poszMountPath)
+	{
+  char				szResolved [PATH_MAX];
+  NSString *	poszParent;
+
+  if (realpath ([a_poszMountPath fileSystemRepresentation], szResolved) != NULL)
+  	return [NSString stringWithUTF8String: szResolved];
+  poszParent = [a_poszMountPath stringByDeletingLastPathComponent];
+  if ([poszParent length] == 0)
+  	poszParent = @".";
+  if (realpath ([poszParent fileSystemRepresentation], szResolved) == NULL)
+  	return [a_poszMountPath stringByStandardizingPath];
+  return [[NSString stringWithUTF8String: szResolved] stringByAppendingPathComponent: [a_poszMountPath lastPathComponent]];
+  }
+
+/* YES if a FUSE file system is mounted at a_pszMountPoint */
+static BOOL	IsFuseMountPoint (const char * a_pszMountPoint)
+	{
+  FILE *	pFileMountInfo = fopen ("/proc/self/mountinfo", "re");
+  BOOL		fFound;
+
+  if (pFileMountInfo == NULL)
+  	return NO;
+  fFound = MountInfoContains (pFileMountInfo, a_pszMountPoint);
+  fclose (pFileMountInfo);
+  return fFound;
+  }
+
+/* Waits up to a_dTimeout seconds for a FUSE file system to be mounted at a_pszMountPoint. The kernel flags
+		/proc/self/mountinfo with POLLPRI whenever the mount table changes, so each change is seen as soon as
+    it happens. Returns YES if the mount table could not be read
+*/
+static BOOL	WaitForFuseMountPoint (const char * a_pszMountPoint, double a_dTimeout)
+	{
+  FILE *					pFileMountInfo = fopen ("/proc/self/mountinfo", "re");
+  struct timespec	tsNow;
+  double					dDeadline;
+  BOOL						fFound;
+
+  if (pFileMountInfo == NULL)
+  	{
+    NSLog (@"fuse: WARNING: Could not open /proc/self/mountinfo. errno %i, %s. Assuming '%s' is mounted", errno, strerror (errno), a_pszMountPoint);
+    return YES;
+    }
+  clock_gettime (CLOCK_MONOTONIC, &tsNow);
+  dDeadline = tsNow.tv_sec + tsNow.tv_nsec / 1e9 + a_dTimeout;
+  while (!(fFound = MountInfoContains (pFileMountInfo, a_pszMountPoint)))
+  	{
+    struct pollfd	pfd;
+    int						msRemaining;
+
+    clock_gettime (CLOCK_MONOTONIC, &tsNow);
+    msRemaining = (int) ((dDeadline - (tsNow.tv_sec + tsNow.tv_nsec / 1e9)) * 1000.0);
+    if (msRemaining <= 0)
+    	break;
+    pfd.fd = fileno (pFileMountInfo);
+    pfd.events = POLLPRI;
+    pfd.revents = 0;
+    if ((poll (&pfd, 1, msRemaining) < 0) && (errno != EINTR))
+    	{
+      NSLog (@"fuse: ERROR: poll() of /proc/self/mountinfo FAILED. errno %i, %s", errno, strerror (errno));
+      break;
+      }
+    }
+  fclose (pFileMountInfo);
+  return fFound;
+  }
+
+/* Unmounts the FUSE file system at a_pszMountPoint, lazily with umount2(2) when running as root and
+		otherwise with the setuid fusermount(1). libfuse 2's fuse_unmount() does exactly that, but libfuse 3's
+    can only unmount a file system that it mounted in this process, so the same is done here
+*/
+static void	UnmountFuseMountPoint (const char * a_pszMountPoint)
+	{
+#if GM_FUSE3
+  char *	apszArgs [] = { "fusermount3", "-u", "-q", "-z", "--", (char *) a_pszMountPoint, NULL };
+  pid_t		pid;
+  int			iStatus;
+  int			iErrno;
+
+  if ((geteuid () == 0) && (umount2 (a_pszMountPoint, MNT_DETACH) == 0))
+  	return;
+  iErrno = posix_spawnp (&pid, apszArgs [0], NULL, NULL, apszArgs, environ);
+  if (iErrno != 0)
+  	{
+    NSLog (@"fuse: ERROR: Could not run fusermount3 to unmount '%s'. errno %i, %s", a_pszMountPoint, iErrno, strerror (iErrno));
+    return;
+    }
+  while ((waitpid (pid, &iStatus, 0) < 0) && (errno == EINTR))
+  	;
+#else
+  fuse_unmount (a_pszMountPoint, NULL);
+#endif	/* GM_FUSE3 */
+  }
+#endif	/* defined (__linux__) */
 
 @implementation GMUserFileSystemInternal
 
@@ -263,12 +546,42 @@ static int	Unmount (NSArray * a_poaoArgs)
     supportsExtendedTimes_ = NO;
     supportsSetVolumeName_ = NO;
     isReadOnly_ = NO;
+    mountProfile_ = [[GMMountProfile alloc] init];
+    smallFiles_ = [[NSMutableDictionary alloc] init];
+    smallFilesLock_ = [[NSLock alloc] init];
+    writebackFiles_ = [[NSMutableDictionary alloc] init];
+    writebackFilesLock_ = [[NSLock alloc] init];
+    negativeCache_ = GMPathCacheCreate();
+    directoryCache_ = GMPathCacheCreate();
+    symlinkCache_ = GMPathCacheCreate();
+    accessCache_ = GMPathCacheCreate();
+    if (negativeCache_ == NULL || directoryCache_ == NULL || symlinkCache_ == NULL ||
+        accessCache_ == NULL) {
+      [self release];
+      return nil;
+    }
     [self setDelegate:delegate];
   }
   return self;
 }
 - (void)dealloc {
+  GMOperationRecorderStop(&recorder_);
   [mountPath_ release];
+  [mountInfoPath_ release];
+  [mountProfile_ release];
+  [negotiatedMountProfile_ release];
+  GMPathCacheDestroy(negativeCache_);
+  GMPathCacheDestroy(directoryCache_);
+  GMPathCacheDestroy(symlinkCache_);
+  GMPathCacheDestroy(accessCache_);
+  [metadataBatcher_ release];
+  [attributeCoalescer_ release];
+  [handleCache_ release];
+  [smallFiles_ release];
+  [smallFilesLock_ release];
+  [writebackFiles_ release];
+  [writebackFilesLock_ release];
+  [sessionDispatcher_ release];
   [super dealloc];
 }
 
@@ -279,6 +592,11 @@ static int	Unmount (NSArray * a_poaoArgs)
   [mountPath_ autorelease];
   mountPath_ = [mountPath copy];
 }
+- (NSString *)mountInfoPath { return mountInfoPath_; }
+- (void)setMountInfoPath:(NSString *)mountInfoPath {
+  [mountInfoPath_ autorelease];
+  mountInfoPath_ = [mountInfoPath copy];
+}
 - (GMUserFileSystemStatus)status { return status_; }
 - (void)setStatus:(GMUserFileSystemStatus)status { status_ = status; }
 - (BOOL)isThreadSafe { return isThreadSafe_; }
@@ -295,6 +613,184 @@ static int	Unmount (NSArray * a_poaoArgs)
 - (BOOL)shouldCheckForResource { return shouldCheckForResource_; }
 - (BOOL)isReadOnly { return isReadOnly_; }
 - (void)setIsReadOnly:(BOOL)val { isReadOnly_ = val; }
+- (GMOperationRecorderSlot *)recorderSlot { return &recorder_; }
+- (GMMountProfile *)mountProfile { return mountProfile_; }
+- (void)setMountProfile:(GMMountProfile *)profile {
+  [mountProfile_ autorelease];
+  mountProfile_ = [profile copy];
+}
+- (GMMountProfile *)negotiatedMountProfile { return negotiatedMountProfile_; }
+- (void)setNegotiatedMountProfile:(GMMountProfile *)profile {
+  [negotiatedMountProfile_ autorelease];
+  negotiatedMountProfile_ = [profile copy];
+}
+- (GMPathCache *)negativeCache { return negativeCache_; }
+- (GMPathCache *)directoryCache { return directoryCache_; }
+- (GMPathCache *)symlinkCache { return symlinkCache_; }
+- (GMPathCache *)accessCache { return accessCache_; }
+- (GMMetadataBatcher *)metadataBatcher { return metadataBatcher_; }
+- (void)setMetadataBatcher:(GMMetadataBatcher *)batcher {
+  [metadataBatcher_ autorelease];
+  metadataBatcher_ = [batcher retain];
+}
+- (GMAttributeCoalescer *)attributeCoalescer { return attributeCoalescer_; }
+- (void)setAttributeCoalescer:(GMAttributeCoalescer *)coalescer {
+  [attributeCoalescer_ autorelease];
+  attributeCoalescer_ = [coalescer retain];
+}
+- (GMHandleCache *)handleCache { return handleCache_; }
+- (void)setHandleCache:(GMHandleCache *)handleCache {
+  [handleCache_ autorelease];
+  handleCache_ = [handleCache retain];
+}
+- (BOOL)interruptible { return interruptible_; }
+- (void)setInterruptible:(BOOL)interruptible { interruptible_ = interruptible; }
+- (GMSessionDispatcher *)sessionDispatcher { return sessionDispatcher_; }
+- (void)setSessionDispatcher:(GMSessionDispatcher *)dispatcher {
+  [sessionDispatcher_ autorelease];
+  sessionDispatcher_ = [dispatcher retain];
+}
+- (NSUInteger)smallFileSize { return smallFileSize_; }
+- (void)setSmallFileSize:(NSUInteger)size { smallFileSize_ = size; }
+- (GMSmallFile *)smallFileForPath:(NSString *)path {
+  if (smallFileSize_ == 0 || path == nil) {
+    return nil;
+  }
+  [smallFilesLock_ lock];
+  GMSmallFile* smallFile = [[smallFiles_ objectForKey:path] retain];
+  [smallFilesLock_ unlock];
+  return [smallFile autorelease];
+}
+// Registers smallFile for its path, unless another open registered the path
+// first. Returns the registered file, opened once more.
+- (GMSmallFile *)openSmallFile:(GMSmallFile *)smallFile {
+  [smallFilesLock_ lock];
+  GMSmallFile* registered = [smallFiles_ objectForKey:[smallFile path]];
+  if (registered == nil) {
+    registered = smallFile;
+    [smallFiles_ setObject:smallFile forKey:[smallFile path]];
+  }
+  [registered setOpenCount:[registered openCount] + 1];
+  [registered retain];
+  [smallFilesLock_ unlock];
+  return [registered autorelease];
+}
+- (GMSmallFile *)openSmallFileForPath:(NSString *)path {
+  if (smallFileSize_ == 0 || path == nil) {
+    return nil;
+  }
+  [smallFilesLock_ lock];
+  GMSmallFile* smallFile = [smallFiles_ objectForKey:path];
+  [smallFile setOpenCount:[smallFile openCount] + 1];
+  [smallFile retain];
+  [smallFilesLock_ unlock];
+  return [smallFile autorelease];
+}
+// Returns YES when the last open of smallFile is closed.
+- (BOOL)closeSmallFile:(GMSmallFile *)smallFile {
+  [smallFilesLock_ lock];
+  NSUInteger openCount = [smallFile openCount] - 1;
+  [smallFile setOpenCount:openCount];
+  if (openCount == 0 && [smallFiles_ objectForKey:[smallFile path]] == smallFile) {
+    [smallFiles_ removeObjectForKey:[smallFile path]];
+  }
+  [smallFilesLock_ unlock];
+  return openCount == 0;
+}
+- (void)removeSmallFile:(GMSmallFile *)smallFile {
+  [smallFilesLock_ lock];
+  if ([smallFiles_ objectForKey:[smallFile path]] == smallFile) {
+    [smallFiles_ removeObjectForKey:[smallFile path]];
+  }
+  [smallFilesLock_ unlock];
+}
+- (BOOL)writebackCache { return writebackCache_; }
+- (void)setWritebackCache:(BOOL)writebackCache { writebackCache_ = writebackCache; }
+// Tracks a file from its first writable open, which truncated it if it was
+// opened with O_TRUNC or created.
+- (void)openWritebackFileForPath:(NSString *)path truncated:(BOOL)truncated {
+  if (!writebackCache_ || path == nil) {
+    return;
+  }
+  [writebackFilesLock_ lock];
+  GMWritebackFile* file = [writebackFiles_ objectForKey:path];
+  if (file == nil) {
+    file = [[GMWritebackFile alloc] init];
+    [writebackFiles_ setObject:file forKey:path];
+    [file release];
+  }
+  [file setOpenCount:[file openCount] + 1];
+  if (truncated) {
+    [file didTruncateToSize:0];
+  }
+  [writebackFilesLock_ unlock];
+}
+- (void)closeWritebackFileForPath:(NSString *)path {
+  if (!writebackCache_ || path == nil) {
+    return;
+  }
+  [writebackFilesLock_ lock];
+  GMWritebackFile* file = [writebackFiles_ objectForKey:path];
+  if (file != nil) {
+    NSUInteger openCount = [file openCount] - 1;
+    [file setOpenCount:openCount];
+    if (openCount == 0) {
+      [writebackFiles_ removeObjectForKey:path];
+    }
+  }
+  [writebackFilesLock_ unlock];
+}
+// Renamed files are released under their new path.
+- (void)moveWritebackFileAtPath:(NSString *)path toPath:(NSString *)toPath {
+  if (!writebackCache_ || path == nil || toPath == nil) {
+    return;
+  }
+  [writebackFilesLock_ lock];
+  GMWritebackFile* file = [[writebackFiles_ objectForKey:path] retain];
+  if (file != nil) {
+    [writebackFiles_ removeObjectForKey:path];
+    [writebackFiles_ setObject:file forKey:toPath];
+    [file release];
+  }
+  [writebackFilesLock_ unlock];
+}
+- (void)didWriteWritebackFileAtPath:(NSString *)path toOffset:(long long)offset {
+  if (!writebackCache_ || path == nil) {
+    return;
+  }
+  [writebackFilesLock_ lock];
+  [[writebackFiles_ objectForKey:path] didWriteToOffset:offset];
+  [writebackFilesLock_ unlock];
+}
+- (void)didTruncateWritebackFileAtPath:(NSString *)path toSize:(long long)size {
+  if (!writebackCache_ || path == nil) {
+    return;
+  }
+  [writebackFilesLock_ lock];
+  [[writebackFiles_ objectForKey:path] didTruncateToSize:size];
+  [writebackFilesLock_ unlock];
+}
+- (void)setWritebackModificationDate:(NSDate *)date forPath:(NSString *)path {
+  if (!writebackCache_ || path == nil) {
+    return;
+  }
+  [writebackFilesLock_ lock];
+  [[writebackFiles_ objectForKey:path] setModificationDate:date];
+  [writebackFilesLock_ unlock];
+}
+- (NSDictionary *)writebackAttributesOverAttributes:(NSDictionary *)attributes
+                                            forPath:(NSString *)path {
+  if (!writebackCache_ || path == nil) {
+    return attributes;
+  }
+  [writebackFilesLock_ lock];
+  GMWritebackFile* file = [writebackFiles_ objectForKey:path];
+  if (file != nil) {
+    attributes = [file attributesOverDelegateAttributes:attributes];
+  }
+  [writebackFilesLock_ unlock];
+  return attributes;
+}
 - (id)delegate { return delegate_; }
 - (void)setDelegate:(id)delegate { 
   delegate_ = delegate;
@@ -317,6 +813,14 @@ static int	Unmount (NSArray * a_poaoArgs)
 
 @end
 
+/* YES if the caller has interrupted the FUSE request that the calling thread is serving. Threads that
+		aren't serving a request, such as the framework's own, never are
+*/
+static BOOL	IsInterrupted (void)
+	{
+  return (fuse_get_context () != NULL) && (fuse_interrupted () != 0);
+  }
+
 // Deprecated delegate methods that we still support for backward compatibility
 // with previously compiled file systems. This will be actively trimmed as
 // new releases occur.
@@ -366,10 +870,43 @@ static int	Unmount (NSArray * a_poaoArgs)
                  forPath:(NSString *)path
                    error:(NSError **)error;
 - (void)fuseInit;
+- (void)startWaitingUntilMounted;
 - (void)fuseDestroy;
 
+- (BOOL)openSmallFileAtPath:(NSString *)path
+                 attributes:(NSDictionary *)attributes
+                      flags:(int)flags
+                      isNew:(BOOL)isNew
+                   userData:(id *)userData
+                      error:(NSError **)error
+                    handled:(BOOL *)handled;
+- (void)releaseSmallFile:(GMSmallFile *)smallFile;
+- (BOOL)canKeepFileAtPath:(NSString *)path userData:(id)userData flags:(int)flags;
+- (void)didOpenFileAtPath:(NSString *)path userData:(id)userData flags:(int)flags;
+- (BOOL)keepFileAtPath:(NSString *)path userData:(id)userData flags:(int)flags;
+- (id)reusableFileAtPath:(NSString *)path flags:(int)flags;
+- (BOOL)isAbandoned:(NSError **)error;
+- (BOOL)spillSmallFileAtPath:(NSString *)path error:(NSError **)error;
+- (void)smallFileDidSpill:(GMSmallFile *)smallFile;
+- (NSDictionary *)attributesOfSmallFile:(GMSmallFile *)smallFile
+                                  error:(NSError **)error;
+- (BOOL)flushFileAtPath:(NSString *)path
+               userData:(id)userData
+                  error:(NSError **)error;
+
 @end
 
+static void	InvalidateCachedLookups (GMUserFileSystem * a_poUserFileSystem, const char * a_pszPath, BOOL a_bDescendants);
+static NSString *	AccessDecisionKey (const struct fuse_context * a_pContext, int a_iMode);
+
+/* The open flags that must match for a kept file to be reused. Those that only matter when the file
+		is created don't
+*/
+static int	HandleCacheFlags (int a_iFlags)
+	{
+  return a_iFlags & ~(O_CREAT | O_EXCL | O_NOCTTY);
+  }
+
 @implementation GMUserFileSystem
 
 + (NSDictionary *)currentContext {
@@ -388,6 +925,10 @@ static int	Unmount (NSArray * a_poaoArgs)
   return [dict autorelease];
 }
 
++ (BOOL)isCurrentOperationCancelled {
+  return IsInterrupted();
+}
+
 - (id)init {
   return [self initWithDelegate:nil isThreadSafe:NO];
 }
@@ -476,10 +1017,48 @@ static int	Unmount (NSArray * a_poaoArgs)
   }
 }
 
+- (void)setMountProfile:(GMMountProfile *)profile {
+  [internal_ setMountProfile:(profile != nil) ? profile : [GMMountProfile mountProfile]];
+}
+- (GMMountProfile *)mountProfile {
+  return [[[internal_ mountProfile] copy] autorelease];
+}
+- (GMMountProfile *)negotiatedMountProfile {
+  return [[[internal_ negotiatedMountProfile] copy] autorelease];
+}
+
+- (void)setSessionDispatcher:(GMSessionDispatcher *)dispatcher {
+  [internal_ setSessionDispatcher:dispatcher];
+}
+- (GMSessionDispatcher *)sessionDispatcher {
+  return [internal_ sessionDispatcher];
+}
+
+- (void)invalidateCachesForPath:(NSString *)path {
+  InvalidateCachedLookups(self, (path != nil) ? [path UTF8String] : NULL, YES);
+#if GM_FUSE3 && GM_FUSE_AT_LEAST(3, 5)
+  // The kernel keeps directory listings too when the directory cache is on.
+  // See fusefm_opendir.
+  if (GMPathCacheIsEnabled([internal_ directoryCache])) {
+    if (path == nil || [path isEqualToString:@"/"]) {
+      [self invalidateItemAtPath:@"/" error:NULL];
+    } else {
+      [self invalidateItemAtPath:path error:NULL];
+      [self invalidateItemAtPath:[path stringByDeletingLastPathComponent]
+                           error:NULL];
+    }
+  }
+#endif	/* GM_FUSE3 && GM_FUSE_AT_LEAST(3, 5) */
+}
+
 - (void)unmount {
   if ([internal_ status] == GMUserFileSystem_MOUNTED) {
+#if defined (__linux__)
+    UnmountFuseMountPoint([[internal_ mountPath] UTF8String]);
+#else
     NSArray* args = [NSArray arrayWithObjects:@"-v", [internal_ mountPath], nil];
     Unmount (args);
+#endif	/* defined (__linux__) */
   }
   else
   	NSLog (@"fuse: ERROR: File system mountpoint '%@' is not mounted IN %@", [internal_ mountPath], self);
@@ -491,7 +1070,7 @@ static int	Unmount (NSArray * a_poaoArgs)
   if ([internal_ status] == GMUserFileSystem_MOUNTED) {		/* CJEC, 2-Aug-19: TODO: OSXFUSE 3.8.3 BUG: Add this line of code to OSXFUSE in GITHUB to prevent invalidation when not mounted */
     struct fuse* handle = [internal_ handle];
     if (handle) {
-#if defined (__APPLE__)
+#if defined (__APPLE__) || (GM_FUSE3 && GM_FUSE_AT_LEAST(3, 5))
       ret = fuse_invalidate_path(handle, [path fileSystemRepresentation]);
     
       // Note: fuse_invalidate_path() may return -ENOENT to indicate that there
@@ -506,7 +1085,7 @@ static int	Unmount (NSArray * a_poaoArgs)
       */
       NSLog (@"fuse: ERROR: UNIMPLEMENTED: fuse_invalidate_path() for path '%@'. Returning ENOTSUP IN %@", path, self);
 		  ret = -ENOTSUP;
-#endif	/* defined (__APPLE__) */
+#endif	/* defined (__APPLE__) || (GM_FUSE3 && GM_FUSE_AT_LEAST(3, 5)) */
     }
   }
   if (ret != 0) {
@@ -519,6 +1098,23 @@ static int	Unmount (NSArray * a_poaoArgs)
   return YES;
 }
 
+- (BOOL)startRecordingOperationsToPath:(NSString *)path
+                                 error:(NSError **)error {
+  int ret = GMOperationRecorderStart([internal_ recorderSlot],
+                                     [path fileSystemRepresentation]);
+  if (ret != 0) {
+    if (error) {
+      *error = [GMUserFileSystem errorWithCode:ret];
+    }
+    return NO;
+  }
+  return YES;
+}
+
+- (void)stopRecordingOperations {
+  GMOperationRecorderStop([internal_ recorderSlot]);
+}
+
 + (NSError *)errorWithCode:(int)code {
   return [NSError errorWithDomain:NSPOSIXErrorDomain code:code userInfo:nil];
 }
@@ -536,6 +1132,13 @@ static int	Unmount (NSArray * a_poaoArgs)
 #define FUSEDEVIOCGETHANDSHAKECOMPLETE _IOR('F', 2, u_int32_t)
 static const int kMaxWaitForMountTries = 50;
 static const int kWaitForMountUSleepInterval = 100000;  // 100 ms
+#else
+#if defined (__linux__)
+/* Fuse on Linux mounts before the first request is read, so the mount is normally listed at once. The limit
+		matches OS X/Darwin's
+*/
+static const double kMaxWaitForMountSeconds = 5.0;
+#endif	/* defined (__linux__) */
 #endif	/* defined (__APPLE__) */
 
 - (void)waitUntilMounted:(NSNumber *)fileDescriptor {
@@ -550,6 +1153,19 @@ static const int kWaitForMountUSleepInterval = 100000;  // 100 ms
       [internal_ setStatus:GMUserFileSystem_MOUNTED];
 #else
   (void) fileDescriptor;                /* Avoid unused parameter compiler warning */
+#if defined (__linux__)
+  if (!WaitForFuseMountPoint ([[internal_ mountInfoPath] UTF8String], kMaxWaitForMountSeconds)) {
+    NSLog (@"fuse: ERROR: Mountpoint '%@' did not appear in /proc/self/mountinfo within %g seconds IN %@", [internal_ mountPath], kMaxWaitForMountSeconds, self);
+    // fuse_main() may have mounted it all the same and be serving requests, so take it down before reporting
+    // failure. The status is set first so that fuseDestroy leaves it be.
+    [internal_ setStatus:GMUserFileSystem_FAILURE];
+    UnmountFuseMountPoint ([[internal_ mountPath] UTF8String]);
+    [self postMountError: [NSError errorWithDomain: NSPOSIXErrorDomain code: EIO userInfo: nil]];
+    [pool release];
+    return;
+  }
+#endif	/* defined (__linux__) */
+  [internal_ setStatus:GMUserFileSystem_MOUNTED];
 #endif	/* defined (__APPLE__) */
 
       // Successfully mounted, so post notification.
@@ -571,7 +1187,10 @@ static const int kWaitForMountUSleepInterval = 100000;  // 100 ms
   }
   
   // Tried for a long time and no luck :-(
-  // Unmount and report failure?
+  // Unmount so that a mount still completing doesn't outlive the failure.
+  // The status is set first so that fuseDestroy leaves it be.
+  [internal_ setStatus:GMUserFileSystem_FAILURE];
+  Unmount ([NSArray arrayWithObjects:@"-v", [internal_ mountPath], nil]);
   [self postMountError: [NSError errorWithDomain: NSPOSIXErrorDomain code: EIO userInfo: nil]];
   [pool release];
 #endif	/* defined (__APPLE__) */
@@ -620,14 +1239,24 @@ static const int kWaitForMountUSleepInterval = 100000;  // 100 ms
       [internal_ setSupportsSetVolumeName:[supports boolValue]];
     }
   }
+}
+
+// Called at the end of fusefm_init, once the capabilities have been negotiated.
+- (void)startWaitingUntilMounted {
+  struct fuse_context* context = fuse_get_context();
+
   // For Fuse for OS X/Darwin:
   // The mountpoint won't actually show up until this winds its way
   // back through the kernel after this routine returns. In order to post
   // the kGMUserFileSystemDidMount notification we start a new thread that will
   // poll until it is mounted.
   struct fuse_session* se = fuse_get_session(context->fuse);
+#if GM_FUSE3
+  int fd = fuse_session_fd(se);
+#else
   struct fuse_chan* chan = fuse_session_next_chan(se, NULL);
   int fd = fuse_chan_fd(chan);
+#endif	/* GM_FUSE3 */
   
   [NSThread detachNewThreadSelector:@selector(waitUntilMounted:)
                            toTarget:self
@@ -635,19 +1264,43 @@ static const int kWaitForMountUSleepInterval = 100000;  // 100 ms
 }
 
 - (void)fuseDestroy {
+  // The delegate gets its final releases before it hears of the unmount.
+  [[internal_ handleCache] stop];
+  [internal_ setHandleCache:nil];
   if ([[internal_ delegate] respondsToSelector:@selector(willUnmount)]) {
     [[internal_ delegate] willUnmount];
   }
-  [internal_ setStatus:GMUserFileSystem_UNMOUNTING];
-
-  NSDictionary* userInfo = 
-    [NSDictionary dictionaryWithObjectsAndKeys:
-     [internal_ mountPath], kGMUserFileSystemMountPathKey,
-     nil];
-  NSNotificationCenter* center = [NSNotificationCenter defaultCenter];
-  [center postNotificationName:kGMUserFileSystemDidUnmount object:self
-                      userInfo:userInfo];
-  [internal_ setStatus:GMUserFileSystem_NOT_MOUNTED];
+  // A mount that waitUntilMounted: gave up on was never reported as mounted,
+  // so it keeps its failure and isn't reported as unmounted either.
+  BOOL didFail = ([internal_ status] == GMUserFileSystem_FAILURE);
+  if (!didFail) {
+    [internal_ setStatus:GMUserFileSystem_UNMOUNTING];
+
+    NSDictionary* userInfo = 
+      [NSDictionary dictionaryWithObjectsAndKeys:
+       [internal_ mountPath], kGMUserFileSystemMountPathKey,
+       nil];
+    NSNotificationCenter* center = [NSNotificationCenter defaultCenter];
+    [center postNotificationName:kGMUserFileSystemDidUnmount object:self
+                        userInfo:userInfo];
+  }
+  if ([[internal_ negotiatedMountProfile] internPaths]) {
+    __atomic_fetch_sub(&g_cInterningFileSystems, 1, __ATOMIC_RELAXED);
+  }
+  [internal_ setNegotiatedMountProfile:nil];
+  GMPathCacheConfigure([internal_ negativeCache], 0, 0);
+  GMPathCacheConfigure([internal_ directoryCache], 0, 0);
+  GMPathCacheConfigure([internal_ symlinkCache], 0, 0);
+  GMPathCacheConfigure([internal_ accessCache], 0, 0);
+  [internal_ setMetadataBatcher:nil];
+  [[internal_ attributeCoalescer] stop];
+  [internal_ setAttributeCoalescer:nil];
+  [internal_ setSmallFileSize:0];
+  [internal_ setWritebackCache:NO];
+  [internal_ setInterruptible:NO];
+  if (!didFail) {
+    [internal_ setStatus:GMUserFileSystem_NOT_MOUNTED];
+  }
 }
 
 #pragma mark Finder Info, Resource Forks and HFS headers
@@ -936,12 +1589,26 @@ static const int kWaitForMountUSleepInterval = 100000;  // 100 ms
                forPath:(NSString *)path 
               userData:(id)userData
                  error:(NSError **)error {
-  NSDictionary* attributes = [self defaultAttributesOfItemAtPath:path 
-                                                        userData:userData
-                                                           error:error];
+  NSDictionary* attributes = nil;
+  GMSmallFile* smallFile = [userData isKindOfClass:[GMSmallFile class]] ?
+    userData : [internal_ smallFileForPath:path];
+  if (smallFile) {
+    attributes = [self attributesOfSmallFile:smallFile error:error];
+  } else {
+    attributes = [self defaultAttributesOfItemAtPath:path 
+                                            userData:userData
+                                               error:error];
+  }
   if (!attributes) {
     return NO;
   }
+  NSDictionary* held = [[internal_ attributeCoalescer] attributesForPath:path];
+  if (held) {
+    NSMutableDictionary* merged = [NSMutableDictionary dictionaryWithDictionary:attributes];
+    [merged addEntriesFromDictionary:held];
+    attributes = merged;
+  }
+  attributes = [internal_ writebackAttributesOverAttributes:attributes forPath:path];
 
   // Inode
   /* CJEC, 23-Dec-20: TODO: OSXFUSE 3.10.5 documents a problem with 64-bit INodeIDs losing the top 32 bits
@@ -1161,6 +1828,21 @@ static const int kWaitForMountUSleepInterval = 100000;  // 100 ms
   }
 #endif	/* defined (__APPLE__) */
 
+  GMMetadataBatcher* batcher = [internal_ metadataBatcher];
+  if (batcher) {
+    GMMetadataOperation* operation =
+      [[[GMMetadataOperation alloc] initWithType:GMMetadataOperationCreateFile
+                                            path:path
+                                 destinationPath:nil
+                                      attributes:attributes
+                                           flags:flags
+                                        userData:nil] autorelease];
+    BOOL ret = [batcher performOperation:operation error:error];
+    if (ret) {
+      *userData = [operation userData];
+    }
+    return ret;
+  }
   if ([[internal_ delegate] respondsToSelector:@selector(createFileAtPath:attributes:flags:userData:error:)]) {
     return [[internal_ delegate] createFileAtPath:path
                                        attributes:attributes
@@ -1200,6 +1882,10 @@ static const int kWaitForMountUSleepInterval = 100000;  // 100 ms
   }  
 #endif	/* defined (__APPLE__) */
 
+  // Later writes through a buffered file's open handles go to the delegate.
+  if (![self spillSmallFileAtPath:path error:error]) {
+    return NO;
+  }
   if ([[internal_ delegate] respondsToSelector:@selector(removeItemAtPath:error:)]) {
     return [[internal_ delegate] removeItemAtPath:path error:error];
   }
@@ -1224,6 +1910,22 @@ static const int kWaitForMountUSleepInterval = 100000;  // 100 ms
   }
 #endif	/* defined (__APPLE__) */
 
+  // Buffered files are known by path, so hand them to the delegate first.
+  if (![self spillSmallFileAtPath:source error:error] ||
+      ![self spillSmallFileAtPath:destination error:error]) {
+    return NO;
+  }
+  GMMetadataBatcher* batcher = [internal_ metadataBatcher];
+  if (batcher) {
+    GMMetadataOperation* operation =
+      [[[GMMetadataOperation alloc] initWithType:GMMetadataOperationMoveItem
+                                            path:source
+                                 destinationPath:destination
+                                      attributes:nil
+                                           flags:0
+                                        userData:nil] autorelease];
+    return [batcher performOperation:operation error:error];
+  }
   if ([[internal_ delegate] respondsToSelector:@selector(moveItemAtPath:toPath:error:)]) {
     return [[internal_ delegate] moveItemAtPath:source toPath:destination error:error];
   }  
@@ -1300,6 +2002,9 @@ static const int kWaitForMountUSleepInterval = 100000;  // 100 ms
 #endif	/* defined (__APPLE__) */
 
   NSArray* contents = nil;
+  if ([self isAbandoned:error]) {
+    return nil;
+  }
   if ([[internal_ delegate] respondsToSelector:@selector(contentsOfDirectoryAtPath:error:)]) {
     contents = [[internal_ delegate] contentsOfDirectoryAtPath:path error:error];
   } else if ([path isEqualToString:@"/"]) {
@@ -1310,6 +2015,19 @@ static const int kWaitForMountUSleepInterval = 100000;  // 100 ms
 
 #pragma mark File Contents
 
+// YES, with an EINTR error, if the mount profile is interruptible and the
+// caller has given up on the current request, so it needn't reach the
+// delegate. Operations that release or flush files never give up.
+- (BOOL)isAbandoned:(NSError **)error {
+  if (![internal_ interruptible] || !IsInterrupted()) {
+    return NO;
+  }
+  if (error) {
+    *error = [GMUserFileSystem errorWithCode:EINTR];
+  }
+  return YES;
+}
+
 // Note: Only call this if the delegate does indeed support this method.
 - (NSData *)contentsAtPath:(NSString *)path {
 #if defined (__APPLE__)
@@ -1333,6 +2051,9 @@ static const int kWaitForMountUSleepInterval = 100000;  // 100 ms
   }
 #endif	/* defined (__APPLE__) */
 
+  if ([self isAbandoned:error]) {
+    return NO;
+  }
   id delegate = [internal_ delegate];
   if ([delegate respondsToSelector:@selector(contentsAtPath:)]) {
     NSData* data = [self contentsAtPath:path];
@@ -1389,11 +2110,79 @@ static const int kWaitForMountUSleepInterval = 100000;  // 100 ms
       [userData isKindOfClass:[GMDataBackedFileDelegate class]]) {
     return;  // Don't report releaseFileAtPath for internal file.
   }
+  if ([userData isKindOfClass:[GMSmallFile class]]) {
+    [self releaseSmallFile:userData];
+    return;
+  }
   if ([[internal_ delegate] respondsToSelector:@selector(releaseFileAtPath:userData:)]) {
     [[internal_ delegate] releaseFileAtPath:path userData:userData];
   }
 }
 
+// Only files opened read-only are kept: a delegate may commit writes when a
+// file is released, and close(2) mustn't return before that.
+- (BOOL)canKeepFileAtPath:(NSString *)path userData:(id)userData flags:(int)flags {
+  return [internal_ handleCache] != nil && path != nil && userData != nil &&
+         (flags & O_ACCMODE) == O_RDONLY && (flags & O_TRUNC) == 0 &&
+         ![userData isKindOfClass:[GMDataBackedFileDelegate class]] &&
+         ![userData isKindOfClass:[GMSmallFile class]];
+}
+
+// Notes who opened a file that may be kept, when it's only to be reused by
+// the same caller.
+- (void)didOpenFileAtPath:(NSString *)path userData:(id)userData flags:(int)flags {
+  GMHandleCache* handleCache = [internal_ handleCache];
+  if ([handleCache requiresOwner] &&
+      [self canKeepFileAtPath:path userData:userData flags:flags]) {
+    [handleCache noteOwner:AccessDecisionKey(fuse_get_context(), 0)
+                ofUserData:userData];
+  }
+}
+
+// Keeps a released file for reuse instead of releasing it. Returns NO if the
+// caller must release it.
+- (BOOL)keepFileAtPath:(NSString *)path userData:(id)userData flags:(int)flags {
+  if (![self canKeepFileAtPath:path userData:userData flags:flags]) {
+    return NO;
+  }
+  return [[internal_ handleCache] keepUserData:userData
+                                       forPath:path
+                                         flags:HandleCacheFlags(flags)];
+}
+
+// Returns the userData of a kept file to reuse for an open, or nil to open the
+// file afresh.
+- (id)reusableFileAtPath:(NSString *)path flags:(int)flags {
+  GMHandleCache* handleCache = [internal_ handleCache];
+  if (handleCache == nil || path == nil) {
+    return nil;
+  }
+  // A file about to be written makes the kept ones stale. So does a buffered
+  // small file, which is newer than any kept file.
+  if ((flags & O_ACCMODE) != O_RDONLY || (flags & O_TRUNC) != 0 ||
+      [internal_ smallFileForPath:path] != nil) {
+    [handleCache discardPath:path descendants:NO];
+    return nil;
+  }
+  NSString* owner = nil;
+  if ([handleCache requiresOwner]) {
+    owner = AccessDecisionKey(fuse_get_context(), 0);
+  }
+  id userData = [handleCache takeUserDataForPath:path
+                                           flags:HandleCacheFlags(flags)
+                                           owner:owner];
+  if (userData == nil) {
+    return nil;
+  }
+  id delegate = [internal_ delegate];
+  if ([delegate respondsToSelector:@selector(shouldReuseFileAtPath:userData:mode:)] &&
+      ![delegate shouldReuseFileAtPath:path userData:userData mode:flags]) {
+    [self releaseFileAtPath:path userData:userData];
+    return nil;
+  }
+  return userData;
+}
+
 - (int)readFileAtPath:(NSString *)path 
              userData:(id)userData
                buffer:(char *)buffer 
@@ -1409,6 +2198,9 @@ static const int kWaitForMountUSleepInterval = 100000;  // 100 ms
   }
 #endif	/* defined (__APPLE__) */
 
+  if ([self isAbandoned:error]) {
+    return -1;
+  }
   if (userData != nil &&
       [userData respondsToSelector:@selector(readToBuffer:size:offset:error:)]) {
     return [userData readToBuffer:buffer size:size offset:offset error:error];
@@ -1439,6 +2231,9 @@ static const int kWaitForMountUSleepInterval = 100000;  // 100 ms
   }
 #endif	/* defined (__APPLE__) */
 
+  if ([self isAbandoned:error]) {
+    return -1;
+  }
   if (userData != nil &&
       [userData respondsToSelector:@selector(writeFromBuffer:size:offset:error:)]) {
     return [userData writeFromBuffer:buffer size:size offset:offset error:error];
@@ -1490,6 +2285,12 @@ static const int kWaitForMountUSleepInterval = 100000;  // 100 ms
   }
 #endif	/* defined (__APPLE__) */
 
+  if ([userData isKindOfClass:[GMSmallFile class]]) {
+    if (![userData spill:error]) {
+      return NO;
+    }
+    userData = [userData delegateUserData];
+  }
   if ([self supportsAllocateFileAtPath]) {
 #if defined (__APPLE__)
     if ((options & PREALLOCATE) == PREALLOCATE) {
@@ -1512,35 +2313,320 @@ static const int kWaitForMountUSleepInterval = 100000;  // 100 ms
   return NO;
 }
 
-- (BOOL)supportsExchangeData {
+- (BOOL)supportsCopyFileRange {
   id delegate = [internal_ delegate];
-  return [delegate respondsToSelector:@selector(exchangeDataOfItemAtPath:withItemAtPath:error:)];
+  return [delegate respondsToSelector:@selector(copyFileRangeAtPath:userData:offset:toPath:toUserData:toOffset:length:error:)];
 }
 
-- (BOOL)exchangeDataOfItemAtPath:(NSString *)path1
-                  withItemAtPath:(NSString *)path2
-                           error:(NSError **)error {
-#if defined (__APPLE__)
-  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
-    NSString* traceinfo = [NSString stringWithFormat:@"%@ <-> %@", path1, path2];
-    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+- (ssize_t)copyFileRangeAtPath:(NSString *)path
+                      userData:(id)userData
+                        offset:(fuse_off_t)offset
+                        toPath:(NSString *)toPath
+                    toUserData:(id)toUserData
+                      toOffset:(fuse_off_t)toOffset
+                        length:(size_t)length
+                         error:(NSError **)error {
+  // ENOTSUP has the kernel fall back to reading and writing the range. That's
+  // cheap for the framework's own files and for a small file still held in
+  // memory, which the delegate hasn't seen.
+  if ([userData isKindOfClass:[GMDataBackedFileDelegate class]] ||
+      [toUserData isKindOfClass:[GMDataBackedFileDelegate class]] ||
+      ([userData isKindOfClass:[GMSmallFile class]] && ![userData isSpilled])) {
+    if (error) {
+      *error = [GMUserFileSystem errorWithCode:ENOTSUP];
+    }
+    return -1;
   }
-#endif	/* defined (__APPLE__) */
-
-  if ([[internal_ delegate] respondsToSelector:@selector(exchangeDataOfItemAtPath:withItemAtPath:error:)]) {
-    return [[internal_ delegate] exchangeDataOfItemAtPath:path1
-                                           withItemAtPath:path2
-                                                    error:error];
-  }  
-  *error = [GMUserFileSystem errorWithCode:ENOSYS];
-  return NO;
+  if ([userData isKindOfClass:[GMSmallFile class]]) {
+    userData = [userData delegateUserData];
+  }
+  // A new copy, such as cp(1) creates, is usually a small file. It won't stay
+  // small once the range is copied into it.
+  if ([toUserData isKindOfClass:[GMSmallFile class]]) {
+    if (![toUserData spill:error]) {
+      return -1;
+    }
+    toUserData = [toUserData delegateUserData];
+  }
+  if ([self isAbandoned:error]) {
+    return -1;
+  }
+  if ([self supportsCopyFileRange]) {
+    return [[internal_ delegate] copyFileRangeAtPath:path
+                                            userData:userData
+                                              offset:offset
+                                              toPath:toPath
+                                          toUserData:toUserData
+                                            toOffset:toOffset
+                                              length:length
+                                               error:error];
+  }
+  if (error) {
+    *error = [GMUserFileSystem errorWithCode:ENOSYS];
+  }
+  return -1;
 }
 
-#pragma mark Performing access checks
+- (BOOL)supportsExtentOfFile {
+  id delegate = [internal_ delegate];
+  return [delegate respondsToSelector:@selector(extentOfFileAtPath:userData:offset:isData:length:error:)];
+}
 
-- (BOOL)	accessCheckOfItemAtPath:(NSString *)path
-                                   mode: (int)mode
-                                   error:(NSError **)error
+- (BOOL)extentOfFileAtPath:(NSString *)path
+                  userData:(id)userData
+                    offset:(fuse_off_t)offset
+                    isData:(BOOL *)isData
+                    length:(fuse_off_t *)length
+                     error:(NSError **)error {
+  // The framework's own files and a small file still held in memory are all
+  // data.
+  fuse_off_t fileLength = -1;
+  if ([userData isKindOfClass:[GMDataBackedFileDelegate class]]) {
+    fileLength = (fuse_off_t)[[userData data] length];
+  } else if ([userData isKindOfClass:[GMSmallFile class]]) {
+    if (![userData getLength:&fileLength]) {
+      userData = [userData delegateUserData];
+    }
+  }
+  if (fileLength >= 0) {
+    if (offset >= fileLength) {
+      if (error) {
+        *error = [GMUserFileSystem errorWithCode:ENXIO];
+      }
+      return NO;
+    }
+    *isData = YES;
+    *length = fileLength - offset;
+    return YES;
+  }
+  if ([self supportsExtentOfFile]) {
+    return [[internal_ delegate] extentOfFileAtPath:path
+                                           userData:userData
+                                             offset:offset
+                                             isData:isData
+                                             length:length
+                                              error:error];
+  }
+  if (error) {
+    *error = [GMUserFileSystem errorWithCode:ENOSYS];
+  }
+  return NO;
+}
+
+// Finds the next data, or hole, at or after offset for lseek(2). The end of
+// the file counts as a hole.
+- (fuse_off_t)seekFileAtPath:(NSString *)path
+                    userData:(id)userData
+                      offset:(fuse_off_t)offset
+                      toData:(BOOL)toData
+                       error:(NSError **)error {
+  if (offset < 0) {
+    if (error) {
+      *error = [GMUserFileSystem errorWithCode:ENXIO];
+    }
+    return -1;
+  }
+  for (fuse_off_t position = offset;;) {
+    BOOL isData = NO;
+    fuse_off_t length = 0;
+    NSError* extentError = nil;
+    if ([self isAbandoned:error]) {
+      return -1;  // A file may have many extents.
+    }
+    if (![self extentOfFileAtPath:path
+                         userData:userData
+                           offset:position
+                           isData:&isData
+                           length:&length
+                            error:&extentError]) {
+      if (!toData && position > offset &&
+          [[extentError domain] isEqualToString:NSPOSIXErrorDomain] &&
+          [extentError code] == ENXIO) {
+        return position;
+      }
+      if (error) {
+        *error = extentError;
+      }
+      return -1;
+    }
+    if (isData == toData) {
+      return position;
+    }
+    if (length <= 0) {
+      if (error) {
+        *error = [GMUserFileSystem errorWithCode:EIO];
+      }
+      return -1;
+    }
+    position += length;
+  }
+}
+
+- (BOOL)supportsExchangeData {
+  id delegate = [internal_ delegate];
+  return [delegate respondsToSelector:@selector(exchangeDataOfItemAtPath:withItemAtPath:error:)];
+}
+
+- (BOOL)exchangeDataOfItemAtPath:(NSString *)path1
+                  withItemAtPath:(NSString *)path2
+                           error:(NSError **)error {
+#if defined (__APPLE__)
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    NSString* traceinfo = [NSString stringWithFormat:@"%@ <-> %@", path1, path2];
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  }
+#endif	/* defined (__APPLE__) */
+
+  if ([[internal_ delegate] respondsToSelector:@selector(exchangeDataOfItemAtPath:withItemAtPath:error:)]) {
+    return [[internal_ delegate] exchangeDataOfItemAtPath:path1
+                                           withItemAtPath:path2
+                                                    error:error];
+  }  
+  *error = [GMUserFileSystem errorWithCode:ENOSYS];
+  return NO;
+}
+
+#pragma mark Small Files
+
+- (BOOL)createFileAtPath:(NSString *)path
+            withContents:(NSData *)contents
+              attributes:(NSDictionary *)attributes
+                   error:(NSError **)error {
+#if defined (__APPLE__)
+  if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
+    NSString* traceinfo =
+      [NSString stringWithFormat:@"%@, length=%lu [%@]",
+       path, (unsigned long)[contents length], attributes];
+    OSXFUSE_OBJC_DELEGATE_ENTRY(DTRACE_STRING(traceinfo));
+  }
+#endif	/* defined (__APPLE__) */
+
+  if ([[internal_ delegate] respondsToSelector:@selector(createFileAtPath:withContents:attributes:error:)]) {
+    return [[internal_ delegate] createFileAtPath:path
+                                     withContents:contents
+                                       attributes:attributes
+                                            error:error];
+  }
+  *error = [GMUserFileSystem errorWithCode:EACCES];
+  return NO;
+}
+
+// Buffers a file that is created, or opened for writing with O_TRUNC, when
+// small file mode is on. Any open of a file that is already buffered shares its
+// buffer. Sets handled to NO if the file should be opened by the delegate.
+- (BOOL)openSmallFileAtPath:(NSString *)path
+                 attributes:(NSDictionary *)attributes
+                      flags:(int)flags
+                      isNew:(BOOL)isNew
+                   userData:(id *)userData
+                      error:(NSError **)error
+                    handled:(BOOL *)handled {
+  *handled = NO;
+  NSUInteger maxSize = [internal_ smallFileSize];
+  if (maxSize == 0 || path == nil) {
+    return NO;
+  }
+
+  GMSmallFile* smallFile = [internal_ openSmallFileForPath:path];
+  if (smallFile == nil) {
+    if (!isNew && ((flags & O_TRUNC) == 0 || (flags & O_ACCMODE) == O_RDONLY)) {
+      return NO;
+    }
+    if (!isNew) {
+      // The delegate isn't asked to open the file, so check what it would have.
+      NSDictionary* existing = [self defaultAttributesOfItemAtPath:path
+                                                          userData:nil
+                                                             error:error];
+      if (existing == nil) {
+        *handled = YES;
+        return NO;
+      }
+      if (![[existing objectForKey:NSFileType] isEqualToString:NSFileTypeRegular]) {
+        return NO;  // Let the delegate decide what opening it means.
+      }
+      if ([[internal_ delegate] respondsToSelector:@selector(accessCheckOfItemAtPath:mode:error:)] &&
+          ![self accessCheckOfItemAtPath:path mode:W_OK error:error]) {
+        *handled = YES;
+        return NO;
+      }
+    }
+    GMSmallFile* newFile =
+      [[[GMSmallFile alloc] initWithFileSystem:self
+                                          path:path
+                                    attributes:attributes
+                                         flags:flags
+                                       maxSize:maxSize
+                              existsInDelegate:!isNew] autorelease];
+    smallFile = [internal_ openSmallFile:newFile];
+    if (smallFile == newFile) {
+      *handled = YES;
+      *userData = smallFile;
+      return YES;
+    }
+  }
+
+  *handled = YES;
+  if ((flags & O_TRUNC) != 0 && (flags & O_ACCMODE) != O_RDONLY &&
+      ![smallFile truncateToOffset:0 error:error]) {
+    [self releaseSmallFile:smallFile];
+    return NO;
+  }
+  *userData = smallFile;
+  return YES;
+}
+
+// Delivers the contents of a buffered file if they have changed, and on the
+// last close releases the delegate's own userData if it had to be spilled.
+- (void)releaseSmallFile:(GMSmallFile *)smallFile {
+  NSError* error = nil;
+  if (![smallFile commit:&error]) {
+    NSLog (@"fuse: ERROR: Failed to deliver small file '%@'. %@ IN %@", [smallFile path], error, self);
+  }
+  if ([internal_ closeSmallFile:smallFile] && [smallFile isSpilled]) {
+    [self releaseFileAtPath:[smallFile path] userData:[smallFile delegateUserData]];
+  }
+}
+
+- (BOOL)spillSmallFileAtPath:(NSString *)path error:(NSError **)error {
+  GMSmallFile* smallFile = [internal_ smallFileForPath:path];
+  return (smallFile == nil) || [smallFile spill:error];
+}
+
+// Once spilled, new opens of the path go to the delegate.
+- (void)smallFileDidSpill:(GMSmallFile *)smallFile {
+  [internal_ removeSmallFile:smallFile];
+}
+
+- (NSDictionary *)attributesOfSmallFile:(GMSmallFile *)smallFile
+                                  error:(NSError **)error {
+  NSDictionary* attributes = nil;
+  if ([smallFile existsInDelegate]) {
+    attributes = [self defaultAttributesOfItemAtPath:[smallFile path]
+                                            userData:[smallFile delegateUserData]
+                                               error:error];
+    if (attributes == nil) {
+      return nil;
+    }
+  }
+  return [smallFile attributesOverDelegateAttributes:attributes];
+}
+
+- (BOOL)flushFileAtPath:(NSString *)path
+               userData:(id)userData
+                  error:(NSError **)error {
+	(void) path;										/* Avoid unused argument compiler warning */
+
+  if ([userData isKindOfClass:[GMSmallFile class]]) {
+    return [userData commit:error];
+  }
+  return YES;
+}
+
+#pragma mark Performing access checks
+
+- (BOOL)	accessCheckOfItemAtPath:(NSString *)path
+                                   mode: (int)mode
+                                   error:(NSError **)error
 	{
 #if defined (__APPLE__)
   if (OSXFUSE_OBJC_DELEGATE_ENTRY_ENABLED()) {
@@ -1637,6 +2723,9 @@ static const int kWaitForMountUSleepInterval = 100000;  // 100 ms
   }
 #endif	/* defined (__APPLE__) */
 
+  if ([self isAbandoned:error]) {
+    return nil;
+  }
   id delegate = [internal_ delegate];
   if ([delegate respondsToSelector:@selector(attributesOfItemAtPath:userData:error:)]) {
     return [delegate attributesOfItemAtPath:path userData:userData error:error];
@@ -1756,6 +2845,26 @@ static const int kWaitForMountUSleepInterval = 100000;  // 100 ms
   }
 #endif	/* defined (__APPLE__) */
 
+  // A buffered file takes its size, and while only it knows of the file its
+  // other attributes. The rest go to the delegate with its own userData.
+  GMSmallFile* smallFile = [userData isKindOfClass:[GMSmallFile class]] ?
+    userData : (userData == nil ? [internal_ smallFileForPath:path] : nil);
+  if (smallFile) {
+    NSMutableDictionary* remaining = [[attributes mutableCopy] autorelease];
+    NSNumber* size = [remaining objectForKey:NSFileSize];
+    if (size != nil) {
+      if (![smallFile truncateToOffset:[size longLongValue] error:error]) {
+        return NO;
+      }
+      [remaining removeObjectForKey:NSFileSize];
+    }
+    if ([remaining count] == 0 || [smallFile mergeAttributes:remaining]) {
+      return YES;
+    }
+    attributes = remaining;
+    userData = [smallFile delegateUserData];
+  }
+
   if ([attributes objectForKey:NSFileSize] != nil) {
     BOOL handled = NO;  // Did they have a delegate method that handles truncation?    
     NSNumber* offsetNumber = [attributes objectForKey:NSFileSize];
@@ -1771,6 +2880,17 @@ static const int kWaitForMountUSleepInterval = 100000;  // 100 ms
     }
   }
   
+  GMMetadataBatcher* batcher = [internal_ metadataBatcher];
+  if (batcher) {
+    GMMetadataOperation* operation =
+      [[[GMMetadataOperation alloc] initWithType:GMMetadataOperationSetAttributes
+                                            path:path
+                                 destinationPath:nil
+                                      attributes:attributes
+                                           flags:0
+                                        userData:userData] autorelease];
+    return [batcher performOperation:operation error:error];
+  }
   if ([[internal_ delegate] respondsToSelector:@selector(setAttributes:ofItemAtPath:userData:error:)]) {
     return [[internal_ delegate] setAttributes:attributes ofItemAtPath:path userData:userData error:error];
   }
@@ -1913,7 +3033,147 @@ static const int kWaitForMountUSleepInterval = 100000;  // 100 ms
     }                                                                     \
   }
 
+// Operation recording. GM_TRACE_BEGIN() costs a single load when nothing is
+// being recorded. See -startRecordingOperationsToPath:error:
+#define GM_TRACE_BEGIN()                                                  \
+  uint64_t traceStart =                                                   \
+    GMOperationRecorderIsActive() ? GMOperationRecorderNow() : 0
+
+#define GM_TRACE_END(op, path, path2, offset, size, fi, flags, result)    \
+  do {                                                                    \
+    if (traceStart != 0) {                                                \
+      RecordOperation((op), (path), (path2), (offset), (size), (fi),      \
+                      (flags), (result), traceStart);                     \
+    }                                                                     \
+  } while (0)
+
+static void	RecordOperation (GMOperationTraceOp a_Op, const char * a_pszPath, const char * a_pszPath2,
+														 int64_t a_iOffset, uint64_t a_cbSize, const struct fuse_file_info * a_pFuseFileInfo,
+                             uint32_t a_uFlags, int a_iResult, uint64_t a_uStart)
+	{
+  struct fuse_context *		pContext;
+  GMUserFileSystem *			poUserFileSystem;
+  GMOperationTraceRecord	Record;
+
+  pContext = fuse_get_context ();
+  if ((pContext == NULL) || (pContext->private_data == NULL))
+  	return;
+  poUserFileSystem = (GMUserFileSystem *) pContext->private_data;
+  memset (&Record, 0, sizeof (Record));
+  Record.op = (uint16_t) a_Op;
+  Record.result = a_iResult;
+  Record.latency = GMOperationRecorderNow () - a_uStart;
+  Record.offset = a_iOffset;
+  Record.size = a_cbSize;
+  Record.handle = (a_pFuseFileInfo != NULL) ? (uint64_t) a_pFuseFileInfo->fh : 0;
+  Record.flags = a_uFlags;
+  Record.pid = (uint32_t) pContext->pid;
+  Record.uid = (uint32_t) pContext->uid;
+  Record.gid = (uint32_t) pContext->gid;
+  GMOperationRecorderRecord ([poUserFileSystem->internal_ recorderSlot], &Record, a_uStart, a_pszPath, a_pszPath2);
+  }
+
+/* Discards what the framework has cached about a_pszPath after an operation that may have created or
+		removed it, or, with a_bDescendants, moved a tree to or from it. That includes the listing of its
+    directory. Called whether or not the operation succeeded, since it may have partly succeeded. A NULL
+    a_pszPath discards everything
+*/
+static void	InvalidateCachedLookups (GMUserFileSystem * a_poUserFileSystem, const char * a_pszPath, BOOL a_bDescendants)
+	{
+  GMPathCache *	pDirectoryCache = [a_poUserFileSystem->internal_ directoryCache];
+  const char *	pszSlash;
+  char *				pszParent;
+
+  GMPathCacheRemove ([a_poUserFileSystem->internal_ negativeCache], a_pszPath, a_bDescendants);
+  GMPathCacheRemove (pDirectoryCache, a_pszPath, a_bDescendants);
+  GMPathCacheRemove ([a_poUserFileSystem->internal_ symlinkCache], a_pszPath, a_bDescendants);
+  GMPathCacheRemove ([a_poUserFileSystem->internal_ accessCache], a_pszPath, a_bDescendants);
+  [[a_poUserFileSystem->internal_ handleCache] discardPath: (a_pszPath != NULL) ? [NSString stringWithUTF8String: a_pszPath] : nil
+                                              descendants: a_bDescendants];
+  if ((a_pszPath == NULL) || !GMPathCacheIsEnabled (pDirectoryCache))
+    return;
+
+  pszSlash = strrchr (a_pszPath, '/');
+  if (pszSlash == NULL)
+    return;
+  /* The parent of "/name" is "/" */
+  pszParent = strndup (a_pszPath, (pszSlash == a_pszPath) ? 1 : (size_t) (pszSlash - a_pszPath));
+  GMPathCacheRemove (pDirectoryCache, pszParent, NO);		/* Everything if out of memory */
+  free (pszParent);
+  }
+
+/* Discards the access decisions for a_pszPath and the items below it after a change to its permissions
+		or owner, which a delegate may also use to decide access to the items below it. The files kept open
+    for them go too, since they were opened under the old permissions
+*/
+static void	InvalidateCachedAccess (GMUserFileSystem * a_poUserFileSystem, const char * a_pszPath)
+	{
+  GMPathCacheRemove ([a_poUserFileSystem->internal_ accessCache], a_pszPath, YES);
+  [[a_poUserFileSystem->internal_ handleCache] discardPath: (a_pszPath != NULL) ? [NSString stringWithUTF8String: a_pszPath] : nil
+                                              descendants: YES];
+  }
+
+/* Operations on open files get a NULL path when the mount profile asks for noPath, and the delegate then
+		gets a nil path. Without noPath libfuse passes a .fuse_hidden path for a file unlinked while open
+*/
+static inline NSString *	StringWithPath (const char * a_pszPath)
+	{
+  if (a_pszPath == NULL)
+    return nil;
+  if (__atomic_load_n (&g_cInterningFileSystems, __ATOMIC_RELAXED) > 0)
+    return [[GMPath internedPathWithUTF8String: a_pszPath] string];
+  return [NSString stringWithUTF8String: a_pszPath];
+  }
+
+/* Passes any attribute changes held for a_pszPath, and with a_bDescendants the items below it, to the
+		delegate before another operation reaches it. A NULL a_pszPath passes on everything, since the item
+    an operation on an open file refers to isn't known. Failures have been logged by the coalescer
+*/
+static void	FlushCoalescedAttributes (GMUserFileSystem * a_poUserFileSystem, const char * a_pszPath, BOOL a_bDescendants)
+	{
+  GMAttributeCoalescer *	poCoalescer = [a_poUserFileSystem->internal_ attributeCoalescer];
+
+  if ((poCoalescer != nil) && ![poCoalescer isEmpty])
+    [poCoalescer flushPath: StringWithPath (a_pszPath) descendants: a_bDescendants error: NULL];
+  }
+
+/* The open(2) flags to give the delegate. With the writeback cache the kernel reads to fill partly
+		written pages, even through a file opened O_WRONLY, and chooses the offset of every write itself, so
+    an O_APPEND handle that appended would put data in the wrong place
+*/
+static int	DelegateOpenFlags (GMUserFileSystem * a_poUserFileSystem, int a_iFlags)
+	{
+  if (![a_poUserFileSystem->internal_ writebackCache])
+  	return a_iFlags;
+  if ((a_iFlags & O_ACCMODE) == O_WRONLY)
+  	a_iFlags = (a_iFlags & ~O_ACCMODE) | O_RDWR;
+  return a_iFlags & ~O_APPEND;
+  }
+
+/* Sets attributes of the item at a_pszPath for chmod, chown, utimens and truncate, holding them to be
+		coalesced if the mount profile asks for it
+*/
+static BOOL	SetAttributesOfItem (GMUserFileSystem * a_poUserFileSystem, const char * a_pszPath, NSDictionary * a_poAttributes,
+																 NSError ** a_ppoError)
+	{
+  GMAttributeCoalescer *	poCoalescer = [a_poUserFileSystem->internal_ attributeCoalescer];
+
+  if ((poCoalescer != nil) && (a_pszPath != NULL))
+  	{
+    [poCoalescer addAttributes: a_poAttributes forPath: StringWithPath (a_pszPath)];
+    return YES;
+    }
+  return [a_poUserFileSystem setAttributes: a_poAttributes
+                              ofItemAtPath: StringWithPath (a_pszPath)
+                                  userData: nil
+                                     error: a_ppoError];
+  }
+
+#if GM_FUSE3
+static void* fusefm_init(struct fuse_conn_info* conn, struct fuse_config* cfg) {
+#else
 static void* fusefm_init(struct fuse_conn_info* conn) {
+#endif	/* GM_FUSE3 */
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
 
   GMUserFileSystem* fs = [GMUserFileSystem currentFS];
@@ -1955,18 +3215,135 @@ static void* fusefm_init(struct fuse_conn_info* conn) {
   SET_CAPABILITY(conn, FUSE_CAP_ATOMIC_O_TRUNC, true);
   NSLog (@"fuse: INFORMATION: Enabled FUSE_CAP_ATOMIC_O_TRUNC");
 
+	/* The remaining generic capabilities and the sizes come from the mount profile. By default
+  		FUSE_CAP_BIG_WRITES is enabled except on OS X/Darwin and FUSE_CAP_SPLICE_WRITE on Linux.
+  */
+  GMMountProfile* profile = [fs->internal_ mountProfile];
+#if !defined (__APPLE__) && !GM_FUSE3
+  SET_CAPABILITY(conn, FUSE_CAP_BIG_WRITES, [profile bigWrites]);
+#endif	/* !defined (__APPLE__) && !GM_FUSE3 */
+#if defined (__linux__)
+	SET_CAPABILITY(conn, FUSE_CAP_SPLICE_READ, [profile spliceRead]);
+	SET_CAPABILITY(conn, FUSE_CAP_SPLICE_WRITE, [profile spliceWrite]);
+#endif	/* defined (__linux__) */
+#if GM_FUSE3
+	/* libfuse 3 always allows big writes and takes the per-mount flags of struct fuse_operations from
+  		struct fuse_config instead. UTIME_NOW and UTIME_OMIT are always passed through to fusefm_utimens.
+      Readdirplus is wanted by default whenever the kernel offers it, but is only useful when
+      fusefm_readdir is asked to return attributes. The writeback cache is never wanted by default,
+      since it changes what the delegate's file handles are asked to do. The kernel keeps symlink
+      targets when the framework does
+  */
+  cfg->nullpath_ok = [profile noPath];
+  SET_CAPABILITY(conn, FUSE_CAP_READDIRPLUS, [profile readdirPlus]);
+  SET_CAPABILITY(conn, FUSE_CAP_READDIRPLUS_AUTO, [profile readdirPlus]);
+  SET_CAPABILITY(conn, FUSE_CAP_WRITEBACK_CACHE, [profile writebackCache]);
+#if GM_FUSE_AT_LEAST(3, 10)
+  SET_CAPABILITY(conn, FUSE_CAP_CACHE_SYMLINKS, [profile symlinkCacheSize] > 0);
+#endif	/* GM_FUSE_AT_LEAST(3, 10) */
+#endif	/* GM_FUSE3 */
+  if ([profile maxReadahead] != 0 && [profile maxReadahead] < conn->max_readahead) {
+    conn->max_readahead = [profile maxReadahead];
+  }
+  if ([profile maxWrite] != 0) {
+    conn->max_write = [profile maxWrite];
+  }
+
+  if ((conn->want & ~conn->capable) != 0) {
+    NSLog (@"fuse: WARNING: Kernel does not support requested capabilities 0x%8.8X. Disabled IN %@", conn->want & ~conn->capable, fs);
+    conn->want &= conn->capable;
+  }
+
+  GMMountProfile* negotiated = [[profile copy] autorelease];
+  [negotiated setMaxWrite:conn->max_write];
+  [negotiated setMaxReadahead:conn->max_readahead];
+#if GM_FUSE3
+  [negotiated setBigWrites:YES];
+  [negotiated setReaddirPlus:(conn->want & FUSE_CAP_READDIRPLUS) != 0];
+  [negotiated setWritebackCache:(conn->want & FUSE_CAP_WRITEBACK_CACHE) != 0];
+#else
 #if !defined (__APPLE__)
-  SET_CAPABILITY(conn, FUSE_CAP_BIG_WRITES, true);
-  NSLog (@"fuse: INFORMATION: Enabled FUSE_CAP_BIG_WRITES");
+  [negotiated setBigWrites:(conn->want & FUSE_CAP_BIG_WRITES) != 0];
 #endif	/* !defined (__APPLE__) */
-
+  [negotiated setReaddirPlus:NO];
+  [negotiated setWritebackCache:NO];
+#endif	/* GM_FUSE3 */
 #if defined (__linux__)
-// 	SET_CAPABILITY(conn, FUSE_CAP_SPLICE_READ, true);
-// 	NSLog (@"fuse: INFORMATION: Enabled FUSE_CAP_SPLICE_READ");
-	SET_CAPABILITY(conn, FUSE_CAP_SPLICE_WRITE, true);
-	NSLog (@"fuse: INFORMATION: Enabled FUSE_CAP_SPLICE_WRITE");
+  [negotiated setSpliceRead:(conn->want & FUSE_CAP_SPLICE_READ) != 0];
+  [negotiated setSpliceWrite:(conn->want & FUSE_CAP_SPLICE_WRITE) != 0];
 #endif	/* defined (__linux__) */
 
+  // Small files need the delegate to accept a file's contents in one call.
+  id delegate = [fs->internal_ delegate];
+  if ([delegate respondsToSelector:@selector(createFileAtPath:withContents:attributes:error:)]) {
+    [fs->internal_ setSmallFileSize:[profile smallFileSize]];
+  } else {
+    [fs->internal_ setSmallFileSize:0];
+    [negotiated setSmallFileSize:0];
+  }
+  [fs->internal_ setWritebackCache:[negotiated writebackCache]];
+  [fs->internal_ setNegotiatedMountProfile:negotiated];
+
+  int iErrno = GMPathCacheConfigure([fs->internal_ negativeCache], [profile negativeCacheSize],
+                                    [profile negativeCacheTimeout]);
+  if (iErrno != 0) {
+    NSLog (@"fuse: WARNING: Negative lookup cache disabled. Errno 0x%8.8X, %d IN %@", iErrno, iErrno, fs);
+  }
+  iErrno = GMPathCacheConfigure([fs->internal_ directoryCache], [profile directoryCacheSize],
+                                [profile directoryCacheTimeout]);
+  if (iErrno != 0) {
+    NSLog (@"fuse: WARNING: Directory listing cache disabled. Errno 0x%8.8X, %d IN %@", iErrno, iErrno, fs);
+  }
+  iErrno = GMPathCacheConfigure([fs->internal_ symlinkCache], [profile symlinkCacheSize],
+                                [profile symlinkCacheTimeout]);
+  if (iErrno != 0) {
+    NSLog (@"fuse: WARNING: Symlink target cache disabled. Errno 0x%8.8X, %d IN %@", iErrno, iErrno, fs);
+  }
+  iErrno = GMPathCacheConfigure([fs->internal_ accessCache], [profile accessCacheSize],
+                                [profile accessCacheTimeout]);
+  if (iErrno != 0) {
+    NSLog (@"fuse: WARNING: Access check cache disabled. Errno 0x%8.8X, %d IN %@", iErrno, iErrno, fs);
+  }
+
+  // Batching only helps when several FUSE threads can wait on the same batch.
+  if ([profile metadataBatchWindow] > 0 && [fs->internal_ isThreadSafe] &&
+      [delegate respondsToSelector:@selector(performMetadataOperations:error:)]) {
+    GMMetadataBatcher* batcher =
+      [[GMMetadataBatcher alloc] initWithDelegate:delegate
+                                           window:[profile metadataBatchWindow]
+                                         maxCount:[profile metadataBatchSize]];
+    [fs->internal_ setMetadataBatcher:batcher];
+    [batcher release];
+  }
+  if ([profile internPaths]) {
+    __atomic_fetch_add(&g_cInterningFileSystems, 1, __ATOMIC_RELAXED);
+  }
+  if ([profile attributeCoalescingDelay] > 0) {
+    GMAttributeCoalescer* coalescer =
+      [[GMAttributeCoalescer alloc] initWithFileSystem:fs
+                                                 delay:[profile attributeCoalescingDelay]];
+    [fs->internal_ setAttributeCoalescer:coalescer];
+    [coalescer start];
+    [coalescer release];
+  }
+  [fs->internal_ setInterruptible:[profile interruptible]];
+  if ([profile handleCacheSize] > 0) {
+    GMHandleCache* handleCache =
+      [[GMHandleCache alloc] initWithFileSystem:fs
+                                       maxCount:[profile handleCacheSize]
+                                        timeout:[profile handleCacheTimeout]
+                                  requiresOwner:![profile kernelPermissions]];
+    [fs->internal_ setHandleCache:handleCache];
+    [handleCache start];
+    [handleCache release];
+  }
+  NSLog (@"fuse: INFORMATION: Negotiated capabilities 0x%8.8X of 0x%8.8X with libfuse %d, protocol %u.%u. %@", conn->want, conn->capable, fuse_version (), conn->proto_major, conn->proto_minor, negotiated);
+
+  @try {
+    [fs startWaitingUntilMounted];
+  }
+  @catch (id exception) { }
+
   [pool release];
   return fs;
 }
@@ -1985,6 +3362,7 @@ static void fusefm_destroy(void* private_data) {
 
 static int fusefm_mkdir(const char* path, mode_t mode) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
   int ret = -EACCES;
 
   @try {
@@ -1994,7 +3372,7 @@ static int fusefm_mkdir(const char* path, mode_t mode) {
       [NSDictionary dictionaryWithObject:[NSNumber numberWithLong:perm]
                                   forKey:NSFilePosixPermissions];
     GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    if ([fs createDirectoryAtPath:[NSString stringWithUTF8String:path] 
+    if ([fs createDirectoryAtPath:StringWithPath(path) 
                        attributes:attribs
                             error:&error]) {
       ret = 0;  // Success!
@@ -2003,14 +3381,17 @@ static int fusefm_mkdir(const char* path, mode_t mode) {
         ret = -[error code];
       }
     }
+    InvalidateCachedLookups(fs, path, NO);
   }
   @catch (id exception) { }
+  GM_TRACE_END(GMOperationTraceOpMkdir, path, NULL, 0, 0, NULL, mode, ret);
   [pool release];
   return ret;
 }
 
 static int fusefm_create(const char* path, mode_t mode, struct fuse_file_info* fi) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
   int ret = -EACCES;
 
   @try {
@@ -2020,122 +3401,171 @@ static int fusefm_create(const char* path, mode_t mode, struct fuse_file_info* f
     NSDictionary* attribs =
       [NSDictionary dictionaryWithObject:[NSNumber numberWithUnsignedLong:perms]
                                   forKey:NSFilePosixPermissions];
+    NSString* pathString = StringWithPath(path);
     GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    if ([fs createFileAtPath:[NSString stringWithUTF8String:path]
-                  attributes:attribs
-                       flags:fi->flags
-                    userData:&userData
-                       error:&error]) {
+    int flags = DelegateOpenFlags(fs, fi->flags);
+    BOOL handled = NO;
+    BOOL created = [fs openSmallFileAtPath:pathString
+                                attributes:attribs
+                                     flags:flags
+                                     isNew:YES
+                                  userData:&userData
+                                     error:&error
+                                   handled:&handled];
+    if (!handled) {
+      created = [fs createFileAtPath:pathString
+                          attributes:attribs
+                               flags:flags
+                            userData:&userData
+                               error:&error];
+    }
+    if (created) {
       ret = 0;
       if (userData != nil) {
         [userData retain];
         fi->fh = (uintptr_t)userData;
       }
+      [fs didOpenFileAtPath:pathString userData:userData flags:flags];
+      [fs->internal_ openWritebackFileForPath:pathString truncated:YES];
     } else {
       MAYBE_USE_ERROR(ret, error);
     }
+    InvalidateCachedLookups(fs, path, NO);
   }
   @catch (id exception) { }
+  GM_TRACE_END(GMOperationTraceOpCreate, path, NULL, 0, 0, fi, fi->flags, ret);
   [pool release];
   return ret;
 }
 
 static int fusefm_rmdir(const char* path) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
   int ret = -EACCES;
 
   @try {
     NSError* error = nil;
     GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    if ([fs removeDirectoryAtPath:[NSString stringWithUTF8String:path] 
+    FlushCoalescedAttributes(fs, path, NO);
+    if ([fs removeDirectoryAtPath:StringWithPath(path) 
                             error:&error]) {
       ret = 0;  // Success!
     } else {
       MAYBE_USE_ERROR(ret, error);
     }
+    InvalidateCachedLookups(fs, path, NO);
   }
   @catch (id exception) { }
+  GM_TRACE_END(GMOperationTraceOpRmdir, path, NULL, 0, 0, NULL, 0, ret);
   [pool release];
   return ret;
 }
 
 static int fusefm_unlink(const char* path) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
   int ret = -EACCES;
   @try {
     NSError* error = nil;
     GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    if ([fs removeItemAtPath:[NSString stringWithUTF8String:path] 
+    FlushCoalescedAttributes(fs, path, NO);
+    if ([fs removeItemAtPath:StringWithPath(path) 
                        error:&error]) {
       ret = 0;  // Success!
     } else {
       MAYBE_USE_ERROR(ret, error);
     }
+    InvalidateCachedLookups(fs, path, NO);
   }
   @catch (id exception) { }
+  GM_TRACE_END(GMOperationTraceOpUnlink, path, NULL, 0, 0, NULL, 0, ret);
   [pool release];
   return ret;
 }
 
 /* Note: renameat2(2) support was added to Linux in the Fuse 3.0 API specification
 					and renamex_np(2) support was added to OS X/Darwin in macFUSE 4.0.0
+          The delegate can't honour RENAME_NOREPLACE or RENAME_EXCHANGE, so they are refused
 */
+#if GM_FUSE3
+static int fusefm_rename(const char* path, const char* toPath, unsigned int flags) {
+#else
 static int fusefm_rename(const char* path, const char* toPath) {
+#endif	/* GM_FUSE3 */
+#if GM_FUSE3
+  if (flags != 0) {
+    return -EINVAL;
+  }
+#endif	/* GM_FUSE3 */
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
   int ret = -EACCES;
 
   @try {
-    NSString* source = [NSString stringWithUTF8String:path];
-    NSString* destination = [NSString stringWithUTF8String:toPath];
+    NSString* source = StringWithPath(path);
+    NSString* destination = StringWithPath(toPath);
     NSError* error = nil;
     GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    FlushCoalescedAttributes(fs, path, YES);
+    FlushCoalescedAttributes(fs, toPath, YES);
     if ([fs moveItemAtPath:source toPath:destination error:&error]) {
       ret = 0;  // Success!
+      [fs->internal_ moveWritebackFileAtPath:source toPath:destination];
     } else {
       MAYBE_USE_ERROR(ret, error);
     }
+    InvalidateCachedLookups(fs, path, YES);
+    InvalidateCachedLookups(fs, toPath, YES);
   }
   @catch (id exception) { }
+  GM_TRACE_END(GMOperationTraceOpRename, path, toPath, 0, 0, NULL, 0, ret);
   [pool release];
   return ret;  
 }
 
 static int fusefm_link(const char* path1, const char* path2) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
   int ret = -EACCES;
   
   @try {
     NSError* error = nil;
     GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    if ([fs linkItemAtPath:[NSString stringWithUTF8String:path1]
-                    toPath:[NSString stringWithUTF8String:path2]
+    FlushCoalescedAttributes(fs, path1, NO);
+    if ([fs linkItemAtPath:StringWithPath(path1)
+                    toPath:StringWithPath(path2)
                      error:&error]) {
       ret = 0;  // Success!
     } else {
       MAYBE_USE_ERROR(ret, error);
     }
+    InvalidateCachedLookups(fs, path2, NO);
   }
   @catch (id exception) { }
+  GM_TRACE_END(GMOperationTraceOpLink, path1, path2, 0, 0, NULL, 0, ret);
   [pool release];
   return ret;
 }
 
 static int fusefm_symlink(const char* path1, const char* path2) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
   int ret = -EACCES;
   
   @try {
     NSError* error = nil;
     GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    if ([fs createSymbolicLinkAtPath:[NSString stringWithUTF8String:path2]
+    if ([fs createSymbolicLinkAtPath:StringWithPath(path2)
                  withDestinationPath:[NSString stringWithUTF8String:path1]
                        error:&error]) {
       ret = 0;  // Success!
     } else {
       MAYBE_USE_ERROR(ret, error);
     }
+    InvalidateCachedLookups(fs, path2, NO);
   }
   @catch (id exception) { }
+  GM_TRACE_END(GMOperationTraceOpSymlink, path2, path1, 0, 0, NULL, 0, ret);
   [pool release];
   return ret;
 }
@@ -2143,94 +3573,219 @@ static int fusefm_symlink(const char* path1, const char* path2) {
 static int fusefm_readlink(const char *path, char *buf, size_t size)
 {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
   int ret = -ENOENT;
 
   @try {
-    NSString* linkPath = [NSString stringWithUTF8String:path];
     NSError* error = nil;
     GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    NSString *pathContent = [fs destinationOfSymbolicLinkAtPath:linkPath
-                                                          error:&error];
-    if (pathContent != nil) {
+    FlushCoalescedAttributes(fs, path, NO);
+    // The cache holds the encoded target, so a hit needs no NSString.
+    NSData* target = nil;
+    GMPathCache* symlinkCache = [fs->internal_ symlinkCache];
+    unsigned long generation = 0;
+    if (!GMPathCacheLookup(symlinkCache, path, &target, &generation)) {
+      NSString *pathContent = [fs destinationOfSymbolicLinkAtPath:StringWithPath(path)
+                                                            error:&error];
+      if (pathContent != nil) {
+        const char* representation = [pathContent fileSystemRepresentation];
+        target = [NSData dataWithBytes:representation length:strlen(representation)];
+        GMPathCacheInsert(symlinkCache, path, target, generation);
+      } else {
+        MAYBE_USE_ERROR(ret, error);
+      }
+    }
+    if (target != nil) {
+      // Like readlink(2), a target too long for the buffer is truncated.
+      size_t length = MIN([target length], size - 1);
+      memcpy(buf, [target bytes], length);
+      buf[length] = '\0';
       ret = 0;
-      [pathContent getFileSystemRepresentation:buf maxLength:size];
-    } else {
-      MAYBE_USE_ERROR(ret, error);
     }
   }
   @catch (id exception) { }
+  GM_TRACE_END(GMOperationTraceOpReadlink, path, NULL, 0, size, NULL, 0, ret);
   [pool release];
   return ret;
 }
 
+#if GM_FUSE3
+static int fusefm_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+                          fuse_off_t offset, struct fuse_file_info* fi,
+                          enum fuse_readdir_flags flags) {
+#else
 static int fusefm_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
                           fuse_off_t offset, struct fuse_file_info* fi) {
+#endif	/* GM_FUSE3 */
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
   int ret = -ENOENT;
 
   (void) offset;									/* Avoid unused argument compiler warning */
-  (void) fi;											/* Avoid unused argument compiler warning */
   
   @try {
     NSError* error = nil;
     GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    NSArray *contents = 
-    [fs contentsOfDirectoryAtPath:[NSString stringWithUTF8String:path] 
-                            error:&error];
+    // With noPath there is no path, but fusefm_opendir saved it in fi->fh.
+    NSString* dirPath = (path != NULL) ? StringWithPath(path)
+                                       : (NSString *)(uintptr_t)fi->fh;
+    NSArray* contents = nil;
+    GMPathCache* directoryCache = [fs->internal_ directoryCache];
+    unsigned long generation = 0;
+    if (!GMPathCacheLookup(directoryCache, [dirPath UTF8String], &contents, &generation)) {
+      contents = [fs contentsOfDirectoryAtPath:dirPath 
+                                         error:&error];
+      if (contents) {
+        contents = [[contents copy] autorelease];
+        GMPathCacheInsert(directoryCache, [dirPath UTF8String], contents, generation);
+      }
+    }
     if (contents) {
       ret = 0;
+#if GM_FUSE3
+      // For readdirplus each entry's attributes are returned with its name,
+      // saving the kernel a lookup per entry. An entry whose attributes can't
+      // be read is returned without them and looked up as usual.
+      filler(buf, ".", NULL, 0, 0);
+      filler(buf, "..", NULL, 0, 0);
+      for (int i = 0, count = [contents count]; i < count; i++) {
+        NSString* name = [contents objectAtIndex:i];
+        struct stat stbuf;
+        NSError* entryError = nil;  // Ignored.
+        if ((flags & FUSE_READDIR_PLUS) != 0 &&
+            [fs fillStatBuffer:&stbuf
+                       forPath:[dirPath stringByAppendingPathComponent:name]
+                      userData:nil
+                         error:&entryError]) {
+          filler(buf, [name UTF8String], &stbuf, 0, FUSE_FILL_DIR_PLUS);
+        } else {
+          filler(buf, [name UTF8String], NULL, 0, 0);
+        }
+      }
+#else
       filler(buf, ".", NULL, 0);
       filler(buf, "..", NULL, 0);
       for (int i = 0, count = [contents count]; i < count; i++) {
         filler(buf, [[contents objectAtIndex:i] UTF8String], NULL, 0);
       }
+#endif	/* GM_FUSE3 */
     } else {
       MAYBE_USE_ERROR(ret, error);
     }
   }
   @catch (id exception) { }
+  GM_TRACE_END(GMOperationTraceOpReaddir, path, NULL, offset, 0, fi, 0, ret);
   [pool release];
   return ret;
 }
 
+/* Used with noPath, to keep the directory's path for fusefm_readdir(). A directory that is renamed while
+		open is still read from its old path. Also used with the directory cache, to let the kernel keep the
+    listing too. It drops it when the directory changes through the mount or its modification date changes
+*/
+static int	fusefm_opendir (const char * a_pszPath, struct fuse_file_info * a_pFuseFileInfo)
+	{
+  NSString *	poszPath = [[NSString alloc] initWithUTF8String: a_pszPath];
+
+  if (poszPath == nil)
+    return -ENOMEM;
+  a_pFuseFileInfo->fh = (uintptr_t) poszPath;
+#if GM_FUSE3 && GM_FUSE_AT_LEAST(3, 5)
+  GMUserFileSystem *	poUserFileSystem = (GMUserFileSystem *) fuse_get_context ()->private_data;
+
+  if (GMPathCacheIsEnabled ([poUserFileSystem->internal_ directoryCache]))
+  	{
+    a_pFuseFileInfo->cache_readdir = 1;
+    a_pFuseFileInfo->keep_cache = 1;
+    }
+#endif	/* GM_FUSE3 && GM_FUSE_AT_LEAST(3, 5) */
+  return 0;
+  }
+
+static int	fusefm_releasedir (const char * a_pszPath, struct fuse_file_info * a_pFuseFileInfo)
+	{
+  (void) a_pszPath;										/* Avoid unused argument compiler warning */
+
+  [(NSString *) (uintptr_t) a_pFuseFileInfo->fh release];
+  return 0;
+  }
+
 static int fusefm_open(const char *path, struct fuse_file_info* fi) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
   int ret = -ENOENT;  // TODO: Default to 0 (success) since a file-system does
                       // not necessarily need to implement open?
 
   @try {
     id userData = nil;
     NSError* error = nil;
+    NSString* pathString = StringWithPath(path);
     GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    if ([fs openFileAtPath:[NSString stringWithUTF8String:path]
-                      mode:fi->flags
-                  userData:&userData
-                     error:&error]) {
+    FlushCoalescedAttributes(fs, path, NO);
+    int flags = DelegateOpenFlags(fs, fi->flags);
+    BOOL handled = NO;
+    BOOL opened = NO;
+    userData = [fs reusableFileAtPath:pathString flags:flags];
+    if (userData != nil) {
+      opened = handled = YES;
+    } else {
+      opened = [fs openSmallFileAtPath:pathString
+                            attributes:nil
+                                 flags:flags
+                                 isNew:NO
+                              userData:&userData
+                                 error:&error
+                               handled:&handled];
+    }
+    if (!handled) {
+      opened = [fs openFileAtPath:pathString
+                             mode:flags
+                         userData:&userData
+                            error:&error];
+    }
+    if (opened) {
       ret = 0;
       if (userData != nil) {
         [userData retain];
         fi->fh = (uintptr_t)userData;
       }
+      [fs didOpenFileAtPath:pathString userData:userData flags:flags];
+      if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+        [fs->internal_ openWritebackFileForPath:pathString
+                                      truncated:(fi->flags & O_TRUNC) != 0];
+      }
     } else {
       MAYBE_USE_ERROR(ret, error);
     }
   }
   @catch (id exception) { }
+  GM_TRACE_END(GMOperationTraceOpOpen, path, NULL, 0, 0, fi, fi->flags, ret);
   [pool release];
   return ret;
 }
 
 static int fusefm_release(const char *path, struct fuse_file_info* fi) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
   @try {
     id userData = (id)(uintptr_t)fi->fh;
     GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    [fs releaseFileAtPath:[NSString stringWithUTF8String:path] userData:userData];
+    FlushCoalescedAttributes(fs, path, NO);
+    NSString* pathString = StringWithPath(path);
+    if (![fs keepFileAtPath:pathString
+                   userData:userData
+                      flags:DelegateOpenFlags(fs, fi->flags)]) {
+      [fs releaseFileAtPath:pathString userData:userData];
+    }
     if (userData) {
       [userData release]; 
     }
+    if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+      [fs->internal_ closeWritebackFileForPath:pathString];
+    }
   }
   @catch (id exception) { }
+  GM_TRACE_END(GMOperationTraceOpRelease, path, NULL, 0, 0, fi, fi->flags, 0);
   [pool release];
   return 0;
 }
@@ -2238,12 +3793,14 @@ static int fusefm_release(const char *path, struct fuse_file_info* fi) {
 static int fusefm_read(const char *path, char *buf, size_t size, fuse_off_t offset,
                        struct fuse_file_info* fi) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
   int ret = -EIO;
 
   @try {
     NSError* error = nil;
     GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    ret = [fs readFileAtPath:[NSString stringWithUTF8String:path]
+    FlushCoalescedAttributes(fs, path, NO);
+    ret = [fs readFileAtPath:StringWithPath(path)
                     userData:(id)(uintptr_t)fi->fh
                       buffer:buf
                         size:size
@@ -2252,6 +3809,7 @@ static int fusefm_read(const char *path, char *buf, size_t size, fuse_off_t offs
     MAYBE_USE_ERROR(ret, error);
   }
   @catch (id exception) { }
+  GM_TRACE_END(GMOperationTraceOpRead, path, NULL, offset, size, fi, 0, ret);
   [pool release];
   return ret;
 }
@@ -2259,20 +3817,51 @@ static int fusefm_read(const char *path, char *buf, size_t size, fuse_off_t offs
 static int fusefm_write(const char* path, const char* buf, size_t size, 
                         fuse_off_t offset, struct fuse_file_info* fi) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
   int ret = -EIO;
   
   @try {
     NSError* error = nil;
     GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    ret = [fs writeFileAtPath:[NSString stringWithUTF8String:path]
+    FlushCoalescedAttributes(fs, path, NO);
+    NSString* pathString = StringWithPath(path);
+    ret = [fs writeFileAtPath:pathString
                      userData:(id)(uintptr_t)fi->fh
                        buffer:buf
                          size:size
                        offset:offset
                         error:&error];
     MAYBE_USE_ERROR(ret, error);
+    if (ret > 0) {
+      [fs->internal_ didWriteWritebackFileAtPath:pathString toOffset:offset + ret];
+    }
   }
   @catch (id exception) { }
+  GM_TRACE_END(GMOperationTraceOpWrite, path, NULL, offset, size, fi, 0, ret);
+  [pool release];
+  return ret;
+}
+
+// Only used with a small file size. Delivers a buffered file so that a failure
+// is reported to close(2), which the later release can't do.
+static int fusefm_flush(const char* path, struct fuse_file_info* fi) {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
+  int ret = 0;
+
+  @try {
+    NSError* error = nil;
+    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    FlushCoalescedAttributes(fs, path, NO);
+    if (![fs flushFileAtPath:StringWithPath(path)
+                    userData:(id)(uintptr_t)fi->fh
+                       error:&error]) {
+      ret = -EIO;
+      MAYBE_USE_ERROR(ret, error);
+    }
+  }
+  @catch (id exception) { }
+  GM_TRACE_END(GMOperationTraceOpFlush, path, NULL, 0, 0, fi, 0, ret);
   [pool release];
   return ret;
 }
@@ -2280,36 +3869,135 @@ static int fusefm_write(const char* path, const char* buf, size_t size,
 static int fusefm_fsync(const char* path, int isdatasync,
                         struct fuse_file_info* fi) {
   // TODO: Support fsync?
-  
-  (void) path;													/* Avoid unused argument compiler warning */
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
+
   (void) isdatasync;										/* Avoid unused argument compiler warning */
   (void) fi;														/* Avoid unused argument compiler warning */
-  
+
+  @try {
+    FlushCoalescedAttributes([GMUserFileSystem currentFS], path, NO);
+  }
+  @catch (id exception) { }
+  GM_TRACE_END(GMOperationTraceOpFsync, path, NULL, 0, 0, fi, isdatasync, 0);
+  [pool release];
   return 0;
 }
 
+#if GM_FUSE3 && !defined (FALLOC_FL_ZERO_RANGE)
+#define	FALLOC_FL_ZERO_RANGE		0x10			/* From the Linux <linux/falloc.h> */
+#endif	/* GM_FUSE3 && !defined (FALLOC_FL_ZERO_RANGE) */
+
 static int fusefm_fallocate(const char* path, int mode, fuse_off_t offset, fuse_off_t length,
                             struct fuse_file_info* fi) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
   int ret = -ENOSYS;
   @try {
     NSError* error = nil;
     GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    if ([fs allocateFileAtPath:[NSString stringWithUTF8String:path]
+    FlushCoalescedAttributes(fs, path, NO);
+    NSString* pathString = StringWithPath(path);
+    if ([fs allocateFileAtPath:pathString
                       userData:(fi ? (id)(uintptr_t)fi->fh : nil)
                        options:mode
                         offset:offset
                         length:length
                          error:&error]) {
       ret = 0;
+#if GM_FUSE3
+      // Allocating or zeroing without FALLOC_FL_KEEP_SIZE may extend the file.
+      // The other modes keep the size, except collapsing and inserting
+      // ranges, which aren't tracked.
+      if ((mode & ~FALLOC_FL_ZERO_RANGE) == 0) {
+        [fs->internal_ didWriteWritebackFileAtPath:pathString toOffset:offset + length];
+      }
+#endif	/* GM_FUSE3 */
     } else {
       MAYBE_USE_ERROR(ret, error);
     }
   }
   @catch (id exception) { }
+  GM_TRACE_END(GMOperationTraceOpFallocate, path, NULL, offset, length, fi, mode, ret);
+  [pool release];
+  return ret;
+}
+
+#if GM_FUSE3 && GM_FUSE_AT_LEAST(3, 4)
+// Only used when the delegate implements copyFileRangeAtPath:. The kernel
+// passes no flags yet.
+static ssize_t fusefm_copy_file_range(const char* path, struct fuse_file_info* fi,
+                                      fuse_off_t offset, const char* toPath,
+                                      struct fuse_file_info* toFi, fuse_off_t toOffset,
+                                      size_t size, int flags) {
+  if (flags != 0) {
+    return -EINVAL;
+  }
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
+  ssize_t ret = -EIO;
+
+  @try {
+    NSError* error = nil;
+    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    FlushCoalescedAttributes(fs, path, NO);
+    FlushCoalescedAttributes(fs, toPath, NO);
+    NSString* toPathString = StringWithPath(toPath);
+    ret = [fs copyFileRangeAtPath:StringWithPath(path)
+                         userData:(id)(uintptr_t)fi->fh
+                           offset:offset
+                           toPath:toPathString
+                       toUserData:(id)(uintptr_t)toFi->fh
+                         toOffset:toOffset
+                           length:size
+                            error:&error];
+    MAYBE_USE_ERROR(ret, error);
+    if (ret > 0) {
+      [fs->internal_ didWriteWritebackFileAtPath:toPathString toOffset:toOffset + ret];
+    }
+  }
+  @catch (id exception) { }
+  GM_TRACE_END(GMOperationTraceOpCopyFileRange, path, toPath, offset, size, fi, 0, (int)ret);
   [pool release];
   return ret;
 }
+#endif	/* GM_FUSE3 && GM_FUSE_AT_LEAST(3, 4) */
+
+#if GM_FUSE3 && GM_FUSE_AT_LEAST(3, 8)
+#if !defined (SEEK_DATA)
+#define	SEEK_DATA								3					/* From the Linux <unistd.h>, which only defines them with _GNU_SOURCE */
+#define	SEEK_HOLE								4
+#endif	/* !defined (SEEK_DATA) */
+
+// Only used when the delegate implements extentOfFileAtPath:. The kernel
+// handles the other kinds of seek itself.
+static off_t fusefm_lseek(const char* path, off_t offset, int whence,
+                          struct fuse_file_info* fi) {
+  if (whence != SEEK_DATA && whence != SEEK_HOLE) {
+    return -EINVAL;
+  }
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
+  off_t ret = -EIO;
+
+  @try {
+    NSError* error = nil;
+    GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    FlushCoalescedAttributes(fs, path, NO);
+    ret = [fs seekFileAtPath:StringWithPath(path)
+                    userData:fi ? (id)(uintptr_t)fi->fh : nil
+                      offset:offset
+                      toData:(whence == SEEK_DATA)
+                       error:&error];
+    MAYBE_USE_ERROR(ret, error);
+  }
+  @catch (id exception) { }
+  GM_TRACE_END(GMOperationTraceOpLseek, path, NULL, offset, (ret < 0) ? 0 : ret, fi, whence,
+               (ret < 0) ? (int)ret : 0);
+  [pool release];
+  return ret;
+}
+#endif	/* GM_FUSE3 && GM_FUSE_AT_LEAST(3, 8) */
 
 /* This method is documented in fuse.h as being required for Linux, and is probably required for others.
 		It is not used if the default_permissions mount option is set, requiring the kernel to perform access
@@ -2318,27 +4006,130 @@ static int fusefm_fallocate(const char* path, int mode, fuse_off_t offset, fuse_
     It must be implemented for the delegate file system to have the opportunity to check permissions,
     and create audit records for example.
 */
+#define	ACCESS_CACHE_DECISIONS_MAX	16						/* Callers and modes remembered for each item */
+#define	ACCESS_CACHE_GROUPS_MAX			64						/* Callers in more supplementary groups aren't cached */
+
+/* Grants and refusals can be cached. Other errors may not happen next time */
+static BOOL	IsAccessDecision (int a_iRC)
+	{
+  switch (a_iRC)
+  	{
+    case 0:
+    case -EACCES:
+    case -EPERM:
+    case -ENOENT:
+    case -ENOTDIR:
+    case -EROFS:
+    	return YES;
+    default:
+    	return NO;
+    }
+  }
+
+#if GM_FUSE3 || defined (__linux__)
+static int	CompareGIDs (const void * a_pv1, const void * a_pv2)
+	{
+  gid_t	gid1 = *(const gid_t *) a_pv1;
+  gid_t	gid2 = *(const gid_t *) a_pv2;
+
+  return (gid1 < gid2) ? -1 : (gid1 > gid2);
+  }
+#endif	/* GM_FUSE3 || defined (__linux__) */
+
+/* The key of the caller's decisions: its user, its groups and the mode it asks about. Returns nil if the
+		caller's supplementary groups can't be found, when its decision isn't cached. libfuse can only find
+    them on Linux, by reading /proc. Elsewhere callers with the same user and primary group share decisions
+*/
+static NSString *	AccessDecisionKey (const struct fuse_context * a_pContext, int a_iMode)
+	{
+  NSMutableString *	poszKey;
+#if GM_FUSE3 || defined (__linux__)
+  gid_t							aGroups [ACCESS_CACHE_GROUPS_MAX];
+  int								cGroups;
+  int								i;
+#endif	/* GM_FUSE3 || defined (__linux__) */
+
+  poszKey = [NSMutableString stringWithFormat: @"%u:%u:%d", (unsigned int) a_pContext->uid, (unsigned int) a_pContext->gid, a_iMode];
+#if GM_FUSE3 || defined (__linux__)
+  cGroups = fuse_getgroups (ACCESS_CACHE_GROUPS_MAX, aGroups);
+  if ((cGroups < 0) || (cGroups > ACCESS_CACHE_GROUPS_MAX))
+    return nil;
+  qsort (aGroups, (size_t) cGroups, sizeof (gid_t), CompareGIDs);
+  for (i = 0; i < cGroups; i++)
+    [poszKey appendFormat: @"%c%u", (i == 0) ? ':' : ',', (unsigned int) aGroups [i]];
+#endif	/* GM_FUSE3 || defined (__linux__) */
+  return poszKey;
+  }
+
+/* The cached entries are immutable, so a new decision replaces the item's entry with a copy that adds it.
+		The copy starts afresh once the item has many callers
+*/
+static void	CacheAccessDecision (GMPathCache * a_pAccessCache, const char * a_poszPath, NSDictionary * a_podoDecisions,
+																 NSString * a_poszKey, int a_iRC, unsigned long a_uGeneration)
+	{
+  NSMutableDictionary *	podoDecisions;
+
+  if ((a_podoDecisions != nil) && ([a_podoDecisions count] < ACCESS_CACHE_DECISIONS_MAX))
+  	podoDecisions = [NSMutableDictionary dictionaryWithDictionary: a_podoDecisions];
+  else
+  	podoDecisions = [NSMutableDictionary dictionaryWithCapacity: 1];
+  [podoDecisions setObject: [NSNumber numberWithInt: a_iRC] forKey: a_poszKey];
+  GMPathCacheInsert (a_pAccessCache, a_poszPath, podoDecisions, a_uGeneration);
+  }
+
+/* Not installed when the mount profile asks the kernel to check permissions */
 static int fusefm_access (const char * a_poszPath, int a_iMode)
 	{
   NSAutoreleasePool *	poAutoReleasePool;
 	NSError * 					poError;
   GMUserFileSystem *	poUserFileSystem;
+  GMPathCache *				pAccessCache;
+  struct fuse_context *	pContext;
+  NSDictionary *			podoDecisions;
+  NSString *					poszKey;
+  NSNumber *					poDecision;
+  unsigned long				uGeneration;
   int									iRC;
 
   poAutoReleasePool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
   poError = nil;
 	iRC = -ENOENT;
   @try
   	{
 		poUserFileSystem = [GMUserFileSystem currentFS];
-    if ([poUserFileSystem accessCheckOfItemAtPath: [NSString stringWithUTF8String: a_poszPath] mode: a_iMode error: &poError])
-    	iRC = 0;													/* Success */
+		FlushCoalescedAttributes (poUserFileSystem, a_poszPath, NO);
+    pAccessCache = [poUserFileSystem->internal_ accessCache];
+    podoDecisions = nil;
+    poszKey = nil;
+    poDecision = nil;
+    uGeneration = 0;
+    if (GMPathCacheIsEnabled (pAccessCache))
+    	{
+      pContext = fuse_get_context ();
+      poszKey = AccessDecisionKey (pContext, a_iMode);
+      if (poszKey != nil)
+      	{
+        GMPathCacheLookup (pAccessCache, a_poszPath, &podoDecisions, &uGeneration);
+        poDecision = [podoDecisions objectForKey: poszKey];
+        }
+      }
+    if (poDecision != nil)
+    	iRC = [poDecision intValue];
     else
-      MAYBE_USE_ERROR(iRC, poError);
+    	{
+      if ([poUserFileSystem accessCheckOfItemAtPath: StringWithPath (a_poszPath) mode: a_iMode error: &poError])
+        iRC = 0;												/* Success */
+      else
+        MAYBE_USE_ERROR(iRC, poError);
+      if ((poszKey != nil) && IsAccessDecision (iRC))
+      	CacheAccessDecision (pAccessCache, a_poszPath, podoDecisions, poszKey, iRC, uGeneration);
+      }
 		}
   @catch (id exception)
   	{
     }
+  GM_TRACE_END(GMOperationTraceOpAccess, a_poszPath, NULL, 0, 0, NULL, a_iMode, iRC);
   [poAutoReleasePool release];
   return iRC;
   }
@@ -2349,12 +4140,13 @@ static int fusefm_exchange(const char* p1, const char* p2, unsigned long opts) {
 	(void) opts;												/* Avoid unused argument compiler warning */
 
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
   int ret = -ENOSYS;
   @try {
     NSError* error = nil;
     GMUserFileSystem* fs = [GMUserFileSystem currentFS];
-    if ([fs exchangeDataOfItemAtPath:[NSString stringWithUTF8String:p1]
-                      withItemAtPath:[NSString stringWithUTF8String:p2]
+    if ([fs exchangeDataOfItemAtPath:StringWithPath(p1)
+                      withItemAtPath:StringWithPath(p2)
                                error:&error]) {
       ret = 0;
     } else {
@@ -2362,19 +4154,21 @@ static int fusefm_exchange(const char* p1, const char* p2, unsigned long opts) {
     }
   }
   @catch (id exception) { }
+  GM_TRACE_END(GMOperationTraceOpExchange, p1, p2, 0, 0, NULL, opts, ret);
   [pool release];
   return ret;  
 }
 
 static int fusefm_statfs_x(const char* path, struct statfs* stbuf) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
   int ret = -ENOENT;
   @try {
     memset(stbuf, 0, sizeof(struct statfs));
     NSError* error = nil;
     GMUserFileSystem* fs = [GMUserFileSystem currentFS];
     if ([fs fillStatfsBuffer:stbuf
-                     forPath:[NSString stringWithUTF8String:path]
+                     forPath:StringWithPath(path)
                        error:&error]) {
       ret = 0;
     } else {
@@ -2382,12 +4176,14 @@ static int fusefm_statfs_x(const char* path, struct statfs* stbuf) {
     }
   }
   @catch (id exception) { }
+  GM_TRACE_END(GMOperationTraceOpStatfs, path, NULL, 0, 0, NULL, 0, ret);
   [pool release];
   return ret;
 }
 
 static int fusefm_setvolname(const char* name) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
   int ret = -ENOSYS;
   @try {
     NSError* error = nil;
@@ -2402,6 +4198,7 @@ static int fusefm_setvolname(const char* name) {
     }
   }
   @catch (id exception) { }
+  GM_TRACE_END(GMOperationTraceOpSetvolname, "/", name, 0, 0, NULL, 0, ret);
   [pool release];
   return ret;
 }
@@ -2415,13 +4212,14 @@ static int fusefm_setvolname(const char* name) {
 static int	fusefm_statfs (const char * a_pszPath, struct statvfs * a_pStatVFS)
 	{
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
   int ret = -ENOENT;
   @try {
     memset(a_pStatVFS, 0, sizeof(struct statvfs));
     NSError* error = nil;
     GMUserFileSystem* fs = [GMUserFileSystem currentFS];
     if ([fs fillStatvfsBuffer:a_pStatVFS
-                     forPath:[NSString stringWithUTF8String:a_pszPath]
+                     forPath:StringWithPath(a_pszPath)
                        error:&error]) {
       ret = 0;
     } else {
@@ -2429,6 +4227,7 @@ static int	fusefm_statfs (const char * a_pszPath, struct statvfs * a_pStatVFS)
     }
   }
   @catch (id exception) { }
+  GM_TRACE_END(GMOperationTraceOpStatfs, a_pszPath, NULL, 0, 0, NULL, 0, ret);
   [pool release];
   return ret;
   }
@@ -2437,29 +4236,50 @@ static int	fusefm_statfs (const char * a_pszPath, struct statvfs * a_pStatVFS)
 static int fusefm_fgetattr(const char *path, struct stat *stbuf, 
                            struct fuse_file_info* fi) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
   int ret = -ENOENT;
   @try {
     memset(stbuf, 0, sizeof(struct stat));
     NSError* error = nil;
     GMUserFileSystem* fs = [GMUserFileSystem currentFS];
     id userData = fi ? (id)(uintptr_t)fi->fh : nil;
-    if ([fs fillStatBuffer:stbuf 
-                   forPath:[NSString stringWithUTF8String:path]
-                  userData:userData
-                     error:&error]) {
+
+    // Only lookups by path are answered from the negative cache. An open file
+    // exists whatever its path.
+    GMPathCache* negativeCache = fi ? NULL : [fs->internal_ negativeCache];
+    unsigned long generation = 0;
+    if (negativeCache && GMPathCacheLookup(negativeCache, path, NULL, &generation)) {
+      ret = -ENOENT;
+    } else if ([fs fillStatBuffer:stbuf 
+                          forPath:StringWithPath(path)
+                         userData:userData
+                            error:&error]) {
       ret = 0;
     } else {
       MAYBE_USE_ERROR(ret, error);
+      if (ret == -ENOENT && negativeCache) {
+        GMPathCacheInsert(negativeCache, path, nil, generation);
+      }
     }
   }
   @catch (id exception) { }
+  GM_TRACE_END((fi != NULL) ? GMOperationTraceOpFgetattr : GMOperationTraceOpGetattr,
+               path, NULL, 0, 0, fi, 0, ret);
   [pool release];
   return ret;
 }
 
+#if GM_FUSE3
+// libfuse 3 passes the open file, if any, to getattr and has no fgetattr.
+static int fusefm_getattr(const char *path, struct stat *stbuf,
+                          struct fuse_file_info* fi) {
+  return fusefm_fgetattr(path, stbuf, fi);
+}
+#else
 static int fusefm_getattr(const char *path, struct stat *stbuf) {
   return fusefm_fgetattr(path, stbuf, NULL);
 }
+#endif	/* GM_FUSE3 */
 
 #if defined (__APPLE__)
 /* CJEC, 14-Oct-20: TODO: Investigate something similar to this for Linux & FreeBSD in newer Fuse APIs.
@@ -2469,13 +4289,14 @@ static int fusefm_getattr(const char *path, struct stat *stbuf) {
 static int fusefm_getxtimes(const char* path, struct timespec* bkuptime, 
                             struct timespec* crtime) {  
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
   int ret = -ENOENT;
 
   @try {
     NSError* error = nil;
     GMUserFileSystem* fs = [GMUserFileSystem currentFS];
     NSDictionary* attribs = 
-      [fs extendedTimesOfItemAtPath:[NSString stringWithUTF8String:path]
+      [fs extendedTimesOfItemAtPath:StringWithPath(path)
                            userData:nil  // TODO: Maybe this should support FH?
                               error:&error];
     if (attribs) {
@@ -2507,6 +4328,7 @@ static int fusefm_getxtimes(const char* path, struct timespec* bkuptime,
     }
   }
   @catch (id exception) { }
+  GM_TRACE_END(GMOperationTraceOpGetxtimes, path, NULL, 0, 0, NULL, 0, ret);
   [pool release];
   return ret;
 }
@@ -2568,6 +4390,7 @@ static NSDictionary* dictionaryWithAttributes(const struct setattr_x* attrs) {
 static int fusefm_fsetattr_x(const char* path, struct setattr_x* attrs,
                              struct fuse_file_info* fi) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
   int ret = 0;  // Note: Return success by default.
 
   @try {
@@ -2575,15 +4398,23 @@ static int fusefm_fsetattr_x(const char* path, struct setattr_x* attrs,
     NSDictionary* attribs = dictionaryWithAttributes(attrs);
     GMUserFileSystem* fs = [GMUserFileSystem currentFS];
     if ([fs setAttributes:attribs 
-             ofItemAtPath:[NSString stringWithUTF8String:path]
+             ofItemAtPath:StringWithPath(path)
                  userData:(fi ? (id)(uintptr_t)fi->fh : nil)
                     error:&error]) {
       ret = 0;
     } else {
       MAYBE_USE_ERROR(ret, error);
     }
+    if (SETATTR_WANTS_MODE(attrs) || SETATTR_WANTS_UID(attrs) || SETATTR_WANTS_GID(attrs) ||
+        SETATTR_WANTS_FLAGS(attrs)) {
+      InvalidateCachedAccess(fs, path);
+    } else if (SETATTR_WANTS_SIZE(attrs)) {
+      [[fs->internal_ handleCache] discardPath:StringWithPath(path) descendants:NO];
+    }
   }
   @catch (id exception) { }
+  GM_TRACE_END(GMOperationTraceOpSetattr, path, NULL, 0,
+               SETATTR_WANTS_SIZE(attrs) ? attrs->size : 0, fi, attrs->valid, ret);
   [pool release];
   return ret;
 }
@@ -2598,83 +4429,126 @@ static int fusefm_setattr_x(const char* path, struct setattr_x* attrs) {
 		and are used instead.
     
     Note: It appears that btime and ctime cannot be set on Linux or FreeBSD.
+    Note: libfuse 3 also passes the open file, if any. Only truncation uses it, as with libfuse 2's
+    			ftruncate, which libfuse 3 folds into truncate.
 
     CJEC, 14-Oct-20: TODO: FreeBSD: What about chflags(2)? See https://bugs.freebsd.org/bugzilla/show_bug.cgi?id=238197
 */
 #if !defined (__APPLE__)
+#if GM_FUSE3
+static int	fusefm_utimens (const char * a_pszPath, const struct timespec a_TimeSpecs [2], struct fuse_file_info * a_pFuseFileInfo)
+#else
 static int	fusefm_utimens (const char * a_pszPath, const struct timespec a_TimeSpecs [2])
+#endif	/* GM_FUSE3 */
 	{
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
   int ret = 0;  // Note: Return success by default.
 
+#if GM_FUSE3
+  (void) a_pFuseFileInfo;							/* Avoid unused argument compiler warning */
+#endif	/* GM_FUSE3 */
   @try {
     NSError* error = nil;
     NSMutableDictionary* attribs = [NSMutableDictionary dictionary];
     GMUserFileSystem* fs = [GMUserFileSystem currentFS];
 
-    [attribs setObject:dateWithTimespec(&(a_TimeSpecs [0])) forKey:kGMUserFileSystemFileAccessDateKey];
-    [attribs setObject:dateWithTimespec(&(a_TimeSpecs [1])) forKey:NSFileModificationDate];
-    if ([fs setAttributes:attribs
-             ofItemAtPath:[NSString stringWithUTF8String:a_pszPath]
-                 userData:nil
-                    error:&error]) {
+    // flag_utime_omit_ok, which libfuse 3 always assumes, passes UTIME_NOW and
+    // UTIME_OMIT through from utimensat(2).
+    NSString* keys [2] = { kGMUserFileSystemFileAccessDateKey, NSFileModificationDate };
+    for (int i = 0; i < 2; i++) {
+      if (a_TimeSpecs [i].tv_nsec == UTIME_NOW) {
+        [attribs setObject:[NSDate date] forKey:keys [i]];
+      } else if (a_TimeSpecs [i].tv_nsec != UTIME_OMIT) {
+        [attribs setObject:dateWithTimespec(&(a_TimeSpecs [i])) forKey:keys [i]];
+      }
+    }
+    if ([attribs count] == 0 || SetAttributesOfItem(fs, a_pszPath, attribs, &error)) {
       ret = 0;
+      // The kernel sets the modification date of its cached writes this way.
+      NSDate* modificationDate = [attribs objectForKey:NSFileModificationDate];
+      if (modificationDate != nil) {
+        [fs->internal_ setWritebackModificationDate:modificationDate
+                                            forPath:StringWithPath(a_pszPath)];
+      }
     } else {
       MAYBE_USE_ERROR(ret, error);
     }
   }
   @catch (id exception) { }
+  GM_TRACE_END(GMOperationTraceOpUtimens, a_pszPath, NULL, 0, 0, NULL, 0, ret);
   [pool release];
   return ret;
   }
 
+#if GM_FUSE3
+static int	fusefm_chmod (const char * a_pszPath, mode_t a_Mode, struct fuse_file_info * a_pFuseFileInfo)
+#else
 static int	fusefm_chmod (const char * a_pszPath, mode_t a_Mode)
+#endif	/* GM_FUSE3 */
 	{
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
   int ret = 0;  // Note: Return success by default.
 
+#if GM_FUSE3
+  (void) a_pFuseFileInfo;							/* Avoid unused argument compiler warning */
+#endif	/* GM_FUSE3 */
   @try {
     NSError* error = nil;
     NSMutableDictionary* attribs = [NSMutableDictionary dictionary];
     GMUserFileSystem* fs = [GMUserFileSystem currentFS];
 
     [attribs setObject: [NSNumber numberWithLong: (long) a_Mode] forKey: NSFilePosixPermissions];
-    if ([fs setAttributes:attribs
-             ofItemAtPath:[NSString stringWithUTF8String:a_pszPath]
-                 userData:nil
-                    error:&error]) {
+    if (SetAttributesOfItem(fs, a_pszPath, attribs, &error)) {
       ret = 0;
     } else {
       MAYBE_USE_ERROR(ret, error);
     }
+    InvalidateCachedAccess(fs, a_pszPath);
   }
   @catch (id exception) { }
+  GM_TRACE_END(GMOperationTraceOpChmod, a_pszPath, NULL, 0, 0, NULL, a_Mode, ret);
   [pool release];
   return ret;
   }
 
+#if GM_FUSE3
+static int	fusefm_chown (const char * a_pszPath, uid_t a_UID, gid_t a_GID, struct fuse_file_info * a_pFuseFileInfo)
+#else
 static int	fusefm_chown (const char * a_pszPath, uid_t a_UID, gid_t a_GID)
+#endif	/* GM_FUSE3 */
 	{
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
   int ret = 0;  // Note: Return success by default.
 
+#if GM_FUSE3
+  (void) a_pFuseFileInfo;							/* Avoid unused argument compiler warning */
+#endif	/* GM_FUSE3 */
   @try {
     NSError* error = nil;
     NSMutableDictionary* attribs = [NSMutableDictionary dictionary];
     GMUserFileSystem* fs = [GMUserFileSystem currentFS];
 
-    [attribs setObject: [NSNumber numberWithLong: (long) a_UID] forKey: NSFileOwnerAccountID];
-    [attribs setObject: [NSNumber numberWithLong: (long) a_GID] forKey: NSFileGroupOwnerAccountID];
-    if ([fs setAttributes:attribs
-             ofItemAtPath:[NSString stringWithUTF8String:a_pszPath]
-                 userData:nil
-                    error:&error]) {
+    // An ID of -1 is left unchanged, so it mustn't replace one held for coalescing.
+    if (a_UID != (uid_t) -1) {
+      [attribs setObject: [NSNumber numberWithLong: (long) a_UID] forKey: NSFileOwnerAccountID];
+    }
+    if (a_GID != (gid_t) -1) {
+      [attribs setObject: [NSNumber numberWithLong: (long) a_GID] forKey: NSFileGroupOwnerAccountID];
+    }
+    if ([attribs count] == 0 || SetAttributesOfItem(fs, a_pszPath, attribs, &error)) {
       ret = 0;
     } else {
       MAYBE_USE_ERROR(ret, error);
     }
+    if ([attribs count] != 0) {
+      InvalidateCachedAccess(fs, a_pszPath);
+    }
   }
   @catch (id exception) { }
+  GM_TRACE_END(GMOperationTraceOpChown, a_pszPath, NULL, a_UID, a_GID, NULL, 0, ret);
   [pool release];
   return ret;
   }
@@ -2682,6 +4556,7 @@ static int	fusefm_chown (const char * a_pszPath, uid_t a_UID, gid_t a_GID)
 static int	fusefm_ftruncate (const char * a_pszPath, fuse_off_t a_cbSize, struct fuse_file_info * a_pFuseFileInfo)
 	{
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
   int ret = 0;  // Note: Return success by default.
 
   @try {
@@ -2690,36 +4565,52 @@ static int	fusefm_ftruncate (const char * a_pszPath, fuse_off_t a_cbSize, struct
     GMUserFileSystem* fs = [GMUserFileSystem currentFS];
 
     [attribs setObject: [NSNumber numberWithLongLong: a_cbSize] forKey: NSFileSize];
-    if ([fs setAttributes:attribs
-             ofItemAtPath:[NSString stringWithUTF8String:a_pszPath]
-                 userData:(a_pFuseFileInfo ? (id)(uintptr_t)a_pFuseFileInfo->fh : nil)
-                    error:&error]) {
+    BOOL truncated = NO;
+    if (a_pFuseFileInfo == NULL) {
+      truncated = SetAttributesOfItem(fs, a_pszPath, attribs, &error);
+    } else {
+      FlushCoalescedAttributes(fs, a_pszPath, NO);
+      truncated = [fs setAttributes:attribs
+                       ofItemAtPath:StringWithPath(a_pszPath)
+                           userData:(id)(uintptr_t)a_pFuseFileInfo->fh
+                              error:&error];
+    }
+    if (truncated) {
       ret = 0;
+      [fs->internal_ didTruncateWritebackFileAtPath:StringWithPath(a_pszPath) toSize:a_cbSize];
     } else {
       MAYBE_USE_ERROR(ret, error);
     }
+    // Kept files were opened before the truncation, which may have partly succeeded.
+    [[fs->internal_ handleCache] discardPath:StringWithPath(a_pszPath) descendants:NO];
   }
   @catch (id exception) { }
+  GM_TRACE_END((a_pFuseFileInfo != NULL) ? GMOperationTraceOpFtruncate : GMOperationTraceOpTruncate,
+               a_pszPath, NULL, a_cbSize, 0, a_pFuseFileInfo, 0, ret);
   [pool release];
   return ret;
   }
 
+#if !GM_FUSE3
 static int	fusefm_truncate (const char * a_pszPath, fuse_off_t a_cbSize)
 	{
   return fusefm_ftruncate (a_pszPath, a_cbSize, NULL);
   }
+#endif	/* !GM_FUSE3 */
 
 #endif	/* !defined (__APPLE__) */
 
 static int fusefm_listxattr(const char *path, char *list, size_t size)
 {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
   int ret = -ENOTSUP;
   @try {
     NSError* error = nil;
     GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    FlushCoalescedAttributes(fs, path, NO);
     NSArray* attributeNames =
-      [fs extendedAttributesOfItemAtPath:[NSString stringWithUTF8String:path]
+      [fs extendedAttributesOfItemAtPath:StringWithPath(path)
                                    error:&error];
     if (attributeNames != nil) {
       char zero = 0;
@@ -2740,6 +4631,7 @@ static int fusefm_listxattr(const char *path, char *list, size_t size)
     }
   }
   @catch (id exception) { }
+  GM_TRACE_END(GMOperationTraceOpListxattr, path, NULL, 0, size, NULL, 0, ret);
   [pool release];
   return ret;
 }
@@ -2753,13 +4645,15 @@ static int fusefm_getxattr(const char *path, const char *name, char *value,
   uint32_t	position = 0;				/* Only OS X/Darwin has this parameter */
 #endif	/* defined (__APPLE__) */
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
   int ret = -ENOATTR;
   
   @try {
     NSError* error = nil;
     GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    FlushCoalescedAttributes(fs, path, NO);
     NSData *data = [fs valueOfExtendedAttribute:[NSString stringWithUTF8String:name]
-                                   ofItemAtPath:[NSString stringWithUTF8String:path]
+                                   ofItemAtPath:StringWithPath(path)
                                        position:position
                                           error:&error];
     if (data != nil) {
@@ -2776,6 +4670,7 @@ static int fusefm_getxattr(const char *path, const char *name, char *value,
     }
   }
   @catch (id exception) { }
+  GM_TRACE_END(GMOperationTraceOpGetxattr, path, name, position, size, NULL, 0, ret);
   [pool release];
   return ret;
 }
@@ -2789,12 +4684,14 @@ static int fusefm_setxattr(const char *path, const char *name, const char *value
   uint32_t position	= 0;								/* Only OS X/Darwin has this parameter */
 #endif	/* defined (__APPLE__) */
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
   int ret = -EPERM;
   @try {
     NSError* error = nil;
     GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    FlushCoalescedAttributes(fs, path, NO);
     if ([fs setExtendedAttribute:[NSString stringWithUTF8String:name]
-                    ofItemAtPath:[NSString stringWithUTF8String:path]
+                    ofItemAtPath:StringWithPath(path)
                            value:[NSData dataWithBytes:value length:size]
                         position:position
                          options:flags
@@ -2805,18 +4702,21 @@ static int fusefm_setxattr(const char *path, const char *name, const char *value
     }
   }
   @catch (id exception) { }
+  GM_TRACE_END(GMOperationTraceOpSetxattr, path, name, position, size, NULL, flags, ret);
   [pool release];
   return ret;
 }
 
 static int fusefm_removexattr(const char *path, const char *name) {
   NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+  GM_TRACE_BEGIN();
   int ret = -ENOATTR;
   @try {
     NSError* error = nil;
     GMUserFileSystem* fs = [GMUserFileSystem currentFS];
+    FlushCoalescedAttributes(fs, path, NO);
     if ([fs removeExtendedAttribute:[NSString stringWithUTF8String:name]
-                    ofItemAtPath:[NSString stringWithUTF8String:path]
+                    ofItemAtPath:StringWithPath(path)
                            error:&error]) {
       ret = 0;
     } else {
@@ -2824,11 +4724,14 @@ static int fusefm_removexattr(const char *path, const char *name) {
     }
   }
   @catch (id exception) { }
+  GM_TRACE_END(GMOperationTraceOpRemovexattr, path, name, 0, 0, NULL, 0, ret);
   [pool release];
   return ret;
 }
 
 #undef MAYBE_USE_ERROR
+#undef GM_TRACE_BEGIN
+#undef GM_TRACE_END
 
 #pragma mark struct fuse_operations
 static struct fuse_operations fusefm_oper = {
@@ -2881,7 +4784,9 @@ static struct fuse_operations fusefm_oper = {
   .statfs = fusefm_statfs,
 #endif	/* defined (__APPLE__) */
   .getattr = fusefm_getattr,
+#if !GM_FUSE3
   .fgetattr = fusefm_fgetattr,
+#endif	/* !GM_FUSE3 */
 #if defined (__APPLE__)
   .getxtimes = fusefm_getxtimes,
   .setattr_x = fusefm_setattr_x,
@@ -2891,8 +4796,12 @@ static struct fuse_operations fusefm_oper = {
   .utimens = fusefm_utimens,
   .chmod = fusefm_chmod,
   .chown = fusefm_chown,
+#if GM_FUSE3
+  .truncate = fusefm_ftruncate,				/* libfuse 3 passes the open file, if any */
+#else
   .truncate = fusefm_truncate,
   .ftruncate = fusefm_ftruncate,
+#endif	/* GM_FUSE3 */
   /* CJEC, 14-Oct-20: TODO: FreeBSD: What about chflags(2) ? See https://bugs.freebsd.org/bugzilla/show_bug.cgi?id=238197 */
 #endif	/* defined (__APPLE__) */
 
@@ -2902,17 +4811,30 @@ static struct fuse_operations fusefm_oper = {
   .setxattr = fusefm_setxattr,
   .removexattr = fusefm_removexattr,
   
+#if !GM_FUSE3
   // Fuse operation flags. See declaration of struct fuse_operations in fuse.h
+  // libfuse 3 has none. fusefm_init sets their equivalents in struct fuse_config
   .flag_reserved = 0,
-  .flag_nullpath_ok = false,				/* CJEC, 16-Dec-20: TODO: Optimise by enabling this so the path doesn't need to be generated when the file has been deleted */
-  .flag_nopath = false,							/* CJEC, 16-Dec-20: TODO: Optimise by enabling this so the path doesn't need to be generated */
-  .flag_utime_omit_ok = false,			/* CJEC, 16-Dec-20: TODO: Support UTIME_NOW and UTIME_OMIT for utimesat(2) support on Linux, FreeBSD */
+  .flag_nullpath_ok = false,				/* Both set by -mount: when the mount profile asks for noPath */
+  .flag_nopath = false,
+  .flag_utime_omit_ok = true,				/* fusefm_utimens handles UTIME_NOW and UTIME_OMIT */
+#endif	/* !GM_FUSE3 */
 };
 
+/* In-process harness support. Returns the operations table so that the tools in Benchmarks/ can call
+		the fusefm_* callbacks directly, without a kernel mount. See GMFuseOperations.h
+*/
+GM_EXPORT const struct fuse_operations *	GMUserFileSystemFuseOperations (void)
+	{
+  return &fusefm_oper;
+  }
+
 #pragma mark Internal Mount
 
 - (void)postMountError:(NSError *)error {
-  assert([internal_ status] == GMUserFileSystem_MOUNTING);
+  assert([internal_ status] == GMUserFileSystem_MOUNTING ||
+         [internal_ status] == GMUserFileSystem_INITIALIZING ||
+         [internal_ status] == GMUserFileSystem_FAILURE);
   [internal_ setStatus:GMUserFileSystem_FAILURE];
 
   NSDictionary* userInfo = 
@@ -2940,11 +4862,22 @@ static struct fuse_operations fusefm_oper = {
 	BOOL fNotMounted	= YES;
   int  iErrno;
 
+#if defined (__linux__)
+  [internal_ setMountInfoPath:MountInfoPath([internal_ mountPath])];
+#endif	/* defined (__linux__) */
+
   // Maybe there is a dead FUSE file system stuck on our mountpoint?
   struct statfs statfs_buf;
   memset(&statfs_buf, 0, sizeof(statfs_buf));
   int ret = statfs([[internal_ mountPath] UTF8String], &statfs_buf);
+#if defined (__linux__)
+  // A dead FUSE file system is still in the mount table, but statfs(2) fails
+  // with ENOTCONN.
+  if (ret != 0 && errno == ENOTCONN &&
+      IsFuseMountPoint([[internal_ mountInfoPath] UTF8String])) {
+#else
   if (ret == 0) {
+#endif	/* defined (__linux__) */
 #if defined (__APPLE__)
     if (statfs_buf.f_fssubtype == (uint32_t)(-1)) {
       // We use a special indicator value from FUSE in the f_fssubtype field to
@@ -2969,15 +4902,11 @@ static struct fuse_operations fusefm_oper = {
       fNotMounted = (iErrno == 0) || (iErrno == EINVAL);	/* unmount(2) returns EINVAL if not in the mount table */
 #else
 #if defined (__linux__)
-		/* CJEC, 18-Dec-20: TODO: Determine whether the mountpoint is a deadfs
-    */
-    NSLog (@"fuse: WARNING: UNIMPLEMENTED: Cannot determine 'dead?' file system at mountpoint '%@'. Attempting dismount anyway. Ignore possible subsequently logged error from the umount(8) program IN %@", [internal_ mountPath], self);
+    NSLog (@"fuse: WARNING: Unmounting dead file system at mountpoint '%@' IN %@", [internal_ mountPath], self);
       {
-//    ret = umount2([[internal_ mountPath] UTF8String], 0);	/* https://www.man7.org/linux/man-pages/man2/umount.2.html */
-//    iErrno = ret < 0 ? errno : 0;
-      NSArray* args = [NSArray arrayWithObjects:@"-v", [internal_ mountPath], nil];
-      iErrno = Unmount (args);	/* Can't use unmount(2) without root priviledge */
-      fNotMounted = (iErrno == 0) || (iErrno == EINVAL);	/* unmount2(2) returns EINVAL if not a mountpoint (among other reasons) */
+      UnmountFuseMountPoint ([[internal_ mountPath] UTF8String]);
+      iErrno = IsFuseMountPoint([[internal_ mountInfoPath] UTF8String]) ? EBUSY : 0;
+      fNotMounted = iErrno == 0;
 #endif	/* defined (__linux__) */
 #endif	/* defined (__FreeBSD__) */
 #endif	/* defined (__APPLE__) */
@@ -3051,6 +4980,15 @@ static struct fuse_operations fusefm_oper = {
     return;
   }
 
+  // Reject a mount profile that the kernel would silently ignore or refuse.
+  GMMountProfile* profile = [internal_ mountProfile];
+  NSError* profileError = nil;
+  if (![profile validate:&profileError]) {
+    [self postMountError:profileError];
+    [pool release];
+    return;
+  }
+
   // On OS X/Darwin, trigger initialization of NSFileManager for '/Volumes'.
   // This is rather lame, but if we
   // don't call directoryContents before we mount our FUSE filesystem and 
@@ -3078,6 +5016,11 @@ static struct fuse_operations fusefm_oper = {
       [arguments addObject:[NSString stringWithFormat:@"-o%@",option]];
     }
   }
+  NSArray* profileOptions = [profile mountOptions];
+  for (NSUInteger i = 0; i < [profileOptions count]; ++i) {
+    [arguments addObject:[NSString stringWithFormat:@"-o%@",
+                          [profileOptions objectAtIndex:i]]];
+  }
   [arguments addObject:[internal_ mountPath]];
   [args release];  // We don't need packaged up args any more.
 
@@ -3088,15 +5031,77 @@ static struct fuse_operations fusefm_oper = {
     NSString* argument = [arguments objectAtIndex:i];
     argv[i] = strdup([argument UTF8String]);  // We'll just leak this for now.
   }
+  // fuse_main() copies the operations, so each mount can have its own flags.
+  // With libfuse 3, fusefm_init sets nullpath_ok from the profile instead.
+  struct fuse_operations operations = fusefm_oper;
+  if ([profile noPath]) {
+#if !GM_FUSE3
+    operations.flag_nullpath_ok = true;
+    operations.flag_nopath = true;
+#endif	/* !GM_FUSE3 */
+    operations.opendir = fusefm_opendir;
+    operations.releasedir = fusefm_releasedir;
+  }
+#if GM_FUSE3 && GM_FUSE_AT_LEAST(3, 5)
+  if ([profile directoryCacheSize] > 0) {
+    operations.opendir = fusefm_opendir;
+    operations.releasedir = fusefm_releasedir;
+  }
+#endif	/* GM_FUSE3 && GM_FUSE_AT_LEAST(3, 5) */
+  if ([profile smallFileSize] > 0) {
+    operations.flush = fusefm_flush;
+  }
+  // With default_permissions the kernel makes the checks itself.
+  if ([profile kernelPermissions]) {
+    operations.access = NULL;
+  }
+#if GM_FUSE3 && GM_FUSE_AT_LEAST(3, 4)
+  // Without it the kernel copies by reading and writing, as it would if the
+  // delegate failed with ENOTSUP.
+  if ([self supportsCopyFileRange]) {
+    operations.copy_file_range = fusefm_copy_file_range;
+  }
+#endif	/* GM_FUSE3 && GM_FUSE_AT_LEAST(3, 4) */
+#if GM_FUSE3 && GM_FUSE_AT_LEAST(3, 8)
+  // Without it the kernel treats the whole file as data.
+  if ([self supportsExtentOfFile]) {
+    operations.lseek = fusefm_lseek;
+  }
+#endif	/* GM_FUSE3 && GM_FUSE_AT_LEAST(3, 8) */
   if ([[internal_ delegate] respondsToSelector:@selector(willMount)]) {
     [[internal_ delegate] willMount];
   }
+
+  // A shared dispatcher serves the mount from its own threads, so this thread
+  // is done with it once it is mounted.
+  GMSessionDispatcher* dispatcher = [internal_ sessionDispatcher];
+  if (dispatcher != nil) {
+    NSLog (@"fuse: INFORMATION: Starting session for mountpoint '%@' with %@", [internal_ mountPath], dispatcher);
+    GMDispatchSession* session =
+      [[GMDispatchSession alloc] initWithFileSystem:self
+                                               argc:argc
+                                               argv:(char **)argv
+                                         operations:&operations
+                                       isThreadSafe:isThreadSafe];
+    if (session != nil) {
+      [dispatcher addSession:session];
+      [session release];
+    } else {
+      [self sessionDidEndWithResult:1];
+    }
+    [pool release];
+    return;
+  }
+
   [pool release];
   NSLog (@"fuse: INFORMATION: Starting fuse_main() for mountpoint '%@'", [internal_ mountPath]);
-  ret = fuse_main(argc, (char **)argv, &fusefm_oper, self);
+  ret = fuse_main(argc, (char **)argv, &operations, self);
   NSLog (@"fuse: INFORMATION: Ended fuse_main() for mountpoint '%@'. Return Code 0x%8.8X, %d", [internal_ mountPath], ret, ret);
+  [self sessionDidEndWithResult:ret];
+}
 
-  pool = [[NSAutoreleasePool alloc] init];
+- (void)sessionDidEndWithResult:(int)ret {
+  NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
 
   if ([internal_ status] == GMUserFileSystem_MOUNTING) {
     // If we returned from fuse_main while we still think we are 
@@ -3116,7 +5121,7 @@ static struct fuse_operations fusefm_oper = {
                                          code:GMUserFileSystem_ERROR_MOUNT_FUSE_MAIN_INTERNAL
                                      userInfo:userInfo];
     [self postMountError:error];
-  } else {
+  } else if ([internal_ status] != GMUserFileSystem_FAILURE) {
     [internal_ setStatus:GMUserFileSystem_NOT_MOUNTED];
   }
 
@@ -3124,3 +5129,349 @@ static struct fuse_operations fusefm_oper = {
 }
 
 @end
+
+@implementation GMSmallFile
+
+- (id)init {
+  [self release];
+  return nil;
+}
+
+- (id)initWithFileSystem:(GMUserFileSystem *)fs
+                    path:(NSString *)path
+              attributes:(NSDictionary *)attributes
+                   flags:(int)flags
+                 maxSize:(NSUInteger)maxSize
+        existsInDelegate:(BOOL)existsInDelegate {
+  self = [super init];
+  if (self) {
+    fs_ = fs;
+    lock_ = [[NSLock alloc] init];
+    path_ = [path copy];
+    attributes_ = attributes ? [attributes mutableCopy] : [[NSMutableDictionary alloc] init];
+    flags_ = flags;
+    maxSize_ = maxSize;
+    data_ = [[NSMutableData alloc] init];
+    modificationDate_ = [[NSDate alloc] init];
+    existsInDelegate_ = existsInDelegate;
+    needsCommit_ = YES;
+  }
+  return self;
+}
+
+- (void)dealloc {
+  [lock_ release];
+  [path_ release];
+  [attributes_ release];
+  [data_ release];
+  [modificationDate_ release];
+  [userData_ release];
+  [super dealloc];
+}
+
+- (NSString *)description {
+  return [NSString stringWithFormat:@"%@ path=%@, length=%lu, spilled=%d, opens=%lu",
+          [super description], path_, (unsigned long)[data_ length],
+          data_ == nil, (unsigned long)openCount_];
+}
+
+- (NSString *)path { return path_; }
+- (NSUInteger)openCount { return openCount_; }
+- (void)setOpenCount:(NSUInteger)openCount { openCount_ = openCount; }
+
+- (BOOL)isSpilled {
+  [lock_ lock];
+  BOOL isSpilled = (data_ == nil);
+  [lock_ unlock];
+  return isSpilled;
+}
+
+- (BOOL)existsInDelegate {
+  [lock_ lock];
+  BOOL existsInDelegate = existsInDelegate_;
+  [lock_ unlock];
+  return existsInDelegate;
+}
+
+// Set once when the file is spilled and never changed, so it can be used
+// without the lock afterwards.
+- (id)delegateUserData {
+  [lock_ lock];
+  id userData = [[userData_ retain] autorelease];
+  [lock_ unlock];
+  return userData;
+}
+
+- (NSDictionary *)attributesOverDelegateAttributes:(NSDictionary *)attributes {
+  [lock_ lock];
+  NSMutableDictionary* merged = nil;
+  if (data_ == nil) {
+    [lock_ unlock];
+    return attributes;
+  } else {
+    if (existsInDelegate_) {
+      merged = [NSMutableDictionary dictionaryWithDictionary:attributes];
+    } else {
+      merged = [NSMutableDictionary dictionaryWithDictionary:attributes_];
+      [merged setObject:NSFileTypeRegular forKey:NSFileType];
+      [merged setObject:[NSNumber numberWithLong:1] forKey:NSFileReferenceCount];
+    }
+    [merged setObject:[NSNumber numberWithUnsignedLongLong:[data_ length]]
+               forKey:NSFileSize];
+    [merged setObject:modificationDate_ forKey:NSFileModificationDate];
+  }
+  [lock_ unlock];
+  return merged;
+}
+
+- (BOOL)mergeAttributes:(NSDictionary *)attributes {
+  [lock_ lock];
+  BOOL merged = (data_ != nil && !existsInDelegate_);
+  if (merged) {
+    [attributes_ addEntriesFromDictionary:attributes];
+    NSDate* modificationDate = [attributes objectForKey:NSFileModificationDate];
+    if (modificationDate) {
+      [modificationDate_ autorelease];
+      modificationDate_ = [modificationDate retain];
+    }
+    needsCommit_ = YES;
+  }
+  [lock_ unlock];
+  return merged;
+}
+
+// Called with the lock held. Creates or truncates the file in the delegate,
+// writes the buffer to it and forwards all later I/O.
+- (BOOL)spillLocked:(NSError **)error {
+  if (data_ == nil) {
+    return YES;
+  }
+  id userData = nil;
+  BOOL opened = NO;
+  if (existsInDelegate_) {
+    opened = [fs_ openFileAtPath:path_
+                            mode:(flags_ & ~(O_CREAT | O_EXCL)) | O_TRUNC
+                        userData:&userData
+                           error:error];
+  } else {
+    opened = [fs_ createFileAtPath:path_
+                        attributes:attributes_
+                             flags:flags_
+                          userData:&userData
+                             error:error];
+  }
+  if (!opened) {
+    return NO;
+  }
+  existsInDelegate_ = YES;
+
+  const char* bytes = [data_ bytes];
+  NSUInteger length = [data_ length];
+  NSUInteger offset = 0;
+  while (offset < length) {
+    int written = [fs_ writeFileAtPath:path_
+                              userData:userData
+                                buffer:bytes + offset
+                                  size:length - offset
+                                offset:offset
+                                 error:error];
+    if (written <= 0) {
+      if (*error == nil) {
+        *error = [GMUserFileSystem errorWithCode:EIO];
+      }
+      [fs_ releaseFileAtPath:path_ userData:userData];
+      return NO;
+    }
+    offset += written;
+  }
+
+  userData_ = [userData retain];
+  [data_ release];
+  data_ = nil;
+  needsCommit_ = NO;
+  [fs_ smallFileDidSpill:self];
+  return YES;
+}
+
+- (BOOL)spill:(NSError **)error {
+  [lock_ lock];
+  BOOL ret = [self spillLocked:error];
+  [lock_ unlock];
+  return ret;
+}
+
+- (BOOL)commit:(NSError **)error {
+  [lock_ lock];
+  BOOL ret = YES;
+  if (data_ != nil && needsCommit_) {
+    NSData* contents = [NSData dataWithData:data_];
+    NSDictionary* attributes = existsInDelegate_ ? nil : [NSDictionary dictionaryWithDictionary:attributes_];
+    ret = [fs_ createFileAtPath:path_
+                   withContents:contents
+                     attributes:attributes
+                          error:error];
+    if (ret) {
+      existsInDelegate_ = YES;
+      needsCommit_ = NO;
+    }
+  }
+  [lock_ unlock];
+  return ret;
+}
+
+- (int)readToBuffer:(char *)buffer
+               size:(size_t)size
+             offset:(fuse_off_t)offset
+              error:(NSError **)error {
+  [lock_ lock];
+  if (data_ == nil) {
+    [lock_ unlock];
+    return [fs_ readFileAtPath:path_
+                      userData:userData_
+                        buffer:buffer
+                          size:size
+                        offset:offset
+                         error:error];
+  }
+  NSUInteger length = [data_ length];
+  int bytesRead = 0;
+  if (offset >= 0 && (NSUInteger)offset < length) {
+    size_t available = length - (NSUInteger)offset;
+    bytesRead = (int)((size < available) ? size : available);
+    memcpy(buffer, (const char *)[data_ bytes] + offset, bytesRead);
+  }
+  [lock_ unlock];
+  return bytesRead;
+}
+
+- (int)writeFromBuffer:(const char *)buffer
+                  size:(size_t)size
+                offset:(fuse_off_t)offset
+                 error:(NSError **)error {
+  if (offset < 0) {
+    *error = [GMUserFileSystem errorWithCode:EINVAL];
+    return -1;
+  }
+  [lock_ lock];
+  if (data_ != nil && (unsigned long long)offset + size > maxSize_ &&
+      ![self spillLocked:error]) {
+    [lock_ unlock];
+    return -1;
+  }
+  if (data_ == nil) {
+    [lock_ unlock];
+    return [fs_ writeFileAtPath:path_
+                       userData:userData_
+                         buffer:buffer
+                           size:size
+                         offset:offset
+                          error:error];
+  }
+  if ((NSUInteger)offset + size > [data_ length]) {
+    [data_ setLength:(NSUInteger)offset + size];
+  }
+  [data_ replaceBytesInRange:NSMakeRange((NSUInteger)offset, size) withBytes:buffer];
+  [modificationDate_ release];
+  modificationDate_ = [[NSDate alloc] init];
+  needsCommit_ = YES;
+  [lock_ unlock];
+  return (int)size;
+}
+
+- (BOOL)truncateToOffset:(fuse_off_t)offset error:(NSError **)error {
+  if (offset < 0) {
+    *error = [GMUserFileSystem errorWithCode:EINVAL];
+    return NO;
+  }
+  [lock_ lock];
+  if (data_ != nil && (unsigned long long)offset > maxSize_ &&
+      ![self spillLocked:error]) {
+    [lock_ unlock];
+    return NO;
+  }
+  if (data_ == nil) {
+    [lock_ unlock];
+    NSDictionary* attributes =
+      [NSDictionary dictionaryWithObject:[NSNumber numberWithLongLong:offset]
+                                  forKey:NSFileSize];
+    return [fs_ setAttributes:attributes
+                 ofItemAtPath:path_
+                     userData:userData_
+                        error:error];
+  }
+  [data_ setLength:(NSUInteger)offset];
+  [modificationDate_ release];
+  modificationDate_ = [[NSDate alloc] init];
+  needsCommit_ = YES;
+  [lock_ unlock];
+  return YES;
+}
+
+// Returns NO once spilled, when the delegate has the file.
+- (BOOL)getLength:(fuse_off_t *)length {
+  [lock_ lock];
+  BOOL isHeld = (data_ != nil);
+  if (isHeld) {
+    *length = (fuse_off_t)[data_ length];
+  }
+  [lock_ unlock];
+  return isHeld;
+}
+
+@end
+
+@implementation GMWritebackFile
+
+- (void)dealloc {
+  [modificationDate_ release];
+  [super dealloc];
+}
+
+- (NSString *)description {
+  return [NSString stringWithFormat:@"%@ size=%lld, exact=%d, opens=%lu",
+          [super description], size_, isSizeExact_, (unsigned long)openCount_];
+}
+
+- (NSUInteger)openCount { return openCount_; }
+- (void)setOpenCount:(NSUInteger)openCount { openCount_ = openCount; }
+
+- (void)didWriteToOffset:(long long)offset {
+  if (offset > size_) {
+    size_ = offset;
+  }
+  [self setModificationDate:[NSDate date]];
+}
+
+- (void)didTruncateToSize:(long long)size {
+  size_ = size;
+  isSizeExact_ = YES;
+  [self setModificationDate:[NSDate date]];
+}
+
+- (void)setModificationDate:(NSDate *)date {
+  [modificationDate_ autorelease];
+  modificationDate_ = [date retain];
+}
+
+// A file that hasn't been truncated is at least as long as the delegate says,
+// since the delegate may already have some of the writes.
+- (NSDictionary *)attributesOverDelegateAttributes:(NSDictionary *)attributes {
+  if (![[attributes objectForKey:NSFileType] isEqualToString:NSFileTypeRegular]) {
+    return attributes;
+  }
+  NSMutableDictionary* merged = [NSMutableDictionary dictionaryWithDictionary:attributes];
+  long long size = size_;
+  if (!isSizeExact_) {
+    long long delegateSize = [[attributes objectForKey:NSFileSize] longLongValue];
+    if (delegateSize > size) {
+      size = delegateSize;
+    }
+  }
+  [merged setObject:[NSNumber numberWithLongLong:size] forKey:NSFileSize];
+  if (modificationDate_ != nil) {
+    [merged setObject:modificationDate_ forKey:NSFileModificationDate];
+  }
+  return merged;
+}
+
+@end
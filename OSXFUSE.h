@@ -46,11 +46,21 @@
 #import "GMUserFileSystem.h"
 #import "GMFinderInfo.h"
 #import "GMResourceFork.h"
+#import "GMOperationTrace.h"
+#import "GMMountProfile.h"
+#import "GMMetadataOperation.h"
+#import "GMPath.h"
+#import "GMSessionDispatcher.h"
 
 #else
 #import <OSXFUSE/GMAvailability.h>
 #import <OSXFUSE/GMUserFileSystem.h>
 #import <OSXFUSE/GMFinderInfo.h>
 #import <OSXFUSE/GMResourceFork.h>
+#import <OSXFUSE/GMOperationTrace.h>
+#import <OSXFUSE/GMMountProfile.h>
+#import <OSXFUSE/GMMetadataOperation.h>
+#import <OSXFUSE/GMPath.h>
+#import <OSXFUSE/GMSessionDispatcher.h>
 
 #endif	/* defined (__APPLE__) */